@@ -0,0 +1,287 @@
+#include "append.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "file_cache.h"
+#include "filesystem.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+#include "stdlib.h"
+#include "string.h"
+
+static const char TAG[] = "append";
+
+#define NUM_SLOTS CONFIG_PROJECT_APPEND_MAX_FILES
+#define BUF_SIZE CONFIG_PROJECT_APPEND_BUF_SIZE
+#define FLUSH_US ((int64_t)CONFIG_PROJECT_APPEND_FLUSH_MS * 1000)
+
+typedef struct slot {
+    char path[MAX_FILE_PATH];   // Empty while unused
+    uint8_t *buf;               // BUF_SIZE bytes; allocated while in use
+    size_t len;
+    int64_t first_us;           // When the oldest buffered byte arrived
+} slot_t;
+
+static slot_t slots[NUM_SLOTS];     // Guarded by `lock`
+static SemaphoreHandle_t lock = NULL;
+
+/**
+ * @brief true if `path` is `prefix` or below it. A NULL prefix covers all.
+ */
+static bool covers(const char *prefix, const char *path)
+{
+    size_t len;
+    if(NULL == prefix) return true;
+    len = strlen(prefix);
+    while(len > 1 && '/' == prefix[len - 1]) len--;
+    return 0 == strncmp(path, prefix, len) && ('\0' == path[len] || '/' == path[len]);
+}
+
+/**
+ * @brief true if appending `len` bytes to a file of `size` rotates it first.
+ */
+static bool rotates(size_t size, size_t len)
+{
+    return CONFIG_PROJECT_APPEND_ROTATE_SIZE > 0
+            && size > 0 && size + len > CONFIG_PROJECT_APPEND_ROTATE_SIZE;
+}
+
+#if CONFIG_PROJECT_APPEND_ROTATE_SIZE > 0
+/**
+ * @brief Shift `path` to `path.1`, `path.1` to `path.2` and so on, dropping
+ * the oldest.
+ */
+static void rotate(const char *path)
+{
+    char *from = malloc(MAX_FILE_PATH);
+    char *to = malloc(MAX_FILE_PATH);
+
+    if(NULL == from || NULL == to) goto exit;
+
+    for(int i = CONFIG_PROJECT_APPEND_ROTATE_KEEP; i > 0; i--) {
+        if(i > 1) snprintf(from, MAX_FILE_PATH, "%s.%d", path, i - 1);
+        else strlcpy(from, path, MAX_FILE_PATH);
+        snprintf(to, MAX_FILE_PATH, "%s.%d", path, i);
+        /* Missing generations are fine */
+        fs_move(from, to);
+    }
+    if(0 == CONFIG_PROJECT_APPEND_ROTATE_KEEP) {
+        unlink(path);
+        fs_hash_remove(path);
+        file_cache_invalidate(path);
+    }
+    ESP_LOGI(TAG, "Rotated %s", path);
+
+exit:
+    free(from);
+    free(to);
+}
+#endif
+
+/**
+ * @brief Append `len` bytes to the file at `path` on storage.
+ */
+static esp_err_t write_out(const char *path, const uint8_t *data, size_t len)
+{
+    esp_err_t err = ESP_OK;
+    struct stat st;
+    size_t size = 0;
+    FILE *fd;
+
+    if(0 == stat(path, &st)) size = st.st_size;
+#if CONFIG_PROJECT_APPEND_ROTATE_SIZE > 0
+    if(rotates(size, len)) {
+        rotate(path);
+        size = 0;
+    }
+#endif
+    /* The file's current contents already occupy their space */
+    if(ESP_OK != (err = fs_check_space(path, size + len, size))) return err;
+
+    if(NULL == (fd = fopen(path, "a"))) {
+        ESP_LOGE(TAG, "Failed to open %s", path);
+        return ESP_FAIL;
+    }
+    if(len != fwrite(data, 1, len, fd)) err = ESP_FAIL;
+    if(0 != fclose(fd)) err = ESP_FAIL;
+
+    /* The stored digest no longer describes the file */
+    fs_hash_remove(path);
+    file_cache_invalidate(path);
+    return err;
+}
+
+/**
+ * @brief Write out a slot's buffer. Must hold `lock`.
+ *
+ * The buffer is emptied even on failure so a full filesystem can't wedge
+ * the slot.
+ */
+static esp_err_t flush_slot(slot_t *s)
+{
+    esp_err_t err;
+    if(0 == s->len) return ESP_OK;
+    if(ESP_OK != (err = write_out(s->path, s->buf, s->len))) {
+        ESP_LOGE(TAG, "Dropped %d bytes for %s", s->len, s->path);
+    }
+    s->len = 0;
+    return err;
+}
+
+/**
+ * @brief Return a slot to the pool. Must hold `lock`.
+ */
+static void release_slot(slot_t *s)
+{
+    free(s->buf);
+    s->buf = NULL;
+    s->len = 0;
+    s->path[0] = '\0';
+}
+
+static void append_task_fn(void *arg)
+{
+    while(true) {
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_PROJECT_APPEND_FLUSH_MS / 4) + 1);
+
+        int64_t now = esp_timer_get_time();
+        xSemaphoreTake(lock, portMAX_DELAY);
+        for(int i = 0; i < NUM_SLOTS; i++) {
+            slot_t *s = &slots[i];
+            if('\0' == s->path[0] || now - s->first_us < FLUSH_US) continue;
+            /* A file that keeps being appended to gets a fresh slot next time */
+            flush_slot(s);
+            release_slot(s);
+        }
+        xSemaphoreGive(lock);
+    }
+}
+
+static void append_shutdown(void)
+{
+    append_flush(NULL);
+}
+
+esp_err_t append_init(void)
+{
+    if(lock) return ESP_OK;
+
+    if(NULL == (lock = xSemaphoreCreateMutex())) return ESP_ERR_NO_MEM;
+    if(pdPASS != xTaskCreate(append_task_fn, "append", 4096, NULL, tskIDLE_PRIORITY + 1, NULL)) {
+        ESP_LOGE(TAG, "Failed to start append task");
+        return ESP_FAIL;
+    }
+    /* Flush before esp_restart(), e.g. for a reboot or after an OTA */
+    return esp_register_shutdown_handler(append_shutdown);
+}
+
+esp_err_t append_write(const char *path, const void *data, size_t len)
+{
+    esp_err_t err = ESP_OK;
+    slot_t *s = NULL, *victim = NULL;
+
+    if(NULL == lock) return ESP_ERR_INVALID_STATE;
+    if(strlen(path) >= MAX_FILE_PATH) return ESP_ERR_INVALID_SIZE;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+
+    for(int i = 0; i < NUM_SLOTS && NULL == s; i++) {
+        if(0 == strcmp(slots[i].path, path)) s = &slots[i];
+        else if('\0' == slots[i].path[0]) victim = &slots[i];
+        else if(NULL == victim || ('\0' != victim->path[0] && slots[i].first_us < victim->first_us)) {
+            victim = &slots[i];
+        }
+    }
+
+    if(NULL == s) {
+        /* Take a free slot, or else the one holding the oldest data */
+        s = victim;
+        if('\0' != s->path[0]) flush_slot(s);
+        if(NULL == s->buf && NULL == (s->buf = malloc(BUF_SIZE))) {
+            release_slot(s);
+            err = ESP_ERR_NO_MEM;
+            goto exit;
+        }
+        strlcpy(s->path, path, sizeof(s->path));
+        s->len = 0;
+    }
+
+    if(s->len + len > BUF_SIZE) err = flush_slot(s);
+
+    if(len > BUF_SIZE) {
+        /* Too large to be worth buffering */
+        esp_err_t write_err = write_out(path, data, len);
+        if(ESP_OK == err) err = write_err;
+        goto exit;
+    }
+
+    if(0 == s->len) s->first_us = esp_timer_get_time();
+    memcpy(s->buf + s->len, data, len);
+    s->len += len;
+    if(BUF_SIZE == s->len) err = flush_slot(s);
+
+exit:
+    xSemaphoreGive(lock);
+    return err;
+}
+
+esp_err_t append_flush(const char *path)
+{
+    esp_err_t err = ESP_OK;
+
+    if(NULL == lock) return ESP_OK;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    for(int i = 0; i < NUM_SLOTS; i++) {
+        slot_t *s = &slots[i];
+        if('\0' == s->path[0] || !covers(path, s->path)) continue;
+        if(ESP_OK != flush_slot(s)) err = ESP_FAIL;
+        release_slot(s);
+    }
+    xSemaphoreGive(lock);
+    return err;
+}
+
+void append_discard(const char *path)
+{
+    if(NULL == lock) return;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    for(int i = 0; i < NUM_SLOTS; i++) {
+        slot_t *s = &slots[i];
+        if('\0' != s->path[0] && covers(path, s->path)) release_slot(s);
+    }
+    xSemaphoreGive(lock);
+}
+
+size_t append_pending(const char *path)
+{
+    size_t len = 0;
+
+    if(NULL == lock) return 0;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    for(int i = 0; i < NUM_SLOTS; i++) {
+        if(0 == strcmp(slots[i].path, path)) len = slots[i].len;
+    }
+    xSemaphoreGive(lock);
+    return len;
+}
+
+size_t append_size(const char *path)
+{
+    struct stat st;
+    size_t size = 0, len = 0;
+
+    if(NULL != lock) xSemaphoreTake(lock, portMAX_DELAY);
+    if(0 == stat(path, &st)) size = st.st_size;
+    for(int i = 0; NULL != lock && i < NUM_SLOTS; i++) {
+        if(0 == strcmp(slots[i].path, path)) len = slots[i].len;
+    }
+    if(NULL != lock) xSemaphoreGive(lock);
+
+    /* A slot's buffer is written in one go, so it rotates as a whole */
+    return rotates(size, len) ? len : size + len;
+}
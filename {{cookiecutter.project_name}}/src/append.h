@@ -0,0 +1,60 @@
+/***
+ * Buffered appends to files, for logging data at a high rate.
+ *
+ * Appends to a file are collected in a RAM buffer and written out in one go
+ * once the buffer fills up, CONFIG_PROJECT_APPEND_FLUSH_MS after the first
+ * buffered byte, or at shutdown, so many small appends cost a few flash
+ * writes instead of one each. Up to CONFIG_PROJECT_APPEND_MAX_FILES files
+ * are buffered at once.
+ *
+ * Buffered data is lost on a crash or power loss. Anything reading or
+ * replacing a file must first call append_flush() or append_discard() on it.
+ */
+
+#ifndef PROJECT_APPEND_H__
+#define PROJECT_APPEND_H__
+
+#include "esp_err.h"
+#include "stddef.h"
+
+/**
+ * @brief Start the flush task and register the shutdown hook.
+ */
+esp_err_t append_init(void);
+
+/**
+ * @brief Append `len` bytes to the file at `path`, creating it if needed.
+ *
+ * The data is buffered; it reaches the file at the latest after
+ * CONFIG_PROJECT_APPEND_FLUSH_MS. When CONFIG_PROJECT_APPEND_ROTATE_SIZE is
+ * set, a file about to grow past it is first rotated to `<path>.1`, whose
+ * predecessor moves to `<path>.2`, and so on.
+ *
+ * @returns ESP_OK on success, or the error of a flush it had to do first.
+ */
+esp_err_t append_write(const char *path, const void *data, size_t len);
+
+/**
+ * @brief Write out buffered data of `path`, and of every file below it if
+ * it's a directory. NULL flushes everything.
+ */
+esp_err_t append_flush(const char *path);
+
+/**
+ * @brief Drop buffered data of `path`, and of every file below it if it's a
+ * directory, without writing it.
+ */
+void append_discard(const char *path);
+
+/**
+ * @brief Bytes buffered for `path` but not yet written to it.
+ */
+size_t append_pending(const char *path);
+
+/**
+ * @brief Size of `path` once its buffered data is written, after the
+ * rotation that may cause.
+ */
+size_t append_size(const char *path);
+
+#endif
@@ -0,0 +1,119 @@
+#include "assets.h"
+#include "string.h"
+
+bool assets_image_open(assets_image_t *img, const void *base, size_t size)
+{
+    const assets_header_t *hdr = base;
+    const uint8_t *bytes = base;
+
+    memset(img, 0, sizeof(assets_image_t));
+
+    if(size < sizeof(assets_header_t)) return false;
+    if(0 != memcmp(hdr->magic, ASSETS_MAGIC, sizeof(hdr->magic))) return false;
+    if(hdr->image_size > size) return false;
+    size = hdr->image_size;
+
+    /* Compare by division to avoid overflow */
+    if(hdr->count > (size - sizeof(assets_header_t)) / sizeof(assets_entry_t)) return false;
+    if(hdr->strings_offset < sizeof(assets_header_t) + hdr->count * sizeof(assets_entry_t)) return false;
+    if(hdr->strings_offset > size || hdr->strings_size > size - hdr->strings_offset) return false;
+    if(0 == hdr->strings_size || '\0' != bytes[hdr->strings_offset + hdr->strings_size - 1]) return false;
+
+    img->base = bytes;
+    img->entries = (const assets_entry_t *)(bytes + sizeof(assets_header_t));
+    img->count = hdr->count;
+    img->strings = (const char *)bytes + hdr->strings_offset;
+    img->strings_size = hdr->strings_size;
+
+    for(uint32_t i = 0; i < img->count; i++) {
+        const assets_entry_t *e = &img->entries[i];
+        if(e->name >= img->strings_size || e->mime >= img->strings_size) return false;
+        if(e->offset > size || e->length > size - e->offset) return false;
+        if(i > 0 && strcmp(img->strings + img->entries[i - 1].name, img->strings + e->name) >= 0) {
+            /* Not sorted; binary search would miss entries */
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+bool assets_get(const assets_image_t *img, uint32_t index, assets_file_t *file)
+{
+    if(index >= img->count) return false;
+
+    const assets_entry_t *e = &img->entries[index];
+    file->name = img->strings + e->name;
+    file->mime = img->strings + e->mime;
+    file->data = img->base + e->offset;
+    file->length = e->length;
+    file->gzip = e->flags & ASSETS_FLAG_GZIP;
+    file->sha256 = e->sha256;
+    return true;
+}
+
+
+bool assets_find(const assets_image_t *img, const char *name, assets_file_t *file)
+{
+    uint32_t lo = 0, hi = img->count;
+
+    while(lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(name, img->strings + img->entries[mid].name);
+        if(0 == cmp) return assets_get(img, mid, file);
+        if(cmp < 0) hi = mid;
+        else lo = mid + 1;
+    }
+    return false;
+}
+
+
+#ifdef ESP_PLATFORM
+#include "esp_log.h"
+#include "esp_partition.h"
+
+static const char TAG[] = "assets";
+
+static assets_image_t image;
+static bool image_ok = false;
+
+esp_err_t assets_init(void)
+{
+    esp_err_t err;
+    const void *ptr;
+    spi_flash_mmap_handle_t handle;
+    const esp_partition_t *part;
+
+    if(image_ok) return ESP_OK;
+
+    part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ASSETS_PARTITION_SUBTYPE,
+            ASSETS_PARTITION_LABEL);
+    if(NULL == part) {
+        ESP_LOGW(TAG, "No \"%s\" partition", ASSETS_PARTITION_LABEL);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    /* Mapped for the lifetime of the program; never unmapped */
+    err = esp_partition_mmap(part, 0, part->size, SPI_FLASH_MMAP_DATA, &ptr, &handle);
+    if(ESP_OK != err) {
+        ESP_LOGE(TAG, "Failed to map assets partition: %s", esp_err_to_name(err));
+        return err;
+    }
+
+    if(!assets_image_open(&image, ptr, part->size)) {
+        ESP_LOGW(TAG, "Assets partition doesn't hold a valid image");
+        spi_flash_munmap(handle);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    image_ok = true;
+    ESP_LOGI(TAG, "Mapped %u assets", image.count);
+    return ESP_OK;
+}
+
+const assets_image_t *assets_image(void)
+{
+    return image_ok ? &image : NULL;
+}
+#endif
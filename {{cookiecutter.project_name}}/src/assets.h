@@ -0,0 +1,99 @@
+/***
+ * Read-only packed asset image, built by `tools/pack_assets.py` and flashed
+ * to the "assets" partition. The partition is memory mapped at boot, so
+ * file bodies can be sent straight from flash without copying.
+ *
+ * Image layout, all integers little endian:
+ *     assets_header_t
+ *     assets_entry_t[count]    sorted by name, in strcmp() order
+ *     string table             NUL-terminated names and MIME types
+ *     file data                each body 4-byte aligned
+ *
+ * Everything but assets_init() is plain C so the reader can be built and
+ * exercised on a host.
+ */
+
+#ifndef PROJECT_ASSETS_H__
+#define PROJECT_ASSETS_H__
+
+#include "stdbool.h"
+#include "stddef.h"
+#include "stdint.h"
+
+#define ASSETS_MAGIC "PKA1"
+#define ASSETS_PARTITION_LABEL "assets"
+#define ASSETS_PARTITION_SUBTYPE 0x40
+
+/* Entry flags */
+#define ASSETS_FLAG_GZIP 0x01   // Body is gzip compressed
+
+typedef struct assets_header {
+    char magic[4];              // ASSETS_MAGIC
+    uint32_t count;             // Number of entries
+    uint32_t strings_offset;    // Start of the string table
+    uint32_t strings_size;
+    uint32_t image_size;        // Total size of the image
+} assets_header_t;
+
+typedef struct assets_entry {
+    uint32_t name;              // String table offset; path without leading '/'
+    uint32_t mime;              // String table offset
+    uint32_t offset;            // Start of the body from the image start
+    uint32_t length;            // Length of the (possibly compressed) body
+    uint32_t flags;
+    uint8_t sha256[32];         // Digest of the body as stored
+} assets_entry_t;
+
+typedef struct assets_image {
+    const uint8_t *base;
+    const assets_entry_t *entries;
+    uint32_t count;
+    const char *strings;
+    uint32_t strings_size;
+} assets_image_t;
+
+typedef struct assets_file {
+    const char *name;
+    const char *mime;
+    const uint8_t *data;
+    size_t length;
+    bool gzip;
+    const uint8_t *sha256;
+} assets_file_t;
+
+/**
+ * @brief Validate an image in memory and prepare it for lookups.
+ *
+ * Every offset is bounds checked here, so lookups need not be.
+ *
+ * @returns false if the image is malformed.
+ */
+bool assets_image_open(assets_image_t *img, const void *base, size_t size);
+
+/**
+ * @brief Binary search for a file by name (without leading '/').
+ */
+bool assets_find(const assets_image_t *img, const char *name, assets_file_t *file);
+
+/**
+ * @brief Get the `index`th file in name order.
+ */
+bool assets_get(const assets_image_t *img, uint32_t index, assets_file_t *file);
+
+#ifdef ESP_PLATFORM
+#include "esp_err.h"
+
+/**
+ * @brief Memory map and open the assets partition.
+ * @returns ESP_OK on success, ESP_ERR_NOT_FOUND if there's no partition,
+ *          ESP_ERR_INVALID_STATE if it doesn't hold a valid image.
+ */
+esp_err_t assets_init(void);
+
+/**
+ * @brief The image mapped by assets_init(); NULL if none.
+ */
+const assets_image_t *assets_image(void);
+#endif
+
+#endif
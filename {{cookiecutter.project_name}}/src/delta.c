@@ -0,0 +1,169 @@
+#include "delta.h"
+#include "esp_log.h"
+#include "sodium.h"
+#include "string.h"
+#include <sys/param.h>
+
+static const char TAG[] = "delta";
+
+enum {
+    STATE_HEADER = 0,
+    STATE_OP,
+    STATE_ARGS,
+    STATE_LITERAL,
+    STATE_DONE,
+};
+
+
+uint32_t delta_weak_checksum(const uint8_t *buf, size_t len)
+{
+    uint32_t a = 0, b = 0;
+    for(size_t i = 0; i < len; i++) {
+        a += buf[i];
+        b += (len - i) * buf[i];
+    }
+    return (a & 0xFFFF) | (b << 16);
+}
+
+
+void delta_strong_checksum(uint8_t out[DELTA_STRONG_LEN], const uint8_t *buf, size_t len)
+{
+    crypto_generichash(out, DELTA_STRONG_LEN, buf, len, NULL, 0);
+}
+
+
+static uint32_t read_u32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+
+void delta_parser_init(delta_parser_t *p, const delta_ops_t *ops, void *ctx)
+{
+    memset(p, 0, sizeof(delta_parser_t));
+    p->ops = ops;
+    p->ctx = ctx;
+    p->state = STATE_HEADER;
+}
+
+
+/**
+ * @brief Number of argument bytes that follow an opcode.
+ */
+static int op_args_len(uint8_t op)
+{
+    switch(op) {
+        case DELTA_OP_COPY: return 8;
+        case DELTA_OP_LITERAL: return 4;
+        case DELTA_OP_END: return 0;
+        default: return -1;
+    }
+}
+
+
+/**
+ * @brief Execute an opcode once all of its arguments have been received.
+ */
+static esp_err_t op_dispatch(delta_parser_t *p)
+{
+    switch(p->op) {
+        case DELTA_OP_COPY: {
+            uint32_t first = read_u32(p->field);
+            uint32_t count = read_u32(p->field + 4);
+            uint64_t offset = (uint64_t)first * p->block_size;
+            uint64_t len = (uint64_t)count * p->block_size;
+            if(offset + len > UINT32_MAX) {
+                ESP_LOGE(TAG, "Copy of blocks %u+%u out of range", first, count);
+                return ESP_ERR_INVALID_ARG;
+            }
+            p->state = STATE_OP;
+            return p->ops->copy(p->ctx, offset, len);
+        }
+        case DELTA_OP_LITERAL:
+            p->remaining = read_u32(p->field);
+            p->state = p->remaining ? STATE_LITERAL : STATE_OP;
+            return ESP_OK;
+        case DELTA_OP_END:
+            p->state = STATE_DONE;
+            return ESP_OK;
+        default:
+            return ESP_ERR_INVALID_ARG;
+    }
+}
+
+
+esp_err_t delta_parser_feed(delta_parser_t *p, const uint8_t *buf, size_t len)
+{
+    esp_err_t err;
+
+    while(len > 0) {
+        switch(p->state) {
+            case STATE_HEADER: {
+                size_t n = MIN(len, 8 - p->field_len);
+                memcpy(p->field + p->field_len, buf, n);
+                p->field_len += n;
+                buf += n;
+                len -= n;
+                if(p->field_len < 8) break;
+
+                if(0 != memcmp(p->field, DELTA_MAGIC, 4)) {
+                    ESP_LOGE(TAG, "Bad delta stream magic");
+                    return ESP_ERR_INVALID_ARG;
+                }
+                p->block_size = read_u32(p->field + 4);
+                if(0 == p->block_size) {
+                    ESP_LOGE(TAG, "Invalid block size");
+                    return ESP_ERR_INVALID_ARG;
+                }
+                p->state = STATE_OP;
+                break;
+            }
+            case STATE_OP:
+                p->op = *buf++;
+                len--;
+                p->field_len = 0;
+                if(op_args_len(p->op) < 0) {
+                    ESP_LOGE(TAG, "Unknown delta op 0x%02x", p->op);
+                    return ESP_ERR_INVALID_ARG;
+                }
+                if(op_args_len(p->op) == 0) {
+                    if(ESP_OK != (err = op_dispatch(p))) return err;
+                }
+                else {
+                    p->state = STATE_ARGS;
+                }
+                break;
+            case STATE_ARGS: {
+                size_t n = MIN(len, op_args_len(p->op) - p->field_len);
+                memcpy(p->field + p->field_len, buf, n);
+                p->field_len += n;
+                buf += n;
+                len -= n;
+                if(p->field_len < op_args_len(p->op)) break;
+                if(ESP_OK != (err = op_dispatch(p))) return err;
+                break;
+            }
+            case STATE_LITERAL: {
+                size_t n = MIN(len, p->remaining);
+                if(ESP_OK != (err = p->ops->literal(p->ctx, buf, n))) return err;
+                p->remaining -= n;
+                buf += n;
+                len -= n;
+                if(0 == p->remaining) p->state = STATE_OP;
+                break;
+            }
+            case STATE_DONE:
+            default:
+                ESP_LOGE(TAG, "Trailing data after end of delta stream");
+                return ESP_ERR_INVALID_ARG;
+        }
+    }
+
+    return ESP_OK;
+}
+
+
+bool delta_parser_done(const delta_parser_t *p)
+{
+    return p->state == STATE_DONE;
+}
@@ -0,0 +1,83 @@
+/***
+ * rsync-style block delta encoding.
+ *
+ * A client that already has a file's block signature (see
+ * `delta_weak_checksum` and `delta_strong_checksum`) can describe a new
+ * version of that file as a stream of "copy these blocks from the old file"
+ * and "insert these literal bytes" instructions.
+ *
+ * Stream format (all integers little-endian):
+ *
+ *     header:  "RDLT" <u32 block_size>
+ *     ops:     'C' <u32 first_block> <u32 n_blocks>   copy blocks from basis
+ *              'L' <u32 length> <length bytes>        literal data
+ *              'E'                                    end of stream
+ *
+ * The final basis block may be shorter than `block_size`; copying it copies
+ * only the bytes that exist.
+ */
+
+#ifndef PROJECT_DELTA_H__
+#define PROJECT_DELTA_H__
+
+#include "esp_err.h"
+#include "stdbool.h"
+#include "stdint.h"
+#include "stddef.h"
+
+#define DELTA_MAGIC "RDLT"
+#define DELTA_STRONG_LEN 16  // Truncated BLAKE2b digest length in bytes
+
+#define DELTA_OP_COPY    'C'
+#define DELTA_OP_LITERAL 'L'
+#define DELTA_OP_END     'E'
+
+/**
+ * @brief rsync rolling checksum of a single block.
+ */
+uint32_t delta_weak_checksum(const uint8_t *buf, size_t len);
+
+/**
+ * @brief Strong checksum (BLAKE2b, truncated to DELTA_STRONG_LEN) of a block.
+ */
+void delta_strong_checksum(uint8_t out[DELTA_STRONG_LEN], const uint8_t *buf, size_t len);
+
+
+/**
+ * @brief Callbacks invoked as instructions are decoded.
+ *
+ * `copy` receives a byte offset/length within the basis file. `literal` may
+ * be called several times for a single 'L' instruction as data arrives.
+ * Returning anything but ESP_OK aborts parsing.
+ */
+typedef struct delta_ops {
+    esp_err_t (*copy)(void *ctx, uint32_t offset, uint32_t len);
+    esp_err_t (*literal)(void *ctx, const uint8_t *data, size_t len);
+} delta_ops_t;
+
+typedef struct delta_parser {
+    const delta_ops_t *ops;
+    void *ctx;
+    uint32_t block_size;
+    uint8_t state;
+    uint8_t op;
+    uint8_t field[8];       // Partially received header/op fields
+    uint8_t field_len;
+    uint32_t remaining;     // Literal bytes still to be received
+} delta_parser_t;
+
+void delta_parser_init(delta_parser_t *p, const delta_ops_t *ops, void *ctx);
+
+/**
+ * @brief Feed the next chunk of the stream into the parser.
+ * @returns ESP_OK on success, ESP_ERR_INVALID_ARG on a malformed stream, or
+ * the error returned by a callback.
+ */
+esp_err_t delta_parser_feed(delta_parser_t *p, const uint8_t *buf, size_t len);
+
+/**
+ * @brief true once the 'E' instruction has been received.
+ */
+bool delta_parser_done(const delta_parser_t *p);
+
+#endif
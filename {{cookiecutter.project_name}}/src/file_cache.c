@@ -0,0 +1,226 @@
+#include "file_cache.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "sdkconfig.h"
+#include "stdio.h"
+#include "stdlib.h"
+#include "string.h"
+
+__unused static const char TAG[] = "file_cache";
+
+#if CONFIG_PROJECT_FILE_CACHE
+
+typedef struct node {
+    file_cache_entry_t entry;       // Must be first; handed out to callers
+    struct node *prev;              // Towards most recently used
+    struct node *next;              // Towards least recently used
+    char *path;
+    time_t mtime;
+    uint32_t refs;
+    bool linked;                    // false once invalidated or evicted
+} node_t;
+
+static node_t *head = NULL;         // Most recently used
+static node_t *tail = NULL;         // Least recently used
+static size_t used = 0;             // Bytes of file data held by linked nodes
+static SemaphoreHandle_t lock = NULL;    // Created by file_cache_init()
+
+static void *data_alloc(size_t size)
+{
+#if CONFIG_PROJECT_FILE_CACHE_PSRAM
+    void *p = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if(p) return p;
+#endif
+    return malloc(size);
+}
+
+static void node_free(node_t *n)
+{
+    free((void *)n->entry.data);
+    free(n->path);
+    free(n);
+}
+
+/**
+ * @brief Remove a node from the LRU list. Must hold `lock`.
+ *
+ * The node is freed now if unreferenced, otherwise on its last release.
+ */
+static void unlink_node(node_t *n)
+{
+    if(n->prev) n->prev->next = n->next;
+    else head = n->next;
+    if(n->next) n->next->prev = n->prev;
+    else tail = n->prev;
+    n->prev = n->next = NULL;
+    n->linked = false;
+    used -= n->entry.size;
+    if(0 == n->refs) node_free(n);
+}
+
+static void push_front(node_t *n)
+{
+    n->prev = NULL;
+    n->next = head;
+    if(head) head->prev = n;
+    head = n;
+    if(NULL == tail) tail = n;
+    n->linked = true;
+}
+
+static node_t *find(const char *path)
+{
+    for(node_t *n = head; n; n = n->next) {
+        if(0 == strcmp(n->path, path)) return n;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Evict least recently used entries until `size` more bytes fit.
+ * @returns false if they can't, because the remainder is in use.
+ */
+static bool make_room(size_t size)
+{
+    node_t *n = tail;
+    while(n && used + size > CONFIG_PROJECT_FILE_CACHE_BUDGET) {
+        node_t *prev = n->prev;
+        if(0 == n->refs) unlink_node(n);
+        n = prev;
+    }
+    return used + size <= CONFIG_PROJECT_FILE_CACHE_BUDGET;
+}
+
+static node_t *load(const char *path, const struct stat *st)
+{
+    node_t *n = NULL;
+    uint8_t *data = NULL;
+    FILE *fd = NULL;
+
+    n = calloc(1, sizeof(node_t));
+    data = data_alloc(st->st_size ? st->st_size : 1);
+    if(NULL == n || NULL == data || NULL == (n->path = strdup(path))) goto fail;
+
+    if(NULL == (fd = fopen(path, "r"))) goto fail;
+    if(fread(data, 1, st->st_size, fd) != (size_t)st->st_size) goto fail;
+    fclose(fd);
+
+    n->entry.data = data;
+    n->entry.size = st->st_size;
+    n->entry.has_digest = (ESP_OK == fs_hash_get(path, n->entry.digest));
+    n->mtime = st->st_mtime;
+    return n;
+
+fail:
+    if(fd) fclose(fd);
+    free(data);
+    if(n) free(n->path);
+    free(n);
+    return NULL;
+}
+
+
+esp_err_t file_cache_init(void)
+{
+    if(lock) return ESP_OK;
+    if(NULL == (lock = xSemaphoreCreateMutex())) return ESP_ERR_NO_MEM;
+    return ESP_OK;
+}
+
+
+const file_cache_entry_t *file_cache_get(const char *path, const struct stat *st)
+{
+    node_t *n;
+
+    if(st->st_size > CONFIG_PROJECT_FILE_CACHE_MAX_FILE_SIZE) return NULL;
+
+    if(NULL == lock) return NULL;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+
+    n = find(path);
+    if(n && (n->mtime != st->st_mtime || n->entry.size != (size_t)st->st_size)) {
+        ESP_LOGI(TAG, "Stale: %s", path);
+        unlink_node(n);
+        n = NULL;
+    }
+
+    if(n) {
+        /* Hit; move to front */
+        if(n != head) {
+            if(n->next) n->next->prev = n->prev;
+            else tail = n->prev;
+            n->prev->next = n->next;
+            push_front(n);
+        }
+    }
+    else if(make_room(st->st_size) && NULL != (n = load(path, st))) {
+        push_front(n);
+        used += n->entry.size;
+        ESP_LOGI(TAG, "Cached %s (%u bytes); %u/%u bytes used",
+                path, n->entry.size, used, CONFIG_PROJECT_FILE_CACHE_BUDGET);
+    }
+
+    if(n) n->refs++;
+    xSemaphoreGive(lock);
+
+    return n ? &n->entry : NULL;
+}
+
+
+void file_cache_release(const file_cache_entry_t *entry)
+{
+    node_t *n = (node_t *)entry;
+    if(NULL == n) return;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    n->refs--;
+    if(0 == n->refs && !n->linked) node_free(n);
+    xSemaphoreGive(lock);
+}
+
+
+void file_cache_invalidate(const char *path)
+{
+    size_t len = strlen(path);
+
+    /* Cache never set up */
+    if(NULL == lock) return;
+
+    /* "/fs/www/" and "/fs/www" both cover "/fs/www/..." */
+    while(len > 1 && '/' == path[len - 1]) len--;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    for(node_t *n = head; n; ) {
+        node_t *next = n->next;
+        if(0 == strncmp(n->path, path, len) && ('\0' == n->path[len] || '/' == n->path[len])) {
+            unlink_node(n);
+        }
+        n = next;
+    }
+    xSemaphoreGive(lock);
+}
+
+#else  /* CONFIG_PROJECT_FILE_CACHE */
+
+esp_err_t file_cache_init(void)
+{
+    return ESP_OK;
+}
+
+const file_cache_entry_t *file_cache_get(const char *path, const struct stat *st)
+{
+    return NULL;
+}
+
+void file_cache_release(const file_cache_entry_t *entry)
+{
+}
+
+void file_cache_invalidate(const char *path)
+{
+}
+
+#endif
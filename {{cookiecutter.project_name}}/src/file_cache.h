@@ -0,0 +1,52 @@
+/***
+ * In-memory cache of small, frequently requested files.
+ *
+ * Entries are keyed by path and checked against the file's current size and
+ * mtime on every lookup. Writers must still call file_cache_invalidate(),
+ * since mtime resolution (2 seconds on FAT) can hide quick rewrites.
+ * fs_writer_commit() and rm_rf() already do.
+ */
+
+#ifndef PROJECT_FILE_CACHE_H__
+#define PROJECT_FILE_CACHE_H__
+
+#include "esp_err.h"
+#include "filesystem.h"
+#include "stdbool.h"
+#include "stddef.h"
+#include "stdint.h"
+#include <sys/stat.h>
+
+typedef struct file_cache_entry {
+    const uint8_t *data;
+    size_t size;
+    bool has_digest;
+    uint8_t digest[FS_HASH_LEN];    // Valid if has_digest
+} file_cache_entry_t;
+
+/**
+ * @brief Set up the cache. Call once from app_main() before the server
+ * starts; until then lookups miss.
+ */
+esp_err_t file_cache_init(void);
+
+/**
+ * @brief Get a file's contents, loading them into the cache on a miss.
+ *
+ * The entry stays valid, even if invalidated or evicted meanwhile, until
+ * released with file_cache_release().
+ *
+ * @param[in] st Current stat of the file.
+ * @returns NULL if the cache is disabled, the file is too large to cache, or
+ *          it couldn't be read.
+ */
+const file_cache_entry_t *file_cache_get(const char *path, const struct stat *st);
+
+void file_cache_release(const file_cache_entry_t *entry);
+
+/**
+ * @brief Drop `path`, and everything below it if it's a directory.
+ */
+void file_cache_invalidate(const char *path);
+
+#endif
@@ -1,17 +1,29 @@
 #include "errno.h"
 #include "esp_littlefs.h"
 #include "esp_log.h"
+#include "file_cache.h"
 #include "filesystem.h"
+#include "freertos/FreeRTOS.h"
 #include "sdkconfig.h"
 #include "sdmmc_cmd.h"
+#include <sys/param.h>
 
 #if CONFIG_PROJECT_WEB_DEPLOY_SD
 #include "esp_vfs_fat.h"
 #include "driver/sdmmc_host.h"
+#include "ff.h"
 #endif
 
 static const char TAG[] = "filesystem";
 
+/* Label of the LittleFS data partition in partitions.csv */
+#define FS_PARTITION_LABEL "filesystem"
+
+/* Chunk size used when a file has to be read back to compute its digest */
+#define FS_HASH_READ_SIZE FS_IO_CHUNK_SIZE
+
+static void fs_sweep(void);
+
 
 #if CONFIG_PROJECT_WEB_DEPLOY_SD
 
@@ -28,8 +40,8 @@ esp_err_t init_fs(void)
 
     esp_vfs_fat_sdmmc_mount_config_t mount_config = {
         .format_if_mount_failed = true,
-        .max_files = 4,
-        .allocation_unit_size = 16 * 1024
+        .max_files = CONFIG_PROJECT_FS_FAT_MAX_FILES,
+        .allocation_unit_size = CONFIG_PROJECT_FS_FAT_ALLOC_UNIT
     };
 
     sdmmc_card_t *card;
@@ -44,6 +56,7 @@ esp_err_t init_fs(void)
     }
     /* print card info if mount successfully */
     sdmmc_card_print_info(stdout, card);
+    fs_sweep();
     return ESP_OK;
 }
 
@@ -53,7 +66,7 @@ esp_err_t init_fs(void)
 {
     esp_vfs_littlefs_conf_t conf = {
         .base_path = CONFIG_PROJECT_FS_MOUNT_POINT,
-        .partition_label = "filesystem",
+        .partition_label = FS_PARTITION_LABEL,
         .format_if_mount_failed = true  // Change this to false if you intend to flash specific contents to the internal filesystem
     };
     esp_err_t ret = esp_vfs_littlefs_register(&conf);
@@ -70,12 +83,13 @@ esp_err_t init_fs(void)
     }
 
     size_t total = 0, used = 0;
-    ret = esp_littlefs_info(NULL, &total, &used);
+    ret = esp_littlefs_info(FS_PARTITION_LABEL, &total, &used);
     if (ret != ESP_OK) {
         ESP_LOGE(TAG, "Failed to get LittleFS partition information (%s)", esp_err_to_name(ret));
     } else {
         ESP_LOGI(TAG, "Partition size: total: %d, used: %d", total, used);
     }
+    fs_sweep();
     return ESP_OK;
 }
 
@@ -83,6 +97,41 @@ esp_err_t init_fs(void)
 #error "Invalid filesystem configuration"
 #endif
 
+
+/**
+ * @brief Bytes free on the mounted filesystem.
+ */
+static esp_err_t fs_free_bytes(uint64_t *free_bytes)
+{
+#if CONFIG_PROJECT_WEB_DEPLOY_SD
+    FATFS *fs;
+    DWORD nclst;
+    if( FR_OK != f_getfree("0:", &nclst, &fs) ) return ESP_FAIL;
+#if FF_MAX_SS != FF_MIN_SS
+    *free_bytes = (uint64_t)nclst * fs->csize * fs->ssize;
+#else
+    *free_bytes = (uint64_t)nclst * fs->csize * FF_MAX_SS;
+#endif
+    return ESP_OK;
+#else
+    size_t total = 0, used = 0;
+    esp_err_t err = esp_littlefs_info(FS_PARTITION_LABEL, &total, &used);
+    if( ESP_OK != err ) return err;
+    *free_bytes = total > used ? total - used : 0;
+    return ESP_OK;
+#endif
+}
+
+void fs_setvbuf(FILE *fd)
+{
+#if CONFIG_PROJECT_FS_STDIO_BUF_SIZE > 0
+    /* newlib allocates the buffer and frees it on fclose */
+    if( 0 != setvbuf(fd, NULL, _IOFBF, CONFIG_PROJECT_FS_STDIO_BUF_SIZE) ) {
+        ESP_LOGW(TAG, "setvbuf failed; using the default buffer");
+    }
+#endif
+}
+
 /**
  * @brief Makes a directory if it doesn't exist
  *
@@ -111,6 +160,53 @@ static esp_err_t mkdir_if_not_exist(const char *path) {
     return ESP_OK;
 }
 
+/* Hashes of directories known to exist, so mkdir_p can skip the stat() of
+ * every ancestor on each upload. Replaced round-robin once full; a hash of 0
+ * marks an empty entry. Any directory removal clears the whole cache, since
+ * hashes can't tell which entries were below the removed directory. */
+static uint64_t dir_cache[FS_DIR_CACHE_SIZE];
+static uint32_t dir_cache_next;
+static portMUX_TYPE dir_cache_lock = portMUX_INITIALIZER_UNLOCKED;
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME  0x100000001b3ULL
+
+static inline uint64_t fnv_step(uint64_t h, char c)
+{
+    return (h ^ (uint8_t)c) * FNV_PRIME;
+}
+
+static bool dir_cache_has(uint64_t h)
+{
+    bool found = false;
+    portENTER_CRITICAL(&dir_cache_lock);
+    for(int i = 0; i < FS_DIR_CACHE_SIZE; i++) {
+        if( dir_cache[i] == h ) {
+            found = true;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&dir_cache_lock);
+    return found;
+}
+
+static void dir_cache_add(uint64_t h)
+{
+    portENTER_CRITICAL(&dir_cache_lock);
+    dir_cache[dir_cache_next] = h;
+    dir_cache_next = (dir_cache_next + 1) % FS_DIR_CACHE_SIZE;
+    portEXIT_CRITICAL(&dir_cache_lock);
+}
+
+void fs_dir_cache_clear(void)
+{
+    portENTER_CRITICAL(&dir_cache_lock);
+    memset(dir_cache, 0, sizeof(dir_cache));
+    dir_cache_next = 0;
+    portEXIT_CRITICAL(&dir_cache_lock);
+}
+
+
 /**
  * @brief Recursively create parent directories for a given path
  * @param[in] path Path to a file/directory to create paths up to
@@ -122,23 +218,43 @@ esp_err_t mkdir_p(const char *path, bool isfile)
 {
     esp_err_t err = ESP_FAIL;
     char *_path = NULL;
+    uint64_t h = FNV_OFFSET;
+    size_t len;
+
+    /* Common case: the whole directory is already known to exist */
+    len = strlen(path);
+    if( isfile ) {
+        const char *sep = strrchr(path, '/');
+        len = sep ? (size_t)(sep - path) : 0;
+    }
+    for( size_t i = 0; i < len; i++ ) h = fnv_step(h, path[i]);
+    if( h != 0 && dir_cache_has(h) ) return ESP_OK;
 
     _path = strdup(path);
     if(NULL == _path) goto exit;
 
+    /* Hash each prefix as it's walked; only touch storage for unknown ones */
+    h = fnv_step(FNV_OFFSET, _path[0]);
     errno = 0;
     for (char *p = _path + 1; *p; p++) {
         if (*p == '/') {
-            *p = '\0';
-            if(ESP_OK != mkdir_if_not_exist(_path)){
-                goto exit;
+            if( !dir_cache_has(h) ) {
+                *p = '\0';
+                if(ESP_OK != mkdir_if_not_exist(_path)){
+                    goto exit;
+                }
+                *p = '/';
+                dir_cache_add(h);
             }
-            *p = '/';
         }
-    }   
+        h = fnv_step(h, *p);
+    }
 
-    if( !isfile && 0 != mkdir_if_not_exist(_path)) {
-        goto exit;
+    if( !isfile ) {
+        if( 0 != mkdir_if_not_exist(_path)) {
+            goto exit;
+        }
+        dir_cache_add(h);
     }
 
     err = ESP_OK;
@@ -170,74 +286,835 @@ char *trim_separators(char *path) {
 }
 
 /**
- * @brief Delete a file/folder and all its contents
- *
- * Based on https://stackoverflow.com/a/42596507
+ * @brief Find the CONFIG_PROJECT_FS_QUOTAS rule covering `path`.
+ * @param[out] dir Full path of the rule's directory.
+ * @returns The quota in bytes, or 0 if no rule covers `path`.
  */
-int rm_rf(const char path[]){
-    size_t path_len;
-    char *full_path = NULL;
-    DIR *dir = NULL;
-    struct stat stat_path, stat_entry;
-    struct dirent *entry;
-    int err = -1;
+static size_t fs_quota_lookup(const char *path, char *dir, size_t dir_size)
+{
+    const size_t mount_len = strlen(CONFIG_PROJECT_FS_MOUNT_POINT);
+    const char *rules = CONFIG_PROJECT_FS_QUOTAS;
+    const char *rel = path + mount_len;
+    size_t quota = 0, best_len = 0;
+
+    if( 0 != strncmp(path, CONFIG_PROJECT_FS_MOUNT_POINT, mount_len) ) return 0;
+
+    while( *rules ) {
+        while( ' ' == *rules || ',' == *rules ) rules++;
+        const char *eq = strchr(rules, '=');
+        if( NULL == eq ) break;
+        size_t len = eq - rules;
+        while( len > 0 && '/' == rules[len - 1] ) len--;  // "/" becomes ""
+
+        if( len >= best_len && 0 == strncmp(rel, rules, len)
+                && ('/' == rel[len] || '\0' == rel[len]) ) {
+            char *end;
+            size_t n = strtoul(eq + 1, &end, 10);
+            size_t unit = 1;
+            if( 'K' == *end || 'k' == *end ) unit = 1024;
+            else if( 'M' == *end || 'm' == *end ) unit = 1024 * 1024;
+            quota = n > SIZE_MAX / unit ? SIZE_MAX : n * unit;
+            best_len = len;
+            snprintf(dir, dir_size, "%s%.*s", CONFIG_PROJECT_FS_MOUNT_POINT, (int)len, rules);
+        }
+
+        if( NULL == (rules = strchr(eq, ',')) ) break;
+    }
+    return quota;
+}
+
+bool fs_is_internal_name(const char *name)
+{
+    return 0 == strncmp(name, FS_INTERNAL_PREFIX, sizeof(FS_INTERNAL_PREFIX) - 1);
+}
+
+
+/**
+ * @brief Path of the internal file with `suffix` that belongs to `path`.
+ */
+static esp_err_t fs_internal_path(char *buf, size_t len, const char *path, const char *suffix)
+{
+    const char *name = strrchr(path, '/');
+    int dir_len = name ? name - path + 1 : 0;
+
+    name = name ? name + 1 : path;
+    if( snprintf(buf, len, "%.*s" FS_INTERNAL_PREFIX "%s%s", dir_len, path, name, suffix) >= len ) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    return ESP_OK;
+}
+
+
+/**
+ * @param[in] suffix FS_TMP_SUFFIX or FS_RESUME_SUFFIX.
+ */
+static esp_err_t fs_tmp_path(char *buf, size_t len, const char *path, const char *suffix)
+{
+    if( ESP_OK != fs_internal_path(buf, len, path, suffix) ) {
+        ESP_LOGE(TAG, "Path too long: %s", path);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    return ESP_OK;
+}
+
+
+typedef struct fs_usage_ctx {
+    uint64_t bytes;
+    const char *exclude;        // File not to count
+    const char *exclude_tmp;    // ... nor its temporary files
+    const char *exclude_resume;
+} fs_usage_ctx_t;
+
+static esp_err_t fs_usage_cb(void *ctx, fs_walk_event_t event, const char *path, const struct stat *st)
+{
+    fs_usage_ctx_t *u = ctx;
+    if( FS_WALK_FILE != event ) return ESP_OK;
+    if( 0 == strcmp(path, u->exclude) || 0 == strcmp(path, u->exclude_tmp)
+            || 0 == strcmp(path, u->exclude_resume) ) {
+        return ESP_OK;
+    }
+    u->bytes += st->st_size;
+    return ESP_OK;
+}
+
+void fs_space_get(const char *path, size_t written, fs_space_t *space)
+{
+    uint64_t free_bytes;
+    size_t quota;
+    char *dir = NULL, *tmp_path = NULL;
+    struct stat st;
+
+    space->free = SIZE_MAX;
+    space->quota = SIZE_MAX;
+
+    if( ESP_OK != fs_free_bytes(&free_bytes) ) {
+        /* Writes still fail cleanly once the filesystem is full */
+        ESP_LOGW(TAG, "Failed to get free space");
+    }
+    else {
+        free_bytes = free_bytes > FS_SPACE_RESERVE ? free_bytes - FS_SPACE_RESERVE : 0;
+        space->free = MIN(free_bytes + written, SIZE_MAX);
+    }
+
+    if( NULL == (dir = malloc(MAX_FILE_PATH)) ) goto exit;
+    if( 0 == (quota = fs_quota_lookup(path, dir, MAX_FILE_PATH)) ) goto exit;
+
+    if( NULL == (tmp_path = malloc(2 * MAX_FILE_PATH)) ) goto exit;
+    char *resume_path = tmp_path + MAX_FILE_PATH;
+    if( ESP_OK != fs_tmp_path(tmp_path, MAX_FILE_PATH, path, FS_TMP_SUFFIX) ) tmp_path[0] = '\0';
+    if( ESP_OK != fs_tmp_path(resume_path, MAX_FILE_PATH, path, FS_RESUME_SUFFIX) ) resume_path[0] = '\0';
+
+    fs_usage_ctx_t u = { .exclude = path, .exclude_tmp = tmp_path, .exclude_resume = resume_path };
+    if( 0 == stat(dir, &st) && S_ISDIR(st.st_mode)
+            && ESP_OK != fs_walk(dir, MAX_FILE_PATH, fs_usage_cb, &u) ) {
+        ESP_LOGW(TAG, "Failed to measure usage of %s", dir);
+        goto exit;
+    }
+    space->quota = u.bytes < quota ? quota - u.bytes : 0;
+
+exit:
+    free(dir);
+    free(tmp_path);
+}
+
+esp_err_t fs_check_space(const char *path, size_t size, size_t written)
+{
+    fs_space_t space;
+    esp_err_t err;
+
+    fs_space_get(path, written, &space);
+    if( ESP_OK != (err = fs_space_check(&space, size)) ) {
+        ESP_LOGE(TAG, "No room for %d bytes at %s (free: %d, quota: %d)",
+                size, path, space.free, space.quota);
+    }
+    return err;
+}
+
+void fs_space_batch_init(fs_space_batch_t *b)
+{
+    memset(b, 0, sizeof(fs_space_batch_t));
+    if( ESP_OK != fs_free_bytes(&b->free) ) {
+        ESP_LOGW(TAG, "Failed to get free space");
+        b->free = UINT64_MAX;
+    }
+    else {
+        b->free = b->free > FS_SPACE_RESERVE ? b->free - FS_SPACE_RESERVE : 0;
+    }
+}
+
+esp_err_t fs_space_batch_check(fs_space_batch_t *b, const char *path, size_t size)
+{
+    esp_err_t err = ESP_OK;
+    char *dir = NULL;
+    size_t quota = 0, old = 0;
+    struct stat st;
 
-    // stat for the path
-    err = stat(path, &stat_path);
-    if( err ) goto exit;
+    if( 0 == stat(path, &st) && S_ISREG(st.st_mode) ) old = st.st_size;
 
-    // If its a file, just delete it
-    if (S_ISDIR(stat_path.st_mode) == 0) {
-        err = unlink(path);
+    if( NULL == (dir = malloc(MAX_FILE_PATH)) ) {
+        err = ESP_ERR_NO_MEM;
         goto exit;
     }
+    if( 0 != (quota = fs_quota_lookup(path, dir, MAX_FILE_PATH))
+            && 0 != strcmp(dir, b->dir) ) {
+        /* Nothing to exclude; the batch tallies its own replacements */
+        fs_usage_ctx_t u = { .exclude = "", .exclude_tmp = "", .exclude_resume = "" };
+        strlcpy(b->dir, dir, sizeof(b->dir));
+        b->quota = quota;
+        if( 0 == stat(b->dir, &st) && S_ISDIR(st.st_mode)
+                && ESP_OK != fs_walk(dir, MAX_FILE_PATH, fs_usage_cb, &u) ) {
+            ESP_LOGW(TAG, "Failed to measure usage of %s", b->dir);
+            b->quota = 0;
+            b->dir[0] = '\0';
+        }
+        b->used = u.bytes;
+    }
 
-    // if not possible to read the directory for this user
-    if ((dir = opendir(path)) == NULL) {
-        ESP_LOGE(TAG, "Can`t open directory %s", path);
-        err = 1;
+    if( 0 != quota && 0 != b->quota && b->used - MIN(old, b->used) + size > b->quota ) {
+        err = FS_ERR_QUOTA;
+    }
+    else if( size > b->free ) {
+        err = FS_ERR_NO_SPACE;
+    }
+    if( ESP_OK != err ) {
+        ESP_LOGE(TAG, "No room for %d bytes at %s", size, path);
         goto exit;
     }
 
-    // the length of the path
-    path_len = strlen(path);
+    /* The old version is freed once the new one is renamed into place */
+    if( 0 != quota && 0 != b->quota ) b->used = b->used - MIN(old, b->used) + size;
+    if( UINT64_MAX != b->free ) b->free = b->free - size + old;
 
-    // iteration through entries in the directory
-    while ((entry = readdir(dir)) != NULL) {
+exit:
+    free(dir);
+    return err;
+}
 
-        // skip entries "." and ".."
-        if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
-            continue;
 
-        // determinate a full path of an entry
-        full_path = calloc(path_len + strlen(entry->d_name) + 2, sizeof(char));
-        strcpy(full_path, path);
-        strcat(full_path, "/");
-        strcat(full_path, entry->d_name);
+esp_err_t fs_rename_replace(const char *src, const char *dst)
+{
+    struct stat sb;
+
+    if( 0 == rename(src, dst) ) return ESP_OK;
+
+    /* FAT won't rename over an existing file */
+    if( 0 == stat(dst, &sb) && !S_ISDIR(sb.st_mode) ) {
+        if( 0 != unlink(dst) ) {
+            ESP_LOGE(TAG, "Failed to remove %s", dst);
+            return ESP_FAIL;
+        }
+        if( 0 == rename(src, dst) ) return ESP_OK;
+    }
+
+    ESP_LOGE(TAG, "Failed to rename %s -> %s", src, dst);
+    return ESP_FAIL;
+}
 
-        // stat for the entry
-        stat(full_path, &stat_entry);
 
-        err = rm_rf(full_path);
-        if(err) goto exit;
+/**
+ * @brief Sidecar contents: digest, the size of the hashed file and its
+ * trailing bytes (zero padded if it's shorter).
+ */
+typedef struct fs_hash_record {
+    uint8_t digest[FS_HASH_LEN];
+    uint32_t size;
+    uint8_t tail[FS_HASH_TAIL_LEN];
+} fs_hash_record_t;
+
 
-        free(full_path);
+static esp_err_t fs_hash_path(char *buf, size_t len, const char *path)
+{
+    return fs_internal_path(buf, len, path, FS_HASH_SUFFIX);
+}
+
+
+static esp_err_t fs_sweep_cb(void *ctx, fs_walk_event_t event, const char *path, const struct stat *st)
+{
+    uint32_t *removed = ctx;
+    const char *name = strrchr(path, '/') + 1;
+    char *owner = NULL;
+    size_t len;
+
+    if( FS_WALK_DIR == event || !fs_is_internal_name(name) ) return ESP_OK;
+
+    /* A tree copy that never finished, or a tree it replaced. Its contents
+     * were just visited, so the walk is done with it */
+    if( FS_WALK_DIR_POST == event ) {
+        if( ESP_OK == rm_rf(path, NULL) ) (*removed)++;
+        return ESP_OK;
     }
 
-    closedir(dir);
-    dir = NULL;
+    len = strlen(name);
+
+    /* Resumable uploads survive reboots on purpose */
+    if( len >= sizeof(FS_RESUME_SUFFIX) && IS_FILE_EXT(name, FS_RESUME_SUFFIX) ) return ESP_OK;
+
+    /* Keep digests whose file still exists */
+    if( len >= sizeof(FS_INTERNAL_PREFIX FS_HASH_SUFFIX) && IS_FILE_EXT(name, FS_HASH_SUFFIX) ) {
+        struct stat sb;
+        bool orphan = true;
+        if( NULL != (owner = malloc(MAX_FILE_PATH)) ) {
+            int dir_len = name - path;
+            snprintf(owner, MAX_FILE_PATH, "%.*s%.*s", dir_len, path,
+                    (int)(len - strlen(FS_INTERNAL_PREFIX FS_HASH_SUFFIX)),
+                    name + strlen(FS_INTERNAL_PREFIX));
+            orphan = 0 != stat(owner, &sb);
+            free(owner);
+        }
+        if( !orphan ) return ESP_OK;
+    }
 
-    // remove the devastated directory and close the object of it
-    err = rmdir(path);
-    if(err) {
-        ESP_LOGE(TAG, "Can`t remove directory: %s\n", path);
+    /* Anything else was left behind by a write that never finished */
+    if( 0 == unlink(path) ) (*removed)++;
+    return ESP_OK;
+}
+
+/**
+ * @brief Remove leftover temporary files and directories, and digests of
+ * files that are gone, from the whole filesystem.
+ */
+static void fs_sweep(void)
+{
+    uint32_t removed = 0;
+    char *path = malloc(MAX_FILE_PATH);
+
+    if( NULL == path ) return;
+    strcpy(path, CONFIG_PROJECT_FS_MOUNT_POINT);
+    if( ESP_OK != fs_walk(path, MAX_FILE_PATH, fs_sweep_cb, &removed) ) {
+        ESP_LOGW(TAG, "Failed to sweep temporary files");
+    }
+    if( removed ) ESP_LOGI(TAG, "Removed %d stale temporary files", removed);
+    free(path);
+}
+
+
+/**
+ * @brief Read the last FS_HASH_TAIL_LEN bytes of a file of `size` bytes.
+ */
+static esp_err_t fs_hash_tail(const char *path, size_t size, uint8_t tail[FS_HASH_TAIL_LEN])
+{
+    esp_err_t err = ESP_FAIL;
+    size_t n = MIN(size, FS_HASH_TAIL_LEN);
+    FILE *fd = NULL;
+
+    memset(tail, 0, FS_HASH_TAIL_LEN);
+    if( NULL == (fd = fopen(path, "r")) ) goto exit;
+    if( 0 != fseek(fd, size - n, SEEK_SET) ) goto exit;
+    if( n != fread(tail, 1, n, fd) ) goto exit;
+    err = ESP_OK;
+
+exit:
+    if( fd ) fclose(fd);
+    return err;
+}
+
+
+esp_err_t fs_hash_get(const char *path, uint8_t digest[FS_HASH_LEN])
+{
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    char hash_path[MAX_FILE_PATH];
+    struct stat file_stat;
+    fs_hash_record_t record;
+    uint8_t tail[FS_HASH_TAIL_LEN];
+    FILE *fd = NULL;
+
+    if( ESP_OK != fs_hash_path(hash_path, sizeof(hash_path), path) ) goto exit;
+    if( 0 != stat(path, &file_stat) ) goto exit;
+
+    if( NULL == (fd = fopen(hash_path, "r")) ) goto exit;
+    if( 1 != fread(&record, sizeof(record), 1, fd) ) goto exit;
+
+    /* File was modified after the digest was recorded */
+    if( record.size != file_stat.st_size ) goto exit;
+    if( ESP_OK != fs_hash_tail(path, file_stat.st_size, tail) ) goto exit;
+    if( 0 != memcmp(tail, record.tail, FS_HASH_TAIL_LEN) ) goto exit;
+
+    memcpy(digest, record.digest, FS_HASH_LEN);
+    err = ESP_OK;
+
+exit:
+    if( fd ) fclose(fd);
+    return err;
+}
+
+
+esp_err_t fs_hash_set(const char *path, const uint8_t digest[FS_HASH_LEN], size_t size)
+{
+    esp_err_t err = ESP_FAIL;
+    char hash_path[MAX_FILE_PATH];
+    fs_hash_record_t record = { .size = size };
+    FILE *fd = NULL;
+
+    memcpy(record.digest, digest, FS_HASH_LEN);
+
+    if( ESP_OK != (err = fs_hash_path(hash_path, sizeof(hash_path), path)) ) goto exit;
+    if( ESP_OK != (err = fs_hash_tail(path, size, record.tail)) ) goto exit;
+    if( NULL == (fd = fopen(hash_path, "w")) ) {
+        err = ESP_FAIL;
         goto exit;
     }
+    err = (1 == fwrite(&record, sizeof(record), 1, fd)) ? ESP_OK : ESP_FAIL;
+
+exit:
+    if( fd ) fclose(fd);
+    if( ESP_OK != err ) {
+        ESP_LOGE(TAG, "Failed to store digest of %s", path);
+        unlink(hash_path);
+    }
+    return err;
+}
 
-    err = 0;
+
+void fs_hash_remove(const char *path)
+{
+    char hash_path[MAX_FILE_PATH];
+    if( ESP_OK == fs_hash_path(hash_path, sizeof(hash_path), path) ) {
+        unlink(hash_path);
+    }
+}
+
+
+/**
+ * @brief Populate the writer's paths and open its temporary file.
+ * @param[in] suffix FS_TMP_SUFFIX or FS_RESUME_SUFFIX.
+ * @param[in] mode fopen mode; "w" to start over, "a" to continue.
+ */
+static esp_err_t fs_writer_init(fs_writer_t *w, const char *path, const char *suffix, const char *mode)
+{
+    esp_err_t err;
+
+    memset(w, 0, sizeof(fs_writer_t));
+
+    if( fs_is_internal_name(strrchr(path, '/') ? strrchr(path, '/') + 1 : path) ) {
+        ESP_LOGE(TAG, "Reserved file name: %s", path);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if( strlcpy(w->path, path, sizeof(w->path)) >= sizeof(w->path) ) {
+        ESP_LOGE(TAG, "Path too long: %s", path);
+        return ESP_ERR_INVALID_SIZE;
+    }
+    if( ESP_OK != (err = fs_tmp_path(w->tmp_path, sizeof(w->tmp_path), path, suffix)) ) return err;
+
+    w->fd = fopen(w->tmp_path, mode);
+    if( NULL == w->fd ) {
+        ESP_LOGE(TAG, "Failed to create file : %s", w->tmp_path);
+        /* In case the parent was removed behind the directory cache's back */
+        fs_dir_cache_clear();
+        return ESP_FAIL;
+    }
+    fs_setvbuf(w->fd);
+    crypto_hash_sha256_init(&w->sha);
+
+    return ESP_OK;
+}
+
+
+esp_err_t fs_writer_open(fs_writer_t *w, const char *path)
+{
+    return fs_writer_init(w, path, FS_TMP_SUFFIX, "w");
+}
+
+
+esp_err_t fs_writer_resume(fs_writer_t *w, const char *path)
+{
+    esp_err_t err;
+    size_t size;
+
+    if( ESP_OK != fs_writer_pending(path, &size) ) {
+        return fs_writer_init(w, path, FS_RESUME_SUFFIX, "w");
+    }
+
+    if( ESP_OK != (err = fs_writer_init(w, path, FS_RESUME_SUFFIX, "a")) ) return err;
+    w->size = size;
+    /* The hash state of the earlier requests is gone */
+    w->resumed = true;
+    return ESP_OK;
+}
+
+
+esp_err_t fs_writer_pending(const char *path, size_t *size)
+{
+    char tmp_path[MAX_FILE_PATH];
+    struct stat sb;
+
+    if( ESP_OK != fs_tmp_path(tmp_path, sizeof(tmp_path), path, FS_RESUME_SUFFIX) ) return ESP_ERR_NOT_FOUND;
+    if( 0 != stat(tmp_path, &sb) ) return ESP_ERR_NOT_FOUND;
+    *size = sb.st_size;
+    return ESP_OK;
+}
+
+
+void fs_writer_discard(const char *path)
+{
+    char tmp_path[MAX_FILE_PATH];
+    if( ESP_OK == fs_tmp_path(tmp_path, sizeof(tmp_path), path, FS_RESUME_SUFFIX) ) {
+        unlink(tmp_path);
+    }
+}
+
+
+/**
+ * @brief Compute the SHA-256 of a file by reading it back.
+ */
+static esp_err_t fs_hash_file(const char *path, uint8_t digest[FS_HASH_LEN])
+{
+    esp_err_t err = ESP_FAIL;
+    crypto_hash_sha256_state sha;
+    FILE *fd = NULL;
+    uint8_t *buf = NULL;
+    size_t n;
+
+    if( NULL == (buf = malloc(FS_HASH_READ_SIZE)) ) goto exit;
+    if( NULL == (fd = fopen(path, "r")) ) goto exit;
+
+    crypto_hash_sha256_init(&sha);
+    while( (n = fread(buf, 1, FS_HASH_READ_SIZE, fd)) > 0 ) {
+        crypto_hash_sha256_update(&sha, buf, n);
+    }
+    if( ferror(fd) ) goto exit;
+    crypto_hash_sha256_final(&sha, digest);
+    err = ESP_OK;
+
+exit:
+    if( fd ) fclose(fd);
+    if( buf ) free(buf);
+    return err;
+}
+
+
+esp_err_t fs_writer_write(fs_writer_t *w, const void *buf, size_t len)
+{
+    if( NULL == w->fd ) return ESP_ERR_INVALID_STATE;
+    if( len != fwrite(buf, 1, len, w->fd) ) {
+        /* Storage may be full? */
+        ESP_LOGE(TAG, "Failed to write %d bytes to %s", len, w->tmp_path);
+        return ESP_FAIL;
+    }
+    crypto_hash_sha256_update(&w->sha, buf, len);
+    w->size += len;
+    return ESP_OK;
+}
+
+
+esp_err_t fs_writer_commit(fs_writer_t *w, const uint8_t *expected)
+{
+    esp_err_t err = ESP_FAIL;
+
+    if( NULL == w->fd ) return ESP_ERR_INVALID_STATE;
+
+    err = (0 == fclose(w->fd)) ? ESP_OK : ESP_FAIL;
+    w->fd = NULL;
+    if( ESP_OK != err ) {
+        ESP_LOGE(TAG, "Failed to close %s", w->tmp_path);
+        goto exit;
+    }
+
+    if( w->resumed ) {
+        if( ESP_OK != (err = fs_hash_file(w->tmp_path, w->digest)) ) goto exit;
+    }
+    else {
+        crypto_hash_sha256_final(&w->sha, w->digest);
+    }
+    if( expected && 0 != sodium_memcmp(expected, w->digest, FS_HASH_LEN) ) {
+        ESP_LOGE(TAG, "Digest mismatch for %s", w->path);
+        err = ESP_ERR_INVALID_CRC;
+        goto exit;
+    }
+
+    /* Drop the old digest first so it can never describe the new contents */
+    fs_hash_remove(w->path);
+    err = fs_rename_replace(w->tmp_path, w->path);
+    /* Even a failed rename may have removed the old file */
+    file_cache_invalidate(w->path);
+    if( ESP_OK != err ) goto exit;
+
+    /* Failing to record the digest doesn't invalidate the file itself */
+    fs_hash_set(w->path, w->digest, w->size);
 
 exit:
-    if(dir) closedir(dir);
+    if( ESP_OK != err ) unlink(w->tmp_path);
     return err;
 }
 
+
+esp_err_t fs_writer_suspend(fs_writer_t *w)
+{
+    esp_err_t err;
+    if( NULL == w->fd ) return ESP_ERR_INVALID_STATE;
+    err = (0 == fclose(w->fd)) ? ESP_OK : ESP_FAIL;
+    w->fd = NULL;
+    return err;
+}
+
+
+void fs_writer_abort(fs_writer_t *w)
+{
+    if( NULL == w->fd ) return;
+    fclose(w->fd);
+    w->fd = NULL;
+    unlink(w->tmp_path);
+}
+
+
+typedef struct fs_copy_ctx {
+    const char *src;
+    size_t src_len;
+    char dst[MAX_FILE_PATH];
+    size_t dst_len;
+    uint8_t *buf;
+    fs_writer_t w;
+    fs_space_batch_t space;
+    fs_rm_stats_t *stats;
+    fs_rm_progress_cb_t cb;
+    void *cb_ctx;
+} fs_copy_ctx_t;
+
+/**
+ * @brief Copy a single file to `c->dst`.
+ */
+static esp_err_t fs_copy_file(fs_copy_ctx_t *c, const char *src, const struct stat *st)
+{
+    esp_err_t err;
+    FILE *fd = NULL;
+    size_t n;
+    uint8_t expected[FS_HASH_LEN];
+    bool has_expected = ESP_OK == fs_hash_get(src, expected);
+
+    if( ESP_OK != (err = fs_space_batch_check(&c->space, c->dst, st->st_size)) ) return err;
+
+    if( NULL == (fd = fopen(src, "r")) ) {
+        ESP_LOGE(TAG, "Failed to open %s", src);
+        return ESP_FAIL;
+    }
+    fs_setvbuf(fd);
+    if( ESP_OK != (err = fs_writer_open(&c->w, c->dst)) ) goto exit;
+
+    while( (n = fread(c->buf, 1, FS_IO_CHUNK_SIZE, fd)) > 0 ) {
+        if( ESP_OK != (err = fs_writer_write(&c->w, c->buf, n)) ) goto exit;
+    }
+    if( ferror(fd) ) {
+        ESP_LOGE(TAG, "Failed to read %s", src);
+        err = ESP_FAIL;
+        goto exit;
+    }
+    if( ESP_OK != (err = fs_writer_commit(&c->w, has_expected ? expected : NULL)) ) goto exit;
+
+    c->stats->files++;
+    c->stats->bytes += c->w.size;
+
+exit:
+    fs_writer_abort(&c->w);
+    fclose(fd);
+    return err;
+}
+
+static esp_err_t fs_copy_cb(void *ctx, fs_walk_event_t event, const char *path, const struct stat *st)
+{
+    fs_copy_ctx_t *c = ctx;
+    esp_err_t err;
+
+    if( FS_WALK_DIR_POST == event ) return ESP_OK;
+    if( FS_WALK_FILE == event && fs_is_internal_name(strrchr(path, '/') + 1) ) return ESP_OK;
+
+    /* Mirror the entry's path below the destination */
+    if( strlcpy(c->dst + c->dst_len, path + c->src_len, sizeof(c->dst) - c->dst_len)
+            >= sizeof(c->dst) - c->dst_len ) {
+        ESP_LOGE(TAG, "Path too long: %s%s", c->dst, path + c->src_len);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    if( FS_WALK_DIR == event ) {
+        if( 0 != mkdir(c->dst, 0755) && EEXIST != errno ) {
+            ESP_LOGE(TAG, "Failed to create %s", c->dst);
+            return ESP_FAIL;
+        }
+        c->stats->dirs++;
+    }
+    else if( ESP_OK != (err = fs_copy_file(c, path, st)) ) {
+        return err;
+    }
+
+    if( c->cb ) return c->cb(c->cb_ctx, c->stats);
+    return ESP_OK;
+}
+
+/**
+ * @brief Rename the finished copy `tmp` to `dst`, replacing a directory
+ * there. Whichever step fails, `dst` is left as it was.
+ */
+static esp_err_t fs_swap_dir(const char *tmp, const char *dst)
+{
+    esp_err_t err = ESP_OK;
+    char *old = NULL;
+    struct stat st;
+
+    if( 0 == stat(dst, &st) ) {
+        if( NULL == (old = malloc(MAX_FILE_PATH)) ) return ESP_ERR_NO_MEM;
+        if( ESP_OK != (err = fs_tmp_path(old, MAX_FILE_PATH, dst, FS_OLD_SUFFIX)) ) goto exit;
+        if( 0 == stat(old, &st) && ESP_OK != (err = rm_rf(old, NULL)) ) {
+            ESP_LOGE(TAG, "Failed to remove %s", old);
+            goto exit;
+        }
+        if( 0 != rename(dst, old) ) {
+            ESP_LOGE(TAG, "Failed to rename %s -> %s", dst, old);
+            err = ESP_FAIL;
+            goto exit;
+        }
+    }
+
+    if( 0 != rename(tmp, dst) ) {
+        ESP_LOGE(TAG, "Failed to rename %s -> %s", tmp, dst);
+        if( old && 0 != rename(old, dst) ) ESP_LOGE(TAG, "Failed to restore %s", dst);
+        err = ESP_FAIL;
+        goto exit;
+    }
+    fs_dir_cache_clear();
+    file_cache_invalidate(dst);
+
+    /* Otherwise removed at the next mount */
+    if( old && ESP_OK != rm_rf(old, NULL) ) ESP_LOGW(TAG, "Failed to remove %s", old);
+
+exit:
+    free(old);
+    return err;
+}
+
+esp_err_t fs_copy(const char *src, const char *dst, fs_rm_stats_t *stats, fs_rm_progress_cb_t cb, void *ctx)
+{
+    esp_err_t err = ESP_FAIL;
+    fs_copy_ctx_t *c = NULL;
+    char *walk_path = NULL, *final_path;
+    fs_rm_stats_t local_stats;
+    struct stat st;
+    bool tmp_created = false;
+
+    if( NULL == stats ) stats = &local_stats;
+    memset(stats, 0, sizeof(fs_rm_stats_t));
+
+    if( -1 == stat(src, &st) ) return ESP_ERR_NOT_FOUND;
+
+    c = calloc(1, sizeof(fs_copy_ctx_t));
+    if( NULL == c || NULL == (c->buf = malloc(FS_IO_CHUNK_SIZE)) ) {
+        err = ESP_ERR_NO_MEM;
+        goto exit;
+    }
+    c->stats = stats;
+    c->cb = cb;
+    c->cb_ctx = ctx;
+    if( strlcpy(c->dst, dst, sizeof(c->dst)) >= sizeof(c->dst) ) {
+        err = ESP_ERR_INVALID_SIZE;
+        goto exit;
+    }
+    c->dst_len = strlen(c->dst);
+
+    if( !S_ISDIR(st.st_mode) ) {
+        fs_space_batch_init(&c->space);
+        err = fs_copy_file(c, src, &st);
+        goto exit;
+    }
+
+    if( NULL == (walk_path = malloc(2 * MAX_FILE_PATH)) ) {
+        err = ESP_ERR_NO_MEM;
+        goto exit;
+    }
+    final_path = walk_path + MAX_FILE_PATH;
+    if( strlcpy(walk_path, src, MAX_FILE_PATH) >= MAX_FILE_PATH ) {
+        err = ESP_ERR_INVALID_SIZE;
+        goto exit;
+    }
+    /* Entry paths are relative to the source without its trailing '/' */
+    c->src = src;
+    c->src_len = strlen(src);
+    if( c->src_len > 1 && '/' == src[c->src_len - 1] ) c->src_len--;
+    if( c->dst_len > 1 && '/' == c->dst[c->dst_len - 1] ) c->dst[--c->dst_len] = '\0';
+
+    if( 0 == stat(c->dst, &st) && !S_ISDIR(st.st_mode) ) {
+        err = ESP_ERR_INVALID_STATE;
+        goto exit;
+    }
+
+    /* The tree is copied next to the destination, which is only replaced
+     * once the copy is complete */
+    strcpy(final_path, c->dst);
+    if( ESP_OK != (err = fs_tmp_path(c->dst, sizeof(c->dst), final_path, FS_TMP_SUFFIX)) ) goto exit;
+    c->dst_len = strlen(c->dst);
+
+    /* Left behind by a copy that was interrupted */
+    if( 0 == stat(c->dst, &st) && ESP_OK != (err = rm_rf(c->dst, NULL)) ) {
+        ESP_LOGE(TAG, "Failed to remove %s", c->dst);
+        goto exit;
+    }
+    fs_space_batch_init(&c->space);
+
+    if( 0 != mkdir(c->dst, 0755) ) {
+        ESP_LOGE(TAG, "Failed to create %s", c->dst);
+        err = ESP_FAIL;
+        goto exit;
+    }
+    tmp_created = true;
+    stats->dirs++;
+
+    if( ESP_OK != (err = fs_walk(walk_path, MAX_FILE_PATH, fs_copy_cb, c)) ) goto exit;
+
+    c->dst[c->dst_len] = '\0';
+    if( ESP_OK == (err = fs_swap_dir(c->dst, final_path)) ) tmp_created = false;
+
+exit:
+    if( c ) {
+        fs_writer_abort(&c->w);
+        if( tmp_created ) {
+            c->dst[c->dst_len] = '\0';
+            if( ESP_OK != rm_rf(c->dst, NULL) ) ESP_LOGW(TAG, "Failed to remove %s", c->dst);
+        }
+        free(c->buf);
+    }
+    free(c);
+    free(walk_path);
+    return err;
+}
+
+
+esp_err_t fs_move(const char *src, const char *dst)
+{
+    esp_err_t err;
+    struct stat st;
+    char *src_hash = NULL, *dst_hash = NULL;
+
+    if( -1 == stat(src, &st) ) return ESP_ERR_NOT_FOUND;
+
+    if( S_ISDIR(st.st_mode) ) {
+        struct stat dst_st;
+        if( 0 == stat(dst, &dst_st) ) return ESP_ERR_INVALID_STATE;
+        if( 0 != rename(src, dst) ) {
+            ESP_LOGE(TAG, "Failed to rename %s -> %s", src, dst);
+            return ESP_FAIL;
+        }
+        /* The source directory and everything below it are gone */
+        fs_dir_cache_clear();
+        file_cache_invalidate(src);
+        return ESP_OK;
+    }
+
+    /* Drop the destination's digest first so it can never describe the
+     * moved contents */
+    fs_hash_remove(dst);
+    err = fs_rename_replace(src, dst);
+    file_cache_invalidate(src);
+    file_cache_invalidate(dst);
+    if( ESP_OK != err ) return err;
+
+    /* Carry the digest along; without it, it's recomputed on demand */
+    src_hash = malloc(MAX_FILE_PATH);
+    dst_hash = malloc(MAX_FILE_PATH);
+    if( src_hash && dst_hash
+            && ESP_OK == fs_hash_path(src_hash, MAX_FILE_PATH, src)
+            && ESP_OK == fs_hash_path(dst_hash, MAX_FILE_PATH, dst) ) {
+        if( 0 != rename(src_hash, dst_hash) ) unlink(src_hash);
+    }
+    else {
+        fs_hash_remove(src);
+    }
+    free(src_hash);
+    free(dst_hash);
+    return ESP_OK;
+}
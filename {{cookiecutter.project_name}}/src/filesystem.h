@@ -3,14 +3,57 @@
 
 
 #include "esp_err.h"
+#include "sdkconfig.h"
+#include "sodium.h"
+#include "stdbool.h"
+#include "stdint.h"
+#include "stdio.h"
+#include <sys/stat.h>
 
 
 #define CONFIG_PROJECT_FS_MOUNT_POINT "/fs"
 
-#define MAX_FILE_SIZE   (500*1024) // 500 KB
-#define MAX_FILE_SIZE_STR "500KB"
 #define MAX_FILE_PATH 256
 
+/* Free space never handed out to uploads, left for filesystem metadata and
+ * copy-on-write blocks */
+#define FS_SPACE_RESERVE (8*1024)
+
+#define FS_ERR_BASE     0x70000
+/* A write would take a directory over its quota */
+#define FS_ERR_QUOTA    (FS_ERR_BASE + 1)
+/* A write doesn't fit in the filesystem's free space */
+#define FS_ERR_NO_SPACE (FS_ERR_BASE + 2)
+
+/* Names starting with this are reserved for the temporary and sidecar files
+ * below, which live next to the file they belong to as
+ * FS_INTERNAL_PREFIX + name + suffix. Uploads may not use it. */
+#define FS_INTERNAL_PREFIX ".~"
+
+/* Suffix of the temporary file a write is staged in before it gets renamed
+ * over the destination, or of the directory a tree copy is. Left over ones
+ * are removed at mount. */
+#define FS_TMP_SUFFIX ".part"
+
+/* Suffix a directory is renamed to when a copied tree takes its place, until
+ * it has been removed. Left over ones are removed at mount. */
+#define FS_OLD_SUFFIX ".old"
+
+/* Suffix of the temporary file of a resumable upload. Kept across reboots
+ * and separate from FS_TMP_SUFFIX, so a one-shot write to the same path can't
+ * clobber an upload that is waiting to be resumed. */
+#define FS_RESUME_SUFFIX ".upload"
+
+/* Suffix of the sidecar file holding a file's SHA-256 digest */
+#define FS_HASH_SUFFIX ".sha256"
+#define FS_HASH_LEN crypto_hash_sha256_BYTES
+
+/* Trailing bytes of a file kept in its sidecar to tell a stale digest apart */
+#define FS_HASH_TAIL_LEN 32
+
+/* Size of each read/write when streaming file data; "Storage Tuning" menu */
+#define FS_IO_CHUNK_SIZE CONFIG_PROJECT_FS_IO_CHUNK_SIZE
+
 #define IS_FILE_EXT(filename, ext) \
     (strcasecmp(&filename[strlen(filename) - sizeof(ext) + 1], ext) == 0)
 
@@ -20,6 +63,15 @@
 esp_err_t init_fs(void);
 
 
+/**
+ * @brief Give a freshly opened stream the configured stdio buffer.
+ *
+ * Must be called before any other operation on `fd`. A no-op when
+ * CONFIG_PROJECT_FS_STDIO_BUF_SIZE is 0.
+ */
+void fs_setvbuf(FILE *fd);
+
+
 /**
  * @brief Recursively create parent directories for a given path
  * @param[in] path Path to a file/directory to create paths up to
@@ -29,6 +81,77 @@ esp_err_t init_fs(void);
  */
 esp_err_t mkdir_p(const char *path, bool isfile);
 
+/* Number of directories mkdir_p remembers as existing */
+#define FS_DIR_CACHE_SIZE 32
+
+/**
+ * @brief Forget every directory mkdir_p has seen.
+ *
+ * Must be called after removing or renaming a directory by any means other
+ * than rm_rf, which already does so.
+ */
+void fs_dir_cache_clear(void);
+
+
+/**
+ * @brief Largest size a file may grow to, per constraint.
+ */
+typedef struct fs_space {
+    size_t free;        // Limited by the filesystem's free space
+    size_t quota;       // Limited by the quota covering the file; SIZE_MAX if none
+} fs_space_t;
+
+/**
+ * @brief Work out how large the file at `path` may become.
+ *
+ * The file's current version doesn't count against its quota, since it's
+ * about to be replaced. Quotas are configured with CONFIG_PROJECT_FS_QUOTAS;
+ * checking one walks the quota's directory.
+ *
+ * @param[in] written Bytes of the file already in its temporary file.
+ */
+void fs_space_get(const char *path, size_t written, fs_space_t *space);
+
+/**
+ * @brief Check that `path` may become `size` bytes large.
+ * @returns ESP_OK if it fits, otherwise FS_ERR_QUOTA or FS_ERR_NO_SPACE.
+ */
+esp_err_t fs_check_space(const char *path, size_t size, size_t written);
+
+/**
+ * @brief Check `size` against an `fs_space_get` result.
+ */
+static inline esp_err_t fs_space_check(const fs_space_t *space, size_t size)
+{
+    if( size > space->quota ) return FS_ERR_QUOTA;
+    if( size > space->free ) return FS_ERR_NO_SPACE;
+    return ESP_OK;
+}
+
+/**
+ * @brief Space accounting across the files of one operation, e.g. an
+ * archive extraction or a tree copy.
+ *
+ * Free space is measured once, and a quota's directory is only walked when a
+ * file falls under a different quota than the previous one; the batch's own
+ * writes are tallied as they're checked.
+ */
+typedef struct fs_space_batch {
+    uint64_t free;              // Free bytes left to the batch
+    char dir[MAX_FILE_PATH];    // Directory of the quota last measured
+    size_t quota;               // Its quota; 0 if none covers it
+    uint64_t used;              // Its contents, including the batch's writes
+} fs_space_batch_t;
+
+void fs_space_batch_init(fs_space_batch_t *b);
+
+/**
+ * @brief Check that a file of `size` bytes may be written to `path`, and
+ * account for it. An existing file at `path` is taken to be replaced.
+ * @returns ESP_OK if it fits, otherwise FS_ERR_QUOTA or FS_ERR_NO_SPACE.
+ */
+esp_err_t fs_space_batch_check(fs_space_batch_t *b, const char *path, size_t size);
+
 
 /**
  * @brief modifies path in place to remove repeated '/'
@@ -36,11 +159,210 @@ esp_err_t mkdir_p(const char *path, bool isfile);
 char *trim_separators(char *path);
 
 
+/* Directory handles fs_walk keeps open at once. Deeper trees are still
+ * walked; a closed handle is reopened from the path once it's needed again */
+#define FS_WALK_MAX_DEPTH 16
+
+typedef enum {
+    FS_WALK_FILE,       // A non-directory entry
+    FS_WALK_DIR,        // A directory, before its contents are visited
+    FS_WALK_DIR_POST,   // A directory, after its contents were visited
+} fs_walk_event_t;
+
+/**
+ * @brief Called for every entry fs_walk visits.
+ * @param[in] path Full path of the entry. Only valid during the call.
+ * @param[in] st Entry's stat; NULL for FS_WALK_DIR_POST.
+ * @returns ESP_OK to continue walking; anything else stops the walk.
+ */
+typedef esp_err_t (*fs_walk_cb_t)(void *ctx, fs_walk_event_t event, const char *path, const struct stat *st);
+
+/**
+ * @brief Iteratively visit everything below the directory `path`.
+ *
+ * Depth-first, without recursion: one open directory handle per level, up
+ * to FS_WALK_MAX_DEPTH, and entry paths are built in place in `path`. Past
+ * that depth, the shallowest handle is closed and reopened after its
+ * subdirectory is done; a callback must then either keep or remove every
+ * entry it visits in a directory, as rm_rf does, for the walk to resume in
+ * the right place.
+ *
+ * @param[in,out] path Buffer of `size` bytes holding the directory to walk.
+ *            Used as scratch for entry paths; holds the directory again,
+ *            minus any trailing '/', once fs_walk returns.
+ * @returns ESP_OK on success, ESP_ERR_INVALID_SIZE if a path exceeds
+ *          `size`, or the callback's error.
+ */
+esp_err_t fs_walk(char *path, size_t size, fs_walk_cb_t cb, void *ctx);
+
+
+typedef struct fs_rm_stats {
+    uint32_t files;
+    uint32_t dirs;
+    size_t bytes;
+} fs_rm_stats_t;
+
 /**
  * @brief Delete a file/folder and all its contents
+ * @param[out] stats What was removed. May be NULL.
+ * @returns ESP_OK on success. On failure, some contents may have been deleted.
+ */
+esp_err_t rm_rf(const char *path, fs_rm_stats_t *stats);
+
+/**
+ * @brief Called after each entry rm_rf_progress removes.
+ * @returns ESP_OK to continue; anything else stops the removal.
+ */
+typedef esp_err_t (*fs_rm_progress_cb_t)(void *ctx, const fs_rm_stats_t *stats);
+
+/**
+ * @brief rm_rf, reporting progress along the way.
+ */
+esp_err_t rm_rf_progress(const char *path, fs_rm_stats_t *stats, fs_rm_progress_cb_t cb, void *ctx);
+
+
+/**
+ * @brief Rename `src` to `dst`, replacing `dst` if it already exists.
+ *
+ * LittleFS replaces the destination atomically. FAT refuses to rename over
+ * an existing file, so the destination is unlinked first.
+ */
+esp_err_t fs_rename_replace(const char *src, const char *dst);
+
+
+/**
+ * @brief true if `name` starts with FS_INTERNAL_PREFIX, i.e. is a temporary
+ * or sidecar file managed by this module that shouldn't be exposed in
+ * directory listings, or be written by clients.
+ */
+bool fs_is_internal_name(const char *name);
+
+
+/**
+ * @brief Read the stored SHA-256 digest of a file.
+ *
+ * The digest is recorded by `fs_writer_commit`. The sidecar also holds the
+ * file's size and last FS_HASH_TAIL_LEN bytes, since LittleFS keeps no
+ * modification times; a sidecar that doesn't match them is considered stale.
+ *
+ * @returns ESP_OK on success, ESP_ERR_NOT_FOUND if no valid digest is stored.
+ */
+esp_err_t fs_hash_get(const char *path, uint8_t digest[FS_HASH_LEN]);
+
+/**
+ * @brief Store the SHA-256 digest of a file of `size` bytes.
+ */
+esp_err_t fs_hash_set(const char *path, const uint8_t digest[FS_HASH_LEN], size_t size);
+
+/**
+ * @brief Remove the stored digest of a file, if any.
+ */
+void fs_hash_remove(const char *path);
+
+
+/**
+ * @brief Writes a file to a temporary path; the destination is only replaced
+ * once the writer is committed.
+ *
+ * Readers never observe a partially written destination, and an aborted
+ * write leaves the previous version untouched. The SHA-256 of the contents is
+ * computed as data streams through and stored alongside the file on commit.
+ */
+typedef struct fs_writer {
+    FILE *fd;
+    size_t size;                            // Bytes written so far
+    bool resumed;                           // Digest must be recomputed on commit
+    crypto_hash_sha256_state sha;
+    uint8_t digest[FS_HASH_LEN];            // Valid after a successful commit
+    char path[MAX_FILE_PATH];               // Final destination
+    char tmp_path[MAX_FILE_PATH];           // See FS_INTERNAL_PREFIX
+} fs_writer_t;
+
+/**
+ * @brief Open a writer for `path`. Parent directories must already exist.
+ * @returns ESP_ERR_INVALID_ARG if the file name is reserved; see
+ * FS_INTERNAL_PREFIX.
+ */
+esp_err_t fs_writer_open(fs_writer_t *w, const char *path);
+
+/**
+ * @brief Open a writer for a resumable upload to `path`, continuing the
+ * unfinished one if there is any.
+ *
+ * Resumable uploads are staged in their own FS_RESUME_SUFFIX file. Call
+ * `fs_writer_discard` first to start over. `w->size` is set to the number of
+ * bytes already written.
+ */
+esp_err_t fs_writer_resume(fs_writer_t *w, const char *path);
+
+/**
+ * @brief Append `len` bytes to the temporary file.
+ */
+esp_err_t fs_writer_write(fs_writer_t *w, const void *buf, size_t len);
+
+/**
+ * @brief Close the temporary file and rename it over the destination.
+ *
+ * The writer is closed regardless of outcome; on failure the temporary file
+ * is removed.
+ *
+ * @param[in] expected SHA-256 the contents must match, or NULL to skip
+ *            verification.
+ * @returns ESP_OK on success, ESP_ERR_INVALID_CRC if the contents don't
+ *          match `expected`.
+ */
+esp_err_t fs_writer_commit(fs_writer_t *w, const uint8_t *expected);
+
+/**
+ * @brief Close the temporary file of a writer opened by `fs_writer_resume`
+ * but keep it so the upload can be resumed later.
+ */
+esp_err_t fs_writer_suspend(fs_writer_t *w);
+
+/**
+ * @brief Close and remove the temporary file, leaving the destination as-is.
+ * Safe to call on a writer that is already closed.
+ */
+void fs_writer_abort(fs_writer_t *w);
+
+/**
+ * @brief Copy the file or directory tree `src` to `dst`.
  *
- * Based on https://stackoverflow.com/a/42596507
+ * Data is streamed through a FS_IO_CHUNK_SIZE buffer. Every file is written
+ * via a fs_writer, so it only appears at its destination once complete, and
+ * is verified against the source's stored digest when it has one. Temporary
+ * and sidecar files aren't copied. The parent of `dst` must exist. An
+ * existing file at `dst` is replaced. A directory is copied into a
+ * FS_TMP_SUFFIX sibling of `dst` and only renamed over an existing
+ * directory once complete, so the old tree is kept until then and nothing
+ * it held is left mixed in; room for both is needed meanwhile.
+ *
+ * @param[out] stats What was copied. May be NULL.
+ * @param[in] cb Called after each file and directory. May be NULL.
+ * @returns ESP_OK on success. On failure, `dst` is left as it was.
+ *          FS_ERR_QUOTA or FS_ERR_NO_SPACE if a file didn't fit, and
+ *          ESP_ERR_INVALID_STATE if a directory would replace a file.
+ */
+esp_err_t fs_copy(const char *src, const char *dst, fs_rm_stats_t *stats, fs_rm_progress_cb_t cb, void *ctx);
+
+/**
+ * @brief Rename the file or directory `src` to `dst`.
+ *
+ * A file replaces an existing destination file and keeps its stored digest.
+ * A directory can't replace an existing directory (ESP_ERR_INVALID_STATE).
+ * The parent of `dst` must exist.
+ */
+esp_err_t fs_move(const char *src, const char *dst);
+
+/**
+ * @brief Size of the unfinished resumable upload to `path`.
+ * @returns ESP_OK on success, ESP_ERR_NOT_FOUND if there is none.
+ */
+esp_err_t fs_writer_pending(const char *path, size_t *size);
+
+/**
+ * @brief Remove the unfinished resumable upload to `path`, if any.
  */
-int rm_rf(const char path[]);
+void fs_writer_discard(const char *path);
 
 #endif
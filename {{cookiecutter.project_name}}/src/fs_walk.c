@@ -0,0 +1,215 @@
+#include "dirent.h"
+#include "esp_log.h"
+#include "file_cache.h"
+#include "filesystem.h"
+#include "stdlib.h"
+#include "string.h"
+#include "unistd.h"
+
+static const char TAG[] = "fs_walk";
+
+/* One level of fs_walk's explicit directory stack */
+typedef struct fs_walk_frame {
+    DIR *dir;
+    size_t path_len;    // Length of this directory's path in the walk buffer
+} fs_walk_frame_t;
+
+/* Levels share FS_WALK_MAX_DEPTH frames; a level's frame is reused once
+ * its handle was closed to make room */
+#define FRAME(stack, depth) (&(stack)[(depth) % FS_WALK_MAX_DEPTH])
+
+/**
+ * @brief Reopen the directory holding `path`, the subdirectory just
+ * finished, and position it after that subdirectory.
+ *
+ * If the subdirectory is gone, e.g. removed by rm_rf's callback, so is
+ * everything listed before it, and the directory is read from the start.
+ */
+static esp_err_t fs_walk_reopen(char *path, fs_walk_frame_t *frame)
+{
+    char *sep = strrchr(path, '/');
+    const char *name = sep + 1;
+    struct dirent *entry;
+
+    frame->path_len = sep - path;
+    *sep = '\0';
+    if( NULL == (frame->dir = opendir(path)) ) goto fail;
+    while( NULL != (entry = readdir(frame->dir)) && 0 != strcmp(entry->d_name, name) ) { }
+    if( NULL == entry ) {
+        closedir(frame->dir);
+        if( NULL == (frame->dir = opendir(path)) ) goto fail;
+    }
+    *sep = '/';
+    return ESP_OK;
+
+fail:
+    ESP_LOGE(TAG, "Can`t reopen directory %s", path);
+    *sep = '/';
+    return ESP_FAIL;
+}
+
+esp_err_t fs_walk(char *path, size_t size, fs_walk_cb_t cb, void *ctx)
+{
+    esp_err_t err = ESP_OK;
+    fs_walk_frame_t stack[FS_WALK_MAX_DEPTH];
+    int depth = 0;
+    int shallowest = 0;     // Shallowest level whose handle is still open
+    size_t root_len;
+    struct dirent *entry;
+    struct stat st;
+
+    root_len = strlen(path);
+    if( root_len > 1 && '/' == path[root_len - 1] ) path[--root_len] = '\0';
+    stack[0].path_len = root_len;
+    if( NULL == (stack[0].dir = opendir(path)) ) {
+        ESP_LOGE(TAG, "Can`t open directory %s", path);
+        return ESP_FAIL;
+    }
+
+    while( depth >= 0 ) {
+        fs_walk_frame_t *top = FRAME(stack, depth);
+        path[top->path_len] = '\0';
+
+        if( NULL == (entry = readdir(top->dir)) ) {
+            /* Directory exhausted; `path` is back to naming it */
+            closedir(top->dir);
+            depth--;
+            if( depth < 0 ) break;
+            if( ESP_OK != (err = cb(ctx, FS_WALK_DIR_POST, path, NULL)) ) goto exit;
+            if( depth < shallowest ) {
+                /* Nothing is open while this fails, so there's nothing to close */
+                if( ESP_OK != (err = fs_walk_reopen(path, FRAME(stack, depth))) ) goto exit;
+                shallowest = depth;
+            }
+            continue;
+        }
+
+        if( !strcmp(entry->d_name, ".") || !strcmp(entry->d_name, "..") ) continue;
+
+        if( top->path_len + 1 + strlen(entry->d_name) >= size ) {
+            ESP_LOGE(TAG, "Path too long: %s/%s", path, entry->d_name);
+            err = ESP_ERR_INVALID_SIZE;
+            goto exit;
+        }
+        path[top->path_len] = '/';
+        strcpy(path + top->path_len + 1, entry->d_name);
+
+        if( -1 == stat(path, &st) ) {
+            ESP_LOGE(TAG, "Failed to stat %s", path);
+            err = ESP_FAIL;
+            goto exit;
+        }
+
+        if( !S_ISDIR(st.st_mode) ) {
+            if( ESP_OK != (err = cb(ctx, FS_WALK_FILE, path, &st)) ) goto exit;
+            continue;
+        }
+
+        if( ESP_OK != (err = cb(ctx, FS_WALK_DIR, path, &st)) ) goto exit;
+        if( depth + 1 - shallowest >= FS_WALK_MAX_DEPTH ) {
+            /* Out of handles; the shallowest is reopened on the way back */
+            closedir(FRAME(stack, shallowest)->dir);
+            shallowest++;
+        }
+        fs_walk_frame_t *next = FRAME(stack, depth + 1);
+        if( NULL == (next->dir = opendir(path)) ) {
+            ESP_LOGE(TAG, "Can`t open directory %s", path);
+            err = ESP_FAIL;
+            goto exit;
+        }
+        next->path_len = strlen(path);
+        depth++;
+    }
+
+exit:
+    for( ; depth >= shallowest; depth-- ) closedir(FRAME(stack, depth)->dir);
+    path[root_len] = '\0';
+    return err;
+}
+
+
+typedef struct rm_rf_ctx {
+    fs_rm_stats_t *stats;
+    fs_rm_progress_cb_t cb;
+    void *cb_ctx;
+} rm_rf_ctx_t;
+
+static esp_err_t rm_rf_cb(void *ctx, fs_walk_event_t event, const char *path, const struct stat *st)
+{
+    rm_rf_ctx_t *rm = ctx;
+
+    switch( event ) {
+        case FS_WALK_FILE:
+            if( 0 != unlink(path) ) break;
+            rm->stats->files++;
+            rm->stats->bytes += st->st_size;
+            return rm->cb ? rm->cb(rm->cb_ctx, rm->stats) : ESP_OK;
+        case FS_WALK_DIR_POST:
+            if( 0 != rmdir(path) ) break;
+            fs_dir_cache_clear();
+            rm->stats->dirs++;
+            return rm->cb ? rm->cb(rm->cb_ctx, rm->stats) : ESP_OK;
+        default:
+            return ESP_OK;
+    }
+    ESP_LOGE(TAG, "Can`t remove %s", path);
+    return ESP_FAIL;
+}
+
+esp_err_t rm_rf(const char *path, fs_rm_stats_t *stats)
+{
+    return rm_rf_progress(path, stats, NULL, NULL);
+}
+
+esp_err_t rm_rf_progress(const char *path, fs_rm_stats_t *stats, fs_rm_progress_cb_t cb, void *ctx)
+{
+    esp_err_t err = ESP_FAIL;
+    fs_rm_stats_t local_stats;
+    rm_rf_ctx_t rm = { .cb = cb, .cb_ctx = ctx };
+    char *buf = NULL;
+    struct stat stat_path;
+
+    if( NULL == stats ) stats = &local_stats;
+    memset(stats, 0, sizeof(fs_rm_stats_t));
+    rm.stats = stats;
+
+    if( -1 == stat(path, &stat_path) ) goto exit;
+
+    // If its a file, just delete it
+    if( !S_ISDIR(stat_path.st_mode) ) {
+        if( 0 != unlink(path) ) goto exit;
+        stats->files = 1;
+        stats->bytes = stat_path.st_size;
+        err = ESP_OK;
+        goto exit;
+    }
+
+    /* Single path buffer reused for every entry in the tree */
+    if( NULL == (buf = malloc(MAX_FILE_PATH)) ) {
+        err = ESP_ERR_NO_MEM;
+        goto exit;
+    }
+    if( strlcpy(buf, path, MAX_FILE_PATH) >= MAX_FILE_PATH ) {
+        err = ESP_ERR_INVALID_SIZE;
+        goto exit;
+    }
+
+    if( ESP_OK != (err = fs_walk(buf, MAX_FILE_PATH, rm_rf_cb, &rm)) ) goto exit;
+
+    // remove the devastated directory
+    fs_dir_cache_clear();
+    if( 0 != rmdir(buf) ) {
+        ESP_LOGE(TAG, "Can`t remove directory: %s", buf);
+        err = ESP_FAIL;
+        goto exit;
+    }
+    stats->dirs++;
+
+exit:
+    /* Directories may have been removed even on failure. Also catches
+     * mkdir_p calls that raced with the removal. */
+    if( buf ) fs_dir_cache_clear();
+    free(buf);
+    file_cache_invalidate(path);
+    return err;
+}
@@ -1,6 +1,8 @@
 #include "nvs.h"
 #include "nvs_flash.h"
 #include "helpers.h"
+#include "nvs_cache.h"
+#include "string.h"
 
 
 char *nvs_get_str_default(const char *namespace, const char *key, const char *def)
@@ -16,7 +18,10 @@ char *nvs_get_str_default(const char *namespace, const char *key, const char *de
     err = nvs_get_str(h, key, NULL, &len);
     if(ESP_ERR_NVS_NOT_FOUND == err) {
         /* Store the default value to nvs */
+        nvs_value_t v = { .type = NVS_TYPE_STR, .data = (char *)def, .len = strlen(def) + 1 };
         ESP_ERROR_CHECK(nvs_set_str(h, key, def));
+        ESP_ERROR_CHECK(nvs_commit(h));
+        nvs_cache_update(namespace, key, &v);
         err = nvs_get_str(h, key, NULL, &len);
     }
     if(ESP_OK != err) goto exit;
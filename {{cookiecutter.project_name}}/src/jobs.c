@@ -0,0 +1,231 @@
+#include "jobs.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+#include "stdatomic.h"
+#include "stdlib.h"
+#include "string.h"
+
+static const char TAG[] = "jobs";
+
+#define NUM_SLOTS CONFIG_PROJECT_JOBS_HISTORY
+
+struct job_slot {
+    job_info_t info;        // Guarded by `lock`
+    job_fn_t fn;
+    void *arg;
+    int64_t start_us;
+    atomic_bool cancel;
+};
+
+static job_slot_t slots[NUM_SLOTS];
+static SemaphoreHandle_t lock = NULL;
+static QueueHandle_t queue = NULL;      // job_slot_t * waiting to run
+static uint32_t next_id = 1;
+
+static bool is_finished(job_state_t state)
+{
+    return state >= JOB_DONE;
+}
+
+/**
+ * @brief Find a job's slot. Must hold `lock`.
+ */
+static job_slot_t *find(uint32_t id)
+{
+    if(0 == id) return NULL;
+    for(int i = 0; i < NUM_SLOTS; i++) {
+        if(slots[i].info.id == id) return &slots[i];
+    }
+    return NULL;
+}
+
+/**
+ * @brief Copy out a slot's status. Must hold `lock`.
+ */
+static void snapshot(const job_slot_t *job, job_info_t *info)
+{
+    *info = job->info;
+    if(JOB_RUNNING == job->info.state) {
+        info->elapsed_ms = (esp_timer_get_time() - job->start_us) / 1000;
+    }
+}
+
+static void jobs_task_fn(void *arg)
+{
+    job_slot_t *job;
+    esp_err_t err;
+
+    for(;;) {
+        if(pdTRUE != xQueueReceive(queue, &job, portMAX_DELAY)) continue;
+
+        xSemaphoreTake(lock, portMAX_DELAY);
+        bool cancelled = atomic_load(&job->cancel);
+        job->info.state = cancelled ? JOB_CANCELLED : JOB_RUNNING;
+        job->start_us = esp_timer_get_time();
+        xSemaphoreGive(lock);
+
+        if(cancelled) {
+            err = JOBS_ERR_CANCELLED;
+        }
+        else {
+            ESP_LOGI(TAG, "Job %u started: %s %s", job->info.id, job->info.kind, job->info.target);
+            err = job->fn(job, job->arg);
+        }
+        free(job->arg);
+        job->arg = NULL;
+
+        job_info_t info;
+        xSemaphoreTake(lock, portMAX_DELAY);
+        job->info.err = err;
+        job->info.elapsed_ms = (esp_timer_get_time() - job->start_us) / 1000;
+        if(atomic_load(&job->cancel)) job->info.state = JOB_CANCELLED;
+        else job->info.state = (ESP_OK == err) ? JOB_DONE : JOB_FAILED;
+        /* Once finished, the slot may be reused as soon as the lock drops */
+        info = job->info;
+        xSemaphoreGive(lock);
+
+        ESP_LOGI(TAG, "Job %u %s after %u ms (%u items, %u bytes)",
+                info.id, jobs_state_str(info.state), info.elapsed_ms,
+                info.items, (unsigned)info.bytes);
+    }
+}
+
+
+esp_err_t jobs_init(void)
+{
+    if(queue) return ESP_OK;
+
+    lock = xSemaphoreCreateMutex();
+    queue = xQueueCreate(NUM_SLOTS, sizeof(job_slot_t *));
+    if(NULL == lock || NULL == queue) return ESP_ERR_NO_MEM;
+
+    if(pdPASS != xTaskCreate(jobs_task_fn, "jobs", 4096, NULL,
+                CONFIG_PROJECT_JOBS_TASK_PRIORITY, NULL)) {
+        ESP_LOGE(TAG, "Failed to start jobs task");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+
+esp_err_t jobs_submit(const char *kind, const char *target, job_fn_t fn, void *arg, uint32_t *id)
+{
+    job_slot_t *job = NULL;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+
+    /* Prefer an unused slot, otherwise evict the oldest finished job */
+    for(int i = 0; i < NUM_SLOTS; i++) {
+        if(0 == slots[i].info.id) {
+            job = &slots[i];
+            break;
+        }
+        if(is_finished(slots[i].info.state) && (NULL == job || slots[i].info.id < job->info.id)) {
+            job = &slots[i];
+        }
+    }
+    if(NULL == job) {
+        xSemaphoreGive(lock);
+        ESP_LOGE(TAG, "No free job slots");
+        free(arg);
+        return ESP_ERR_NO_MEM;
+    }
+
+    memset(&job->info, 0, sizeof(job_info_t));
+    job->info.id = next_id++;
+    job->info.state = JOB_QUEUED;
+    strlcpy(job->info.kind, kind, sizeof(job->info.kind));
+    strlcpy(job->info.target, target, sizeof(job->info.target));
+    job->fn = fn;
+    job->arg = arg;
+    atomic_store(&job->cancel, false);
+    *id = job->info.id;
+
+    xSemaphoreGive(lock);
+
+    /* The queue holds as many entries as there are slots; never blocks */
+    xQueueSend(queue, &job, portMAX_DELAY);
+    return ESP_OK;
+}
+
+
+esp_err_t jobs_get(uint32_t id, job_info_t *info)
+{
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    xSemaphoreTake(lock, portMAX_DELAY);
+    job_slot_t *job = find(id);
+    if(job) {
+        snapshot(job, info);
+        err = ESP_OK;
+    }
+    xSemaphoreGive(lock);
+    return err;
+}
+
+
+esp_err_t jobs_cancel(uint32_t id)
+{
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    xSemaphoreTake(lock, portMAX_DELAY);
+    job_slot_t *job = find(id);
+    if(job) {
+        if(is_finished(job->info.state)) {
+            err = ESP_ERR_INVALID_STATE;
+        }
+        else {
+            atomic_store(&job->cancel, true);
+            err = ESP_OK;
+        }
+    }
+    xSemaphoreGive(lock);
+    return err;
+}
+
+
+size_t jobs_list(job_info_t *infos, size_t max)
+{
+    size_t n = 0;
+    xSemaphoreTake(lock, portMAX_DELAY);
+    for(int i = 0; i < NUM_SLOTS && n < max; i++) {
+        if(0 == slots[i].info.id) continue;
+        /* Insertion sort by id; the table is tiny */
+        size_t j = n++;
+        for(; j > 0 && infos[j - 1].id > slots[i].info.id; j--) infos[j] = infos[j - 1];
+        snapshot(&slots[i], &infos[j]);
+    }
+    xSemaphoreGive(lock);
+    return n;
+}
+
+
+void jobs_set_progress(job_slot_t *job, uint32_t items, size_t bytes)
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+    job->info.items = items;
+    job->info.bytes = bytes;
+    xSemaphoreGive(lock);
+}
+
+
+bool jobs_is_cancelled(const job_slot_t *job)
+{
+    return atomic_load(&job->cancel);
+}
+
+
+const char *jobs_state_str(job_state_t state)
+{
+    switch(state) {
+        case JOB_QUEUED:    return "queued";
+        case JOB_RUNNING:   return "running";
+        case JOB_DONE:      return "done";
+        case JOB_FAILED:    return "failed";
+        case JOB_CANCELLED: return "cancelled";
+        default:            return "unknown";
+    }
+}
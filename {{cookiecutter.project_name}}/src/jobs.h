@@ -0,0 +1,103 @@
+/***
+ * Runs long operations on a low priority background task so that the HTTP
+ * server task is free to answer requests, including status queries about
+ * the job itself.
+ *
+ * Jobs are kept in a fixed table of CONFIG_PROJECT_JOBS_HISTORY slots. When
+ * it's full, the oldest finished job is forgotten to make room.
+ */
+
+#ifndef PROJECT_JOBS_H__
+#define PROJECT_JOBS_H__
+
+#include "esp_err.h"
+#include "stdbool.h"
+#include "stddef.h"
+#include "stdint.h"
+
+#define JOBS_KIND_LEN 16
+#define JOBS_TARGET_LEN 128
+
+/* Returned by a job that noticed it was cancelled */
+#define JOBS_ERR_CANCELLED ESP_ERR_TIMEOUT
+
+typedef enum {
+    JOB_QUEUED,
+    JOB_RUNNING,
+    JOB_DONE,
+    JOB_FAILED,
+    JOB_CANCELLED,
+} job_state_t;
+
+/* Snapshot of a job's status */
+typedef struct job_info {
+    uint32_t id;
+    job_state_t state;
+    char kind[JOBS_KIND_LEN];       // e.g. "delete"
+    char target[JOBS_TARGET_LEN];   // What the job operates on, e.g. a path
+    uint32_t items;                 // Progress: entries processed so far
+    size_t bytes;                   // Progress: bytes processed so far
+    esp_err_t err;                  // Result once finished
+    uint32_t elapsed_ms;            // Time spent running so far
+} job_info_t;
+
+typedef struct job_slot job_slot_t;
+
+/**
+ * @brief Body of a job; runs on the jobs task.
+ *
+ * Should call jobs_set_progress() and poll jobs_is_cancelled() regularly.
+ */
+typedef esp_err_t (*job_fn_t)(job_slot_t *job, void *arg);
+
+/**
+ * @brief Create the job table and start the jobs task.
+ */
+esp_err_t jobs_init(void);
+
+/**
+ * @brief Queue a job.
+ * @param[in] arg Passed to `fn`; freed with free() once the job finishes.
+ * @param[out] id Id to query the job with.
+ * @returns ESP_OK on success, ESP_ERR_NO_MEM if every slot holds an
+ *          unfinished job. `arg` is freed on failure too.
+ */
+esp_err_t jobs_submit(const char *kind, const char *target, job_fn_t fn, void *arg, uint32_t *id);
+
+/**
+ * @brief Get a snapshot of a job's status.
+ * @returns ESP_OK on success, ESP_ERR_NOT_FOUND if the id is unknown or
+ *          was evicted from the history.
+ */
+esp_err_t jobs_get(uint32_t id, job_info_t *info);
+
+/**
+ * @brief Request that a job stop.
+ *
+ * Queued jobs never start; running jobs stop at their next
+ * jobs_is_cancelled() check.
+ *
+ * @returns ESP_OK on success, ESP_ERR_NOT_FOUND if the id is unknown,
+ *          ESP_ERR_INVALID_STATE if the job already finished.
+ */
+esp_err_t jobs_cancel(uint32_t id);
+
+/**
+ * @brief Snapshot every job in the table, oldest first.
+ * @returns Number of entries written to `infos`.
+ */
+size_t jobs_list(job_info_t *infos, size_t max);
+
+/**
+ * @brief Update a running job's progress counters.
+ */
+void jobs_set_progress(job_slot_t *job, uint32_t items, size_t bytes);
+
+bool jobs_is_cancelled(const job_slot_t *job);
+
+/**
+ * @brief Human readable name of a job state, e.g. "running".
+ */
+const char *jobs_state_str(job_state_t state);
+
+#endif
@@ -27,8 +27,11 @@
 #include "string.h"
 
 
+#include "file_cache.h"
 #include "filesystem.h"
 #include "helpers.h"
+#include "nvs_cache.h"
+#include "nvs_wb.h"
 #include "led.h"
 #include "server.h"
 
@@ -197,9 +200,12 @@ void app_main(void)
         err = nvs_flash_init();
     }
     ESP_ERROR_CHECK(err);
+    ESP_ERROR_CHECK(nvs_cache_init());
+    ESP_ERROR_CHECK(nvs_wb_init());
 
     /* Initialize Filesystem */
     ESP_ERROR_CHECK(init_fs());
+    ESP_ERROR_CHECK(file_cache_init());
 
     /* Initialize Wifi */
     wifi_init_sta();
@@ -212,12 +218,13 @@ void app_main(void)
 
     /* Setup DNS */
     {
-        char *hostname = get_hostname();
+        char hostname[HOSTNAME_MAX];
+        /* Falls back to the default rather than failing */
+        get_hostname(hostname, sizeof(hostname));
         initialize_mdns(hostname);
         netbiosns_init();
         netbiosns_set_name(hostname);
         ESP_LOGI(TAG, "Access device at http://%s.local", hostname);
-        free(hostname);
     }
 
     /* Start Server */
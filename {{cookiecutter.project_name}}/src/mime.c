@@ -0,0 +1,88 @@
+#include "mime.h"
+#include "ctype.h"
+#include "stdbool.h"
+#include "stdint.h"
+#include "string.h"
+
+typedef struct mime_entry {
+    const char *ext;
+    const char *type;
+} mime_entry_t;
+
+static const mime_entry_t mime_table[] = {
+    { "html",  "text/html" },
+    { "htm",   "text/html" },
+    { "css",   "text/css" },
+    { "js",    "application/javascript" },
+    { "mjs",   "application/javascript" },
+    { "json",  "application/json" },
+    { "map",   "application/json" },
+    { "txt",   "text/plain" },
+    { "csv",   "text/csv" },
+    { "xml",   "application/xml" },
+    { "svg",   "image/svg+xml" },
+    { "png",   "image/png" },
+    { "jpg",   "image/jpeg" },
+    { "jpeg",  "image/jpeg" },
+    { "gif",   "image/gif" },
+    { "webp",  "image/webp" },
+    { "ico",   "image/x-icon" },
+    { "wasm",  "application/wasm" },
+    { "woff",  "font/woff" },
+    { "woff2", "font/woff2" },
+    { "ttf",   "font/ttf" },
+    { "pdf",   "application/pdf" },
+    { "bin",   "application/octet-stream" },
+    { "gz",    "application/gzip" },
+    { "tar",   "application/x-tar" },
+};
+
+#define NUM_ENTRIES (sizeof(mime_table) / sizeof(mime_table[0]))
+#define MAX_EXT_LEN 8
+
+/* Open addressing; must be a power of 2 comfortably above NUM_ENTRIES.
+ * Slots hold an index into mime_table plus one; 0 is empty. */
+#define NUM_SLOTS 64
+static uint8_t slots[NUM_SLOTS];
+static bool slots_ready = false;
+
+/* FNV-1a over the lowercased extension */
+static uint32_t ext_hash(const char *ext, size_t len)
+{
+    uint32_t h = 2166136261u;
+    for(size_t i = 0; i < len; i++) {
+        h = (h ^ (uint8_t)tolower((unsigned char)ext[i])) * 16777619u;
+    }
+    return h;
+}
+
+static void build_slots(void)
+{
+    for(uint8_t i = 0; i < NUM_ENTRIES; i++) {
+        uint32_t s = ext_hash(mime_table[i].ext, strlen(mime_table[i].ext)) & (NUM_SLOTS - 1);
+        while(slots[s]) s = (s + 1) & (NUM_SLOTS - 1);
+        slots[s] = i + 1;
+    }
+    slots_ready = true;
+}
+
+const char *mime_type_from_path(const char *path)
+{
+    const char *dot = strrchr(path, '.');
+    if(NULL == dot || strchr(dot, '/')) return NULL;
+
+    const char *ext = dot + 1;
+    size_t len = strlen(ext);
+    if(0 == len || len > MAX_EXT_LEN) return NULL;
+
+    /* Lookups only happen on the HTTP server task, so no locking */
+    if(!slots_ready) build_slots();
+
+    uint32_t s = ext_hash(ext, len) & (NUM_SLOTS - 1);
+    while(slots[s]) {
+        const mime_entry_t *e = &mime_table[slots[s] - 1];
+        if(0 == strcasecmp(e->ext, ext)) return e->type;
+        s = (s + 1) & (NUM_SLOTS - 1);
+    }
+    return NULL;
+}
@@ -0,0 +1,17 @@
+/***
+ * Maps file extensions to MIME types.
+ */
+
+#ifndef PROJECT_MIME_H__
+#define PROJECT_MIME_H__
+
+/**
+ * @brief Look up the MIME type of a file from its extension.
+ *
+ * Case insensitive; a trailing ".gz" is *not* stripped.
+ *
+ * @returns MIME type, or NULL if the extension is unknown.
+ */
+const char *mime_type_from_path(const char *path);
+
+#endif
@@ -0,0 +1,283 @@
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "nvs_cache.h"
+#include "nvs_wb.h"
+#include "sdkconfig.h"
+#include "stdatomic.h"
+#include "string.h"
+#include <sys/param.h>
+
+static const char TAG[] = "nvs_cache";
+
+#define NUM_ENTRIES CONFIG_PROJECT_NVS_CACHE_ENTRIES
+#define STR_SIZE CONFIG_PROJECT_NVS_CACHE_STR_SIZE
+#define MAX_NAMESPACES 8
+
+/* The low nibble of an integer nvs_type_t is its size in bytes */
+#define NUM_SIZE(type) ((type) & 0x0f)
+
+typedef struct entry {
+    char namespace[NVS_NS_NAME_MAX_SIZE];   // Fixed once published
+    char key[NVS_KEY_NAME_MAX_SIZE];        // Fixed once published
+    atomic_uint seq;                        // Odd while the value is being rewritten
+    nvs_type_t type;                        // NVS_TYPE_ANY while the value isn't cached
+    size_t len;                             // Of `str`, including the terminator
+    uint64_t num;                           // Integer types, as stored by nvs_value_t
+    char str[STR_SIZE];
+} entry_t;
+
+static entry_t entries[NUM_ENTRIES];
+static atomic_uint num_entries;             // Entries below this are published
+static portMUX_TYPE write_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/* Set up once by nvs_cache_init() */
+static char namespaces[MAX_NAMESPACES][NVS_NS_NAME_MAX_SIZE];
+static size_t num_namespaces;
+
+static bool cacheable(const nvs_value_t *v)
+{
+    return (NVS_TYPE_STR == v->type && v->len <= STR_SIZE) || nvs_type_is_number(v->type);
+}
+
+static entry_t *find(const char *namespace, const char *key)
+{
+    unsigned int n = atomic_load_explicit(&num_entries, memory_order_acquire);
+    for(unsigned int i = 0; i < n; i++) {
+        if(0 == strcmp(entries[i].key, key) && 0 == strcmp(entries[i].namespace, namespace)) {
+            return &entries[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Rewrite an entry's value. Must hold `write_lock`.
+ */
+static void entry_store(entry_t *e, const nvs_value_t *v)
+{
+    unsigned int seq = atomic_load_explicit(&e->seq, memory_order_relaxed);
+
+    atomic_store_explicit(&e->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    if(!cacheable(v)) {
+        /* Readers fall back to NVS */
+        e->type = NVS_TYPE_ANY;
+    }
+    else if(NVS_TYPE_STR == v->type) {
+        memcpy(e->str, v->data, v->len);
+        e->len = v->len;
+        e->type = v->type;
+    }
+    else {
+        e->num = v->num.u;
+        e->type = v->type;
+    }
+
+    atomic_store_explicit(&e->seq, seq + 2, memory_order_release);
+}
+
+/**
+ * @brief Copy an entry's value without locking, retrying while a writer is
+ * in the middle of changing it. Only fills `str` for strings.
+ */
+static void entry_snapshot(entry_t *e, nvs_type_t *type, uint64_t *num, char *str, size_t *len)
+{
+    unsigned int seq;
+    do {
+        seq = atomic_load_explicit(&e->seq, memory_order_acquire);
+        *type = e->type;
+        *num = e->num;
+        *len = MIN(e->len, STR_SIZE);
+        if(NVS_TYPE_STR == *type && str) memcpy(str, e->str, *len);
+        atomic_thread_fence(memory_order_acquire);
+    } while((seq & 1) || seq != atomic_load_explicit(&e->seq, memory_order_relaxed));
+}
+
+bool nvs_cache_has_namespace(const char *namespace)
+{
+    for(size_t i = 0; i < num_namespaces; i++) {
+        if(0 == strcmp(namespaces[i], namespace)) return true;
+    }
+    return false;
+}
+
+void nvs_cache_update(const char *namespace, const char *key, const nvs_value_t *v)
+{
+    entry_t *e;
+
+    if(!nvs_cache_has_namespace(namespace)) return;
+
+    portENTER_CRITICAL(&write_lock);
+    if(NULL == (e = find(namespace, key)) && cacheable(v)) {
+        unsigned int n = atomic_load_explicit(&num_entries, memory_order_relaxed);
+        if(n < NUM_ENTRIES) {
+            e = &entries[n];
+            strlcpy(e->namespace, namespace, sizeof(e->namespace));
+            strlcpy(e->key, key, sizeof(e->key));
+            entry_store(e, v);
+            /* Publish only once the entry is complete */
+            atomic_store_explicit(&num_entries, n + 1, memory_order_release);
+            e = NULL;
+        }
+    }
+    if(e) entry_store(e, v);
+    portEXIT_CRITICAL(&write_lock);
+}
+
+/**
+ * @brief Load every string and integer of `namespace`.
+ */
+static esp_err_t load_namespace(const char *namespace)
+{
+    esp_err_t err;
+    nvs_handle_t h = 0;
+    nvs_iterator_t it;
+    size_t loaded = 0;
+
+    err = nvs_open(namespace, NVS_READONLY, &h);
+    if(ESP_ERR_NVS_NOT_FOUND == err) {
+        /* Nothing stored yet; keys are cached as they're written */
+        return ESP_OK;
+    }
+    if(ESP_OK != err) return err;
+
+    it = nvs_entry_find(NVS_DEFAULT_PART_NAME, namespace, NVS_TYPE_ANY);
+    while(it != NULL) {
+        nvs_entry_info_t info;
+        nvs_value_t v;
+
+        nvs_entry_info(it, &info);
+        it = nvs_entry_next(it);
+
+        if(NVS_TYPE_BLOB == info.type) continue;
+        if(ESP_OK != nvs_value_get(h, info.key, info.type, &v)) {
+            ESP_LOGW(TAG, "Couldn't read %s/%s", namespace, info.key);
+            continue;
+        }
+        nvs_cache_update(namespace, info.key, &v);
+        nvs_value_free(&v);
+        loaded++;
+    }
+    nvs_release_iterator(it);
+    nvs_close(h);
+
+    ESP_LOGI(TAG, "Loaded %d keys of %s", loaded, namespace);
+    return ESP_OK;
+}
+
+esp_err_t nvs_cache_init(void)
+{
+    const char *p = CONFIG_PROJECT_NVS_CACHE_NAMESPACES;
+
+    while(*p && num_namespaces < MAX_NAMESPACES) {
+        size_t len = strcspn(p, ",");
+        if(len > 0 && len < NVS_NS_NAME_MAX_SIZE) {
+            memcpy(namespaces[num_namespaces], p, len);
+            namespaces[num_namespaces][len] = '\0';
+            num_namespaces++;
+        }
+        else if(len > 0) {
+            ESP_LOGE(TAG, "Namespace \"%.*s\" too long", (int)len, p);
+        }
+        p += len;
+        if(',' == *p) p++;
+    }
+
+    for(size_t i = 0; i < num_namespaces; i++) {
+        esp_err_t err = load_namespace(namespaces[i]);
+        if(ESP_OK != err) {
+            ESP_LOGE(TAG, "Failed to load %s: %s", namespaces[i], esp_err_to_name(err));
+            return err;
+        }
+    }
+    if(atomic_load(&num_entries) == NUM_ENTRIES) {
+        ESP_LOGW(TAG, "Cache full; further keys are read from NVS");
+    }
+    return ESP_OK;
+}
+
+esp_err_t nvs_cache_get_str(const char *namespace, const char *key, char *buf, size_t *len)
+{
+    esp_err_t err;
+    nvs_handle_t h;
+    nvs_value_t v;
+    entry_t *e;
+
+    if(NULL != (e = find(namespace, key))) {
+        char str[STR_SIZE];
+        nvs_type_t type;
+        uint64_t num;
+        size_t n;
+
+        entry_snapshot(e, &type, &num, str, &n);
+        if(NVS_TYPE_STR == type) {
+            if(NULL == buf) {
+                *len = n;
+                return ESP_OK;
+            }
+            if(*len < n) return ESP_ERR_NVS_INVALID_LENGTH;
+            memcpy(buf, str, n);
+            *len = n;
+            return ESP_OK;
+        }
+        if(NVS_TYPE_ANY != type) return ESP_ERR_NVS_TYPE_MISMATCH;
+    }
+
+    /* Not cached */
+    if(ESP_OK == (err = nvs_wb_get(namespace, key, &v))) {
+        /* Held back by write-behind */
+        if(NVS_TYPE_STR != v.type) err = ESP_ERR_NVS_TYPE_MISMATCH;
+        else if(NULL == buf) *len = v.len;
+        else if(*len < v.len) err = ESP_ERR_NVS_INVALID_LENGTH;
+        else {
+            memcpy(buf, v.data, v.len);
+            *len = v.len;
+        }
+        nvs_value_free(&v);
+        return err;
+    }
+    if(ESP_OK != (err = nvs_open(namespace, NVS_READONLY, &h))) return err;
+    err = nvs_get_str(h, key, buf, len);
+    nvs_close(h);
+    return err;
+}
+
+esp_err_t nvs_cache_get_num(const char *namespace, const char *key, nvs_type_t type, void *out)
+{
+    esp_err_t err;
+    nvs_handle_t h;
+    nvs_value_t v;
+    entry_t *e;
+
+    if(!nvs_type_is_number(type)) return ESP_ERR_INVALID_ARG;
+
+    if(NULL != (e = find(namespace, key))) {
+        nvs_type_t cached_type;
+        uint64_t num;
+        size_t n;
+
+        entry_snapshot(e, &cached_type, &num, NULL, &n);
+        if(cached_type == type) {
+            /* Little-endian: the low bytes hold the value */
+            memcpy(out, &num, NUM_SIZE(type));
+            return ESP_OK;
+        }
+        if(NVS_TYPE_ANY != cached_type) return ESP_ERR_NVS_TYPE_MISMATCH;
+    }
+
+    /* Not cached */
+    if(ESP_OK == (err = nvs_wb_get(namespace, key, &v))) {
+        /* Held back by write-behind */
+        if(v.type != type) err = ESP_ERR_NVS_TYPE_MISMATCH;
+        else memcpy(out, &v.num, NUM_SIZE(type));
+        nvs_value_free(&v);
+        return err;
+    }
+    if(ESP_OK != (err = nvs_open(namespace, NVS_READONLY, &h))) return err;
+    if(ESP_OK == (err = nvs_value_get(h, key, type, &v))) {
+        memcpy(out, &v.num, NUM_SIZE(type));
+    }
+    nvs_close(h);
+    return err;
+}
@@ -0,0 +1,53 @@
+/***
+ * Write-through RAM cache of frequently read NVS namespaces.
+ *
+ * The namespaces in CONFIG_PROJECT_NVS_CACHE_NAMESPACES are loaded at boot.
+ * Reads copy straight out of RAM into the caller's buffer, without opening
+ * NVS or allocating, and without taking a lock: each entry is guarded by a
+ * sequence counter that readers retry on. Anything not cached (other
+ * namespaces, long strings, blobs, keys beyond CONFIG_PROJECT_NVS_CACHE_ENTRIES)
+ * is read from NVS instead, so the functions can be used for any key.
+ * Values still held back by write-behind (nvs_wb.h) are returned as well.
+ *
+ * Code that writes a cached namespace must call nvs_cache_update() after
+ * committing, or the cache will keep serving the old value.
+ */
+
+#ifndef PROJECT_NVS_CACHE_H__
+#define PROJECT_NVS_CACHE_H__
+
+#include "esp_err.h"
+#include "nvs.h"
+#include "nvs_value.h"
+#include "stdbool.h"
+#include "stddef.h"
+
+/**
+ * @brief Load the configured namespaces. Call after nvs_flash_init().
+ */
+esp_err_t nvs_cache_init(void);
+
+/**
+ * @brief Same semantics as nvs_get_str(): with `buf` NULL, only sets `len`
+ * to the required size including the NULL-terminator.
+ */
+esp_err_t nvs_cache_get_str(const char *namespace, const char *key, char *buf, size_t *len);
+
+/**
+ * @brief Read an integer key of the given `type` into `out`, which must be of
+ * the matching C type (e.g. uint16_t for NVS_TYPE_U16).
+ * @returns ESP_ERR_NVS_TYPE_MISMATCH if the key holds another type.
+ */
+esp_err_t nvs_cache_get_num(const char *namespace, const char *key, nvs_type_t type, void *out);
+
+/**
+ * @brief Record a value just written to NVS. No-op for uncached namespaces.
+ */
+void nvs_cache_update(const char *namespace, const char *key, const nvs_value_t *v);
+
+/**
+ * @brief true if `namespace` is one of the cached namespaces.
+ */
+bool nvs_cache_has_namespace(const char *namespace);
+
+#endif
@@ -0,0 +1,70 @@
+#include "esp_log.h"
+#include "nvs_index.h"
+#include "stdlib.h"
+#include "string.h"
+
+static const char TAG[] = "nvs_index";
+
+#define INITIAL_CAPACITY 16
+
+static int entry_cmp(const void *a, const void *b)
+{
+    return strcmp(((const nvs_index_entry_t *)a)->key, ((const nvs_index_entry_t *)b)->key);
+}
+
+esp_err_t nvs_index_build(nvs_index_t *idx, const char *part, const char *namespace)
+{
+    esp_err_t err = ESP_OK;
+    size_t capacity = 0;
+    nvs_iterator_t it;
+
+    idx->entries = NULL;
+    idx->count = 0;
+
+    it = nvs_entry_find(part, namespace, NVS_TYPE_ANY);
+    while(it != NULL) {
+        nvs_entry_info_t info;
+        nvs_entry_info(it, &info);
+
+        if(idx->count == capacity) {
+            size_t n = capacity ? capacity * 2 : INITIAL_CAPACITY;
+            nvs_index_entry_t *tmp = realloc(idx->entries, n * sizeof(nvs_index_entry_t));
+            if(NULL == tmp) {
+                ESP_LOGE(TAG, "OOM indexing %d entries of %s", idx->count, namespace);
+                err = ESP_ERR_NO_MEM;
+                goto exit;
+            }
+            idx->entries = tmp;
+            capacity = n;
+        }
+        strlcpy(idx->entries[idx->count].key, info.key, NVS_KEY_NAME_MAX_SIZE);
+        idx->entries[idx->count].type = info.type;
+        idx->count++;
+
+        it = nvs_entry_next(it);
+    }
+
+    qsort(idx->entries, idx->count, sizeof(nvs_index_entry_t), entry_cmp);
+
+exit:
+    nvs_release_iterator(it);
+    if(ESP_OK != err) nvs_index_free(idx);
+    return err;
+}
+
+const nvs_index_entry_t *nvs_index_find(const nvs_index_t *idx, const char *key)
+{
+    nvs_index_entry_t needle;
+
+    if(0 == idx->count) return NULL;
+    if(strlen(key) >= NVS_KEY_NAME_MAX_SIZE) return NULL;
+    strcpy(needle.key, key);
+    return bsearch(&needle, idx->entries, idx->count, sizeof(nvs_index_entry_t), entry_cmp);
+}
+
+void nvs_index_free(nvs_index_t *idx)
+{
+    free(idx->entries);
+    idx->entries = NULL;
+    idx->count = 0;
+}
@@ -0,0 +1,44 @@
+/***
+ * Sorted key -> type index of an NVS namespace.
+ *
+ * NVS can only be searched by walking an iterator over every entry in a
+ * namespace. Anything that looks up many keys builds this index with a single
+ * walk and then binary-searches it, instead of walking once per key.
+ */
+
+#ifndef PROJECT_NVS_INDEX_H__
+#define PROJECT_NVS_INDEX_H__
+
+#include "esp_err.h"
+#include "nvs.h"
+#include "stddef.h"
+
+typedef struct nvs_index_entry {
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    nvs_type_t type;
+} nvs_index_entry_t;
+
+typedef struct nvs_index {
+    nvs_index_entry_t *entries;     // Sorted by key
+    size_t count;
+} nvs_index_t;
+
+/**
+ * @brief Walk `namespace` of partition `part` once and index its keys.
+ *
+ * An empty or nonexistent namespace yields an empty index. Free with
+ * nvs_index_free().
+ *
+ * @returns ESP_OK on success, ESP_ERR_NO_MEM if the index couldn't be allocated.
+ */
+esp_err_t nvs_index_build(nvs_index_t *idx, const char *part, const char *namespace);
+
+/**
+ * @brief Look up `key` in the index.
+ * @returns The entry, or NULL if the namespace has no such key.
+ */
+const nvs_index_entry_t *nvs_index_find(const nvs_index_t *idx, const char *key);
+
+void nvs_index_free(nvs_index_t *idx);
+
+#endif
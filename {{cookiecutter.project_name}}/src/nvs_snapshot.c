@@ -0,0 +1,128 @@
+#include "nvs_snapshot.h"
+#include "string.h"
+
+/* The low nibble of an integer nvs_type_t is its size in bytes */
+#define NUM_SIZE(type) ((type) & 0x0f)
+
+bool nvs_snapshot_excluded(const char *namespace)
+{
+    return 0 == strcmp(namespace, "phy") || 0 == strncmp(namespace, "nvs.", 4);
+}
+
+static uint8_t *put_le(uint8_t *p, uint64_t val, size_t n)
+{
+    for(size_t i = 0; i < n; i++) *p++ = (uint8_t)(val >> (8 * i));
+    return p;
+}
+
+static uint64_t get_le(const uint8_t *p, size_t n)
+{
+    uint64_t val = 0;
+    for(size_t i = 0; i < n; i++) val |= (uint64_t)p[i] << (8 * i);
+    return val;
+}
+
+size_t nvs_snapshot_encode(uint8_t *buf, const char *namespace, const char *key, const nvs_value_t *v)
+{
+    uint8_t *p = buf;
+    size_t ns_len = strlen(namespace);
+    size_t key_len = strlen(key);
+
+    *p++ = v->type;
+    *p++ = ns_len;
+    *p++ = key_len;
+    memcpy(p, namespace, ns_len);
+    p += ns_len;
+    memcpy(p, key, key_len);
+    p += key_len;
+
+    if(nvs_type_is_number(v->type)) p = put_le(p, v->num.u, NUM_SIZE(v->type));
+    else p = put_le(p, v->len, 4);
+
+    return p - buf;
+}
+
+esp_err_t nvs_snapshot_reader_init(nvs_snapshot_reader_t *r, const uint8_t *buf, size_t len)
+{
+    if(len < NVS_SNAPSHOT_MAGIC_LEN || 0 != memcmp(buf, NVS_SNAPSHOT_MAGIC, NVS_SNAPSHOT_MAGIC_LEN)) {
+        return ESP_ERR_INVALID_VERSION;
+    }
+    r->pos = buf + NVS_SNAPSHOT_MAGIC_LEN;
+    r->end = buf + len;
+    return ESP_OK;
+}
+
+/**
+ * @brief Copy a length-prefixed name without NULs into `out`.
+ */
+static bool read_name(char *out, const uint8_t *p, size_t len)
+{
+    if(0 == len || len >= NVS_KEY_NAME_MAX_SIZE || NULL != memchr(p, '\0', len)) return false;
+    memcpy(out, p, len);
+    out[len] = '\0';
+    return true;
+}
+
+esp_err_t nvs_snapshot_next(nvs_snapshot_reader_t *r, nvs_snapshot_entry_t *e)
+{
+    const uint8_t *p = r->pos;
+    size_t avail = r->end - p;
+    size_t ns_len, key_len;
+    nvs_type_t type;
+
+    if(avail < 1) return ESP_ERR_INVALID_ARG;
+    if(0 == p[0]) {
+        r->pos = p + 1;
+        return ESP_ERR_NOT_FOUND;
+    }
+    if(avail < 3) return ESP_ERR_INVALID_ARG;
+
+    type = p[0];
+    ns_len = p[1];
+    key_len = p[2];
+    p += 3;
+    avail -= 3;
+
+    if(avail < ns_len + key_len) return ESP_ERR_INVALID_ARG;
+    if(!read_name(e->namespace, p, ns_len)) return ESP_ERR_INVALID_ARG;
+    p += ns_len;
+    if(!read_name(e->key, p, key_len)) return ESP_ERR_INVALID_ARG;
+    p += key_len;
+    avail -= ns_len + key_len;
+
+    memset(&e->val, 0, sizeof(nvs_value_t));
+    e->val.type = type;
+
+    if(nvs_type_is_number(type)) {
+        size_t n = NUM_SIZE(type);
+        if((type & 0xe0) || (n != 1 && n != 2 && n != 4 && n != 8)) return ESP_ERR_INVALID_ARG;
+        if(avail < n) return ESP_ERR_INVALID_ARG;
+        e->val.num.u = get_le(p, n);
+        if(nvs_type_is_signed(type) && n < 8 && (e->val.num.u >> (8 * n - 1))) {
+            /* Sign extend */
+            e->val.num.u |= ~(uint64_t)0 << (8 * n);
+        }
+        p += n;
+    }
+    else if(NVS_TYPE_STR == type || NVS_TYPE_BLOB == type) {
+        if(avail < 4) return ESP_ERR_INVALID_ARG;
+        e->val.len = get_le(p, 4);
+        p += 4;
+        avail -= 4;
+        if(avail < e->val.len) return ESP_ERR_INVALID_ARG;
+        if(NVS_TYPE_STR == type) {
+            /* Must be exactly one NULL-terminated string */
+            if(0 == e->val.len || NULL != memchr(p, '\0', e->val.len - 1) || '\0' != p[e->val.len - 1]) {
+                return ESP_ERR_INVALID_ARG;
+            }
+        }
+        e->val.data = (void *)p;
+        p += e->val.len;
+    }
+    else {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    r->pos = p;
+    return ESP_OK;
+}
@@ -0,0 +1,80 @@
+/***
+ * Compact binary snapshot of NVS contents, for exporting and restoring a
+ * device's configuration in one request. `tools/nvs_snapshot.py` converts
+ * snapshots to and from the CSV format of `nvs_partition_gen.py`.
+ *
+ * Layout, all integers little endian:
+ *     "NVS1"
+ *     records, each:
+ *         uint8_t type             nvs_type_t; 0 marks the end
+ *         uint8_t namespace_len    1-15, without terminator
+ *         uint8_t key_len          1-15, without terminator
+ *         char namespace[namespace_len]
+ *         char key[key_len]
+ *         value:
+ *             integers             (type & 0x0f) bytes
+ *             strings and blobs    uint32_t length, then the bytes; strings
+ *                                  include their NULL-terminator
+ *     uint8_t 0
+ *
+ * Snapshots without the end marker are truncated and rejected.
+ *
+ * Everything here is plain C so the format can be exercised on a host.
+ */
+
+#ifndef PROJECT_NVS_SNAPSHOT_H__
+#define PROJECT_NVS_SNAPSHOT_H__
+
+#include "esp_err.h"
+#include "nvs.h"
+#include "nvs_value.h"
+#include "stdbool.h"
+#include "stddef.h"
+#include "stdint.h"
+
+#define NVS_SNAPSHOT_MAGIC "NVS1"
+#define NVS_SNAPSHOT_MAGIC_LEN 4
+
+/* Largest encoded record, not counting string and blob data */
+#define NVS_SNAPSHOT_RECORD_MAX (3 + 2 * (NVS_KEY_NAME_MAX_SIZE - 1) + 8)
+
+typedef struct nvs_snapshot_entry {
+    char namespace[NVS_NS_NAME_MAX_SIZE];
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    nvs_value_t val;        // `data` points into the snapshot; don't free
+} nvs_snapshot_entry_t;
+
+typedef struct nvs_snapshot_reader {
+    const uint8_t *pos;
+    const uint8_t *end;
+} nvs_snapshot_reader_t;
+
+/**
+ * @brief true for namespaces holding per-device data that must not be
+ * copied between devices: RF calibration ("phy") and ESP-IDF's internal
+ * "nvs.*" namespaces.
+ */
+bool nvs_snapshot_excluded(const char *namespace);
+
+/**
+ * @brief Encode a record, except for the data of a string or blob, which
+ * follows it as is.
+ * @param[out] buf At least NVS_SNAPSHOT_RECORD_MAX bytes.
+ * @return Bytes written to `buf`.
+ */
+size_t nvs_snapshot_encode(uint8_t *buf, const char *namespace, const char *key, const nvs_value_t *v);
+
+/**
+ * @brief Start reading the snapshot in `buf`.
+ * @returns ESP_ERR_INVALID_VERSION if it doesn't start with NVS_SNAPSHOT_MAGIC.
+ */
+esp_err_t nvs_snapshot_reader_init(nvs_snapshot_reader_t *r, const uint8_t *buf, size_t len);
+
+/**
+ * @brief Decode the next record.
+ * @returns ESP_OK, ESP_ERR_NOT_FOUND at the end marker, or
+ * ESP_ERR_INVALID_ARG if the snapshot is malformed or truncated.
+ */
+esp_err_t nvs_snapshot_next(nvs_snapshot_reader_t *r, nvs_snapshot_entry_t *e);
+
+#endif
@@ -0,0 +1,99 @@
+#include "esp_log.h"
+#include "nvs_value.h"
+#include "stdlib.h"
+#include "string.h"
+
+static const char TAG[] = "nvs_value";
+
+esp_err_t nvs_value_get(nvs_handle_t h, const char *key, nvs_type_t type, nvs_value_t *v)
+{
+    esp_err_t err = ESP_FAIL;
+
+    memset(v, 0, sizeof(nvs_value_t));
+    v->type = type;
+
+    switch(type) {
+        case NVS_TYPE_U8: {
+            uint8_t val;
+            if(ESP_OK == (err = nvs_get_u8(h, key, &val))) v->num.u = val;
+            break;
+        }
+        case NVS_TYPE_I8: {
+            int8_t val;
+            if(ESP_OK == (err = nvs_get_i8(h, key, &val))) v->num.i = val;
+            break;
+        }
+        case NVS_TYPE_U16: {
+            uint16_t val;
+            if(ESP_OK == (err = nvs_get_u16(h, key, &val))) v->num.u = val;
+            break;
+        }
+        case NVS_TYPE_I16: {
+            int16_t val;
+            if(ESP_OK == (err = nvs_get_i16(h, key, &val))) v->num.i = val;
+            break;
+        }
+        case NVS_TYPE_U32: {
+            uint32_t val;
+            if(ESP_OK == (err = nvs_get_u32(h, key, &val))) v->num.u = val;
+            break;
+        }
+        case NVS_TYPE_I32: {
+            int32_t val;
+            if(ESP_OK == (err = nvs_get_i32(h, key, &val))) v->num.i = val;
+            break;
+        }
+        case NVS_TYPE_U64:
+            err = nvs_get_u64(h, key, &v->num.u);
+            break;
+        case NVS_TYPE_I64:
+            err = nvs_get_i64(h, key, &v->num.i);
+            break;
+        case NVS_TYPE_STR:
+        case NVS_TYPE_BLOB:
+            err = NVS_TYPE_STR == type
+                ? nvs_get_str(h, key, NULL, &v->len)
+                : nvs_get_blob(h, key, NULL, &v->len);
+            if(ESP_OK != err) break;
+            /* malloc(0) may return NULL for an empty blob */
+            if(NULL == (v->data = malloc(v->len ? v->len : 1))) {
+                ESP_LOGE(TAG, "OOM reading %s", key);
+                err = ESP_ERR_NO_MEM;
+                break;
+            }
+            err = NVS_TYPE_STR == type
+                ? nvs_get_str(h, key, v->data, &v->len)
+                : nvs_get_blob(h, key, v->data, &v->len);
+            break;
+        default:
+            err = ESP_ERR_NOT_SUPPORTED;
+            break;
+    }
+
+    if(ESP_OK != err) nvs_value_free(v);
+    return err;
+}
+
+esp_err_t nvs_value_set(nvs_handle_t h, const char *key, const nvs_value_t *v)
+{
+    switch(v->type) {
+        case NVS_TYPE_U8:  return nvs_set_u8( h, key, (uint8_t) v->num.u);
+        case NVS_TYPE_I8:  return nvs_set_i8( h, key, (int8_t)  v->num.i);
+        case NVS_TYPE_U16: return nvs_set_u16(h, key, (uint16_t)v->num.u);
+        case NVS_TYPE_I16: return nvs_set_i16(h, key, (int16_t) v->num.i);
+        case NVS_TYPE_U32: return nvs_set_u32(h, key, (uint32_t)v->num.u);
+        case NVS_TYPE_I32: return nvs_set_i32(h, key, (int32_t) v->num.i);
+        case NVS_TYPE_U64: return nvs_set_u64(h, key, v->num.u);
+        case NVS_TYPE_I64: return nvs_set_i64(h, key, v->num.i);
+        case NVS_TYPE_STR: return nvs_set_str(h, key, v->data);
+        case NVS_TYPE_BLOB: return nvs_set_blob(h, key, v->data, v->len);
+        default: return ESP_ERR_NOT_SUPPORTED;
+    }
+}
+
+void nvs_value_free(nvs_value_t *v)
+{
+    free(v->data);
+    v->data = NULL;
+    v->len = 0;
+}
@@ -0,0 +1,54 @@
+/***
+ * Type-tagged NVS values, so a value can be read, held and written back
+ * without a switch over every nvs_get_*()/nvs_set_*() at each call site.
+ */
+
+#ifndef PROJECT_NVS_VALUE_H__
+#define PROJECT_NVS_VALUE_H__
+
+#include "esp_err.h"
+#include "nvs.h"
+#include "stdbool.h"
+#include "stddef.h"
+#include "stdint.h"
+
+typedef struct nvs_value {
+    nvs_type_t type;
+    union {
+        uint64_t u;         // NVS_TYPE_U*
+        int64_t i;          // NVS_TYPE_I*
+    } num;
+    void *data;             // NVS_TYPE_STR (NULL-terminated) and NVS_TYPE_BLOB; malloc'd
+    size_t len;             // Bytes at `data`, including the terminator of a string
+} nvs_value_t;
+
+/**
+ * @brief Read `key` of the given `type` into `v`. Free with nvs_value_free().
+ */
+esp_err_t nvs_value_get(nvs_handle_t h, const char *key, nvs_type_t type, nvs_value_t *v);
+
+/**
+ * @brief Write `v` to `key`. Doesn't commit.
+ */
+esp_err_t nvs_value_set(nvs_handle_t h, const char *key, const nvs_value_t *v);
+
+void nvs_value_free(nvs_value_t *v);
+
+/**
+ * @brief true for the integer types.
+ */
+static inline bool nvs_type_is_number(nvs_type_t type)
+{
+    return NVS_TYPE_STR != type && NVS_TYPE_BLOB != type && NVS_TYPE_ANY != type;
+}
+
+/**
+ * @brief true for the signed integer types.
+ */
+static inline bool nvs_type_is_signed(nvs_type_t type)
+{
+    return NVS_TYPE_I8 == type || NVS_TYPE_I16 == type
+        || NVS_TYPE_I32 == type || NVS_TYPE_I64 == type;
+}
+
+#endif
@@ -0,0 +1,43 @@
+#include "esp_system.h"
+#include "nvs_version.h"
+#include "stdatomic.h"
+#include "stdint.h"
+#include "stdio.h"
+
+static atomic_uint versions[NVS_VERSION_BUCKETS];
+static atomic_uint all_version;             // Bumped along with every namespace
+static atomic_uint boot_id;
+
+/* FNV-1a */
+static uint32_t hash(const char *s)
+{
+    uint32_t h = 2166136261u;
+    while(*s) h = (h ^ (uint8_t)*s++) * 16777619u;
+    return h;
+}
+
+void nvs_version_bump(const char *namespace)
+{
+    atomic_fetch_add(&versions[hash(namespace) % NVS_VERSION_BUCKETS], 1);
+    atomic_fetch_add(&all_version, 1);
+}
+
+unsigned int nvs_version_get(const char *namespace)
+{
+    return NULL == namespace ? atomic_load(&all_version)
+        : atomic_load(&versions[hash(namespace) % NVS_VERSION_BUCKETS]);
+}
+
+void nvs_version_etag(const char *namespace, char etag[NVS_ETAG_LEN])
+{
+    unsigned int id = atomic_load(&boot_id);
+
+    if(0 == id) {
+        /* Racing callers pick different IDs; only the first sticks */
+        unsigned int expected = 0;
+        id = esp_random() | 1;
+        if(!atomic_compare_exchange_strong(&boot_id, &expected, id)) id = expected;
+    }
+
+    snprintf(etag, NVS_ETAG_LEN, "\"%08x-%08x\"", id, nvs_version_get(namespace));
+}
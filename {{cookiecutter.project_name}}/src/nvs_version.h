@@ -0,0 +1,39 @@
+/***
+ * Per-namespace version counters, for optimistic concurrency over the NVS
+ * API: clients send back the ETag they last read and updates fail if the
+ * namespace has changed since.
+ *
+ * Counters live in RAM so tracking changes costs no flash writes. ETags
+ * include an ID picked at random on every boot, so one from before a reboot
+ * never matches. Namespaces hash into NVS_VERSION_BUCKETS counters; two
+ * namespaces sharing one only cause spurious mismatches, never a missed
+ * change.
+ *
+ * Code changing NVS outside of the API should call nvs_version_bump() after
+ * committing.
+ */
+
+#ifndef PROJECT_NVS_VERSION_H__
+#define PROJECT_NVS_VERSION_H__
+
+#define NVS_VERSION_BUCKETS 64
+
+// "\"<boot id>-<version>\"", both 8 hex digits, with NULL-terminator
+#define NVS_ETAG_LEN 21
+
+/**
+ * @brief Record a change to `namespace`.
+ */
+void nvs_version_bump(const char *namespace);
+
+/**
+ * @brief Current version of `namespace`, or of the whole partition if NULL.
+ */
+unsigned int nvs_version_get(const char *namespace);
+
+/**
+ * @brief Current ETag of `namespace`, or of the whole partition if NULL.
+ */
+void nvs_version_etag(const char *namespace, char etag[NVS_ETAG_LEN]);
+
+#endif
@@ -0,0 +1,252 @@
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "nvs_wb.h"
+#include "sdkconfig.h"
+#include "stdlib.h"
+#include "string.h"
+
+static const char TAG[] = "nvs_wb";
+
+#define NUM_ENTRIES CONFIG_PROJECT_NVS_WB_ENTRIES
+#define QUIET_US ((int64_t)CONFIG_PROJECT_NVS_WB_QUIET_MS * 1000)
+#define MAX_DELAY_US ((int64_t)CONFIG_PROJECT_NVS_WB_MAX_DELAY_MS * 1000)
+#define MAX_NAMESPACES 8
+
+// Passed as `now` to flush regardless of age
+#define FLUSH_ALL -1
+
+typedef struct entry {
+    char namespace[NVS_NS_NAME_MAX_SIZE];   // Empty while unused
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    nvs_value_t val;                        // Owns `data`
+    int64_t first_us;                       // First write since the last commit
+    int64_t last_us;                        // Latest write
+} entry_t;
+
+static entry_t entries[NUM_ENTRIES];        // Guarded by `lock`
+static nvs_wb_stats_t stats;                // Guarded by `lock`
+static SemaphoreHandle_t lock = NULL;
+
+/* Set up once by nvs_wb_init() */
+static char namespaces[MAX_NAMESPACES][NVS_NS_NAME_MAX_SIZE];
+static size_t num_namespaces;
+
+/**
+ * @brief Must hold `lock`.
+ */
+static entry_t *find(const char *namespace, const char *key)
+{
+    for(int i = 0; i < NUM_ENTRIES; i++) {
+        if(0 == strcmp(entries[i].key, key) && 0 == strcmp(entries[i].namespace, namespace)) {
+            return &entries[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief true if `e` is in use, in `namespace` (any if NULL) and, unless
+ * `now` is FLUSH_ALL, has waited long enough.
+ */
+static bool due(const entry_t *e, const char *namespace, int64_t now)
+{
+    if('\0' == e->namespace[0]) return false;
+    if(namespace && 0 != strcmp(e->namespace, namespace)) return false;
+    return FLUSH_ALL == now || now - e->last_us >= QUIET_US || now - e->first_us >= MAX_DELAY_US;
+}
+
+static void release(entry_t *e)
+{
+    nvs_value_free(&e->val);
+    e->namespace[0] = '\0';
+    e->key[0] = '\0';
+    stats.pending--;
+}
+
+/**
+ * @brief Write out due entries, one commit per namespace. Must hold `lock`.
+ *
+ * Entries are released even on failure so a full NVS partition can't wedge
+ * them.
+ */
+static esp_err_t flush_locked(const char *namespace, int64_t now)
+{
+    esp_err_t ret = ESP_OK;
+
+    for(int i = 0; i < NUM_ENTRIES; i++) {
+        char ns[NVS_NS_NAME_MAX_SIZE];
+        nvs_handle_t h = 0;
+        esp_err_t err;
+        size_t n = 0;
+
+        if(!due(&entries[i], namespace, now)) continue;
+
+        /* Every due entry of this namespace goes out with one commit */
+        strcpy(ns, entries[i].namespace);
+        err = nvs_open(ns, NVS_READWRITE, &h);
+        for(int j = i; j < NUM_ENTRIES; j++) {
+            entry_t *e = &entries[j];
+            if(!due(e, ns, now)) continue;
+            if(ESP_OK == err) err = nvs_value_set(h, e->key, &e->val);
+            release(e);
+            n++;
+        }
+        if(ESP_OK == err) err = nvs_commit(h);
+        if(h) nvs_close(h);
+
+        if(ESP_OK != err) {
+            ESP_LOGE(TAG, "Dropped %d pending keys of %s: %s", n, ns, esp_err_to_name(err));
+            stats.failed += n;
+            ret = err;
+        }
+        else {
+            ESP_LOGD(TAG, "Committed %d keys of %s", n, ns);
+            stats.flushed += n;
+            stats.commits++;
+        }
+    }
+    return ret;
+}
+
+static void nvs_wb_task_fn(void *arg)
+{
+    while(true) {
+        vTaskDelay(pdMS_TO_TICKS(CONFIG_PROJECT_NVS_WB_QUIET_MS / 4) + 1);
+
+        xSemaphoreTake(lock, portMAX_DELAY);
+        flush_locked(NULL, esp_timer_get_time());
+        xSemaphoreGive(lock);
+    }
+}
+
+static void nvs_wb_shutdown(void)
+{
+    nvs_wb_flush(NULL);
+}
+
+esp_err_t nvs_wb_init(void)
+{
+    const char *p = CONFIG_PROJECT_NVS_WB_NAMESPACES;
+
+    if(lock) return ESP_OK;
+
+    while(*p && num_namespaces < MAX_NAMESPACES) {
+        size_t len = strcspn(p, ",");
+        if(len > 0 && len < NVS_NS_NAME_MAX_SIZE) {
+            memcpy(namespaces[num_namespaces], p, len);
+            namespaces[num_namespaces][len] = '\0';
+            num_namespaces++;
+        }
+        else if(len > 0) {
+            ESP_LOGE(TAG, "Namespace \"%.*s\" too long", (int)len, p);
+        }
+        p += len;
+        if(',' == *p) p++;
+    }
+    if(0 == num_namespaces) return ESP_OK;
+
+    if(NULL == (lock = xSemaphoreCreateMutex())) return ESP_ERR_NO_MEM;
+    if(pdPASS != xTaskCreate(nvs_wb_task_fn, "nvs_wb", 3072, NULL, tskIDLE_PRIORITY + 1, NULL)) {
+        ESP_LOGE(TAG, "Failed to start write-behind task");
+        return ESP_FAIL;
+    }
+    /* Flush before esp_restart(), e.g. for a reboot or after an OTA */
+    return esp_register_shutdown_handler(nvs_wb_shutdown);
+}
+
+bool nvs_wb_has_namespace(const char *namespace)
+{
+    for(size_t i = 0; i < num_namespaces; i++) {
+        if(0 == strcmp(namespaces[i], namespace)) return true;
+    }
+    return false;
+}
+
+esp_err_t nvs_wb_write(const char *namespace, const char *key, const nvs_value_t *v)
+{
+    esp_err_t err;
+    nvs_value_t copy = *v;
+    int64_t now = esp_timer_get_time();
+    entry_t *e;
+
+    if(NULL == lock || !nvs_wb_has_namespace(namespace) || NVS_TYPE_BLOB == v->type) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    if(NVS_TYPE_STR == v->type) {
+        if(NULL == (copy.data = malloc(v->len))) return ESP_ERR_NO_MEM;
+        memcpy(copy.data, v->data, v->len);
+    }
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    if(NULL != (e = find(namespace, key))) {
+        nvs_value_free(&e->val);
+        stats.absorbed++;
+    }
+    else {
+        if(NULL == (e = find("", "")) && ESP_OK != (err = flush_locked(NULL, FLUSH_ALL))) {
+            /* Full, and making room lost the values flushed; don't hold
+             * this one either, so the caller's direct write reports it */
+            xSemaphoreGive(lock);
+            ESP_LOGE(TAG, "Flush to make room failed: %s", esp_err_to_name(err));
+            if(NVS_TYPE_STR == v->type) nvs_value_free(&copy);
+            return err;
+        }
+        if(NULL == e) e = &entries[0];
+        strlcpy(e->namespace, namespace, sizeof(e->namespace));
+        strlcpy(e->key, key, sizeof(e->key));
+        e->first_us = now;
+        stats.pending++;
+    }
+    e->val = copy;
+    e->last_us = now;
+    stats.writes++;
+    xSemaphoreGive(lock);
+    return ESP_OK;
+}
+
+esp_err_t nvs_wb_get(const char *namespace, const char *key, nvs_value_t *v)
+{
+    esp_err_t err = ESP_ERR_NOT_FOUND;
+    entry_t *e;
+
+    if(NULL == lock || !nvs_wb_has_namespace(namespace)) return ESP_ERR_NOT_FOUND;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    if(NULL != (e = find(namespace, key))) {
+        *v = e->val;
+        err = ESP_OK;
+        if(NVS_TYPE_STR == v->type) {
+            if(NULL != (v->data = malloc(e->val.len))) memcpy(v->data, e->val.data, e->val.len);
+            else err = ESP_ERR_NO_MEM;
+        }
+    }
+    xSemaphoreGive(lock);
+    return err;
+}
+
+esp_err_t nvs_wb_flush(const char *namespace)
+{
+    esp_err_t err;
+
+    if(NULL == lock) return ESP_OK;
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    err = flush_locked(namespace, FLUSH_ALL);
+    xSemaphoreGive(lock);
+    return err;
+}
+
+void nvs_wb_get_stats(nvs_wb_stats_t *out)
+{
+    if(NULL == lock) {
+        memset(out, 0, sizeof(nvs_wb_stats_t));
+        return;
+    }
+    xSemaphoreTake(lock, portMAX_DELAY);
+    *out = stats;
+    xSemaphoreGive(lock);
+}
@@ -0,0 +1,74 @@
+/***
+ * Write-behind for NVS namespaces whose keys are updated many times a second,
+ * such as counters and setpoints.
+ *
+ * Writes to the namespaces in CONFIG_PROJECT_NVS_WB_NAMESPACES are held in
+ * RAM, and writing a key again before it reaches flash just replaces the
+ * pending value. A key is committed once it has been left alone for
+ * CONFIG_PROJECT_NVS_WB_QUIET_MS, CONFIG_PROJECT_NVS_WB_MAX_DELAY_MS after
+ * its first pending write at the latest, and at shutdown. Pending keys of a
+ * namespace are committed together with a single nvs_commit().
+ *
+ * Only integers and strings are held back; blobs are written straight away.
+ * Pending values are lost on a crash or power loss. Reads of these
+ * namespaces must check nvs_wb_get() before NVS, as the NVS routes and
+ * nvs_cache do, and anything writing them directly must call nvs_wb_flush()
+ * first.
+ */
+
+#ifndef PROJECT_NVS_WB_H__
+#define PROJECT_NVS_WB_H__
+
+#include "esp_err.h"
+#include "nvs.h"
+#include "nvs_value.h"
+#include "stdbool.h"
+#include "stdint.h"
+
+typedef struct nvs_wb_stats {
+    uint32_t writes;        // Accepted by nvs_wb_write()
+    uint32_t absorbed;      // Replaced a still pending value, saving a flash write
+    uint32_t flushed;       // Values written to flash
+    uint32_t commits;       // nvs_commit() calls those took
+    uint32_t failed;        // Values dropped because they couldn't be written
+    uint32_t pending;       // Values waiting right now
+} nvs_wb_stats_t;
+
+/**
+ * @brief Start the flush task and register the shutdown hook. Call after
+ * nvs_flash_init().
+ */
+esp_err_t nvs_wb_init(void);
+
+/**
+ * @brief true if writes to `namespace` are held back.
+ */
+bool nvs_wb_has_namespace(const char *namespace);
+
+/**
+ * @brief Hold a value for `key`, replacing any value still pending.
+ * When every entry is in use, all pending values are committed first to make
+ * room.
+ *
+ * @returns ESP_ERR_NOT_SUPPORTED for blobs and namespaces without
+ * write-behind, ESP_ERR_NO_MEM if it couldn't be held, or the error of a
+ * commit made to make room, whose values are then lost. The caller should
+ * then write to NVS itself.
+ */
+esp_err_t nvs_wb_write(const char *namespace, const char *key, const nvs_value_t *v);
+
+/**
+ * @brief Copy the pending value of `key` into `v`. Free with nvs_value_free().
+ * @returns ESP_ERR_NOT_FOUND if nothing is pending; the value in NVS is
+ * current.
+ */
+esp_err_t nvs_wb_get(const char *namespace, const char *key, nvs_value_t *v);
+
+/**
+ * @brief Commit everything pending for `namespace`. NULL flushes all.
+ */
+esp_err_t nvs_wb_flush(const char *namespace);
+
+void nvs_wb_get_stats(nvs_wb_stats_t *stats);
+
+#endif
@@ -1,11 +1,15 @@
 #include "route.h"
+#include "file_cache.h"
+#include "ctype.h"
 
 /* Include route handlers */
 #include "route/v1/example.h"
 #include "route/v1/filesystem.h"
+#include "route/v1/jobs.h"
 #include "route/v1/nvs.h"
 #include "route/v1/ota.h"
 #include "route/v1/system.h"
+#include "route/static.h"
 
 __unused static const char TAG[] = "route";
 
@@ -17,6 +21,7 @@ __unused static const char TAG[] = "route";
     } while(0)
 
 
+#if !CONFIG_PROJECT_STATIC_SITE
 /* Handler to respond with an icon file embedded in flash.
  * Browsers expect to GET website icon at URI /favicon.ico.
  * This can be overridden by uploading file with same name */
@@ -29,13 +34,16 @@ static esp_err_t favicon_get_handler(httpd_req_t *req)
     httpd_resp_send(req, (const char *)_route_favicon_ico_start, favicon_ico_size);
     return ESP_OK;
 }
+#endif
 
 
 /**
  * @Brief Manual sitemap
  */
 static esp_err_t root_get_handler(httpd_req_t *req) {
-    char *hostname = get_hostname();
+    char hostname[HOSTNAME_MAX];
+
+    get_hostname(hostname, sizeof(hostname));
 
     HTTP_SEND_DOCTYPE_HTML(req);
     HTTP_SEND_COMMON_HEAD(req, "{{cookiecutter.project_name}} NVS");
@@ -70,7 +78,6 @@ static esp_err_t root_get_handler(httpd_req_t *req) {
     httpd_resp_sendstr_chunk(req, "</body>");
     httpd_resp_sendstr_chunk(req, NULL);
 
-    free(hostname);
     return ESP_OK;
 }
 
@@ -79,15 +86,28 @@ esp_err_t register_routes() {
 
    /* Add all routes HERE */
 
+#if CONFIG_PROJECT_STATIC_SITE
+    ERR_CHECK(server_register("/admin", HTTP_GET, root_get_handler));
+#else
     ERR_CHECK(server_register("/", HTTP_GET, root_get_handler));
     ERR_CHECK(server_register("/favicon.ico", HTTP_GET, favicon_get_handler));
+#endif
 
     ERR_CHECK(server_register(PROJECT_ROUTE_V1_FILESYSTEM "/*", HTTP_DELETE, filesystem_file_delete_handler));
     ERR_CHECK(server_register(PROJECT_ROUTE_V1_FILESYSTEM "/*", HTTP_GET, filesystem_file_get_handler));
     ERR_CHECK(server_register(PROJECT_ROUTE_V1_FILESYSTEM,      HTTP_GET, filesystem_file_get_handler));
     ERR_CHECK(server_register(PROJECT_ROUTE_V1_FILESYSTEM "/*", HTTP_POST, filesystem_file_post_handler));
+    ERR_CHECK(server_register(PROJECT_ROUTE_V1_FILESYSTEM "/*", HTTP_PATCH, filesystem_file_patch_handler));
+    ERR_CHECK(server_register(PROJECT_ROUTE_V1_FILESYSTEM "/*", HTTP_HEAD, filesystem_file_head_handler));
+    ERR_CHECK(server_register(PROJECT_ROUTE_V1_FILESYSTEM "/*", HTTP_COPY, filesystem_file_copy_handler));
+    ERR_CHECK(server_register(PROJECT_ROUTE_V1_FILESYSTEM "/*", HTTP_MOVE, filesystem_file_move_handler));
+
+    ERR_CHECK(server_register(PROJECT_ROUTE_V1_JOBS "/*", HTTP_GET, jobs_get_handler));
+    ERR_CHECK(server_register(PROJECT_ROUTE_V1_JOBS,      HTTP_GET, jobs_get_handler));
+    ERR_CHECK(server_register(PROJECT_ROUTE_V1_JOBS "/*", HTTP_DELETE, jobs_delete_handler));
 
     ERR_CHECK(server_register(PROJECT_ROUTE_V1_NVS "/*", HTTP_POST, nvs_post_handler));
+    ERR_CHECK(server_register(PROJECT_ROUTE_V1_NVS,      HTTP_POST, nvs_post_handler));
     ERR_CHECK(server_register(PROJECT_ROUTE_V1_NVS "/*", HTTP_GET, nvs_get_handler));
     ERR_CHECK(server_register(PROJECT_ROUTE_V1_NVS,      HTTP_GET, nvs_get_handler));
 
@@ -96,6 +116,19 @@ esp_err_t register_routes() {
     ERR_CHECK(server_register("/api/v1/system/info", HTTP_GET, system_info_get_handler));
     ERR_CHECK(server_register("/api/v1/system/time", HTTP_GET, system_time_get_handler));
     ERR_CHECK(server_register("/api/v1/system/reboot", HTTP_POST, system_reboot_post_handler));
+#if CONFIG_PROJECT_FSBENCH
+    ERR_CHECK(server_register("/api/v1/system/fsbench", HTTP_POST, system_fsbench_post_handler));
+#endif
+    /* Also when disabled, in case an earlier build left it behind */
+    system_nvsbench_cleanup();
+#if CONFIG_PROJECT_NVSBENCH
+    ERR_CHECK(server_register("/api/v1/system/nvsbench", HTTP_POST, system_nvsbench_post_handler));
+#endif
+
+#if CONFIG_PROJECT_STATIC_SITE
+    /* Matches every URI, so must come last */
+    ERR_CHECK(server_register("/*", HTTP_GET, static_get_handler));
+#endif
 
 exit:
     return err;
@@ -149,3 +182,225 @@ bool detect_if_browser(httpd_req_t *req)
 }
 
 
+
+
+/**
+ * @brief Copy the URL query string into a newly allocated buffer.
+ *
+ * Caller must free the returned string. NULL if there is no query string.
+ */
+static char *http_query_dup(httpd_req_t *req)
+{
+    char *qry;
+    size_t len = httpd_req_get_url_query_len(req);
+    if(0 == len) return NULL;
+    if(NULL == (qry = malloc(len + 1))) return NULL;
+    if(ESP_OK != httpd_req_get_url_query_str(req, qry, len + 1)) {
+        free(qry);
+        return NULL;
+    }
+    return qry;
+}
+
+bool http_query_has_key(httpd_req_t *req, const char *key)
+{
+    bool found = false;
+    size_t key_len = strlen(key);
+    char *qry = http_query_dup(req);
+
+    for(char *p = qry; p && *p; ) {
+        if(0 == strncmp(p, key, key_len) && (p[key_len] == '\0' || p[key_len] == '=' || p[key_len] == '&')) {
+            found = true;
+            break;
+        }
+        p = strchr(p, '&');
+        if(p) p++;
+    }
+
+    if(qry) free(qry);
+    return found;
+}
+
+esp_err_t http_query_get_value(httpd_req_t *req, const char *key, char *val, size_t val_size)
+{
+    esp_err_t err;
+    char *qry = http_query_dup(req);
+    if(NULL == qry) return ESP_ERR_NOT_FOUND;
+    err = httpd_query_key_value(qry, key, val, val_size);
+    free(qry);
+    return err;
+}
+
+
+static int hex_digit(char c)
+{
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+esp_err_t http_url_decode(char *str)
+{
+    char *w = str;
+    for(const char *r = str; *r; r++, w++) {
+        if('%' != *r) {
+            *w = *r;
+            continue;
+        }
+        int hi = hex_digit(r[1]);
+        int lo = hi < 0 ? -1 : hex_digit(r[2]);
+        if(lo < 0 || (0 == hi && 0 == lo)) return ESP_ERR_INVALID_ARG;
+        *w = hi << 4 | lo;
+        r += 2;
+    }
+    *w = '\0';
+    return ESP_OK;
+}
+
+
+/* Escapes are written to a small buffer, sent whenever it fills */
+#define ESCAPE_BUF_SIZE 64
+
+esp_err_t http_resp_send_html_chunk(httpd_req_t *req, const char *str)
+{
+    char buf[ESCAPE_BUF_SIZE];
+    size_t n = 0;
+
+    for(; *str; str++) {
+        const char *esc = NULL;
+        switch(*str) {
+            case '&':  esc = "&amp;";  break;
+            case '<':  esc = "&lt;";   break;
+            case '>':  esc = "&gt;";   break;
+            case '"':  esc = "&quot;"; break;
+            case '\'': esc = "&#39;";  break;
+        }
+        if(n + 6 > sizeof(buf)) {
+            if(ESP_OK != httpd_resp_send_chunk(req, buf, n)) return ESP_FAIL;
+            n = 0;
+        }
+        if(esc) n += strlcpy(buf + n, esc, sizeof(buf) - n);
+        else buf[n++] = *str;
+    }
+    return n ? httpd_resp_send_chunk(req, buf, n) : ESP_OK;
+}
+
+esp_err_t http_resp_send_url_chunk(httpd_req_t *req, const char *str)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    char buf[ESCAPE_BUF_SIZE];
+    size_t n = 0;
+
+    for(; *str; str++) {
+        unsigned char c = *str;
+        if(n + 3 > sizeof(buf)) {
+            if(ESP_OK != httpd_resp_send_chunk(req, buf, n)) return ESP_FAIL;
+            n = 0;
+        }
+        if(isalnum(c) || strchr("-._~/", c)) {
+            buf[n++] = c;
+        }
+        else {
+            buf[n++] = '%';
+            buf[n++] = hex[c >> 4];
+            buf[n++] = hex[c & 0xF];
+        }
+    }
+    return n ? httpd_resp_send_chunk(req, buf, n) : ESP_OK;
+}
+
+
+bool http_expects_continue(httpd_req_t *req)
+{
+    char val[16];
+    if(ESP_OK != httpd_req_get_hdr_value_str(req, "Expect", val, sizeof(val))) return false;
+    return 0 == strcasecmp(val, "100-continue");
+}
+
+esp_err_t http_continue(httpd_req_t *req)
+{
+    /* esp_http_server doesn't send interim responses itself */
+    static const char resp[] = "HTTP/1.1 100 Continue\r\n\r\n";
+    if(!http_expects_continue(req)) return ESP_OK;
+    if(httpd_send(req, resp, sizeof(resp) - 1) != sizeof(resp) - 1) {
+        ESP_LOGE(TAG, "Failed to send 100 Continue");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+void http_resp_no_space(httpd_req_t *req, esp_err_t err)
+{
+    if(FS_ERR_QUOTA == err) {
+        httpd_resp_set_status(req, "413 Payload Too Large");
+        httpd_resp_sendstr(req, "Directory quota exceeded");
+    }
+    else {
+        httpd_resp_set_status(req, "507 Insufficient Storage");
+        httpd_resp_sendstr(req, "Not enough free space on the filesystem");
+    }
+}
+
+
+bool http_etag_listed(httpd_req_t *req, const char *field, const char *etag, bool weak)
+{
+    size_t len = httpd_req_get_hdr_value_len(req, field);
+    bool listed = false;
+    char *val = NULL, *item, *save;
+
+    if(0 == len || NULL == (val = malloc(len + 1))) goto exit;
+    if(ESP_OK != httpd_req_get_hdr_value_str(req, field, val, len + 1)) goto exit;
+
+    for(item = strtok_r(val, ",", &save); item && !listed; item = strtok_r(NULL, ",", &save)) {
+        item += strspn(item, " \t");
+        item[strcspn(item, " \t")] = '\0';
+        if(0 == strncmp(item, "W/", 2)) {
+            if(!weak) continue;
+            item += 2;
+        }
+        listed = 0 == strcmp(item, "*") || 0 == strcmp(item, etag);
+    }
+
+exit:
+    free(val);
+    return listed;
+}
+
+bool http_set_etag_from_file(httpd_req_t *req, const char *filepath, char etag[HTTP_ETAG_LEN])
+{
+    uint8_t digest[FS_HASH_LEN];
+    if(ESP_OK != fs_hash_get(filepath, digest)) return false;
+    return http_set_etag(req, digest, etag);
+}
+
+bool http_set_etag(httpd_req_t *req, const uint8_t digest[FS_HASH_LEN], char etag[HTTP_ETAG_LEN])
+{
+    etag[0] = '"';
+    sodium_bin2hex(etag + 1, 2 * FS_HASH_LEN + 1, digest, FS_HASH_LEN);
+    strcat(etag, "\"");
+    httpd_resp_set_hdr(req, "ETag", etag);
+
+    return http_etag_listed(req, "If-None-Match", etag, true);
+}
+
+
+bool http_resp_from_cache(httpd_req_t *req, const char *filepath, const struct stat *st)
+{
+    char etag[HTTP_ETAG_LEN];
+    const file_cache_entry_t *entry = file_cache_get(filepath, st);
+
+    if(NULL == entry) return false;
+
+    if(entry->has_digest && http_set_etag(req, entry->digest, etag)) {
+        httpd_resp_set_status(req, "304 Not Modified");
+        httpd_resp_send(req, NULL, 0);
+    }
+    else {
+        /* Single response with a Content-Length; no chunking */
+        httpd_resp_send(req, (const char *)entry->data, entry->size);
+    }
+
+    file_cache_release(entry);
+    return true;
+}
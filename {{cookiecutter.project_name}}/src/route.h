@@ -1,6 +1,7 @@
 #ifndef PROJECT_ROUTE_H__
 #define PROJECT_ROUTE_H__
 
+#include "filesystem.h"
 #include "server.h"
 
 /**
@@ -35,6 +36,110 @@ esp_err_t parse_post_request(cJSON **json, httpd_req_t *req);
 bool detect_if_browser(httpd_req_t *req);
 
 
+/**
+ * @brief Check if the URL query string contains `key`.
+ *
+ * Flags without a value count, i.e. both `?delta` and `?delta=1` contain
+ * the key "delta".
+ */
+bool http_query_has_key(httpd_req_t *req, const char *key);
+
+
+/**
+ * @brief Get the value of `key` from the URL query string.
+ * @param[out] val Buffer to copy the (still URL-encoded) value into.
+ * @param[in] val_size Size of `val`.
+ * @returns ESP_OK on success, ESP_ERR_NOT_FOUND if the key is not present.
+ */
+esp_err_t http_query_get_value(httpd_req_t *req, const char *key, char *val, size_t val_size);
+
+
+/**
+ * @brief Decode %XX escapes in `str` in place.
+ * @returns ESP_OK on success, ESP_ERR_INVALID_ARG for a malformed escape or
+ *          an encoded NUL.
+ */
+esp_err_t http_url_decode(char *str);
+
+
+/**
+ * @brief Send `str` as a chunk with &, <, >, " and ' HTML-escaped, for
+ * element text and quoted attribute values.
+ */
+esp_err_t http_resp_send_html_chunk(httpd_req_t *req, const char *str);
+
+
+/**
+ * @brief Send `str` as a chunk with everything but unreserved characters and
+ * '/' percent-encoded, for a path or query value inside a URL.
+ */
+esp_err_t http_resp_send_url_chunk(httpd_req_t *req, const char *str);
+
+
+/**
+ * @brief true if the client sent `Expect: 100-continue` and is waiting for
+ * the go-ahead before sending the request body.
+ */
+bool http_expects_continue(httpd_req_t *req);
+
+/**
+ * @brief Tell a client waiting on `Expect: 100-continue` to send the body.
+ *
+ * Call once the request has been accepted, right before receiving the body.
+ * A no-op for other requests. A handler rejecting such a request must
+ * return an error so the connection is closed instead of waiting for a body
+ * that never comes.
+ */
+esp_err_t http_continue(httpd_req_t *req);
+
+/**
+ * @brief Respond to a body that doesn't fit on the filesystem.
+ *
+ * 413 for FS_ERR_QUOTA, 507 for FS_ERR_NO_SPACE.
+ */
+void http_resp_no_space(httpd_req_t *req, esp_err_t err);
+
+
+/**
+ * @brief true if the header `field` lists `etag`, or is "*".
+ *
+ * If-None-Match compares weakly, so a `W/` tag matches its strong form;
+ * If-Match compares strongly, so a `W/` tag never matches (RFC 7232).
+ */
+bool http_etag_listed(httpd_req_t *req, const char *field, const char *etag, bool weak);
+
+
+/* Size of a buffer holding a quoted hex SHA-256 ETag */
+#define HTTP_ETAG_LEN (2 * FS_HASH_LEN + 3)
+
+/**
+ * @brief Set the ETag of a file from its stored digest.
+ *
+ * @param[out] etag Buffer the header value is formatted into; must stay
+ *             valid until the response is sent.
+ * @returns true if the client's If-None-Match matches, i.e. the client's
+ *          copy is current and a 304 should be sent instead of the body.
+ */
+bool http_set_etag_from_file(httpd_req_t *req, const char *filepath, char etag[HTTP_ETAG_LEN]);
+
+/**
+ * @brief http_set_etag_from_file() for an already known digest.
+ */
+bool http_set_etag(httpd_req_t *req, const uint8_t digest[FS_HASH_LEN], char etag[HTTP_ETAG_LEN]);
+
+
+/**
+ * @brief Respond with a file from the file cache.
+ *
+ * Handles ETag/If-None-Match. The content type must already be set.
+ *
+ * @param[in] st Current stat of the file.
+ * @returns true if a response was sent, false if the file isn't cacheable
+ *          and must be streamed instead.
+ */
+bool http_resp_from_cache(httpd_req_t *req, const char *filepath, const struct stat *st);
+
+
 /**
  * Send the contents of the file that was stored as binary/text data.
  * Don't put file in quotes.
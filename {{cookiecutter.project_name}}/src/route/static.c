@@ -0,0 +1,249 @@
+#include "route/static.h"
+#include "../append.h"
+#include "../assets.h"
+#include "../filesystem.h"
+#include "../mime.h"
+#include "../transfer.h"
+#include "sdkconfig.h"
+
+__unused static const char TAG[] = "route/static";
+
+
+/**
+ * @brief Reject paths with ".." components that would escape the site.
+ */
+static bool static_path_is_safe(const char *uri, size_t len)
+{
+    for(size_t i = 0; i + 2 <= len; i++) {
+        if('/' == uri[i] && '.' == uri[i + 1] && '.' == uri[i + 2]
+                && (i + 3 == len || '/' == uri[i + 3])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/**
+ * @brief Strip leading and trailing whitespace in place.
+ */
+static char *trim_ows(char *s)
+{
+    char *end;
+    while(' ' == *s || '\t' == *s) s++;
+    end = s + strlen(s);
+    while(end > s && (' ' == end[-1] || '\t' == end[-1])) *--end = '\0';
+    return s;
+}
+
+
+/**
+ * @brief true if the qvalue `q` is zero, i.e. "0" with optional zero
+ * decimals.
+ */
+static bool qvalue_is_zero(const char *q)
+{
+    if('0' != *q++) return false;
+    if('\0' == *q) return true;
+    if('.' != *q++) return false;
+    while('0' == *q) q++;
+    return '\0' == *q;
+}
+
+
+/**
+ * @brief true if the client's Accept-Encoding allows gzip.
+ *
+ * gzip is acceptable if it's listed with a non-zero q-value, or if it isn't
+ * listed but "*" is.
+ */
+static bool accepts_gzip(httpd_req_t *req)
+{
+    size_t len = httpd_req_get_hdr_value_len(req, "Accept-Encoding");
+    int gzip = -1, any = -1;    // -1: not listed, 0: refused, 1: accepted
+    char *val = NULL, *item, *item_save;
+
+    if(0 == len || NULL == (val = malloc(len + 1))) goto exit;
+    if(ESP_OK != httpd_req_get_hdr_value_str(req, "Accept-Encoding", val, len + 1)) goto exit;
+
+    for(item = strtok_r(val, ",", &item_save); item; item = strtok_r(NULL, ",", &item_save)) {
+        char *param_save;
+        char *coding = strtok_r(item, ";", &param_save);
+        int accepted = 1;
+
+        if(NULL == coding) continue;
+        coding = trim_ows(coding);
+
+        for(char *param; NULL != (param = strtok_r(NULL, ";", &param_save)); ) {
+            param = trim_ows(param);
+            if(('q' == param[0] || 'Q' == param[0]) && '=' == param[1]) {
+                accepted = !qvalue_is_zero(trim_ows(param + 2));
+            }
+        }
+
+        if(0 == strcasecmp(coding, "gzip")) gzip = accepted;
+        else if(0 == strcmp(coding, "*")) any = accepted;
+    }
+
+exit:
+    free(val);
+    return gzip >= 0 ? gzip : any > 0;
+}
+
+
+#if CONFIG_PROJECT_STATIC_SITE_ASSETS
+/**
+ * @brief Respond with a file from the packed assets partition.
+ *
+ * The body is sent straight from memory mapped flash.
+ *
+ * @returns false if there is no such asset.
+ */
+static bool static_resp_asset(httpd_req_t *req, const char *name)
+{
+    const assets_image_t *img = assets_image();
+    assets_file_t file;
+    char etag[HTTP_ETAG_LEN];
+
+    if(NULL == img || !assets_find(img, name, &file)) return false;
+
+    if(file.gzip) {
+        if(!accepts_gzip(req)) {
+            httpd_resp_set_status(req, "406 Not Acceptable");
+            httpd_resp_sendstr(req, "Only available gzip encoded");
+            return true;
+        }
+        httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+    }
+    httpd_resp_set_type(req, file.mime);
+    httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+
+    if(http_set_etag(req, file.sha256, etag)) {
+        httpd_resp_set_status(req, "304 Not Modified");
+        httpd_resp_send(req, NULL, 0);
+    }
+    else {
+        httpd_resp_send(req, (const char *)file.data, file.length);
+    }
+    return true;
+}
+#endif
+
+
+esp_err_t static_get_handler(httpd_req_t *req)
+{
+    esp_err_t err = ESP_FAIL;
+    char *filepath = NULL;
+    FILE *fd = NULL;
+    struct stat file_stat;
+    char etag[HTTP_ETAG_LEN];
+    const char *type;
+
+    const char *base_path = ((server_ctx_t *)req->user_ctx)->base_path;
+    const size_t uri_len = strcspn(req->uri, "?#");
+    size_t path_len = strlen(base_path) + strlen(CONFIG_PROJECT_STATIC_SITE_ROOT) + uri_len;
+
+    if(!static_path_is_safe(req->uri, uri_len)
+            || path_len + sizeof(STATIC_INDEX) + sizeof(STATIC_GZ_SUFFIX) > MAX_FILE_PATH) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "File does not exist");
+        goto exit;
+    }
+
+    /* Checked above to leave room for both STATIC_INDEX and STATIC_GZ_SUFFIX */
+    filepath = malloc(MAX_FILE_PATH);
+    if(NULL == filepath) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        goto exit;
+    }
+    snprintf(filepath, MAX_FILE_PATH, "%s%s%.*s",
+            base_path, CONFIG_PROJECT_STATIC_SITE_ROOT, uri_len, req->uri);
+
+    if('/' == filepath[path_len - 1]) {
+        strcpy(filepath + path_len, STATIC_INDEX);
+        path_len += sizeof(STATIC_INDEX) - 1;
+    }
+    else if(0 == stat(filepath, &file_stat) && S_ISDIR(file_stat.st_mode)) {
+        /* Redirect so that relative links in the index resolve correctly */
+        char *location = malloc(uri_len + 2);
+        if(NULL == location) {
+            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+            goto exit;
+        }
+        sprintf(location, "%.*s/", uri_len, req->uri);
+        httpd_resp_set_status(req, "301 Moved Permanently");
+        httpd_resp_set_hdr(req, "Location", location);
+        httpd_resp_send(req, NULL, 0);
+        free(location);
+        err = ESP_OK;
+        goto exit;
+    }
+
+    if(fs_is_internal_name(strrchr(filepath, '/') + 1)) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "File does not exist");
+        goto exit;
+    }
+
+    /* Type comes from the uncompressed name */
+    type = mime_type_from_path(filepath);
+    httpd_resp_set_type(req, type ? type : "application/octet-stream");
+    httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+
+    if(accepts_gzip(req)) {
+        strcpy(filepath + path_len, STATIC_GZ_SUFFIX);
+        if(0 == stat(filepath, &file_stat) && !S_ISDIR(file_stat.st_mode)) {
+            httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+        }
+        else {
+            filepath[path_len] = '\0';
+        }
+    }
+
+    /* Serve what was appended to the file, not just what reached storage */
+    append_flush(filepath);
+    if(-1 == stat(filepath, &file_stat) || S_ISDIR(file_stat.st_mode)) {
+#if CONFIG_PROJECT_STATIC_SITE_ASSETS
+        /* Files on the filesystem override the packed ones. The asset name
+         * is the path relative to the site root. */
+        const char *name = filepath + strlen(base_path) + strlen(CONFIG_PROJECT_STATIC_SITE_ROOT) + 1;
+        if(static_resp_asset(req, name)) {
+            err = ESP_OK;
+            goto exit;
+        }
+#endif
+        ESP_LOGI(TAG, "Not found : %s", filepath);
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "File does not exist");
+        goto exit;
+    }
+
+    if(http_resp_from_cache(req, filepath, &file_stat)) {
+        err = ESP_OK;
+        goto exit;
+    }
+
+    if(NULL == (fd = fopen(filepath, "r"))) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to read existing file");
+        goto exit;
+    }
+    fs_setvbuf(fd);
+
+    if(http_set_etag_from_file(req, filepath, etag)) {
+        httpd_resp_set_status(req, "304 Not Modified");
+        httpd_resp_send(req, NULL, 0);
+        err = ESP_OK;
+        goto exit;
+    }
+
+    ESP_LOGI(TAG, "Sending file : %s (%ld bytes)...", filepath, file_stat.st_size);
+    if(ESP_OK != transfer_send_file(req, fd)) {
+        ESP_LOGE(TAG, "File sending failed!");
+        /* Returning without the final chunk makes httpd close the socket */
+        goto exit;
+    }
+    httpd_resp_send_chunk(req, NULL, 0);
+    err = ESP_OK;
+
+exit:
+    if(fd) fclose(fd);
+    if(filepath) free(filepath);
+    return err;
+}
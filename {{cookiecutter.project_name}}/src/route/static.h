@@ -0,0 +1,27 @@
+/***
+ * Serves a directory of the filesystem as a static website at "/".
+ */
+
+#ifndef PROJECT_ROUTE_STATIC_H__
+#define PROJECT_ROUTE_STATIC_H__
+
+#include "route.h"
+
+#define STATIC_INDEX "index.html"
+#define STATIC_GZ_SUFFIX ".gz"
+
+/**
+ * @brief Serve a file from CONFIG_PROJECT_STATIC_SITE_ROOT.
+ *
+ *     curl ${ESP32_IP}/${PATH}
+ *
+ * Paths ending in '/' serve the directory's STATIC_INDEX; directories
+ * requested without the trailing '/' are redirected to it. If the client
+ * accepts gzip and `${PATH}.gz` exists, that is sent instead with
+ * `Content-Encoding: gzip`.
+ *
+ * Must be registered last, as it matches every URI.
+ */
+esp_err_t static_get_handler(httpd_req_t *req);
+
+#endif
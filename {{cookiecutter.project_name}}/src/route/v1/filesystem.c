@@ -1,5 +1,14 @@
 #include "route/v1/filesystem.h"
+#include "route/v1/jobs.h"
+#include "../../append.h"
+#include "../../delta.h"
 #include "../../filesystem.h"
+#include "../../jobs.h"
+#include "../../mime.h"
+#include "../../tar.h"
+#include "../../transfer.h"
+#include "esp_heap_caps.h"
+#include "sodium.h"
 #include <sys/param.h>
 
 /**
@@ -72,6 +81,17 @@ exit:
 }
 
 
+/**
+ * @brief true if the file name at the end of `path` is reserved for the
+ * filesystem's temporary and sidecar files.
+ */
+static bool path_is_reserved(const char *path)
+{
+    const char *name = strrchr(path, '/');
+    return fs_is_internal_name(name ? name + 1 : path);
+}
+
+
 /* Send HTTP response with a run-time generated html consisting of
  * a list of all files and folders under the requested path.
  */
@@ -147,6 +167,9 @@ static esp_err_t http_resp_dir_html(httpd_req_t *req, const char *dirpath)
     /* Iterate over all files / folders and fetch their names and sizes */
     bool first_iter = true;
     while ((entry = readdir(dir)) != NULL) {
+        if (fs_is_internal_name(entry->d_name)) {
+            continue;
+        }
         entrytype = (entry->d_type == DT_DIR ? "directory" : "file");
 
         strlcpy(entrypath + dirpath_len, entry->d_name, sizeof(entrypath) - dirpath_len);
@@ -223,274 +246,1459 @@ exit:
 /* Set HTTP response content type according to file extension */
 static esp_err_t set_content_type_from_file(httpd_req_t *req, const char *filename)
 {
-    if (IS_FILE_EXT(filename, ".pdf")) {
-        return httpd_resp_set_type(req, "application/pdf");
-    } else if (IS_FILE_EXT(filename, ".html")) {
-        return httpd_resp_set_type(req, "text/html");
-    } else if (IS_FILE_EXT(filename, ".jpeg")) {
-        return httpd_resp_set_type(req, "image/jpeg");
-    } else if (IS_FILE_EXT(filename, ".ico")) {
-        return httpd_resp_set_type(req, "image/x-icon");
-    }
-    /* This is a limited set only */
+    const char *type = mime_type_from_path(filename);
     /* For any other type always set as plain text */
-    return httpd_resp_set_type(req, "text/plain");
+    return httpd_resp_set_type(req, type ? type : "text/plain");
 }
 
-esp_err_t filesystem_file_post_handler(httpd_req_t *req)
+/**
+ * @brief Get the SHA-256 a client expects an upload to have.
+ *
+ * Accepts either of:
+ *     Content-SHA256: <hex>
+ *     Digest: sha-256=<base64>
+ *
+ * @returns ESP_OK if a digest was supplied, ESP_ERR_NOT_FOUND if not, and
+ * ESP_ERR_INVALID_ARG if a header was present but malformed.
+ */
+static esp_err_t get_expected_digest(httpd_req_t *req, uint8_t digest[FS_HASH_LEN])
+{
+    char val[96];
+    size_t bin_len;
+
+    if(ESP_OK == httpd_req_get_hdr_value_str(req, "Content-SHA256", val, sizeof(val))) {
+        if(0 != sodium_hex2bin(digest, FS_HASH_LEN, val, strlen(val), NULL, &bin_len, NULL)
+                || bin_len != FS_HASH_LEN) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        return ESP_OK;
+    }
+
+    if(ESP_OK == httpd_req_get_hdr_value_str(req, "Digest", val, sizeof(val))) {
+        /* May list several algorithms, e.g. "md5=..., sha-256=..." */
+        const char prefix[] = "sha-256=";
+        char *p;
+        for(p = val; *p; p++) {
+            if(0 == strncasecmp(p, prefix, sizeof(prefix) - 1)) break;
+        }
+        if('\0' == *p) return ESP_ERR_NOT_FOUND;
+        p += sizeof(prefix) - 1;
+        char *end = strchr(p, ',');
+        if(end) *end = '\0';
+        if(0 != sodium_base642bin(digest, FS_HASH_LEN, p, strlen(p), NULL, &bin_len, NULL,
+                    sodium_base64_VARIANT_ORIGINAL) || bin_len != FS_HASH_LEN) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        return ESP_OK;
+    }
+
+    return ESP_ERR_NOT_FOUND;
+}
+
+
+/**
+ * @brief Respond with the rsync-style block signature of a file.
+ *
+ * Response is of form:
+ *     {"size":<file size>,"block":<block size>,"blocks":[{"weak":<u32>,"strong":"<hex>"}, ...]}
+ */
+static esp_err_t http_resp_signature(httpd_req_t *req, const char *filepath)
 {
     esp_err_t err = ESP_FAIL;
     FILE *fd = NULL;
-    char *buf = ((server_ctx_t *)req->user_ctx)->scratch;
+    struct stat file_stat;
+    uint8_t *chunk = (uint8_t *)((server_ctx_t *)req->user_ctx)->scratch;
+    size_t block_size = DELTA_BLOCK_SIZE_DEFAULT;
+    char buf[96];
 
-    char *filepath = get_path_from_uri(req);
+    {
+        char val[12];
+        if(ESP_OK == http_query_get_value(req, "block", val, sizeof(val))) {
+            block_size = strtoul(val, NULL, 10);
+        }
+        if(block_size < DELTA_BLOCK_SIZE_MIN || block_size > CONFIG_SERVER_SCRATCH_BUFSIZE) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid block size");
+            goto exit;
+        }
+    }
 
-    if (!filepath || filepath[strlen(filepath) - 1] == '/') {
-        ESP_LOGE(TAG, "Invalid filepath : %s", filepath);
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Invalid filepath");
+    if(stat(filepath, &file_stat) == -1 || NULL == (fd = fopen(filepath, "r"))) {
+        ESP_LOGE(TAG, "Failed to open file : %s", filepath);
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "File does not exist");
         goto exit;
     }
 
-    // Enable the following if you don't want POST requests to be able to
-    // overwrite existing files.
-#if 0
-    struct stat file_stat;
-    if (stat(filepath, &file_stat) == 0) {
-        ESP_LOGE(TAG, "File already exists : %s", filepath);
-        /* Respond with 400 Bad Request */
-        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "File already exists");
-        goto exit;
+    httpd_resp_set_type(req, "application/json");
+    snprintf(buf, sizeof(buf), "{\"size\":%ld,\"block\":%d,\"blocks\":[", file_stat.st_size, block_size);
+    httpd_resp_sendstr_chunk(req, buf);
+
+    size_t n;
+    bool first_iter = true;
+    while((n = fread(chunk, 1, block_size, fd)) > 0) {
+        uint8_t strong[DELTA_STRONG_LEN];
+        char strong_hex[2 * DELTA_STRONG_LEN + 1];
+
+        delta_strong_checksum(strong, chunk, n);
+        sodium_bin2hex(strong_hex, sizeof(strong_hex), strong, sizeof(strong));
+        snprintf(buf, sizeof(buf), "%s{\"weak\":%u,\"strong\":\"%s\"}",
+                first_iter ? "" : ",", delta_weak_checksum(chunk, n), strong_hex);
+        if(ESP_OK != httpd_resp_sendstr_chunk(req, buf)) {
+            ESP_LOGE(TAG, "Signature sending failed!");
+            goto exit;
+        }
+        first_iter = false;
     }
-#endif
-    ESP_LOGI(TAG, "Content_len: %d", req->content_len);
 
-    /* File cannot be larger than a limit */
-    if (req->content_len > MAX_FILE_SIZE) {
-        ESP_LOGE(TAG, "File too large : %d bytes", req->content_len);
-        /* Respond with 400 Bad Request */
-        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
-                            "File size must be less than "
-                            MAX_FILE_SIZE_STR "!");
-        /* Return failure to close underlying connection else the
-         * incoming file content will keep the socket busy */
-        goto exit;
+    httpd_resp_sendstr_chunk(req, "]}");
+    httpd_resp_sendstr_chunk(req, NULL);
+    err = ESP_OK;
+
+exit:
+    if(fd) fclose(fd);
+    return err;
+}
+
+
+typedef struct delta_apply_ctx {
+    FILE *basis;
+    size_t basis_size;
+    uint8_t *buf;           // Staging buffer for copied blocks
+    size_t buf_len;
+    fs_space_t space;       // Limits on the size of the rebuilt file
+    fs_writer_t w;
+} delta_apply_ctx_t;
+
+static esp_err_t delta_apply_copy(void *ctx, uint32_t offset, uint32_t len)
+{
+    delta_apply_ctx_t *d = ctx;
+    esp_err_t err;
+
+    if(offset >= d->basis_size) {
+        ESP_LOGE(TAG, "Copy offset %u beyond end of basis file", offset);
+        return ESP_ERR_INVALID_ARG;
     }
+    /* The last block of the basis file may be short */
+    len = MIN(len, d->basis_size - offset);
+    if(ESP_OK != (err = fs_space_check(&d->space, d->w.size + len))) return err;
+
+    if(0 != fseek(d->basis, offset, SEEK_SET)) return ESP_FAIL;
+    while(len > 0) {
+        size_t n = fread(d->buf, 1, MIN(len, d->buf_len), d->basis);
+        if(0 == n) return ESP_FAIL;
+        if(ESP_OK != (err = fs_writer_write(&d->w, d->buf, n))) return err;
+        len -= n;
+    }
+    return ESP_OK;
+}
 
-    if(req->content_len == 0) {
-        /* Delete the file. NOTE: this means that we don't allow
-         * the upload of 0-byte files. */
-        err = filesystem_file_delete_handler(req);
+static esp_err_t delta_apply_literal(void *ctx, const uint8_t *data, size_t len)
+{
+    delta_apply_ctx_t *d = ctx;
+    esp_err_t err;
+    if(ESP_OK != (err = fs_space_check(&d->space, d->w.size + len))) return err;
+    return fs_writer_write(&d->w, data, len);
+}
+
+static const delta_ops_t delta_apply_ops = {
+    .copy = delta_apply_copy,
+    .literal = delta_apply_literal,
+};
+
+
+/**
+ * @brief Rebuild `filepath` from its current contents and a delta stream.
+ *
+ * The new version is assembled in a temporary file and renamed into place
+ * only once the entire stream has been applied.
+ *
+ * @param[in] expected SHA-256 the rebuilt file must match. May be NULL.
+ */
+static esp_err_t filesystem_delta_post(httpd_req_t *req, const char *filepath, const uint8_t *expected)
+{
+    esp_err_t err = ESP_FAIL;
+    struct stat file_stat;
+    delta_apply_ctx_t *d = NULL;
+    delta_parser_t parser;
+
+    /* First half of scratch receives the stream, second half stages copies */
+    char *buf = ((server_ctx_t *)req->user_ctx)->scratch;
+    const size_t half = CONFIG_SERVER_SCRATCH_BUFSIZE / 2;
+
+    if(stat(filepath, &file_stat) == -1 || S_ISDIR(file_stat.st_mode)) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Delta basis file does not exist");
         goto exit;
     }
 
-    /* Create folders to path if necessary. */
-    if( 0 != mkdir_p(filepath, true) ) {
-        ESP_LOGE(TAG, "Failed to create directories for: %s", filepath);
-        /* Respond with 500 Internal Server Error */
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to create directories");
+    d = calloc(1, sizeof(delta_apply_ctx_t));
+    if(NULL == d) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
         goto exit;
     }
+    d->basis_size = file_stat.st_size;
+    d->buf = (uint8_t *)buf + half;
+    d->buf_len = half;
 
-    fd = fopen(filepath, "w");
-    if (!fd) {
-        ESP_LOGE(TAG, "Failed to create file : %s", filepath);
-        /* Respond with 500 Internal Server Error */
+    if(NULL == (d->basis = fopen(filepath, "r"))) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to read existing file");
+        goto exit;
+    }
+    if(ESP_OK != fs_writer_open(&d->w, filepath)) {
         httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to create file");
         goto exit;
     }
+    /* The rebuilt size isn't known up front; it's checked as it grows */
+    fs_space_get(filepath, 0, &d->space);
 
-    ESP_LOGI(TAG, "Receiving file : %s...", filepath);
+    delta_parser_init(&parser, &delta_apply_ops, d);
+    if(ESP_OK != http_continue(req)) goto exit;
 
-    /* Retrieve the pointer to scratch buffer for temporary storage */
     int received;
-
-    /* Content length of the request gives
-     * the size of the file being uploaded */
     int remaining = req->content_len;
-
     while (remaining > 0) {
-
-        ESP_LOGI(TAG, "Remaining size : %d", remaining);
-        /* Receive the file part by part into a buffer */
-        if ((received = httpd_req_recv(req, buf, MIN(remaining, CONFIG_SERVER_SCRATCH_BUFSIZE))) <= 0) {
+        if ((received = httpd_req_recv(req, buf, MIN(remaining, half))) <= 0) {
             if (received == HTTPD_SOCK_ERR_TIMEOUT) {
                 /* Retry if timeout occurred */
                 continue;
             }
-
-            /* In case of unrecoverable error,
-             * close and delete the unfinished file*/
-            fclose(fd);
-            unlink(filepath);
-
-            ESP_LOGE(TAG, "File reception failed!");
-            /* Respond with 500 Internal Server Error */
-            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to receive file");
+            ESP_LOGE(TAG, "Delta reception failed!");
+            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to receive delta");
             goto exit;
         }
+        remaining -= received;
 
-        /* Write buffer content to file on storage */
-        if (received && (received != fwrite(buf, 1, received, fd))) {
-            /* Couldn't write everything to file!
-             * Storage may be full? */
-            fclose(fd);
-            unlink(filepath);
-
-            ESP_LOGE(TAG, "File write failed!");
-            /* Respond with 500 Internal Server Error */
-            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to write file to storage");
+        err = delta_parser_feed(&parser, (uint8_t *)buf, received);
+        if(FS_ERR_QUOTA == err || FS_ERR_NO_SPACE == err) {
+            http_resp_no_space(req, err);
+            err = ESP_FAIL;  // Close the connection on the rest of the body
+            goto exit;
+        }
+        else if(ESP_OK != err) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid delta stream");
             goto exit;
         }
+    }
 
-        /* Keep track of remaining size of
-         * the file left to be uploaded */
-        remaining -= received;
+    if(!delta_parser_done(&parser)) {
+        err = ESP_FAIL;
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Truncated delta stream");
+        goto exit;
     }
 
-    /* Close file upon upload completion */
-    fclose(fd);
-    ESP_LOGI(TAG, "File reception complete");
+    /* Release the basis before it gets replaced */
+    fclose(d->basis);
+    d->basis = NULL;
 
-    /* Redirect onto root to see the updated file list */
+    err = fs_writer_commit(&d->w, expected);
+    if(ESP_ERR_INVALID_CRC == err) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Digest mismatch");
+        goto exit;
+    }
+    else if(ESP_OK != err) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to write file to storage");
+        goto exit;
+    }
+
+    ESP_LOGI(TAG, "Rebuilt %s (%d bytes) from a %d byte delta", filepath, d->w.size, req->content_len);
     httpd_resp_set_status(req, "303 See Other");
     httpd_resp_set_hdr(req, "Location", "/api/v1/filesystem/");
     httpd_resp_sendstr(req, "File uploaded successfully");
-
     err = ESP_OK;
 
 exit:
-	if(filepath) {
-        free(filepath);
-	}
-	return err;
+    if(d) {
+        if(d->basis) fclose(d->basis);
+        fs_writer_abort(&d->w);
+        free(d);
+    }
+    return err;
 }
 
 
-esp_err_t filesystem_file_get_handler(httpd_req_t *req)
+/**
+ * @brief true if the request carries "?archive=tar".
+ */
+static bool http_query_is_tar(httpd_req_t *req)
+{
+    char val[8];
+    return ESP_OK == http_query_get_value(req, "archive", val, sizeof(val))
+            && 0 == strcmp(val, "tar");
+}
+
+typedef struct tar_send_ctx {
+    httpd_req_t *req;
+    uint8_t *buf;               // Staging buffer; at least TAR_BLOCK_SIZE
+    size_t buf_len;
+    size_t root_len;            // Length of the archived directory's path, plus '/'
+    char path[MAX_FILE_PATH];   // fs_walk buffer
+    char name[TAR_NAME_MAX];    // Directory entry name, with trailing '/'
+} tar_send_ctx_t;
+
+static esp_err_t tar_send_file(tar_send_ctx_t *t, const char *path, const struct stat *st)
 {
     esp_err_t err = ESP_FAIL;
     FILE *fd = NULL;
-    struct stat file_stat;
-    char *chunk = ((server_ctx_t *)req->user_ctx)->scratch;
-
-    char *filepath = get_path_from_uri(req);
+    size_t remaining = st->st_size;
 
-    if (!filepath) {
-        ESP_LOGE(TAG, "Invalid filepath : %s", filepath);
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Invalid filepath");
+    if(NULL == (fd = fopen(path, "r"))) {
+        ESP_LOGE(TAG, "Failed to open file : %s", path);
         goto exit;
     }
 
-    /* If name has trailing '/', respond with directory contents */
-    if (filepath[strlen(filepath) - 1] == '/') {
-        err = http_resp_dir_html(req, filepath);
+    if(ESP_OK != tar_header_fill(t->buf, path + t->root_len, remaining, false, st->st_mtime)) {
+        ESP_LOGW(TAG, "Name too long for archive, skipping : %s", path);
+        err = ESP_OK;
         goto exit;
     }
+    if(ESP_OK != httpd_resp_send_chunk(t->req, (char *)t->buf, TAR_BLOCK_SIZE)) goto exit;
 
-    if (stat(filepath, &file_stat) == -1) {
-		// TODO: re-enable if useful
-#if 0
-        /* If file not present on filesystem, check if URI
-         * corresponds to one of the hardcoded paths */
-        if (strcmp(filepath, "/index.html") == 0) {
-            err = index_html_get_handler(req);
-            goto exit;
-        } else if (strcmp(filepath, "/favicon.ico") == 0) {
-            err = favicon_get_handler(req);
+    /* Header size is already sent; never send more or less than that */
+    while(remaining > 0) {
+        size_t n = fread(t->buf, 1, MIN(remaining, t->buf_len), fd);
+        if(0 == n) {
+            ESP_LOGE(TAG, "File shrank while archiving : %s", path);
             goto exit;
         }
-#endif
-        ESP_LOGE(TAG, "Failed to stat file : %s", filepath);
-        /* Respond with 404 Not Found */
-        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "File does not exist");
-        goto exit;
+        if(ESP_OK != httpd_resp_send_chunk(t->req, (char *)t->buf, n)) goto exit;
+        remaining -= n;
     }
 
-    fd = fopen(filepath, "r");
-    if (!fd) {
-        ESP_LOGE(TAG, "Failed to read existing file : %s", filepath);
-        /* Respond with 500 Internal Server Error */
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to read existing file");
-        goto exit;
+    if(TAR_PADDING(st->st_size)) {
+        memset(t->buf, 0, TAR_PADDING(st->st_size));
+        if(ESP_OK != httpd_resp_send_chunk(t->req, (char *)t->buf, TAR_PADDING(st->st_size))) goto exit;
     }
+    err = ESP_OK;
 
-    ESP_LOGI(TAG, "Sending file : %s (%ld bytes)...", filepath, file_stat.st_size);
-    set_content_type_from_file(req, filepath);
-
-    /* Retrieve the pointer to scratch buffer for temporary storage */
-    size_t chunksize;
-    do {
-        /* Read file in chunks into the scratch buffer */
-        chunksize = fread(chunk, 1, CONFIG_SERVER_SCRATCH_BUFSIZE, fd);
+exit:
+    if(fd) fclose(fd);
+    return err;
+}
 
-        if (chunksize > 0) {
-            /* Send the buffer contents as HTTP response chunk */
-            if (httpd_resp_send_chunk(req, chunk, chunksize) != ESP_OK) {
-                ESP_LOGE(TAG, "File sending failed!");
-                /* Abort sending file */
-                httpd_resp_sendstr_chunk(req, NULL);
-                /* Respond with 500 Internal Server Error */
-                httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to send file");
-                goto exit;
-           }
-        }
+static esp_err_t tar_send_cb(void *ctx, fs_walk_event_t event, const char *path, const struct stat *st)
+{
+    tar_send_ctx_t *t = ctx;
+
+    switch(event) {
+        case FS_WALK_FILE:
+            if(fs_is_internal_name(strrchr(path, '/') + 1)) return ESP_OK;
+            return tar_send_file(t, path, st);
+        case FS_WALK_DIR:
+            if((size_t)snprintf(t->name, sizeof(t->name), "%s/", path + t->root_len) >= sizeof(t->name)
+                    || ESP_OK != tar_header_fill(t->buf, t->name, 0, true, st->st_mtime)) {
+                ESP_LOGW(TAG, "Name too long for archive, skipping : %s", path);
+                return ESP_OK;
+            }
+            return httpd_resp_send_chunk(t->req, (char *)t->buf, TAR_BLOCK_SIZE);
+        default:
+            return ESP_OK;
+    }
+}
 
-        /* Keep looping till the whole file is sent */
-    } while (chunksize != 0);
+/**
+ * @brief Stream the directory `dirpath` (ending in '/') as a ustar archive.
+ *
+ * Entries are read and sent one scratch buffer at a time, so the archive
+ * never has to fit in memory.
+ */
+static esp_err_t http_resp_dir_tar(httpd_req_t *req, const char *dirpath)
+{
+    esp_err_t err = ESP_FAIL;
+    tar_send_ctx_t *t = NULL;
+    struct stat dir_stat;
 
-    ESP_LOGI(TAG, "File sending complete");
+    if(stat(dirpath, &dir_stat) == -1 || !S_ISDIR(dir_stat.st_mode)) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Directory does not exist");
+        goto exit;
+    }
 
-    /* Respond with an empty chunk to signal HTTP response completion */
-    httpd_resp_send_chunk(req, NULL, 0);
+    t = malloc(sizeof(tar_send_ctx_t));
+    if(NULL == t) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        goto exit;
+    }
+    t->req = req;
+    t->buf = (uint8_t *)((server_ctx_t *)req->user_ctx)->scratch;
+    t->buf_len = FS_IO_CHUNK_SIZE;
+    strlcpy(t->path, dirpath, sizeof(t->path));
+    /* Entry names are relative to, and exclude, the archived directory */
+    t->root_len = strlen(t->path);
+
+    httpd_resp_set_type(req, "application/x-tar");
+
+    if(ESP_OK != fs_walk(t->path, sizeof(t->path), tar_send_cb, t)) {
+        ESP_LOGE(TAG, "Archive sending failed!");
+        /* Returning without the final chunk makes httpd close the socket,
+         * so the client can't mistake a partial archive for a whole one */
+        goto exit;
+    }
 
+    /* End of archive: two zero blocks */
+    memset(t->buf, 0, 2 * TAR_BLOCK_SIZE);
+    httpd_resp_send_chunk(req, (char *)t->buf, 2 * TAR_BLOCK_SIZE);
+    httpd_resp_sendstr_chunk(req, NULL);
     err = ESP_OK;
 
 exit:
-    if(filepath) {
-        free(filepath);
-    }
-    if(fd) {
-        fclose(fd);
-    }
+    free(t);
     return err;
 }
 
 
-esp_err_t filesystem_file_delete_handler(httpd_req_t *req)
-{
-    esp_err_t err = ESP_FAIL;
-    struct stat file_stat;
+typedef struct tar_extract_ctx {
+    size_t root_len;                // Length of the extraction directory's path
+    char path[MAX_FILE_PATH];       // Full path of the current entry
+    char last_dir[MAX_FILE_PATH];   // Most recently created directory
+    fs_writer_t w;
+    fs_space_batch_t space;
+    uint32_t files;
+    uint32_t dirs;
+    size_t bytes;
+} tar_extract_ctx_t;
 
-    char *filepath = get_path_from_uri(req);
+/**
+ * @brief Reject names that would escape the extraction directory or use a
+ * reserved name.
+ */
+static bool tar_name_is_safe(const char *name)
+{
+    if('/' == name[0]) return false;
+    for(const char *p = name; *p; ) {
+        if('.' == p[0] && '.' == p[1] && ('/' == p[2] || '\0' == p[2])) return false;
+        if(fs_is_internal_name(p)) return false;
+        p = strchr(p, '/');
+        if(NULL == p) break;
+        p++;
+    }
+    return true;
+}
 
-    if (!filepath) {
-        /* Respond with 500 Internal Server Error */
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Filename too long");
-        return ESP_FAIL;
+static esp_err_t tar_extract_entry(void *ctx, const char *name, bool is_dir, size_t size)
+{
+    tar_extract_ctx_t *x = ctx;
+    esp_err_t err;
+
+    while('.' == name[0] && '/' == name[1]) name += 2;
+    if('\0' == name[0]) return ESP_OK;  // The archive root itself
+    if(!tar_name_is_safe(name)) {
+        ESP_LOGE(TAG, "Unsafe archive entry : %s", name);
+        return ESP_ERR_INVALID_ARG;
+    }
+    if(strlcpy(x->path + x->root_len, name, sizeof(x->path) - x->root_len)
+            >= sizeof(x->path) - x->root_len) {
+        return ESP_ERR_INVALID_ARG;
     }
 
-    if (stat(filepath, &file_stat) == -1) {
-        ESP_LOGE(TAG, "Does not exist: %s", filepath);
-        /* Respond with 400 Bad Request */
-        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "File/Directory does not exist");
-        goto exit;
+    if(is_dir) {
+        size_t len = strlen(x->path);
+        if('/' == x->path[len - 1]) x->path[len - 1] = '\0';
+        if(0 == strcmp(x->path, x->last_dir)) return ESP_OK;
+        if(ESP_OK != (err = mkdir_p(x->path, false))) return err;
+        strlcpy(x->last_dir, x->path, sizeof(x->last_dir));
+        x->dirs++;
+        return ESP_OK;
     }
 
-    ESP_LOGI(TAG, "Deleting: %s", filepath);
+    if(ESP_OK != (err = fs_space_batch_check(&x->space, x->path, size))) return err;
 
-    /* Delete file */
-    rm_rf(filepath);
+    /* Archives list a directory's files together, so this is usually a no-op */
+    char *sep = strrchr(x->path, '/');
+    *sep = '\0';
+    bool new_dir = 0 != strcmp(x->path, x->last_dir);
+    if(new_dir) strlcpy(x->last_dir, x->path, sizeof(x->last_dir));
+    *sep = '/';
+    if(new_dir && ESP_OK != (err = mkdir_p(x->path, true))) return err;
 
-    /* Redirect onto root to see the updated file list */
-    httpd_resp_set_status(req, "303 See Other");
-    httpd_resp_set_hdr(req, "Location", PROJECT_ROUTE_V1_FILESYSTEM);
-    httpd_resp_sendstr(req, "File deleted successfully");
-	err = ESP_OK;
+    return fs_writer_open(&x->w, x->path);
+}
 
-exit:
-    if(filepath) {
-        free(filepath);
-    }
-    return err;
+static esp_err_t tar_extract_data(void *ctx, const uint8_t *buf, size_t len)
+{
+    tar_extract_ctx_t *x = ctx;
+    return fs_writer_write(&x->w, buf, len);
 }
 
+static esp_err_t tar_extract_entry_end(void *ctx)
+{
+    tar_extract_ctx_t *x = ctx;
+    esp_err_t err;
+
+    /* Directory entries never open the writer */
+    if(NULL == x->w.fd) return ESP_OK;
+    if(ESP_OK != (err = fs_writer_commit(&x->w, NULL))) return err;
+    x->files++;
+    x->bytes += x->w.size;
+    return ESP_OK;
+}
+
+static const tar_ops_t tar_extract_ops = {
+    .entry = tar_extract_entry,
+    .data = tar_extract_data,
+    .entry_end = tar_extract_entry_end,
+};
+
+
+/**
+ * @brief Extract a ustar archive from the request body into `dirpath`.
+ *
+ * Each file is written through a temporary file and renamed into place
+ * once complete, so an interrupted upload never leaves a truncated file.
+ * Files extracted before an error are kept.
+ *
+ * Response is of form:
+ *     {"files":<count>,"dirs":<count>,"bytes":<total file bytes>}
+ */
+static esp_err_t filesystem_tar_post(httpd_req_t *req, const char *dirpath)
+{
+    esp_err_t err = ESP_FAIL;
+    tar_extract_ctx_t *x = NULL;
+    tar_parser_t *parser = NULL;
+    char *buf = ((server_ctx_t *)req->user_ctx)->scratch;
+    char resp[80];
+
+    x = calloc(1, sizeof(tar_extract_ctx_t));
+    parser = malloc(sizeof(tar_parser_t));
+    if(NULL == x || NULL == parser) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        goto exit;
+    }
+    strlcpy(x->path, dirpath, sizeof(x->path));
+    x->root_len = strlen(x->path);
+    if(ESP_OK != mkdir_p(x->path, false)) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to create directory");
+        goto exit;
+    }
+    /* Matches the form entries' parents take, without the trailing '/' */
+    strlcpy(x->last_dir, x->path, sizeof(x->last_dir));
+    x->last_dir[x->root_len - 1] = '\0';
+
+    fs_space_batch_init(&x->space);
+    tar_parser_init(parser, &tar_extract_ops, x);
+    /* Each file is checked against free space and quotas as it arrives */
+    if(ESP_OK != http_continue(req)) goto exit;
+
+    int received;
+    int remaining = req->content_len;
+    while (remaining > 0 && !tar_parser_done(parser)) {
+        if ((received = httpd_req_recv(req, buf, MIN(remaining, CONFIG_SERVER_SCRATCH_BUFSIZE))) <= 0) {
+            if (received == HTTPD_SOCK_ERR_TIMEOUT) {
+                /* Retry if timeout occurred */
+                continue;
+            }
+            ESP_LOGE(TAG, "Archive reception failed!");
+            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to receive archive");
+            goto exit;
+        }
+        remaining -= received;
+
+        err = tar_parser_feed(parser, (uint8_t *)buf, received);
+        if(FS_ERR_QUOTA == err || FS_ERR_NO_SPACE == err) {
+            http_resp_no_space(req, err);
+            err = ESP_FAIL;  // Close the connection on the rest of the body
+            goto exit;
+        }
+        else if(ESP_ERR_INVALID_ARG == err) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid archive");
+            goto exit;
+        }
+        else if(ESP_OK != err) {
+            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to write file to storage");
+            goto exit;
+        }
+    }
+
+    if(!tar_parser_done(parser)) {
+        err = ESP_FAIL;
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Truncated archive");
+        goto exit;
+    }
+
+    ESP_LOGI(TAG, "Extracted %u files (%d bytes) into %s", x->files, x->bytes, dirpath);
+    snprintf(resp, sizeof(resp), "{\"files\":%u,\"dirs\":%u,\"bytes\":%u}",
+            x->files, x->dirs, (unsigned)x->bytes);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_sendstr(req, resp);
+    err = ESP_OK;
+
+exit:
+    if(x) fs_writer_abort(&x->w);
+    free(parser);
+    free(x);
+    return err;
+}
+
+
+/**
+ * @brief Append the request body to `filepath` through its write-back buffer.
+ *
+ * With `?sync` the data is on storage before the response is sent.
+ *
+ * Response is of form:
+ *     {"size":<file size, including still buffered data>}
+ */
+static esp_err_t filesystem_append_post(httpd_req_t *req, const char *filepath)
+{
+    esp_err_t err = ESP_FAIL;
+    struct stat file_stat;
+    size_t size = 0;
+    char *buf = ((server_ctx_t *)req->user_ctx)->scratch;
+    char resp[32];
+
+    if (0 == stat(filepath, &file_stat)) {
+        if (S_ISDIR(file_stat.st_mode)) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Cannot append to a directory");
+            goto exit;
+        }
+        size = file_stat.st_size;
+    }
+    size += append_pending(filepath);
+
+    if (ESP_OK != (err = fs_check_space(filepath, size + req->content_len, size))) {
+        http_resp_no_space(req, err);
+        err = ESP_FAIL;
+        goto exit;
+    }
+    if (0 != mkdir_p(filepath, true)) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to create directories");
+        err = ESP_FAIL;
+        goto exit;
+    }
+    if (ESP_OK != (err = http_continue(req))) goto exit;
+
+    int received;
+    int remaining = req->content_len;
+    while (remaining > 0) {
+        if ((received = httpd_req_recv(req, buf, MIN(remaining, CONFIG_SERVER_SCRATCH_BUFSIZE))) <= 0) {
+            if (received == HTTPD_SOCK_ERR_TIMEOUT) {
+                /* Retry if timeout occurred */
+                continue;
+            }
+            ESP_LOGE(TAG, "Append reception failed!");
+            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to receive data");
+            err = ESP_FAIL;
+            goto exit;
+        }
+        remaining -= received;
+        if (ESP_OK != (err = append_write(filepath, buf, received))) break;
+    }
+    if (ESP_OK == err && http_query_has_key(req, "sync")) {
+        err = append_flush(filepath);
+    }
+    if (FS_ERR_QUOTA == err || FS_ERR_NO_SPACE == err) {
+        http_resp_no_space(req, err);
+        goto exit;
+    }
+    else if (ESP_OK != err) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to write file to storage");
+        goto exit;
+    }
+
+    /* Not size + content_len, the file may have been rotated meanwhile */
+    snprintf(resp, sizeof(resp), "{\"size\":%u}", (unsigned)append_size(filepath));
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_sendstr(req, resp);
+
+exit:
+    return err;
+}
+
+
+esp_err_t filesystem_file_post_handler(httpd_req_t *req)
+{
+    esp_err_t err = ESP_FAIL;
+    fs_writer_t *w = NULL;
+    uint8_t expected[FS_HASH_LEN];
+    bool has_expected = false;
+
+    char *filepath = get_path_from_uri(req);
+
+    if (filepath && filepath[strlen(filepath) - 1] == '/' && http_query_is_tar(req)) {
+        /* Extracted files replace whatever is buffered for them */
+        append_discard(filepath);
+        err = filesystem_tar_post(req, filepath);
+        goto exit;
+    }
+
+    if (!filepath || filepath[strlen(filepath) - 1] == '/') {
+        ESP_LOGE(TAG, "Invalid filepath : %s", filepath);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Invalid filepath");
+        goto exit;
+    }
+    if (path_is_reserved(filepath)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Reserved file name");
+        goto exit;
+    }
+
+    // Enable the following if you don't want POST requests to be able to
+    // overwrite existing files.
+#if 0
+    struct stat file_stat;
+    if (stat(filepath, &file_stat) == 0) {
+        ESP_LOGE(TAG, "File already exists : %s", filepath);
+        /* Respond with 400 Bad Request */
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "File already exists");
+        goto exit;
+    }
+#endif
+    ESP_LOGI(TAG, "Content_len: %d", req->content_len);
+
+    switch(get_expected_digest(req, expected)) {
+        case ESP_OK:
+            has_expected = true;
+            break;
+        case ESP_ERR_NOT_FOUND:
+            break;
+        default:
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Malformed digest header");
+            goto exit;
+    }
+
+    if(http_query_has_key(req, "append")) {
+        err = filesystem_append_post(req, filepath);
+        goto exit;
+    }
+
+    if(http_query_has_key(req, "delta")) {
+        /* The delta applies to the file including anything still buffered */
+        append_flush(filepath);
+        err = filesystem_delta_post(req, filepath, has_expected ? expected : NULL);
+        goto exit;
+    }
+
+    /* Reject bodies that can't be stored before they're sent */
+    if (ESP_OK != (err = fs_check_space(filepath, req->content_len, 0))) {
+        http_resp_no_space(req, err);
+        /* Return failure to close underlying connection else the
+         * incoming file content will keep the socket busy */
+        err = ESP_FAIL;
+        goto exit;
+    }
+
+    if(req->content_len == 0) {
+        /* Delete the file. NOTE: this means that we don't allow
+         * the upload of 0-byte files. */
+        err = filesystem_file_delete_handler(req);
+        goto exit;
+    }
+
+    /* The upload replaces anything still waiting to be appended */
+    append_discard(filepath);
+
+    /* Create folders to path if necessary. */
+    if( 0 != mkdir_p(filepath, true) ) {
+        ESP_LOGE(TAG, "Failed to create directories for: %s", filepath);
+        /* Respond with 500 Internal Server Error */
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to create directories");
+        goto exit;
+    }
+
+    if (NULL == (w = malloc(sizeof(fs_writer_t)))) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        goto exit;
+    }
+    if (ESP_OK != fs_writer_open(w, filepath)) {
+        /* Respond with 500 Internal Server Error */
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to create file");
+        goto exit;
+    }
+
+    ESP_LOGI(TAG, "Receiving file : %s...", filepath);
+    if (ESP_OK != (err = http_continue(req))) goto exit;
+
+    /* Content length of the request gives
+     * the size of the file being uploaded */
+    err = transfer_recv_to_writer(req, w, req->content_len);
+    if (TRANSFER_ERR_NET == err) {
+        /* In case of unrecoverable error, discard the unfinished
+         * file; the previous version remains in place. */
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to receive file");
+        goto exit;
+    }
+    else if (ESP_OK != err) {
+        /* Couldn't write everything to file!
+         * Storage may be full? */
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to write file to storage");
+        goto exit;
+    }
+
+    /* Verify and move the file into place upon upload completion */
+    err = fs_writer_commit(w, has_expected ? expected : NULL);
+    if (ESP_ERR_INVALID_CRC == err) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Digest mismatch");
+        goto exit;
+    }
+    else if (ESP_OK != err) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to write file to storage");
+        goto exit;
+    }
+    ESP_LOGI(TAG, "File reception complete");
+
+    /* Let the client know the digest it can use for conditional requests */
+    char etag[HTTP_ETAG_LEN] = "\"";
+    sodium_bin2hex(etag + 1, 2 * FS_HASH_LEN + 1, w->digest, FS_HASH_LEN);
+    strcat(etag, "\"");
+    httpd_resp_set_hdr(req, "ETag", etag);
+
+    /* Redirect onto root to see the updated file list */
+    httpd_resp_set_status(req, "303 See Other");
+    httpd_resp_set_hdr(req, "Location", "/api/v1/filesystem/");
+    httpd_resp_sendstr(req, "File uploaded successfully");
+
+    err = ESP_OK;
+
+exit:
+    if(w) {
+        fs_writer_abort(w);
+        free(w);
+    }
+	if(filepath) {
+        free(filepath);
+	}
+	return err;
+}
+
+
+esp_err_t filesystem_file_get_handler(httpd_req_t *req)
+{
+    esp_err_t err = ESP_FAIL;
+    FILE *fd = NULL;
+    struct stat file_stat;
+    char etag[HTTP_ETAG_LEN];
+
+    char *filepath = get_path_from_uri(req);
+
+    if (!filepath) {
+        ESP_LOGE(TAG, "Invalid filepath : %s", filepath);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Invalid filepath");
+        goto exit;
+    }
+
+    /* Serve appended data even if it's still buffered */
+    append_flush(filepath);
+
+    /* If name has trailing '/', respond with directory contents */
+    if (filepath[strlen(filepath) - 1] == '/') {
+        if(http_query_is_tar(req)) {
+            err = http_resp_dir_tar(req, filepath);
+            goto exit;
+        }
+        err = http_resp_dir_html(req, filepath);
+        goto exit;
+    }
+
+    if (http_query_has_key(req, "signature")) {
+        err = http_resp_signature(req, filepath);
+        goto exit;
+    }
+
+    if (stat(filepath, &file_stat) == -1) {
+		// TODO: re-enable if useful
+#if 0
+        /* If file not present on filesystem, check if URI
+         * corresponds to one of the hardcoded paths */
+        if (strcmp(filepath, "/index.html") == 0) {
+            err = index_html_get_handler(req);
+            goto exit;
+        } else if (strcmp(filepath, "/favicon.ico") == 0) {
+            err = favicon_get_handler(req);
+            goto exit;
+        }
+#endif
+        ESP_LOGE(TAG, "Failed to stat file : %s", filepath);
+        /* Respond with 404 Not Found */
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "File does not exist");
+        goto exit;
+    }
+
+    set_content_type_from_file(req, filepath);
+
+    if (!S_ISDIR(file_stat.st_mode) && http_resp_from_cache(req, filepath, &file_stat)) {
+        err = ESP_OK;
+        goto exit;
+    }
+
+    fd = fopen(filepath, "r");
+    if (!fd) {
+        ESP_LOGE(TAG, "Failed to read existing file : %s", filepath);
+        /* Respond with 500 Internal Server Error */
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to read existing file");
+        goto exit;
+    }
+    fs_setvbuf(fd);
+
+    if (http_set_etag_from_file(req, filepath, etag)) {
+        ESP_LOGI(TAG, "Not modified : %s", filepath);
+        httpd_resp_set_status(req, "304 Not Modified");
+        httpd_resp_send(req, NULL, 0);
+        err = ESP_OK;
+        goto exit;
+    }
+
+    ESP_LOGI(TAG, "Sending file : %s (%ld bytes)...", filepath, file_stat.st_size);
+
+    if (ESP_OK != transfer_send_file(req, fd)) {
+        /* Abort sending file */
+        httpd_resp_sendstr_chunk(req, NULL);
+        /* Respond with 500 Internal Server Error */
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to send file");
+        goto exit;
+    }
+
+    ESP_LOGI(TAG, "File sending complete");
+
+    /* Respond with an empty chunk to signal HTTP response completion */
+    httpd_resp_send_chunk(req, NULL, 0);
+
+    err = ESP_OK;
+
+exit:
+    if(filepath) {
+        free(filepath);
+    }
+    if(fd) {
+        fclose(fd);
+    }
+    return err;
+}
+
+
+/* Progress callback of background filesystem jobs */
+static esp_err_t fs_job_progress(void *ctx, const fs_rm_stats_t *stats)
+{
+    job_slot_t *job = ctx;
+    jobs_set_progress(job, stats->files + stats->dirs, stats->bytes);
+    return jobs_is_cancelled(job) ? JOBS_ERR_CANCELLED : ESP_OK;
+}
+
+/* Background job deleting the directory `arg` */
+static esp_err_t rm_rf_job(job_slot_t *job, void *arg)
+{
+    fs_rm_stats_t stats;
+    size_t heap_before = esp_get_free_heap_size();
+    /* The low-water mark can't be reset; if the walk set a new one, the
+     * second value is the least free heap seen during it */
+    size_t min_before = heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT);
+    esp_err_t err = rm_rf_progress(arg, &stats, fs_job_progress, job);
+    ESP_LOGI(TAG, "Removed %u files, %u dirs (%u bytes); free heap %u -> %u, minimum %u -> %u",
+            stats.files, stats.dirs, (unsigned)stats.bytes, heap_before, esp_get_free_heap_size(),
+            min_before, heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT));
+    return err;
+}
+
+
+esp_err_t filesystem_file_delete_handler(httpd_req_t *req)
+{
+    esp_err_t err = ESP_FAIL;
+    struct stat file_stat;
+
+    char *filepath = get_path_from_uri(req);
+
+    if (!filepath) {
+        /* Respond with 500 Internal Server Error */
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Filename too long");
+        return ESP_FAIL;
+    }
+
+    append_discard(filepath);
+
+    if (stat(filepath, &file_stat) == -1) {
+        size_t pending;
+        if (ESP_OK == fs_writer_pending(filepath, &pending)) {
+            /* Only an unfinished resumable upload exists; cancel it */
+            ESP_LOGI(TAG, "Discarding unfinished upload: %s", filepath);
+            fs_writer_discard(filepath);
+            httpd_resp_sendstr(req, "Upload discarded");
+            err = ESP_OK;
+            goto exit;
+        }
+        ESP_LOGE(TAG, "Does not exist: %s", filepath);
+        /* Respond with 400 Bad Request */
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "File/Directory does not exist");
+        goto exit;
+    }
+
+    if (S_ISDIR(file_stat.st_mode)) {
+        /* Removing a tree can outlast client timeouts; do it in the background */
+        uint32_t id;
+        char *arg = strdup(filepath);
+        if (NULL == arg || ESP_OK != jobs_submit("delete", filepath, rm_rf_job, arg, &id)) {
+            httpd_resp_set_status(req, "503 Service Unavailable");
+            httpd_resp_sendstr(req, "Too many jobs in progress");
+            goto exit;
+        }
+        ESP_LOGI(TAG, "Deleting directory %s as job %u", filepath, id);
+        err = http_resp_job_accepted(req, id);
+        goto exit;
+    }
+
+    ESP_LOGI(TAG, "Deleting: %s", filepath);
+
+    /* Delete file */
+    if (ESP_OK != rm_rf(filepath, NULL)) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to delete");
+        goto exit;
+    }
+    fs_hash_remove(filepath);
+    fs_writer_discard(filepath);
+
+    /* Redirect onto root to see the updated file list */
+    httpd_resp_set_status(req, "303 See Other");
+    httpd_resp_set_hdr(req, "Location", PROJECT_ROUTE_V1_FILESYSTEM);
+    httpd_resp_sendstr(req, "File deleted successfully");
+	err = ESP_OK;
+
+exit:
+    if(filepath) {
+        free(filepath);
+    }
+    return err;
+}
+
+
+
+/**
+ * @brief Parse the upload range of a PATCH request.
+ *
+ * Accepts either a `Content-Range: bytes <start>-<end>/<total>` header (total
+ * may be `*` if not yet known) or `?offset=<start>[&total=<total>]`.
+ *
+ * @param[out] total Set to -1 if the total size is unknown.
+ * @returns ESP_OK on success, ESP_ERR_NOT_FOUND if no offset was supplied,
+ *          ESP_ERR_INVALID_ARG if it was malformed.
+ */
+static esp_err_t get_upload_range(httpd_req_t *req, long *start, long *total)
+{
+    char val[64];
+    char *end;
+
+    *total = -1;
+
+    if (ESP_OK == httpd_req_get_hdr_value_str(req, "Content-Range", val, sizeof(val))) {
+        long last;
+        char *p = val;
+        if (0 != strncmp(p, "bytes ", 6)) return ESP_ERR_INVALID_ARG;
+        p += 6;
+        *start = strtol(p, &end, 10);
+        if (end == p || *end != '-') return ESP_ERR_INVALID_ARG;
+        p = end + 1;
+        last = strtol(p, &end, 10);
+        if (end == p || *end != '/') return ESP_ERR_INVALID_ARG;
+        if (last - *start + 1 != req->content_len) return ESP_ERR_INVALID_ARG;
+        p = end + 1;
+        if (*p != '*') {
+            *total = strtol(p, &end, 10);
+            if (end == p || *total <= last) return ESP_ERR_INVALID_ARG;
+        }
+        return ESP_OK;
+    }
+
+    if (ESP_OK == http_query_get_value(req, "offset", val, sizeof(val))) {
+        *start = strtol(val, &end, 10);
+        if (end == val || *start < 0) return ESP_ERR_INVALID_ARG;
+        if (ESP_OK == http_query_get_value(req, "total", val, sizeof(val))) {
+            *total = strtol(val, &end, 10);
+            if (end == val || *total < *start + (long)req->content_len) return ESP_ERR_INVALID_ARG;
+        }
+        return ESP_OK;
+    }
+
+    return ESP_ERR_NOT_FOUND;
+}
+
+
+/**
+ * @brief Respond with a status and the current offset of an unfinished upload.
+ */
+static void http_resp_upload_offset(httpd_req_t *req, const char *status, size_t offset)
+{
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%d", offset);
+    httpd_resp_set_status(req, status);
+    httpd_resp_set_hdr(req, "Upload-Offset", buf);
+    httpd_resp_send(req, NULL, 0);
+}
+
+
+esp_err_t filesystem_file_patch_handler(httpd_req_t *req)
+{
+    esp_err_t err = ESP_FAIL;
+    fs_writer_t *w = NULL;
+    long start, total;
+    size_t pending = 0;
+    uint8_t expected[FS_HASH_LEN];
+    bool has_expected = false;
+
+    char *filepath = get_path_from_uri(req);
+
+    if (!filepath || filepath[strlen(filepath) - 1] == '/') {
+        ESP_LOGE(TAG, "Invalid filepath : %s", filepath);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Invalid filepath");
+        goto exit;
+    }
+    if (path_is_reserved(filepath)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Reserved file name");
+        goto exit;
+    }
+
+    if (ESP_OK != get_upload_range(req, &start, &total)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing or invalid Content-Range/offset");
+        goto exit;
+    }
+
+    switch(get_expected_digest(req, expected)) {
+        case ESP_OK:
+            has_expected = true;
+            break;
+        case ESP_ERR_NOT_FOUND:
+            break;
+        default:
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Malformed digest header");
+            goto exit;
+    }
+
+    fs_writer_pending(filepath, &pending);
+    if (start != 0 && start != pending) {
+        /* Client and server disagree; tell the client where to continue */
+        ESP_LOGE(TAG, "Upload offset %ld doesn't match %d bytes received", start, pending);
+        http_resp_upload_offset(req, "409 Conflict", pending);
+        /* A client waiting to send the body won't; don't wait for it */
+        err = http_expects_continue(req) ? ESP_FAIL : ESP_OK;
+        goto exit;
+    }
+
+    /* The temporary file already holds the first `start` bytes */
+    if (ESP_OK != (err = fs_check_space(filepath, MAX(total, start + (long)req->content_len), start))) {
+        http_resp_no_space(req, err);
+        err = ESP_FAIL;
+        goto exit;
+    }
+
+    if (0 == start) append_discard(filepath);
+    if (0 == start && 0 != mkdir_p(filepath, true)) {
+        ESP_LOGE(TAG, "Failed to create directories for: %s", filepath);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to create directories");
+        goto exit;
+    }
+
+    if (NULL == (w = malloc(sizeof(fs_writer_t)))) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        goto exit;
+    }
+    /* An offset of 0 (re)starts the upload */
+    if (0 == start) fs_writer_discard(filepath);
+    err = fs_writer_resume(w, filepath);
+    if (ESP_OK != err) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to create file");
+        goto exit;
+    }
+
+    ESP_LOGI(TAG, "Receiving %d bytes at offset %ld of %s", req->content_len, start, filepath);
+    if (ESP_OK != (err = http_continue(req))) goto exit;
+    err = transfer_recv_to_writer(req, w, req->content_len);
+    if (ESP_OK != err) {
+        /* Keep what made it to storage so the client can resume from there */
+        fs_writer_suspend(w);
+        fs_writer_pending(filepath, &pending);
+        ESP_LOGE(TAG, "Upload interrupted at offset %d", pending);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR,
+                TRANSFER_ERR_NET == err ? "Failed to receive file" : "Failed to write file to storage");
+        goto exit;
+    }
+
+    if (total < 0 || w->size < total) {
+        err = fs_writer_suspend(w);
+        if (ESP_OK != err) {
+            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to write file to storage");
+            goto exit;
+        }
+        http_resp_upload_offset(req, "202 Accepted", w->size);
+        goto exit;
+    }
+
+    /* Final chunk received; verify and move the file into place */
+    err = fs_writer_commit(w, has_expected ? expected : NULL);
+    if (ESP_ERR_INVALID_CRC == err) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Digest mismatch");
+        goto exit;
+    }
+    else if (ESP_OK != err) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to write file to storage");
+        goto exit;
+    }
+
+    ESP_LOGI(TAG, "Resumable upload of %s complete (%d bytes)", filepath, w->size);
+    {
+        char etag[HTTP_ETAG_LEN] = "\"";
+        sodium_bin2hex(etag + 1, 2 * FS_HASH_LEN + 1, w->digest, FS_HASH_LEN);
+        strcat(etag, "\"");
+        httpd_resp_set_hdr(req, "ETag", etag);
+    }
+    httpd_resp_set_status(req, "201 Created");
+    httpd_resp_sendstr(req, "File uploaded successfully");
+
+exit:
+    if (w) {
+        /* Unfinished uploads are suspended above; never throw them away here */
+        free(w);
+    }
+    if (filepath) {
+        free(filepath);
+    }
+    return err;
+}
+
+
+esp_err_t filesystem_file_head_handler(httpd_req_t *req)
+{
+    esp_err_t err = ESP_FAIL;
+    struct stat file_stat;
+    size_t pending;
+    bool exists;
+    char etag[HTTP_ETAG_LEN];
+
+    char *filepath = get_path_from_uri(req);
+
+    if (!filepath) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Invalid filepath");
+        goto exit;
+    }
+
+    append_flush(filepath);
+    exists = (0 == stat(filepath, &file_stat));
+    if (ESP_OK == fs_writer_pending(filepath, &pending)) {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "%d", pending);
+        httpd_resp_set_hdr(req, "Upload-Offset", buf);
+    }
+    else if (!exists) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "File does not exist");
+        goto exit;
+    }
+
+    if (exists) {
+        http_set_etag_from_file(req, filepath, etag);
+    }
+    httpd_resp_send(req, NULL, 0);
+    err = ESP_OK;
+
+exit:
+    if (filepath) {
+        free(filepath);
+    }
+    return err;
+}
+
+
+/**
+ * @brief Get the destination of a COPY/MOVE request as a local path.
+ *
+ * Taken from the `Destination` header, a filesystem URL that may include
+ * scheme and host, or else from `?to=`, a path relative to the filesystem
+ * root; either is percent-decoded. Caller must free the returned string.
+ * NULL if missing or invalid.
+ */
+static char *get_destination_path(httpd_req_t *req)
+{
+    const char *base_path = ((server_ctx_t *)req->user_ctx)->base_path;
+    char *val = NULL, *path = NULL;
+    const char *rel;
+
+    if (NULL == (val = malloc(MAX_FILE_PATH))) goto exit;
+
+    if (ESP_OK == httpd_req_get_hdr_value_str(req, "Destination", val, MAX_FILE_PATH)) {
+        const char *p = strstr(val, "://");
+        /* Skip over scheme and host of an absolute URL */
+        if (p && NULL == (p = strchr(p + 3, '/'))) goto exit;
+        rel = p ? p : val;
+        if (0 != strncmp(rel, PROJECT_ROUTE_V1_FILESYSTEM "/", strlen(PROJECT_ROUTE_V1_FILESYSTEM) + 1)) {
+            goto exit;
+        }
+        rel += strlen(PROJECT_ROUTE_V1_FILESYSTEM) + 1;
+        val[strcspn(val, "?#")] = '\0';
+    }
+    else if (ESP_OK == http_query_get_value(req, "to", val, MAX_FILE_PATH)) {
+        rel = val;
+    }
+    else {
+        goto exit;
+    }
+
+    /* Clients escape spaces and the like in both */
+    if (ESP_OK != http_url_decode((char *)rel)) goto exit;
+    while ('/' == *rel) rel++;
+    if ('\0' == *rel || !tar_name_is_safe(rel)) goto exit;
+
+    if (NULL == (path = malloc(MAX_FILE_PATH))) goto exit;
+    if (snprintf(path, MAX_FILE_PATH, "%s/%s", base_path, rel) >= MAX_FILE_PATH) {
+        free(path);
+        path = NULL;
+        goto exit;
+    }
+    trim_separators(path);
+
+exit:
+    free(val);
+    return path;
+}
+
+
+typedef struct copy_job_arg {
+    char src[MAX_FILE_PATH];
+    char dst[MAX_FILE_PATH];
+} copy_job_arg_t;
+
+/* Background job copying a directory tree */
+static esp_err_t copy_job(job_slot_t *job, void *arg)
+{
+    copy_job_arg_t *a = arg;
+    fs_rm_stats_t stats;
+    esp_err_t err = fs_copy(a->src, a->dst, &stats, fs_job_progress, job);
+    ESP_LOGI(TAG, "Copied %u files, %u dirs (%u bytes) to %s",
+            stats.files, stats.dirs, (unsigned)stats.bytes, a->dst);
+    return err;
+}
+
+
+/**
+ * @brief Remove a trailing '/' so directories compare equal either way.
+ */
+static void strip_trailing_separator(char *path)
+{
+    size_t len = strlen(path);
+    if (len > 1 && '/' == path[len - 1]) path[len - 1] = '\0';
+}
+
+/**
+ * @brief Shared implementation of the COPY and MOVE handlers.
+ */
+static esp_err_t filesystem_copy_move(httpd_req_t *req, bool move)
+{
+    esp_err_t err = ESP_FAIL;
+    const char *base_path = ((server_ctx_t *)req->user_ctx)->base_path;
+    struct stat src_stat, dst_stat;
+    bool dst_exists;
+    char *dst = NULL;
+    char *loc = NULL;
+
+    char *src = get_path_from_uri(req);
+
+    if (!src) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Filename too long");
+        goto exit;
+    }
+    if (NULL == (dst = get_destination_path(req))) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing or invalid Destination");
+        goto exit;
+    }
+    strip_trailing_separator(trim_separators(src));
+    strip_trailing_separator(dst);
+    if (path_is_reserved(src) || path_is_reserved(dst)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Reserved file name");
+        goto exit;
+    }
+
+    if (0 == strcmp(src, base_path)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Cannot copy or move the filesystem root");
+        goto exit;
+    }
+    append_flush(src);
+    if (stat(src, &src_stat) == -1) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "File/Directory does not exist");
+        goto exit;
+    }
+    if (0 == strcmp(src, dst)
+            || (0 == strncmp(dst, src, strlen(src)) && '/' == dst[strlen(src)])) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Destination is the source or inside it");
+        goto exit;
+    }
+    if (0 == strncmp(src, dst, strlen(dst)) && '/' == src[strlen(dst)]) {
+        /* Replacing the destination would delete the source with it */
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Source is inside the destination");
+        goto exit;
+    }
+
+    dst_exists = (0 == stat(dst, &dst_stat));
+    if (dst_exists) {
+        char val[4];
+        if (ESP_OK == httpd_req_get_hdr_value_str(req, "Overwrite", val, sizeof(val))
+                && 0 == strcasecmp(val, "F")) {
+            httpd_resp_set_status(req, "412 Precondition Failed");
+            httpd_resp_sendstr(req, "Destination exists");
+            goto exit;
+        }
+        if (S_ISDIR(src_stat.st_mode) != S_ISDIR(dst_stat.st_mode)) {
+            httpd_resp_set_status(req, "409 Conflict");
+            httpd_resp_sendstr(req, "Destination exists and is of a different type");
+            goto exit;
+        }
+    }
+
+    if (0 != mkdir_p(dst, true)) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to create directories");
+        goto exit;
+    }
+    append_discard(dst);
+
+    if (move) {
+        ESP_LOGI(TAG, "Moving %s -> %s", src, dst);
+        err = fs_move(src, dst);
+        if (ESP_ERR_INVALID_STATE == err) {
+            httpd_resp_set_status(req, "409 Conflict");
+            httpd_resp_sendstr(req, "Destination directory exists");
+            goto exit;
+        }
+    }
+    else if (S_ISDIR(src_stat.st_mode)) {
+        /* Copying a tree can outlast client timeouts; do it in the background */
+        uint32_t id;
+        copy_job_arg_t *arg = malloc(sizeof(copy_job_arg_t));
+        if (NULL == arg) {
+            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+            goto exit;
+        }
+        strlcpy(arg->src, src, sizeof(arg->src));
+        strlcpy(arg->dst, dst, sizeof(arg->dst));
+        if (ESP_OK != jobs_submit("copy", src, copy_job, arg, &id)) {
+            httpd_resp_set_status(req, "503 Service Unavailable");
+            httpd_resp_sendstr(req, "Too many jobs in progress");
+            goto exit;
+        }
+        ESP_LOGI(TAG, "Copying directory %s -> %s as job %u", src, dst, id);
+        err = http_resp_job_accepted(req, id);
+        goto exit;
+    }
+    else {
+        ESP_LOGI(TAG, "Copying %s -> %s", src, dst);
+        err = fs_copy(src, dst, NULL, NULL, NULL);
+        if (FS_ERR_QUOTA == err || FS_ERR_NO_SPACE == err) {
+            http_resp_no_space(req, err);
+            goto exit;
+        }
+    }
+    if (ESP_OK != err) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, move ? "Failed to move" : "Failed to copy");
+        goto exit;
+    }
+
+    if (NULL != (loc = malloc(MAX_FILE_PATH + sizeof(PROJECT_ROUTE_V1_FILESYSTEM)))) {
+        sprintf(loc, PROJECT_ROUTE_V1_FILESYSTEM "%s", dst + strlen(base_path));
+        httpd_resp_set_hdr(req, "Location", loc);
+    }
+    httpd_resp_set_status(req, dst_exists ? "204 No Content" : "201 Created");
+    httpd_resp_send(req, NULL, 0);
+    err = ESP_OK;
+
+exit:
+    free(loc);
+    free(dst);
+    free(src);
+    return err;
+}
+
+esp_err_t filesystem_file_copy_handler(httpd_req_t *req)
+{
+    return filesystem_copy_move(req, false);
+}
+
+esp_err_t filesystem_file_move_handler(httpd_req_t *req)
+{
+    return filesystem_copy_move(req, true);
+}
@@ -10,6 +10,9 @@
 
 #define PROJECT_ROUTE_V1_FILESYSTEM "/api/v1/filesystem"
 
+#define DELTA_BLOCK_SIZE_DEFAULT 1024
+#define DELTA_BLOCK_SIZE_MIN 64
+
 /**
  * @brief Upload/overwrite/deletes file. If content len is 0, deletes file.
  *
@@ -19,6 +22,18 @@
  *     ESP32_IP - IP address of the device
  *     PATH - Path on device
  *     LOCAL_FILE - File to upload
+ *
+ * An existing file can instead be patched with a delta stream (see `delta.h`)
+ * built against its block signature:
+ *
+ *      curl -X POST ${ESP32_IP}/api/v1/filesystem/${PATH}?delta --data-binary @- < ${DELTA_FILE}
+ *
+ * The file is rebuilt into a temporary path and renamed into place once the
+ * whole stream has been applied.
+ *
+ * A ustar archive can be extracted into a directory (trailing '/'):
+ *
+ *      curl -X POST ${ESP32_IP}/api/v1/filesystem/${DIR}/?archive=tar --data-binary @- < ${TAR_FILE}
  */
 esp_err_t filesystem_file_post_handler(httpd_req_t *req);
 
@@ -29,6 +44,17 @@ esp_err_t filesystem_file_post_handler(httpd_req_t *req);
  *     curl ${ESP32_IP}/api/v1/filesystem/${PATH}
  * where:
  *     PATH - Path on device
+ *
+ * The rsync-style block signature of a file, used to build delta uploads,
+ * can be fetched with:
+ *
+ *     curl ${ESP32_IP}/api/v1/filesystem/${PATH}?signature&block=${BLOCK_SIZE}
+ *
+ * BLOCK_SIZE is optional and defaults to DELTA_BLOCK_SIZE_DEFAULT bytes.
+ *
+ * A directory (trailing '/') can be downloaded as a ustar archive with:
+ *
+ *     curl ${ESP32_IP}/api/v1/filesystem/${DIR}/?archive=tar -o ${TAR_FILE}
  */
 esp_err_t filesystem_file_get_handler(httpd_req_t *req);
 
@@ -39,7 +65,68 @@ esp_err_t filesystem_file_get_handler(httpd_req_t *req);
  *     curl -X DELETE ${ESP32_IP}/api/v1/filesystem/${PATH}
  * where:
  *     PATH - Path on device
+ *
+ * Directories are deleted by a background job; the response is
+ * `202 Accepted` with the job's status URL in the `Location` header.
  */
 esp_err_t filesystem_file_delete_handler(httpd_req_t *req);
 
+
+/**
+ * @brief Resumable upload: append a chunk to an unfinished upload.
+ *
+ *     curl -X PATCH ${ESP32_IP}/api/v1/filesystem/${PATH} \
+ *          -H "Content-Range: bytes ${START}-${END}/${TOTAL}" --data-binary @- < ${CHUNK}
+ *
+ * or equivalently `?offset=${START}&total=${TOTAL}`. TOTAL may be `*` (or
+ * omitted) while still unknown. Chunks are appended to a temporary file; once
+ * TOTAL bytes have been received the file is renamed into place.
+ *
+ * An offset of 0 starts a new upload. Any other offset must match the number
+ * of bytes already received, otherwise `409 Conflict` is returned along with
+ * the expected offset in the `Upload-Offset` header.
+ */
+esp_err_t filesystem_file_patch_handler(httpd_req_t *req);
+
+
+/**
+ * @brief Query a file and the progress of an unfinished upload to it.
+ *
+ *     curl -I ${ESP32_IP}/api/v1/filesystem/${PATH}
+ *
+ * Responds with an `Upload-Offset` header if a resumable upload is pending,
+ * and the `ETag` of the committed file if it exists.
+ */
+esp_err_t filesystem_file_head_handler(httpd_req_t *req);
+
+
+/**
+ * @brief Copy a file or directory on the device.
+ *
+ *     curl -X COPY ${ESP32_IP}/api/v1/filesystem/${SRC} \
+ *          -H "Destination: /api/v1/filesystem/${DST}"
+ *
+ * or equivalently `?to=${DST}`, relative to the filesystem root. Data never
+ * leaves the device. An existing destination is replaced unless the request
+ * has `Overwrite: F`, in which case `412 Precondition Failed` is returned.
+ *
+ * Responds `201 Created` (`204 No Content` if the destination was replaced)
+ * with the destination in the `Location` header. Directories are copied by
+ * a background job; the response is then `202 Accepted` as for DELETE.
+ */
+esp_err_t filesystem_file_copy_handler(httpd_req_t *req);
+
+
+/**
+ * @brief Rename a file or directory on the device.
+ *
+ *     curl -X MOVE ${ESP32_IP}/api/v1/filesystem/${SRC} \
+ *          -H "Destination: /api/v1/filesystem/${DST}"
+ *
+ * Same destination rules and responses as COPY. A single `rename`, so the
+ * source disappears and the destination appears in one step. A directory
+ * can't replace an existing one (`409 Conflict`).
+ */
+esp_err_t filesystem_file_move_handler(httpd_req_t *req);
+
 #endif
@@ -0,0 +1,116 @@
+#include "route/v1/jobs.h"
+#include "../../jobs.h"
+#include "sdkconfig.h"
+
+__unused static const char TAG[] = "route/v1/jobs";
+
+
+static cJSON *job_to_json(const job_info_t *info)
+{
+    cJSON *obj = cJSON_CreateObject();
+    if(NULL == obj) return NULL;
+    cJSON_AddNumberToObject(obj, "id", info->id);
+    cJSON_AddStringToObject(obj, "kind", info->kind);
+    cJSON_AddStringToObject(obj, "target", info->target);
+    cJSON_AddStringToObject(obj, "state", jobs_state_str(info->state));
+    cJSON_AddNumberToObject(obj, "items", info->items);
+    cJSON_AddNumberToObject(obj, "bytes", info->bytes);
+    cJSON_AddNumberToObject(obj, "elapsed_ms", info->elapsed_ms);
+    if(JOB_FAILED == info->state) {
+        cJSON_AddStringToObject(obj, "error", esp_err_to_name(info->err));
+    }
+    return obj;
+}
+
+
+/**
+ * @brief Parse the job id following PROJECT_ROUTE_V1_JOBS "/" in the URI.
+ * @returns 0 if there is none.
+ */
+static uint32_t get_id_from_uri(const httpd_req_t *req)
+{
+    const char *p = req->uri + strlen(PROJECT_ROUTE_V1_JOBS);
+    if('/' != *p) return 0;
+    return strtoul(p + 1, NULL, 10);
+}
+
+
+esp_err_t jobs_get_handler(httpd_req_t *req)
+{
+    esp_err_t err = ESP_FAIL;
+    cJSON *root = NULL;
+    char *str = NULL;
+    uint32_t id = get_id_from_uri(req);
+
+    if(0 != id) {
+        job_info_t info;
+        if(ESP_OK != jobs_get(id, &info)) {
+            httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Unknown job");
+            goto exit;
+        }
+        root = job_to_json(&info);
+    }
+    else {
+        job_info_t *infos = malloc(CONFIG_PROJECT_JOBS_HISTORY * sizeof(job_info_t));
+        if(NULL == infos) goto oom;
+        size_t n = jobs_list(infos, CONFIG_PROJECT_JOBS_HISTORY);
+        root = cJSON_CreateObject();
+        cJSON *arr = cJSON_AddArrayToObject(root, "jobs");
+        for(size_t i = 0; arr && i < n; i++) {
+            cJSON_AddItemToArray(arr, job_to_json(&infos[i]));
+        }
+        free(infos);
+    }
+    if(NULL == root || NULL == (str = cJSON_PrintUnformatted(root))) goto oom;
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_sendstr(req, str);
+    err = ESP_OK;
+    goto exit;
+
+oom:
+    httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+
+exit:
+    if(str) free(str);
+    if(root) cJSON_Delete(root);
+    return err;
+}
+
+
+esp_err_t jobs_delete_handler(httpd_req_t *req)
+{
+    switch(jobs_cancel(get_id_from_uri(req))) {
+        case ESP_OK:
+            httpd_resp_set_status(req, "202 Accepted");
+            httpd_resp_sendstr(req, "Job cancellation requested");
+            return ESP_OK;
+        case ESP_ERR_INVALID_STATE:
+            httpd_resp_set_status(req, "409 Conflict");
+            httpd_resp_sendstr(req, "Job already finished");
+            return ESP_OK;
+        default:
+            httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Unknown job");
+            return ESP_FAIL;
+    }
+}
+
+
+esp_err_t http_resp_job_accepted(httpd_req_t *req, uint32_t id)
+{
+    char location[sizeof(PROJECT_ROUTE_V1_JOBS) + 12];
+    char body[64];
+
+    snprintf(location, sizeof(location), PROJECT_ROUTE_V1_JOBS "/%u", id);
+    httpd_resp_set_hdr(req, "Location", location);
+
+    if(detect_if_browser(req)) {
+        httpd_resp_set_status(req, "303 See Other");
+        return httpd_resp_sendstr(req, "Job started");
+    }
+
+    snprintf(body, sizeof(body), "{\"id\":%u,\"href\":\"%s\"}", id, location);
+    httpd_resp_set_status(req, "202 Accepted");
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_sendstr(req, body);
+}
@@ -0,0 +1,44 @@
+/***
+ * Status and cancellation of background jobs (see `jobs.h`).
+ */
+
+#ifndef PROJECT_ROUTE_V1_JOBS_H__
+#define PROJECT_ROUTE_V1_JOBS_H__
+
+#include "route.h"
+
+
+#define PROJECT_ROUTE_V1_JOBS "/api/v1/jobs"
+
+/**
+ * @brief Get the status of every job in the history, or of a single job.
+ *
+ *     curl ${ESP32_IP}/api/v1/jobs
+ *     curl ${ESP32_IP}/api/v1/jobs/${ID}
+ *
+ * A job is of form:
+ *     {"id":3,"kind":"delete","target":"/fs/www","state":"running",
+ *      "items":120,"bytes":48213,"elapsed_ms":850}
+ *
+ * Finished jobs also include an "error" string if they failed.
+ */
+esp_err_t jobs_get_handler(httpd_req_t *req);
+
+
+/**
+ * @brief Cancel a queued or running job
+ *
+ *     curl -X DELETE ${ESP32_IP}/api/v1/jobs/${ID}
+ */
+esp_err_t jobs_delete_handler(httpd_req_t *req);
+
+
+/**
+ * @brief Respond to a request that started job `id`.
+ *
+ * Sends `202 Accepted` with the job's URL in the `Location` header. Browsers
+ * are redirected to it instead.
+ */
+esp_err_t http_resp_job_accepted(httpd_req_t *req, uint32_t id);
+
+#endif
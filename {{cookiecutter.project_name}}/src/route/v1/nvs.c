@@ -1,8 +1,16 @@
 #include "nvs.h"
 #include "nvs_flash.h"
+#include "nvs_cache.h"
+#include "nvs_index.h"
+#include "nvs_snapshot.h"
+#include "nvs_value.h"
+#include "nvs_version.h"
+#include "nvs_wb.h"
 #include "route/v1/nvs.h"
 #include "sodium.h"
 #include "errno.h"
+#include <ctype.h>
+#include <math.h>
 #include <sys/param.h>
 
 // Including NULL-terminator
@@ -16,6 +24,30 @@
 
 #define CJSON_CHECK(x) if(NULL == x) {err = ESP_FAIL; goto exit;}
 
+// Blob bytes encoded per response chunk; a multiple of 3 for base64
+#define NVS_HEX_WINDOW 512
+#define NVS_BASE64_WINDOW 384
+#define NVS_ENC_BUF_SIZE (2 * NVS_HEX_WINDOW + 1)
+
+#define NVS_BASE64_VARIANT sodium_base64_VARIANT_ORIGINAL
+// Whitespace, as isspace() has it; skipped when decoding base64
+#define NVS_BASE64_IGNORE " \t\n\v\f\r"
+
+// Entries per page of a listing; the HTML page shows fewer by default
+#define NVS_LIST_LIMIT_MAX 100
+#define NVS_LIST_LIMIT_MAX_STR "100"
+#define NVS_LIST_HTML_LIMIT 50
+
+// Values with a longer text form are left out of listings
+#define NVS_LIST_VALUE_MAX 256
+
+// Bytes of a per-key upload received at a time
+#define NVS_RECV_WINDOW 1024
+
+// Bytes per NVS entry, and largest chunk of a blob
+#define NVS_ENTRY_SIZE 32
+#define NVS_BLOB_CHUNK_MAX 4000
+
 static const char TAG[] = "route/v1/nvs";
 
 /**
@@ -27,12 +59,14 @@ static uint8_t get_namespace_key_from_uri(char *namespace, char *key, const http
 
     uint8_t res = 0;
     const char *uri = req->uri;
+    const char *end;
 
     ESP_LOGD(TAG, "Parsing %s", uri);
 
     uri += strlen(PROJECT_ROUTE_V1_NVS);
+    end = uri + strcspn(uri, "?");  // Ignore the query string
 
-    if( *uri == '\0' ) {
+    if( uri == end ) {
         /* parsed /api/v1/nvs - no namespace or key to parse */
         return res;
     }
@@ -42,7 +76,7 @@ static uint8_t get_namespace_key_from_uri(char *namespace, char *key, const http
         return res;
     }
     uri++;
-    if( *uri == '\0' ) {
+    if( uri == end ) {
         /* parsed /api/v1/nvs/ - no namespace or key to parse */
         return res;
     }
@@ -53,15 +87,16 @@ static uint8_t get_namespace_key_from_uri(char *namespace, char *key, const http
      */
     res |= PARSE_NAMESPACE;
 
-    char *first_sep = strchr(uri, '/');
+    const char *first_sep = memchr(uri, '/', end - uri);
     if(NULL == first_sep){
         /* parsed /api/v1/nvs/some_namespace */
-        if(strlen(uri) >= NAMESPACE_MAX) {
+        if(end - uri >= NAMESPACE_MAX) {
             ESP_LOGE(TAG, "Namespace \"%s\" too long (must be <%d char)", uri, NAMESPACE_MAX);
             res |= PARSE_ERROR;
             return res;
         }
-        strcpy(namespace, uri);
+        memcpy(namespace, uri, end - uri);
+        namespace[end - uri] = '\0';
         return res;
     }
 
@@ -77,22 +112,23 @@ static uint8_t get_namespace_key_from_uri(char *namespace, char *key, const http
         uri = first_sep + 1;  // skip over the '/'
     }
 
-    if(*uri == '\0') {
+    if(uri == end) {
         return res;
     }
 
     res |= PARSE_KEY;
 
-    char *second_sep = strchr(uri, '/');
+    const char *second_sep = memchr(uri, '/', end - uri);
     if(NULL == second_sep){
         /* parsed /api/v1/nvs/some_namespace/some_key */
-        if(strlen(uri) >= KEY_MAX) {
+        if(end - uri >= KEY_MAX) {
             ESP_LOGE(TAG, "key \"%s\" too long (must be <%d char)", uri, KEY_MAX);
             res |= PARSE_ERROR;
             return res;
         }
         if(key) {
-            strcpy(key, uri);
+            memcpy(key, uri, end - uri);
+            key[end - uri] = '\0';
         }
         return res;
     }
@@ -112,6 +148,12 @@ static uint8_t get_namespace_key_from_uri(char *namespace, char *key, const http
     return res;
 }
 
+static const nvs_type_t nvs_types[] = {
+    NVS_TYPE_U8, NVS_TYPE_I8, NVS_TYPE_U16, NVS_TYPE_I16, NVS_TYPE_U32,
+    NVS_TYPE_I32, NVS_TYPE_U64, NVS_TYPE_I64, NVS_TYPE_STR, NVS_TYPE_BLOB,
+};
+#define NUM_NVS_TYPES (sizeof(nvs_types) / sizeof(nvs_types[0]))
+
 static const char *nvs_type_to_str(nvs_type_t type) {
     switch(type) {
         case NVS_TYPE_U8: return "uint8";
@@ -142,23 +184,111 @@ static size_t nvs_type_to_size(nvs_type_t type) {
     }
 }
 
-static esp_err_t nvs_type_set_number(nvs_handle_t h, nvs_type_t type, const char *key, double val) {
-    esp_err_t err = ESP_FAIL;
-    switch(type) {
-        case NVS_TYPE_U8:  err = nvs_set_u8( h, key, (uint8_t) val); break;
-        case NVS_TYPE_I8:  err = nvs_set_i8( h, key, (int8_t)  val); break;
-        case NVS_TYPE_U16: err = nvs_set_u16(h, key, (uint16_t)val); break;
-        case NVS_TYPE_I16: err = nvs_set_i16(h, key, (int16_t) val); break;
-        case NVS_TYPE_U32: err = nvs_set_u32(h, key, (uint32_t)val); break;
-        case NVS_TYPE_I32: err = nvs_set_i32(h, key, (int32_t) val); break;
-        case NVS_TYPE_U64: err = nvs_set_u64(h, key, (uint64_t)val); break;
-        case NVS_TYPE_I64: err = nvs_set_i64(h, key, (int64_t) val); break;
-        default:
-            break;
+/* How binary values are written as text, chosen by `?encoding=` */
+typedef enum nvs_encoding {
+    NVS_ENCODING_HEX,
+    NVS_ENCODING_BASE64,
+    NVS_ENCODING_RAW,           // The bytes alone as the body; single keys only
+} nvs_encoding_t;
+
+static const char *nvs_encoding_to_str(nvs_encoding_t enc) {
+    switch(enc) {
+        case NVS_ENCODING_BASE64: return "base64";
+        case NVS_ENCODING_RAW: return "raw";
+        default: return "hex";
     }
-    return err;
 }
 
+/**
+ * @brief Parse `?encoding=hex|base64|raw`. Without it, an
+ * application/octet-stream request body is raw and anything else is hex.
+ * Responds with 400 and returns false if it's unknown.
+ */
+static bool nvs_encoding_parse(httpd_req_t *req, nvs_encoding_t *enc)
+{
+    char val[32];
+
+    *enc = NVS_ENCODING_HEX;
+    if(ESP_OK == http_query_get_value(req, "encoding", val, sizeof(val))) {
+        if(0 == strcmp(val, "base64")) *enc = NVS_ENCODING_BASE64;
+        else if(0 == strcmp(val, "raw")) *enc = NVS_ENCODING_RAW;
+        else if(0 != strcmp(val, "hex")) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "encoding must be hex, base64 or raw");
+            return false;
+        }
+    }
+    else if(ESP_OK == httpd_req_get_hdr_value_str(req, "Content-Type", val, sizeof(val))
+            && 0 == strncasecmp(val, "application/octet-stream", 24)) {
+        *enc = NVS_ENCODING_RAW;
+    }
+    return true;
+}
+
+/**
+ * @brief Send the ETag of `namespace`, or of everything if NULL. If it's
+ * what the client already has, respond with 304 Not Modified.
+ * @param[out] etag Must stay valid until the response is sent.
+ * @returns true if the 304 was sent.
+ */
+static bool nvs_not_modified(httpd_req_t *req, const char *namespace, char etag[NVS_ETAG_LEN])
+{
+    nvs_version_etag(namespace, etag);
+    httpd_resp_set_hdr(req, "ETag", etag);
+    if(!http_etag_listed(req, "If-None-Match", etag, true)) return false;
+
+    httpd_resp_set_status(req, "304 Not Modified");
+    httpd_resp_send(req, NULL, 0);
+    return true;
+}
+
+/**
+ * @brief Check an `If-Match` header against the ETag of `namespace`, or of
+ * everything if NULL. Responds with 412 and returns false if it has changed
+ * since the client read it.
+ *
+ * esp_http_server handles one request at a time, so nothing else can change
+ * the namespace through the API between this check and the update.
+ */
+static bool nvs_if_match(httpd_req_t *req, const char *namespace)
+{
+    char etag[NVS_ETAG_LEN];
+    char val[4];
+
+    /* Unconditional */
+    if(ESP_ERR_NOT_FOUND == httpd_req_get_hdr_value_str(req, "If-Match", val, sizeof(val))) return true;
+
+    nvs_version_etag(namespace, etag);
+    if(http_etag_listed(req, "If-Match", etag, false)) return true;
+
+    ESP_LOGW(TAG, "%s changed since the client read it", namespace ? namespace : "NVS");
+    httpd_resp_set_hdr(req, "ETag", etag);
+    httpd_resp_set_status(req, "412 Precondition Failed");
+    httpd_resp_sendstr(req, "Changed since it was read");
+    return false;
+}
+
+/**
+ * @brief Record a change to `namespace` and send its new ETag.
+ * @param[out] etag Must stay valid until the response is sent.
+ */
+static void nvs_changed(httpd_req_t *req, const char *namespace, char etag[NVS_ETAG_LEN])
+{
+    nvs_version_bump(namespace);
+    nvs_version_etag(namespace, etag);
+    httpd_resp_set_hdr(req, "ETag", etag);
+}
+
+/**
+ * @brief Read `key` as clients should see it: its write-behind value if one
+ * is pending, otherwise the value in NVS.
+ */
+static esp_err_t nvs_visible_get(nvs_handle_t h, const char *namespace, const char *key,
+        nvs_type_t type, nvs_value_t *v)
+{
+    esp_err_t err = nvs_wb_get(namespace, key, v);
+    if(ESP_ERR_NOT_FOUND == err) err = nvs_value_get(h, key, type, v);
+    return err;
+}
 
 /**
  * @brief Reads and converts the value to string
@@ -166,15 +296,44 @@ static esp_err_t nvs_type_set_number(nvs_handle_t h, nvs_type_t type, const char
  * @param[in] len Length of output buffer
  * @param[in] namespace 
  * @param[in] key
+ * @param[in] enc How to write binary values; hex or base64.
+ * @param[out] omitted Set if the value didn't fit into `buf`, which is then empty.
  * @return The full length (in bytes) of the data. Returns a negative value on error.
  */
-static int nvs_as_str(char *buf, size_t len, const char *namespace, const char *key, nvs_type_t type)
+static int nvs_as_str(char *buf, size_t len, const char *namespace, const char *key, nvs_type_t type,
+        nvs_encoding_t enc, bool *omitted)
 {
     assert( len > 21 );  // So we don't have to error check number conversions
     int outlen = -1;
     esp_err_t err;
     nvs_handle_t h = 0;
 
+    *omitted = false;
+
+    if(NVS_TYPE_BLOB != type) {
+        nvs_value_t v;
+        if(ESP_OK == nvs_wb_get(namespace, key, &v)) {
+            /* Not in NVS yet */
+            if(NVS_TYPE_STR == v.type) {
+                outlen = v.len;
+                if(v.len > len) {
+                    buf[0] = '\0';
+                    *omitted = true;
+                }
+                else {
+                    memcpy(buf, v.data, v.len);
+                }
+            }
+            else {
+                outlen = nvs_type_to_size(v.type);
+                if(nvs_type_is_signed(v.type)) sprintf(buf, "%lld", v.num.i);
+                else sprintf(buf, "%llu", v.num.u);
+            }
+            nvs_value_free(&v);
+            return outlen;
+        }
+    }
+
     err = nvs_open(namespace, NVS_READONLY, &h);
     if(ESP_OK != err) {
         ESP_LOGE(TAG, "Couldn't open namespace %s", namespace);
@@ -236,7 +395,8 @@ static int nvs_as_str(char *buf, size_t len, const char *namespace, const char *
         case NVS_TYPE_STR: {
             NVS_CHECK(nvs_get_str(h, key, NULL, (size_t *)&outlen));
             if(outlen > len) {
-                strlcpy(buf, "&lt;exceeds buffer length&gt;", len);
+                buf[0] = '\0';
+                *omitted = true;
                 goto exit;
             }
             NVS_CHECK(nvs_get_str(h, key, buf, (size_t *)&outlen));
@@ -244,9 +404,13 @@ static int nvs_as_str(char *buf, size_t len, const char *namespace, const char *
         }
         case NVS_TYPE_BLOB: {
             uint8_t *bin;
+            size_t enc_len;
             NVS_CHECK(nvs_get_blob(h, key, NULL, (size_t *)&outlen));
-            if(outlen > (len-1) / 2) {
-                strlcpy(buf, "&lt;exceeds buffer length&gt;", len);
+            enc_len = NVS_ENCODING_BASE64 == enc
+                ? sodium_base64_ENCODED_LEN(outlen, NVS_BASE64_VARIANT) : 2 * outlen + 1;
+            if(enc_len > len) {
+                buf[0] = '\0';
+                *omitted = true;
                 goto exit;
             }
             if((bin = malloc(outlen)) == NULL) goto exit;
@@ -254,7 +418,8 @@ static int nvs_as_str(char *buf, size_t len, const char *namespace, const char *
                 free(bin);
                 goto exit;
             }
-            sodium_bin2hex(buf, len, bin, outlen);
+            if(NVS_ENCODING_BASE64 == enc) sodium_bin2base64(buf, len, bin, outlen, NVS_BASE64_VARIANT);
+            else sodium_bin2hex(buf, len, bin, outlen);
             free(bin);
             break;
         }
@@ -271,16 +436,99 @@ exit:
 }
 
 
+/**
+ * @brief Respond with a blob as JSON, encoding it a window at a time
+ * straight into the response rather than building the whole string. With
+ * NVS_ENCODING_RAW, the response is the blob alone.
+ *
+ * NVS can only read a blob whole; it's read into the scratch buffer behind
+ * the encoding window when it fits, so only larger blobs cost heap, and only
+ * their own size.
+ *
+ * @param[in] meta Object with the other fields of the response. `size` and
+ * `encoding` are added to it.
+ */
+static esp_err_t nvs_blob_get(httpd_req_t *req, nvs_handle_t h, cJSON *meta, nvs_encoding_t enc)
+{
+    esp_err_t err;
+    char *text = ((server_ctx_t *)req->user_ctx)->scratch;
+    size_t window = NVS_ENCODING_BASE64 == enc ? NVS_BASE64_WINDOW : NVS_HEX_WINDOW;
+    const char *key = cJSON_GetObjectItemCaseSensitive(meta, "key")->valuestring;
+    uint8_t *bin = NULL;
+    bool bin_on_heap = false;
+    char *msg = NULL;
+    size_t size;
+
+    if(ESP_OK != (err = nvs_get_blob(h, key, NULL, &size))) goto exit;
+
+    if(size <= CONFIG_SERVER_SCRATCH_BUFSIZE - NVS_ENC_BUF_SIZE) {
+        bin = (uint8_t *)text + NVS_ENC_BUF_SIZE;
+    }
+    else if(NULL != (bin = malloc(size))) {
+        bin_on_heap = true;
+    }
+    else {
+        ESP_LOGE(TAG, "OOM reading %d byte blob", size);
+        err = ESP_ERR_NO_MEM;
+        goto exit;
+    }
+    if(ESP_OK != (err = nvs_get_blob(h, key, bin, &size))) goto exit;
+
+    if(NVS_ENCODING_RAW == enc) {
+        httpd_resp_set_type(req, "application/octet-stream");
+        err = httpd_resp_send(req, (char *)bin, size);
+        goto exit;
+    }
+
+    /* Send the metadata object without its closing brace, then the value */
+    if(NULL == cJSON_AddNumberToObject(meta, "size", size)
+            || NULL == cJSON_AddStringToObject(meta, "encoding", nvs_encoding_to_str(enc))
+            || NULL == (msg = cJSON_PrintUnformatted(meta))) {
+        err = ESP_FAIL;
+        goto exit;
+    }
+    msg[strlen(msg) - 1] = '\0';
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_sendstr_chunk(req, msg);
+    httpd_resp_sendstr_chunk(req, ",\"value\":\"");
+    for(size_t off = 0; off < size; off += window) {
+        size_t n = MIN(window, size - off);
+        if(NVS_ENCODING_BASE64 == enc) {
+            sodium_bin2base64(text, NVS_ENC_BUF_SIZE, bin + off, n, NVS_BASE64_VARIANT);
+        }
+        else {
+            sodium_bin2hex(text, NVS_ENC_BUF_SIZE, bin + off, n);
+        }
+        if(ESP_OK != (err = httpd_resp_sendstr_chunk(req, text))) {
+            /* Returning without the final chunk makes httpd close the socket */
+            goto exit;
+        }
+    }
+    httpd_resp_sendstr_chunk(req, "\"}");
+    httpd_resp_sendstr_chunk(req, NULL);
+
+exit:
+    if(bin_on_heap) free(bin);
+    if(msg) free(msg);
+    return err;
+}
+
 /**
  * @brief GET handler that responds with json data for a namespace/key
  */
 static esp_err_t nvs_namespace_key_get_handler(httpd_req_t *req, const char *namespace, const char *key) {
     esp_err_t err = ESP_FAIL;
     nvs_entry_info_t info;
+    nvs_encoding_t enc;
+    nvs_value_t v = { 0 };
+    size_t dsize;
     char *msg = NULL;
     cJSON *root = NULL;
+    cJSON *val;
     nvs_handle_t h = 0;
 
+    if(!nvs_encoding_parse(req, &enc)) return ESP_FAIL;
+
     nvs_iterator_t it = nvs_entry_find(NVS_DEFAULT_PART_NAME, namespace, NVS_TYPE_ANY);
     while (it != NULL) {
         nvs_entry_info(it, &info);
@@ -294,6 +542,12 @@ static esp_err_t nvs_namespace_key_get_handler(httpd_req_t *req, const char *nam
         ESP_LOGE(TAG, "Couldn't find %s in namespace %s", key, namespace);
         goto exit;
     }
+    nvs_release_iterator(it);
+
+    if(NVS_ENCODING_RAW == enc && NVS_TYPE_BLOB != info.type) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Only binary values can be sent raw");
+        goto exit;
+    }
 
     root = cJSON_CreateObject();
     CJSON_CHECK(cJSON_AddStringToObject(root, "namespace", namespace));
@@ -305,117 +559,22 @@ static esp_err_t nvs_namespace_key_get_handler(httpd_req_t *req, const char *nam
         goto exit;
     }
 
-    size_t dsize;
-    switch(info.type) {
-        case NVS_TYPE_U8:{
-            uint8_t val;
-            if(ESP_OK != (err = nvs_get_u8(h, key, &val))) goto exit;
-            CJSON_CHECK(cJSON_AddNumberToObject(root, "value", val));
-            dsize = 1;
-            break;
-        }
-        case NVS_TYPE_I8: {
-            int8_t val;
-            if(ESP_OK != (err = nvs_get_i8(h, key, &val))) goto exit;
-            CJSON_CHECK(cJSON_AddNumberToObject(root, "value", val));
-            dsize = 1;
-            break;
-        }
-        case NVS_TYPE_U16: {
-            uint16_t val;
-            if(ESP_OK != (err = nvs_get_u16(h, key, &val))) goto exit;
-            CJSON_CHECK(cJSON_AddNumberToObject(root, "value", val));
-            dsize = 2;
-            break;
-        }
-        case NVS_TYPE_I16: {
-            int16_t val;
-            if(ESP_OK != (err = nvs_get_i16(h, key, &val))) goto exit;
-            CJSON_CHECK(cJSON_AddNumberToObject(root, "value", val));
-            dsize = 2;
-            break;
-        }
-        case NVS_TYPE_U32: {
-            uint32_t val;
-            if(ESP_OK != (err = nvs_get_u32(h, key, &val))) goto exit;
-            CJSON_CHECK(cJSON_AddNumberToObject(root, "value", val));
-            dsize = 4;
-            break;
-        }
-        case NVS_TYPE_I32: {
-            int32_t val;
-            if(ESP_OK != (err = nvs_get_i32(h, key, &val))) goto exit;
-            CJSON_CHECK(cJSON_AddNumberToObject(root, "value", val));
-            dsize = 4;
-            break;
-        }
-        case NVS_TYPE_U64: {
-            uint64_t val;
-            if(ESP_OK != (err = nvs_get_u64(h, key, &val))) goto exit;
-            CJSON_CHECK(cJSON_AddNumberToObject(root, "value", val));
-            dsize = 8;
-            break;
-        }
-        case NVS_TYPE_I64: {
-            int64_t val;
-            if(ESP_OK != (err = nvs_get_i64(h, key, &val))) goto exit;
-            CJSON_CHECK(cJSON_AddNumberToObject(root, "value", val));
-            dsize = 8;
-            break;
-        }
-        case NVS_TYPE_STR: {
-            cJSON *obj;
-            char *val;
-            if(ESP_OK != (err = nvs_get_str(h, key, NULL, &dsize))) goto exit;
-            if(NULL == (val = malloc(dsize))) {
-                ESP_LOGE(TAG, "OOM");
-                err = ESP_FAIL;
-                goto exit;
-            }
-            if(ESP_OK != (err = nvs_get_str(h, key, val, &dsize))) goto exit;
-            obj = cJSON_AddStringToObject(root, "value", val);
-            free(val);
-            if(NULL == obj) {
-                err = ESP_FAIL;
-                goto exit;
-            }
-            break;
-        }
-        case NVS_TYPE_BLOB: {
-            cJSON *obj;
-            char *hex;
-            uint8_t *val;
-            if(ESP_OK != (err = nvs_get_blob(h, key, NULL, &dsize))) goto exit;
-            if(NULL == (val = malloc(dsize))) {
-                ESP_LOGE(TAG, "OOM");
-                err = ESP_FAIL;
-                goto exit;
-            }
-            if(ESP_OK != (err = nvs_get_blob(h, key, val, &dsize))) goto exit;
-
-            size_t hex_len = dsize * 2 + 1;
-            if(NULL == (hex = malloc(hex_len))) {
-                ESP_LOGE(TAG, "OOM");
-                err = ESP_FAIL;
-                free(val);
-                goto exit;
-            }
-
-            sodium_bin2hex(hex, hex_len, val, dsize);
-            obj = cJSON_AddStringToObject(root, "value", hex);
+    if(NVS_TYPE_BLOB == info.type) {
+        err = nvs_blob_get(req, h, root, enc);
+        goto exit;
+    }
 
-            free(val);
-            free(hex);
-            if(NULL == obj) {
-                err = ESP_FAIL;
-                goto exit;
-            }
-            break;
-        }
-        default:
-            // Do Nothing
-            break;
+    if(ESP_OK != (err = nvs_visible_get(h, namespace, key, info.type, &v))) goto exit;
+    if(NVS_TYPE_STR == v.type) {
+        val = cJSON_AddStringToObject(root, "value", v.data);
+        dsize = v.len;
+    }
+    else {
+        val = cJSON_AddNumberToObject(root, "value",
+                nvs_type_is_signed(v.type) ? (double)v.num.i : (double)v.num.u);
+        dsize = nvs_type_to_size(v.type);
     }
+    CJSON_CHECK(val);
 
     cJSON_AddNumberToObject(root, "size", dsize);
 
@@ -426,14 +585,166 @@ static esp_err_t nvs_namespace_key_get_handler(httpd_req_t *req, const char *nam
     }
 
 exit:
+    nvs_value_free(&v);
     if( msg ) free(msg);
     if( root ) cJSON_Delete(root);
     if( h ) nvs_close(h);
     return err;
 }
 
+/* Listing options from the query string */
+typedef struct nvs_list_opts {
+    size_t limit;
+    bool has_cursor;
+    char cursor_ns[NAMESPACE_MAX];      // Only entries after cursor_ns/cursor_key are listed
+    char cursor_key[KEY_MAX];
+    char prefix[KEY_MAX];               // Only keys starting with this are listed
+    nvs_type_t type;                    // NVS_TYPE_ANY for all
+    bool values;                        // Include values
+    nvs_encoding_t enc;                 // Of binary values
+} nvs_list_opts_t;
+
+static bool nvs_type_from_str(const char *str, nvs_type_t *type)
+{
+    for(int i = 0; i < NUM_NVS_TYPES; i++) {
+        if(0 == strcmp(str, nvs_type_to_str(nvs_types[i]))) {
+            *type = nvs_types[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Parse `limit`, `cursor`, `prefix`, `dtype`, `values` and `encoding`
+ * from the query string. Responds with 400 and returns false if any are
+ * invalid.
+ */
+static bool nvs_list_opts_parse(httpd_req_t *req, nvs_list_opts_t *opts, bool serve_html)
+{
+    char val[NAMESPACE_MAX + KEY_MAX + 1];
+
+    memset(opts, 0, sizeof(nvs_list_opts_t));
+    opts->limit = serve_html ? NVS_LIST_HTML_LIMIT : NVS_LIST_LIMIT_MAX;
+    opts->type = NVS_TYPE_ANY;
+    opts->values = true;
+
+    if(ESP_OK == http_query_get_value(req, "limit", val, sizeof(val))) {
+        opts->limit = strtoul(val, NULL, 10);
+        if(opts->limit == 0 || opts->limit > NVS_LIST_LIMIT_MAX) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "limit must be 1-" NVS_LIST_LIMIT_MAX_STR);
+            return false;
+        }
+    }
+    if(ESP_OK == http_query_get_value(req, "cursor", val, sizeof(val))) {
+        /* "<namespace>/<key>" of the last entry of the previous page */
+        char *sep = ESP_OK == http_url_decode(val) ? strchr(val, '/') : NULL;
+        if(NULL == sep || sep - val >= NAMESPACE_MAX || strlen(sep + 1) >= KEY_MAX) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid cursor");
+            return false;
+        }
+        *sep = '\0';
+        strcpy(opts->cursor_ns, val);
+        strcpy(opts->cursor_key, sep + 1);
+        opts->has_cursor = true;
+    }
+    if(ESP_OK == http_query_get_value(req, "prefix", val, sizeof(val))) {
+        if(ESP_OK != http_url_decode(val) || strlen(val) >= KEY_MAX) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "prefix too long");
+            return false;
+        }
+        strcpy(opts->prefix, val);
+    }
+    if(ESP_OK == http_query_get_value(req, "dtype", val, sizeof(val))) {
+        if(!nvs_type_from_str(val, &opts->type)) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Unknown dtype");
+            return false;
+        }
+    }
+    if(ESP_OK == http_query_get_value(req, "values", val, sizeof(val))) {
+        opts->values = 0 != strcmp(val, "false") && 0 != strcmp(val, "0");
+    }
+    if(!nvs_encoding_parse(req, &opts->enc)) return false;
+    if(NVS_ENCODING_RAW == opts->enc) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "raw encoding is only for single keys");
+        return false;
+    }
+    if(serve_html) {
+        /* The page posts edits back as hex */
+        opts->enc = NVS_ENCODING_HEX;
+    }
+    return true;
+}
+
+/**
+ * @brief Order entries by namespace, then key.
+ */
+static int nvs_entry_cmp(const char *ns_a, const char *key_a, const char *ns_b, const char *key_b)
+{
+    int res = strcmp(ns_a, ns_b);
+    return res ? res : strcmp(key_a, key_b);
+}
+
+/**
+ * @brief Collect one page of entries in one walk over NVS.
+ *
+ * NVS iterates in storage order, which changes as entries are rewritten, so
+ * pages are cut from the (namespace, key) order instead: the walk keeps the
+ * `limit` smallest entries after the cursor. This keeps a cursor valid
+ * across writes made between pages.
+ *
+ * @param[out] page Array of `opts->limit` entries, filled in order.
+ * @param[out] more Set if entries remain after the page.
+ * @return Number of entries in `page`.
+ */
+static size_t nvs_list_page(const char *namespace, const nvs_list_opts_t *opts,
+        nvs_entry_info_t *page, bool *more)
+{
+    size_t count = 0;
+    size_t prefix_len = strlen(opts->prefix);
+
+    *more = false;
+
+    nvs_iterator_t it = nvs_entry_find(NVS_DEFAULT_PART_NAME, namespace, opts->type);
+    while (it != NULL) {
+        nvs_entry_info_t info;
+        size_t pos;
+
+        nvs_entry_info(it, &info);
+        it = nvs_entry_next(it);
+
+        if(0 != strncmp(info.key, opts->prefix, prefix_len)) continue;
+        if(opts->has_cursor && nvs_entry_cmp(info.namespace_name, info.key,
+                    opts->cursor_ns, opts->cursor_key) <= 0) {
+            continue;
+        }
+        if(count == opts->limit) {
+            const nvs_entry_info_t *last = &page[count - 1];
+            *more = true;
+            if(nvs_entry_cmp(info.namespace_name, info.key, last->namespace_name, last->key) > 0) {
+                continue;
+            }
+            /* Displaces the largest entry of the page */
+            count--;
+        }
+        for(pos = count; pos > 0; pos--) {
+            const nvs_entry_info_t *prev = &page[pos - 1];
+            if(nvs_entry_cmp(info.namespace_name, info.key, prev->namespace_name, prev->key) > 0) break;
+            page[pos] = *prev;
+        }
+        page[pos] = info;
+        count++;
+    }
+    return count;
+}
+
 /**
  * @brief Render the html table with NVS contents.
+ *
+ * Listings are paginated and filtered as given by nvs_list_opts_parse().
+ * Values whose text form is longer than NVS_LIST_VALUE_MAX are left out in
+ * favor of a link to the key's own URL.
+ *
  * @param[in] req
  * @param[in] namespace Namespace to iterate over. Set to NULL to iterate over
  * all namespaces
@@ -442,6 +753,23 @@ static esp_err_t nvs_namespace_get_handler(httpd_req_t *req, const char *namespa
 {
     esp_err_t err = ESP_FAIL;
     bool serve_html = detect_if_browser(req);
+    nvs_list_opts_t opts;
+    nvs_entry_info_t *page = NULL;
+    size_t count;
+    bool more;
+    char next[NAMESPACE_MAX + KEY_MAX + 1] = { 0 };
+
+    if(!nvs_list_opts_parse(req, &opts, serve_html)) return ESP_FAIL;
+
+    if(NULL == (page = malloc(opts.limit * sizeof(nvs_entry_info_t)))) {
+        ESP_LOGE(TAG, "OOM");
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        return ESP_FAIL;
+    }
+    count = nvs_list_page(namespace, &opts, page, &more);
+    if(more) {
+        snprintf(next, sizeof(next), "%s/%s", page[count - 1].namespace_name, page[count - 1].key);
+    }
 
     if( serve_html ){
         HTTP_SEND_DOCTYPE_HTML(req);
@@ -468,23 +796,24 @@ static esp_err_t nvs_namespace_get_handler(httpd_req_t *req, const char *namespa
             "<tbody>");
     }
     else{
+        httpd_resp_set_type(req, "application/json");
         /* Send JSON Meta */
         httpd_resp_sendstr_chunk(req, "{\"contents\":[");
     }
 
-    nvs_iterator_t it = nvs_entry_find(NVS_DEFAULT_PART_NAME, namespace, NVS_TYPE_ANY);
-    bool first_iter = true;
-    while (it != NULL) {
+    for(size_t i = 0; i < count; i++) {
         int len;
+        bool omitted = false;
         char size_buf[16] = {0};
-        char value_buf[256] = {0};
-        nvs_entry_info_t info;
-        nvs_entry_info(it, &info);
-        it = nvs_entry_next(it);
+        char value_buf[NVS_LIST_VALUE_MAX] = {0};
+        const nvs_entry_info_t *info = &page[i];
 
-        ESP_LOGD(TAG, "key '%s', type '%d'", info.key, info.type);
+        ESP_LOGD(TAG, "key '%s', type '%d'", info->key, info->type);
 
-        len = nvs_as_str(value_buf, sizeof(value_buf), info.namespace_name, info.key, info.type);
+        /* Without values, a minimal buffer still yields the size while
+         * skipping the read of all but tiny strings and blobs */
+        len = nvs_as_str(value_buf, opts.values ? sizeof(value_buf) : 22,
+                info->namespace_name, info->key, info->type, opts.enc, &omitted);
         if(len < 0) {
             ESP_LOGE(TAG, "Unhandled error");
             continue;
@@ -493,56 +822,97 @@ static esp_err_t nvs_namespace_get_handler(httpd_req_t *req, const char *namespa
 
         if(serve_html) {
             httpd_resp_sendstr_chunk(req, "<tr><td>");
+            /* Names may hold any character but NULL; escape them for
+             * markup and percent-encode them in links */
             if(namespace == NULL){
                 /* Hyperlink the namespace */
-                httpd_resp_sendstr_chunk(req, "<a href=\"");
-                httpd_resp_sendstr_chunk(req, req->uri);
-                httpd_resp_sendstr_chunk(req, "/");
-                httpd_resp_sendstr_chunk(req, info.namespace_name);
+                httpd_resp_sendstr_chunk(req, "<a href=\"" PROJECT_ROUTE_V1_NVS "/");
+                http_resp_send_url_chunk(req, info->namespace_name);
                 httpd_resp_sendstr_chunk(req, "\">");
-                httpd_resp_sendstr_chunk(req, info.namespace_name);
+                http_resp_send_html_chunk(req, info->namespace_name);
                 httpd_resp_sendstr_chunk(req, "</a>");
             }
             else{
-                httpd_resp_sendstr_chunk(req, info.namespace_name);
+                http_resp_send_html_chunk(req, info->namespace_name);
             }
             httpd_resp_sendstr_chunk(req, "</td><td>");
-            httpd_resp_sendstr_chunk(req, info.key);
-            httpd_resp_sendstr_chunk(req, "</td><td><input type='text' name='");
-            httpd_resp_sendstr_chunk(req, info.key);
-            httpd_resp_sendstr_chunk(req, "' data-namespace='");
-            httpd_resp_sendstr_chunk(req, info.namespace_name);
-            httpd_resp_sendstr_chunk(req, "' value='");
-            httpd_resp_sendstr_chunk(req, value_buf);
-            httpd_resp_sendstr_chunk(req, "' /></td><td>");
-            httpd_resp_sendstr_chunk(req, nvs_type_to_str(info.type));
+            http_resp_send_html_chunk(req, info->key);
+            if(omitted || !opts.values) {
+                httpd_resp_sendstr_chunk(req, "</td><td><a href=\"" PROJECT_ROUTE_V1_NVS "/");
+                http_resp_send_url_chunk(req, info->namespace_name);
+                httpd_resp_sendstr_chunk(req, "/");
+                http_resp_send_url_chunk(req, info->key);
+                httpd_resp_sendstr_chunk(req, "\">View</a></td><td>");
+            }
+            else {
+                httpd_resp_sendstr_chunk(req, "</td><td><input type='text' name='");
+                http_resp_send_html_chunk(req, info->key);
+                httpd_resp_sendstr_chunk(req, "' data-namespace='");
+                http_resp_send_html_chunk(req, info->namespace_name);
+                httpd_resp_sendstr_chunk(req, "' value='");
+                http_resp_send_html_chunk(req, value_buf);
+                httpd_resp_sendstr_chunk(req, "' /></td><td>");
+            }
+            httpd_resp_sendstr_chunk(req, nvs_type_to_str(info->type));
             httpd_resp_sendstr_chunk(req, "</td><td>");
             httpd_resp_sendstr_chunk(req, size_buf);
             httpd_resp_sendstr_chunk(req, "</td></tr>\n");
         }
         else {
-            if(!first_iter) {
+            /* cJSON takes care of escaping */
+            char *msg = NULL;
+            cJSON *obj = cJSON_CreateObject();
+            CJSON_CHECK(obj);
+            if(NULL == cJSON_AddStringToObject(obj, "namespace", info->namespace_name)
+                    || NULL == cJSON_AddStringToObject(obj, "key", info->key)
+                    || (opts.values && !omitted && NULL == cJSON_AddStringToObject(obj, "value", value_buf))
+                    || NULL == cJSON_AddStringToObject(obj, "dtype", nvs_type_to_str(info->type))
+                    || NULL == cJSON_AddNumberToObject(obj, "size", len)
+                    || NULL == (msg = cJSON_PrintUnformatted(obj))) {
+                cJSON_Delete(obj);
+                err = ESP_FAIL;
+                goto exit;
+            }
+            if(omitted && opts.values) {
+                /* Too large to inline; point at the key's own URL */
+                char href[sizeof(PROJECT_ROUTE_V1_NVS) + NAMESPACE_MAX + KEY_MAX + 2];
+                snprintf(href, sizeof(href), PROJECT_ROUTE_V1_NVS "/%s/%s", info->namespace_name, info->key);
+                cJSON_AddStringToObject(obj, "href", href);
+                free(msg);
+                msg = cJSON_PrintUnformatted(obj);
+            }
+            cJSON_Delete(obj);
+            if(NULL == msg) {
+                err = ESP_FAIL;
+                goto exit;
+            }
+            if(i > 0) {
                 httpd_resp_sendstr_chunk(req, ",");
             }
-            httpd_resp_sendstr_chunk(req, "{\"namespace\":\"");
-            httpd_resp_sendstr_chunk(req, info.namespace_name);
-            httpd_resp_sendstr_chunk(req, "\",\"key\":\"");
-            httpd_resp_sendstr_chunk(req, info.key);
-            httpd_resp_sendstr_chunk(req, "\",\"value\":\"");
-            httpd_resp_sendstr_chunk(req, value_buf);
-            httpd_resp_sendstr_chunk(req, "\",\"dtype\":\"");
-            httpd_resp_sendstr_chunk(req, nvs_type_to_str(info.type));
-            httpd_resp_sendstr_chunk(req, "\",\"size\":");
-            httpd_resp_sendstr_chunk(req, size_buf);
-            httpd_resp_sendstr_chunk(req, "}");
+            httpd_resp_sendstr_chunk(req, msg);
+            free(msg);
         }
-        first_iter = false;
     }
 
     if(serve_html){
         /* Finish the file list table */
         httpd_resp_sendstr_chunk(req, "</tbody></table>");
 
+        if(more) {
+            /* Carry the filters over to the next page */
+            httpd_resp_sendstr_chunk(req, "<p><a href=\"?cursor=");
+            http_resp_send_url_chunk(req, next);
+            if(opts.prefix[0]) {
+                httpd_resp_sendstr_chunk(req, "&amp;prefix=");
+                http_resp_send_url_chunk(req, opts.prefix);
+            }
+            if(NVS_TYPE_ANY != opts.type) {
+                httpd_resp_sendstr_chunk(req, "&amp;dtype=");
+                httpd_resp_sendstr_chunk(req, nvs_type_to_str(opts.type));
+            }
+            httpd_resp_sendstr_chunk(req, "\">Next page</a></p>");
+        }
+
         HTTP_SEND_JS(req, api_v1_nvs);
 
         /* Send remaining chunk of HTML file to complete it */
@@ -551,7 +921,22 @@ static esp_err_t nvs_namespace_get_handler(httpd_req_t *req, const char *namespa
         httpd_resp_sendstr_chunk(req, "</html>");
     }
     else{
-        httpd_resp_sendstr_chunk(req, "]}");
+        httpd_resp_sendstr_chunk(req, "]");
+        if(more) {
+            /* The cursor holds a namespace and key; cJSON escapes them */
+            char *msg = NULL;
+            cJSON *cursor = cJSON_CreateString(next);
+            if(NULL != cursor) msg = cJSON_PrintUnformatted(cursor);
+            cJSON_Delete(cursor);
+            if(NULL == msg) {
+                err = ESP_FAIL;
+                goto exit;
+            }
+            httpd_resp_sendstr_chunk(req, ",\"next\":");
+            httpd_resp_sendstr_chunk(req, msg);
+            free(msg);
+        }
+        httpd_resp_sendstr_chunk(req, "}");
     }
 
     /* Send empty chunk to signal HTTP response completion */
@@ -559,156 +944,1000 @@ static esp_err_t nvs_namespace_get_handler(httpd_req_t *req, const char *namespa
 
     err = ESP_OK;
 
+exit:
+    free(page);
     return err;
 }
 
-esp_err_t nvs_post_handler(httpd_req_t *req)
+/* One key of a POST body on its way to NVS */
+typedef struct nvs_staged {
+    const char *key;
+    nvs_value_t val;            // Value to write
+    nvs_value_t prev;           // Value before the update, restored on failure
+    const char *outcome;        // Reported back to the client
+} nvs_staged_t;
+
+/**
+ * @brief true if the integer part of `val` fits in the numeric `type`.
+ */
+static bool nvs_number_in_range(nvs_type_t type, double val)
 {
-    esp_err_t err = ESP_FAIL;
-    uint8_t res;
-    char namespace[NAMESPACE_MAX] = {0};
-    nvs_handle_t h = 0;
-    nvs_iterator_t it;
-    cJSON *root = NULL;
-    cJSON *elem;
+    int bits = 8 * nvs_type_to_size(type);
+    if(nvs_type_is_signed(type)) {
+        return val > -ldexp(1, bits - 1) - 1 && val < ldexp(1, bits - 1);
+    }
+    return val > -1 && val < ldexp(1, bits);
+}
 
-    res = get_namespace_key_from_uri(namespace, NULL, req);
-    if(res & PARSE_ERROR) {
-        ESP_LOGE(TAG, "Failed to parse namespace");
-        goto exit;
+/**
+ * @brief Convert a JSON value into a value of the given NVS type. Binary
+ * values are decoded per `enc`, hex or base64.
+ * @returns NULL on success, otherwise why the value is invalid.
+ */
+static const char *nvs_stage_value(nvs_value_t *v, nvs_type_t type, const cJSON *item, nvs_encoding_t enc)
+{
+    memset(v, 0, sizeof(nvs_value_t));
+    v->type = type;
+
+    if(type == NVS_TYPE_STR) {
+        if(! cJSON_IsString(item)) return "must be a string";
+        if(NULL == (v->data = strdup(item->valuestring))) return "out of memory";
+        v->len = strlen(item->valuestring) + 1;
     }
-    if(res & PARSE_KEY) {
-        ESP_LOGE(TAG, "Don't supply key in URI");
-        goto exit;
+    else if(type == NVS_TYPE_BLOB && NVS_ENCODING_BASE64 == enc) {
+        size_t b64_len;
+        if(! cJSON_IsString(item)) return "must be a base64 string";
+        b64_len = strlen(item->valuestring);
+        if(NULL == (v->data = malloc(b64_len / 4 * 3 + 3))) return "out of memory";
+        /* Same dialect as nvs_decode() */
+        if(0 != sodium_base642bin(v->data, b64_len / 4 * 3 + 3,
+                    item->valuestring, b64_len, NVS_BASE64_IGNORE, &v->len, NULL, NVS_BASE64_VARIANT)) {
+            return "invalid base64 string";
+        }
     }
-    if(!(res & PARSE_NAMESPACE)) {
-        ESP_LOGE(TAG, "Missing required namespace");
-        goto exit;
+    else if(type == NVS_TYPE_BLOB) {
+        size_t hex_len;
+        if(! cJSON_IsString(item)) return "must be a hex string";
+        hex_len = strlen(item->valuestring);
+        if(NULL == (v->data = malloc(hex_len / 2 + 1))) return "out of memory";
+        if(0 != sodium_hex2bin(v->data, hex_len / 2 + 1,
+                    item->valuestring, hex_len, NULL, &v->len, NULL)) {
+            return "invalid hex string";
+        }
+    }
+    else if(nvs_type_is_number(type)) {
+        double val;
+        if(cJSON_IsString(item)) {
+            errno = 0;
+            char *endptr;
+            val = strtod(item->valuestring, &endptr);
+            if(errno != 0 || endptr == item->valuestring) {
+                return "non-numeric entry for a numeric datatype";
+            }
+        }
+        else if(cJSON_IsNumber(item)) {
+            val = item->valuedouble;
+        }
+        else {
+            return "invalid input";
+        }
+        if(!nvs_number_in_range(type, val)) return "out of range";
+        if(nvs_type_is_signed(type)) v->num.i = (int64_t)val;
+        else v->num.u = (uint64_t)val;
+    }
+    else {
+        return "unsupported datatype";
     }
+    return NULL;
+}
 
-    if(ESP_OK != parse_post_request(&root, req)) goto exit;
+/**
+ * @brief Respond with the outcome of every key of a POST.
+ */
+static esp_err_t nvs_post_report(httpd_req_t *req, const char *status, const char *namespace,
+        bool committed, const nvs_staged_t *staged, size_t n)
+{
+    esp_err_t err = ESP_FAIL;
+    char *msg = NULL;
+    cJSON *root = NULL, *results;
 
-    /* Open the namespace */
-    err = nvs_open(namespace, NVS_READWRITE, &h);
-    if(ESP_OK != err) goto exit;
+    root = cJSON_CreateObject();
+    CJSON_CHECK(root);
+    CJSON_CHECK(cJSON_AddStringToObject(root, "namespace", namespace));
+    CJSON_CHECK(cJSON_AddBoolToObject(root, "committed", committed));
+    results = cJSON_AddObjectToObject(root, "results");
+    CJSON_CHECK(results);
+    for(size_t i = 0; i < n; i++) {
+        CJSON_CHECK(cJSON_AddStringToObject(results, staged[i].key, staged[i].outcome));
+    }
+    msg = cJSON_Print(root);
+    CJSON_CHECK(msg);
 
-    /* Iterate over all provided keys */
-    cJSON_ArrayForEach(elem, root) {
-        nvs_entry_info_t info;
-        char *key = elem->string;
-        bool found = false;
+    httpd_resp_set_status(req, status);
+    httpd_resp_set_type(req, "application/json");
+    err = httpd_resp_sendstr(req, msg);
 
-        cJSON *item;
-        item = cJSON_GetObjectItemCaseSensitive(root, elem->string);
-        if(NULL == item) goto exit;
+exit:
+    if(ESP_OK != err) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to build response");
+    }
+    if( msg ) free(msg);
+    if( root ) cJSON_Delete(root);
+    return err;
+}
 
-        it = nvs_entry_find(NVS_DEFAULT_PART_NAME, namespace, NVS_TYPE_ANY);
+static int hex_digit(char c)
+{
+    if(c >= '0' && c <= '9') return c - '0';
+    if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
 
-        /* Get the info for this particular namespace/key */
-        while (it != NULL) {
-            nvs_entry_info(it, &info);
-            if(0 == strcmp(info.key, key)) {
-                found = true;
-                break;
+static int base64_digit(char c)
+{
+    if(c >= 'A' && c <= 'Z') return c - 'A';
+    if(c >= 'a' && c <= 'z') return c - 'a' + 26;
+    if(c >= '0' && c <= '9') return c - '0' + 52;
+    if(c == '+') return 62;
+    if(c == '/') return 63;
+    return -1;
+}
+
+/* Decodes a hex or base64 body in pieces as it's received */
+typedef struct nvs_decoder {
+    nvs_encoding_t enc;
+    uint32_t acc;               // Bits not yet making up a byte
+    int nbits;
+    size_t digits;
+    size_t pads;                // Base64 '=' seen; nothing but padding may follow
+} nvs_decoder_t;
+
+/**
+ * @brief Decode `n` characters, appending the bytes to `out`.
+ *
+ * Base64 is read as sodium_base642bin() reads NVS_BASE64_VARIANT in JSON
+ * bodies: padded to a multiple of 4 characters, with whitespace ignored.
+ *
+ * @returns false on an invalid character or misplaced padding.
+ */
+static bool nvs_decode(nvs_decoder_t *d, const char *in, size_t n, uint8_t *out, size_t *outlen)
+{
+    bool hex = NVS_ENCODING_HEX == d->enc;
+
+    for(size_t i = 0; i < n; i++) {
+        int digit = hex ? hex_digit(in[i]) : base64_digit(in[i]);
+        if(digit < 0) {
+            /* Allow e.g. the trailing newline of a file */
+            if(isspace((unsigned char)in[i])) continue;
+            if(!hex && '=' == in[i]) {
+                /* Only as many as complete the last group of 4 */
+                if(d->digits % 4 < 2 || 0 == (d->digits + d->pads) % 4) return false;
+                d->pads++;
+                continue;
             }
-            it = nvs_entry_next(it);
+            return false;
         }
-        nvs_release_iterator(it);
-        it = NULL;
-        if(!found) goto exit;
+        if(d->pads) return false;
+
+        d->acc = (d->acc << (hex ? 4 : 6)) | digit;
+        d->nbits += hex ? 4 : 6;
+        d->digits++;
+        if(d->nbits >= 8) {
+            d->nbits -= 8;
+            out[(*outlen)++] = d->acc >> d->nbits;
+            d->acc &= (1 << d->nbits) - 1;
+        }
+    }
+    return true;
+}
 
-        /* Update the found key */
-        if(info.type == NVS_TYPE_STR) {
-            if(! cJSON_IsString(item)) {
-                ESP_LOGE(TAG, "Value for key \"%s\" must be a string", key);
-                httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Must provide a string");
-                err = ESP_FAIL;
-                goto exit;
-            }
-            if(ESP_OK == (err = nvs_set_str(h, key, item->valuestring))){
-                ESP_LOGI(TAG, "Saved string \"%s\" to %s/%s", item->valuestring, namespace, key);
+/**
+ * @brief false if the input stopped partway through a byte or, for base64,
+ * without its padding or with stray bits in its last character.
+ */
+static bool nvs_decode_complete(const nvs_decoder_t *d)
+{
+    if(NVS_ENCODING_HEX == d->enc) return 0 == d->nbits;
+    return 0 == (d->digits + d->pads) % 4 && 0 == d->acc;
+}
+
+/**
+ * @brief Replace a blob with the request body, decoding hex or base64 as it
+ * arrives instead of holding the text. A raw body is received straight into
+ * place.
+ *
+ * The decoded blob goes into the scratch buffer behind the receive window
+ * when it fits; otherwise it's the only heap allocation.
+ */
+static esp_err_t nvs_blob_post(httpd_req_t *req, const char *namespace, const char *key, nvs_encoding_t enc)
+{
+    esp_err_t err = ESP_FAIL;
+    char *buf = ((server_ctx_t *)req->user_ctx)->scratch;
+    nvs_handle_t h = 0;
+    nvs_index_t idx = { 0 };
+    const nvs_index_entry_t *info;
+    nvs_staged_t staged = { .key = key, .outcome = "not applied" };
+    const char *status = "500 Internal Server Error";
+    char etag[NVS_ETAG_LEN];
+    bool bin_on_heap = false;
+    nvs_decoder_t decoder = { .enc = enc };
+    size_t max_len;
+    int received;
+    int remaining = req->content_len;
+
+    if(ESP_OK != (err = nvs_open(namespace, NVS_READWRITE, &h))
+            || ESP_OK != (err = nvs_index_build(&idx, NVS_DEFAULT_PART_NAME, namespace))) {
+        ESP_LOGE(TAG, "Couldn't open namespace %s", namespace);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Couldn't open namespace");
+        goto exit;
+    }
+    if(NULL == (info = nvs_index_find(&idx, key))) {
+        ESP_LOGE(TAG, "Couldn't find %s in namespace %s", key, namespace);
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Key not found");
+        err = ESP_FAIL;
+        goto exit;
+    }
+    if(NVS_TYPE_BLOB != info->type) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
+                "Only binary values can be sent on their own; POST a JSON object to the namespace");
+        err = ESP_FAIL;
+        goto exit;
+    }
+
+    /* Largest value the body could decode to */
+    switch(enc) {
+        case NVS_ENCODING_RAW: max_len = remaining; break;
+        case NVS_ENCODING_BASE64: max_len = remaining / 4 * 3 + 2; break;
+        default: max_len = remaining / 2; break;
+    }
+
+    staged.val.type = NVS_TYPE_BLOB;
+    if(max_len <= CONFIG_SERVER_SCRATCH_BUFSIZE - NVS_RECV_WINDOW) {
+        staged.val.data = buf + NVS_RECV_WINDOW;
+    }
+    else if(NULL != (staged.val.data = malloc(max_len))) {
+        bin_on_heap = true;
+    }
+    else {
+        ESP_LOGE(TAG, "OOM for %d byte blob", max_len);
+        httpd_resp_set_status(req, "413 Payload Too Large");
+        httpd_resp_sendstr(req, "Value too large");
+        err = ESP_ERR_NO_MEM;
+        goto exit;
+    }
+
+    http_continue(req);
+    while(remaining > 0) {
+        char *dst = NVS_ENCODING_RAW == enc ? (char *)staged.val.data + staged.val.len : buf;
+        if((received = httpd_req_recv(req, dst, MIN(remaining, NVS_RECV_WINDOW))) <= 0) {
+            if(received == HTTPD_SOCK_ERR_TIMEOUT) {
+                /* Retry if timeout occurred */
+                continue;
             }
+            ESP_LOGE(TAG, "Blob reception failed!");
+            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to receive value");
+            err = ESP_FAIL;
+            goto exit;
         }
-        else if(info.type == NVS_TYPE_BLOB) {
-            if(! cJSON_IsString(item)) {
-                ESP_LOGE(TAG, "Value for key \"%s\" must be a hex string", key);
-                httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Must provide a valid hex string");
-                err = ESP_FAIL;
-                goto exit;
+        remaining -= received;
+
+        if(NVS_ENCODING_RAW == enc) {
+            staged.val.len += received;
+        }
+        else if(!nvs_decode(&decoder, buf, received, staged.val.data, &staged.val.len)) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
+                    NVS_ENCODING_HEX == enc ? "Invalid hex string" : "Invalid base64 string");
+            err = ESP_FAIL;
+            goto exit;
+        }
+    }
+    if(NVS_ENCODING_RAW != enc && !nvs_decode_complete(&decoder)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
+                NVS_ENCODING_HEX == enc ? "Odd number of hex digits" : "Truncated or badly padded base64 string");
+        err = ESP_FAIL;
+        goto exit;
+    }
+
+    if(ESP_OK != (err = nvs_value_set(h, key, &staged.val)) || ESP_OK != (err = nvs_commit(h))) {
+        ESP_LOGE(TAG, "Failed to save %s/%s: %s", namespace, key, esp_err_to_name(err));
+        staged.outcome = esp_err_to_name(err);
+        /* The old value may be gone */
+        nvs_changed(req, namespace, etag);
+        nvs_post_report(req, status, namespace, false, &staged, 1);
+        goto exit;
+    }
+    nvs_cache_update(namespace, key, &staged.val);
+    nvs_changed(req, namespace, etag);
+    ESP_LOGI(TAG, "Saved %d byte blob to %s/%s", staged.val.len, namespace, key);
+
+    staged.outcome = "ok";
+    nvs_post_report(req, "200 OK", namespace, true, &staged, 1);
+
+exit:
+    if(bin_on_heap) free(staged.val.data);
+    if( h ) nvs_close(h);
+    nvs_index_free(&idx);
+    return err;
+}
+
+/**
+ * @brief Stream every entry of `namespace`, or of all namespaces if NULL,
+ * as a snapshot (see nvs_snapshot.h).
+ */
+static esp_err_t nvs_snapshot_get(httpd_req_t *req, const char *namespace)
+{
+    esp_err_t err = ESP_OK;
+    uint8_t record[NVS_SNAPSHOT_RECORD_MAX];
+    size_t count = 0;
+
+    /* Export what clients see, including values still held back */
+    nvs_wb_flush(namespace);
+
+    httpd_resp_set_type(req, "application/octet-stream");
+    httpd_resp_set_hdr(req, "Content-Disposition", "attachment; filename=\"nvs.snapshot\"");
+    httpd_resp_send_chunk(req, NVS_SNAPSHOT_MAGIC, NVS_SNAPSHOT_MAGIC_LEN);
+
+    nvs_iterator_t it = nvs_entry_find(NVS_DEFAULT_PART_NAME, namespace, NVS_TYPE_ANY);
+    while (it != NULL && ESP_OK == err) {
+        nvs_entry_info_t info;
+        nvs_handle_t h;
+        nvs_value_t v;
+
+        nvs_entry_info(it, &info);
+        it = nvs_entry_next(it);
+
+        if(nvs_snapshot_excluded(info.namespace_name)) continue;
+
+        if(ESP_OK != (err = nvs_open(info.namespace_name, NVS_READONLY, &h))) break;
+        err = nvs_value_get(h, info.key, info.type, &v);
+        nvs_close(h);
+        if(ESP_OK != err) {
+            ESP_LOGE(TAG, "Couldn't read %s/%s", info.namespace_name, info.key);
+            break;
+        }
+
+        err = httpd_resp_send_chunk(req, (char *)record,
+                nvs_snapshot_encode(record, info.namespace_name, info.key, &v));
+        if(ESP_OK == err && v.data) err = httpd_resp_send_chunk(req, v.data, v.len);
+        nvs_value_free(&v);
+        count++;
+    }
+    nvs_release_iterator(it);
+
+    if(ESP_OK != err) {
+        /* Returning without the end marker and final chunk makes httpd
+         * close the socket; the client is left with a truncated snapshot */
+        ESP_LOGE(TAG, "Snapshot failed: %s", esp_err_to_name(err));
+        return ESP_FAIL;
+    }
+
+    httpd_resp_send_chunk(req, "", 1);  // End marker
+    httpd_resp_send_chunk(req, NULL, 0);
+    ESP_LOGI(TAG, "Exported %d entries", count);
+    return ESP_OK;
+}
+
+/* A namespace touched by a snapshot restore */
+typedef struct nvs_snapshot_ns {
+    char name[NAMESPACE_MAX];
+    nvs_handle_t h;
+    nvs_index_t idx;            // Keys and types before the restore
+} nvs_snapshot_ns_t;
+
+/* One entry of a snapshot restore */
+typedef struct nvs_snapshot_item {
+    nvs_snapshot_entry_t entry;
+    nvs_snapshot_ns_t *ns;
+    nvs_value_t prev;           // Value before the restore; NVS_TYPE_ANY if absent
+    bool erase_first;           // The key exists with another type
+} nvs_snapshot_item_t;
+
+/**
+ * @brief Undo a snapshot restore's writes to the first `applied` items.
+ */
+static void nvs_snapshot_rollback(nvs_snapshot_item_t *items, size_t applied)
+{
+    /* In reverse, so a key given twice ends up at its original value */
+    while(applied > 0) {
+        nvs_snapshot_item_t *item = &items[--applied];
+        nvs_erase_key(item->ns->h, item->entry.key);
+        if(NVS_TYPE_ANY != item->prev.type
+                && ESP_OK != nvs_value_set(item->ns->h, item->entry.key, &item->prev)) {
+            ESP_LOGE(TAG, "Failed to restore %s/%s", item->ns->name, item->entry.key);
+        }
+    }
+}
+
+/**
+ * @brief Restore a snapshot from the request body in one all-or-nothing
+ * pass. Keys not in the snapshot are left alone.
+ */
+static esp_err_t nvs_snapshot_post(httpd_req_t *req)
+{
+    esp_err_t err = ESP_FAIL;
+    uint8_t *buf = NULL;
+    nvs_snapshot_reader_t reader;
+    nvs_snapshot_entry_t entry;
+    nvs_snapshot_item_t *items = NULL;
+    nvs_snapshot_ns_t *namespaces = NULL;
+    size_t count = 0, num_namespaces = 0, applied = 0;
+    const char *error = NULL;
+    char etag[NVS_ETAG_LEN];
+    int received;
+    int remaining = req->content_len;
+
+    if(req->content_len > NVS_SNAPSHOT_MAX) {
+        httpd_resp_set_status(req, "413 Payload Too Large");
+        httpd_resp_sendstr(req, "Snapshot too large");
+        return ESP_FAIL;
+    }
+    if(NULL == (buf = malloc(req->content_len ? req->content_len : 1))) {
+        ESP_LOGE(TAG, "OOM");
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        return ESP_FAIL;
+    }
+
+    http_continue(req);
+    while(remaining > 0) {
+        if((received = httpd_req_recv(req, (char *)buf + req->content_len - remaining, remaining)) <= 0) {
+            if(received == HTTPD_SOCK_ERR_TIMEOUT) {
+                /* Retry if timeout occurred */
+                continue;
             }
+            ESP_LOGE(TAG, "Snapshot reception failed!");
+            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to receive snapshot");
+            goto exit;
+        }
+        remaining -= received;
+    }
 
-            size_t bin_actual_len;
-            size_t bin_buf_len = strlen(item->valuestring) / 2;
-            uint8_t *bin;
-            if(NULL == (bin = malloc(bin_buf_len))) {
-                ESP_LOGE(TAG, "OOM");
+    /* Validate the whole snapshot before touching NVS */
+    if(ESP_OK != nvs_snapshot_reader_init(&reader, buf, req->content_len)) {
+        error = "Not a snapshot";
+        goto invalid;
+    }
+    while(ESP_OK == (err = nvs_snapshot_next(&reader, &entry))) {
+        if(nvs_snapshot_excluded(entry.namespace)) {
+            error = "Snapshot includes a per-device namespace";
+            goto invalid;
+        }
+        count++;
+    }
+    if(ESP_ERR_NOT_FOUND != err) {
+        error = "Malformed or truncated snapshot";
+        goto invalid;
+    }
+
+    items = calloc(count ? count : 1, sizeof(nvs_snapshot_item_t));
+    namespaces = calloc(count ? count : 1, sizeof(nvs_snapshot_ns_t));
+    if(NULL == items || NULL == namespaces) {
+        ESP_LOGE(TAG, "OOM");
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        err = ESP_ERR_NO_MEM;
+        goto exit;
+    }
+
+    /* Pending write-behind values would otherwise land on top of the
+     * restored ones */
+    nvs_wb_flush(NULL);
+
+    /* Open each namespace once and capture the values about to change */
+    nvs_snapshot_reader_init(&reader, buf, req->content_len);
+    for(size_t i = 0; i < count; i++) {
+        nvs_snapshot_item_t *item = &items[i];
+        const nvs_index_entry_t *info;
+
+        nvs_snapshot_next(&reader, &item->entry);
+        item->prev.type = NVS_TYPE_ANY;
+
+        for(size_t j = 0; j < num_namespaces && NULL == item->ns; j++) {
+            if(0 == strcmp(namespaces[j].name, item->entry.namespace)) item->ns = &namespaces[j];
+        }
+        if(NULL == item->ns) {
+            nvs_snapshot_ns_t *ns = &namespaces[num_namespaces];
+            strcpy(ns->name, item->entry.namespace);
+            if(ESP_OK != (err = nvs_open(ns->name, NVS_READWRITE, &ns->h))
+                    || ESP_OK != (err = nvs_index_build(&ns->idx, NVS_DEFAULT_PART_NAME, ns->name))) {
+                ESP_LOGE(TAG, "Couldn't open namespace %s", ns->name);
+                httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Couldn't open namespace");
+                num_namespaces++;  // Close it on exit
                 goto exit;
             }
+            item->ns = ns;
+            num_namespaces++;
+        }
 
-            int res;
-            res = sodium_hex2bin(bin, bin_buf_len, 
-                    item->valuestring, strlen(item->valuestring),
-                    NULL, &bin_actual_len, NULL);
-            if(res != 0) {
-                ESP_LOGE(TAG, "Failed to convert hexstring to bin");
-                free(bin);
-                httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Failed to convert hexstring to bin");
-                err = ESP_FAIL;
+        if(NULL != (info = nvs_index_find(&item->ns->idx, item->entry.key))) {
+            if(ESP_OK != (err = nvs_value_get(item->ns->h, item->entry.key, info->type, &item->prev))) {
+                ESP_LOGE(TAG, "Couldn't read %s/%s", item->ns->name, item->entry.key);
+                httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Couldn't read current value");
                 goto exit;
             }
-            if( ESP_OK == (err = nvs_set_blob(h, key, bin, bin_actual_len))) {
-                ESP_LOGI(TAG, "Saved blob \"%s\" to %s/%s", item->valuestring, namespace, key);
-            }
-            free(bin);
+            item->erase_first = info->type != item->entry.val.type;
         }
-        else {
-            double val;
-            if(cJSON_IsString(item)) {
-                errno = 0;
-                char *endptr;
-                val = strtod(item->valuestring, &endptr);
-                if(errno != 0 || endptr == item->valuestring) {
-                    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Non-numeric entry for a numeric datatype");
-                    ESP_LOGE(TAG, "Non-numeric entry for a numeric datatype");
-                    err = ESP_FAIL;
-                    goto exit;
-                }
+    }
+
+    /* Apply */
+    for(applied = 0; applied < count; applied++) {
+        nvs_snapshot_item_t *item = &items[applied];
+        if(item->erase_first) nvs_erase_key(item->ns->h, item->entry.key);
+        if(ESP_OK != (err = nvs_value_set(item->ns->h, item->entry.key, &item->entry.val))) {
+            ESP_LOGE(TAG, "Failed to save %s/%s: %s", item->ns->name, item->entry.key, esp_err_to_name(err));
+            applied++;  // May have been partially applied by the erase
+            break;
+        }
+    }
+    for(size_t j = 0; ESP_OK == err && j < num_namespaces; j++) {
+        err = nvs_commit(namespaces[j].h);
+    }
+    if(ESP_OK != err) {
+        nvs_snapshot_rollback(items, applied);
+        for(size_t j = 0; j < num_namespaces; j++) {
+            nvs_commit(namespaces[j].h);
+            /* In case the rollback wasn't perfect */
+            nvs_version_bump(namespaces[j].name);
+        }
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Restore failed; rolled back");
+        goto exit;
+    }
+
+    for(size_t i = 0; i < count; i++) {
+        nvs_cache_update(items[i].ns->name, items[i].entry.key, &items[i].entry.val);
+    }
+    for(size_t j = 0; j < num_namespaces; j++) nvs_version_bump(namespaces[j].name);
+    nvs_version_etag(NULL, etag);
+    httpd_resp_set_hdr(req, "ETag", etag);
+    ESP_LOGI(TAG, "Restored %d entries in %d namespaces", count, num_namespaces);
+    {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "{\"committed\":true,\"entries\":%d,\"namespaces\":%d}",
+                count, num_namespaces);
+        httpd_resp_set_type(req, "application/json");
+        httpd_resp_sendstr(req, msg);
+    }
+    err = ESP_OK;
+    goto exit;
+
+invalid:
+    ESP_LOGE(TAG, "%s", error);
+    httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, error);
+    err = ESP_FAIL;
+
+exit:
+    if(items) {
+        for(size_t i = 0; i < count; i++) nvs_value_free(&items[i].prev);
+        free(items);
+    }
+    if(namespaces) {
+        for(size_t j = 0; j < num_namespaces; j++) {
+            if(namespaces[j].h) nvs_close(namespaces[j].h);
+            nvs_index_free(&namespaces[j].idx);
+        }
+        free(namespaces);
+    }
+    free(buf);
+    return err;
+}
+
+/**
+ * @brief true if the request asks for `?format=snapshot`.
+ */
+static bool nvs_wants_snapshot(httpd_req_t *req)
+{
+    char val[16];
+    return ESP_OK == http_query_get_value(req, "format", val, sizeof(val))
+        && 0 == strcmp(val, "snapshot");
+}
+
+esp_err_t nvs_post_handler(httpd_req_t *req)
+{
+    esp_err_t err = ESP_FAIL;
+    uint8_t res;
+    char namespace[NAMESPACE_MAX] = {0};
+    char key[KEY_MAX] = {0};
+    nvs_handle_t h = 0;
+    nvs_index_t idx = { 0 };
+    nvs_staged_t *staged = NULL;
+    size_t n = 0, applied = 0, held = 0;
+    const char *status = "200 OK";
+    bool committed = false;
+    nvs_encoding_t enc;
+    char etag[NVS_ETAG_LEN];
+    cJSON *root = NULL;
+    cJSON *elem;
+
+    res = get_namespace_key_from_uri(namespace, key, req);
+    if(res & PARSE_ERROR) {
+        ESP_LOGE(TAG, "Failed to parse namespace");
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid namespace");
+        goto exit;
+    }
+    if(!nvs_if_match(req, (res & PARSE_NAMESPACE) ? namespace : NULL)) goto exit;
+    if(nvs_wants_snapshot(req)) {
+        if(res & PARSE_NAMESPACE) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "POST snapshots to " PROJECT_ROUTE_V1_NVS);
+            goto exit;
+        }
+        return nvs_snapshot_post(req);
+    }
+    if(!nvs_encoding_parse(req, &enc)) goto exit;
+    if(res & PARSE_KEY) {
+        /* A single blob, sent as the whole body */
+        return nvs_blob_post(req, namespace, key, enc);
+    }
+    if(NVS_ENCODING_RAW == enc) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "raw encoding is only for single keys");
+        goto exit;
+    }
+    if(!(res & PARSE_NAMESPACE)) {
+        ESP_LOGE(TAG, "Missing required namespace");
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing required namespace");
+        goto exit;
+    }
+
+    if(ESP_OK != parse_post_request(&root, req)) goto exit;
+    if(!cJSON_IsObject(root)) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Expected a JSON object");
+        goto exit;
+    }
+
+    /* Open the namespace */
+    if(ESP_OK != (err = nvs_open(namespace, NVS_READWRITE, &h))
+            /* Walk the namespace once to learn every key's type, rather than
+             * once per provided key */
+            || ESP_OK != (err = nvs_index_build(&idx, NVS_DEFAULT_PART_NAME, namespace))) {
+        ESP_LOGE(TAG, "Couldn't open namespace %s", namespace);
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Couldn't open namespace");
+        goto exit;
+    }
+
+    n = cJSON_GetArraySize(root);
+    if(NULL == (staged = calloc(n ? n : 1, sizeof(nvs_staged_t)))) {
+        ESP_LOGE(TAG, "OOM");
+        err = ESP_ERR_NO_MEM;
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
+        goto exit;
+    }
+
+    /* Validate the whole body and capture the current values before
+     * writing anything */
+    {
+        size_t i = 0;
+        cJSON_ArrayForEach(elem, root) {
+            nvs_staged_t *s = &staged[i++];
+            const nvs_index_entry_t *info;
+            const char *reason;
+
+            s->key = elem->string;
+            s->outcome = "not applied";
+
+            if(NULL == (info = nvs_index_find(&idx, s->key))) {
+                ESP_LOGE(TAG, "Couldn't find %s in namespace %s", s->key, namespace);
+                s->outcome = "not found";
+                status = "400 Bad Request";
             }
-            else if(cJSON_IsNumber(item)) {
-                val = item->valuedouble;
+            else if(NULL != (reason = nvs_stage_value(&s->val, info->type, elem, enc))) {
+                ESP_LOGE(TAG, "Invalid value for %s/%s: %s", namespace, s->key, reason);
+                s->outcome = reason;
+                status = "400 Bad Request";
             }
-            else {
-                httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid input");
-                err = ESP_FAIL;
-                goto exit;
+            else if(ESP_OK != (err = nvs_visible_get(h, namespace, s->key, info->type, &s->prev))) {
+                ESP_LOGE(TAG, "Couldn't read %s/%s", namespace, s->key);
+                s->outcome = "failed to read current value";
+                status = "500 Internal Server Error";
             }
+        }
+        if(0 != strcmp(status, "200 OK")) {
+            err = ESP_FAIL;
+            goto exit;
+        }
+    }
+
+    if(nvs_wb_has_namespace(namespace)) {
+        /* Blobs aren't held back; a batch with one is written directly */
+        bool hold = true;
+        for(size_t i = 0; i < n; i++) {
+            if(NVS_TYPE_BLOB == staged[i].val.type) hold = false;
+        }
 
-            if( ESP_OK == (err = nvs_type_set_number(h, info.type, key, val))) {
-                ESP_LOGI(TAG, "Saved number %lf to %s/%s", val, namespace, key);
+        /* Hold the values back so rapid updates cost one flash write */
+        for(held = 0; hold && held < n; held++) {
+            if(ESP_OK != nvs_wb_write(namespace, staged[held].key, &staged[held].val)) break;
+        }
+        if(held == n) {
+            for(size_t i = 0; i < n; i++) {
+                staged[i].outcome = "pending";
+                nvs_cache_update(namespace, staged[i].key, &staged[i].val);
             }
+            ESP_LOGD(TAG, "Holding %d keys of %s", n, namespace);
+            nvs_changed(req, namespace, etag);
+            status = "202 Accepted";
+            err = ESP_OK;
+            goto exit;
+        }
+        if(hold) {
+            ESP_LOGW(TAG, "Couldn't hold back %s/%s; writing the rest directly", namespace, staged[held].key);
+        }
+        /* Commit what's pending first, including the keys held above, so it
+         * can't later overwrite the direct writes */
+        if(ESP_OK != (err = nvs_wb_flush(namespace))) {
+            ESP_LOGE(TAG, "Failed to flush %s: %s", namespace, esp_err_to_name(err));
+        }
+        for(size_t i = 0; i < held; i++) staged[i].outcome = "ok";
+    }
+
+    /* Apply */
+    for(applied = held; ESP_OK == err && applied < n; applied++) {
+        nvs_staged_t *s = &staged[applied];
+        if(ESP_OK != (err = nvs_value_set(h, s->key, &s->val))) {
+            ESP_LOGE(TAG, "Failed to save %s/%s: %s", namespace, s->key, esp_err_to_name(err));
+            s->outcome = esp_err_to_name(err);
+            break;
+        }
+        s->outcome = "ok";
+    }
+    if(ESP_OK == err && ESP_OK != (err = nvs_commit(h))) {
+        ESP_LOGE(TAG, "Failed to commit %s: %s", namespace, esp_err_to_name(err));
+    }
+
+    if(ESP_OK != err) {
+        /* Restore in reverse so a key given twice ends up at its original value */
+        while(applied > 0) {
+            nvs_staged_t *s = &staged[--applied];
+            s->outcome = ESP_OK == nvs_value_set(h, s->key, &s->prev)
+                ? "rolled back" : "rollback failed";
         }
+        nvs_commit(h);
+        /* In case a rollback failed */
+        nvs_changed(req, namespace, etag);
+        status = "500 Internal Server Error";
+        goto exit;
+    }
 
-        if(ESP_OK != err) goto exit;
+    ESP_LOGI(TAG, "Committed %d keys to %s", n, namespace);
+    nvs_changed(req, namespace, etag);
+    committed = true;
+    for(size_t i = 0; i < n; i++) {
+        nvs_cache_update(namespace, staged[i].key, &staged[i].val);
     }
 
-    err = ESP_OK;
-    
 exit:
-    httpd_resp_send_chunk(req, NULL, 0);
+    if(staged) {
+        nvs_post_report(req, status, namespace, committed, staged, n);
+        for(size_t i = 0; i < n; i++) {
+            nvs_value_free(&staged[i].val);
+            nvs_value_free(&staged[i].prev);
+        }
+        free(staged);
+    }
     if(root) cJSON_Delete(root);
     if( h ) nvs_close(h);
-    nvs_release_iterator(it);
+    nvs_index_free(&idx);
     if(ESP_OK != err) {
         ESP_LOGE(TAG, "nvs post failed");
     }
     return err;
 }
 
+/**
+ * @brief Respond with the write-behind counters.
+ */
+static esp_err_t nvs_wb_stats_get(httpd_req_t *req)
+{
+    nvs_wb_stats_t stats;
+    char msg[160];
+
+    nvs_wb_get_stats(&stats);
+    snprintf(msg, sizeof(msg),
+            "{\"writes\":%u,\"absorbed\":%u,\"flushed\":%u,\"commits\":%u,\"failed\":%u,\"pending\":%u}",
+            stats.writes, stats.absorbed, stats.flushed, stats.commits, stats.failed, stats.pending);
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_sendstr(req, msg);
+}
+
+/* Footprint of one namespace */
+typedef struct nvs_usage {
+    char namespace[NAMESPACE_MAX];
+    size_t keys;
+    size_t bytes;
+    size_t entries;                 // Estimated from the sizes
+    struct {
+        size_t keys;
+        size_t bytes;
+    } types[NUM_NVS_TYPES];         // Indexed like nvs_types
+} nvs_usage_t;
+
+/* Per-namespace part of the last `?stats` response */
+static struct {
+    char *json;                     // NULL until computed
+    unsigned int version;           // nvs_version_get(NULL) when computed
+    uint32_t wb_written;            // Write-behind values flushed or dropped by then
+} nvs_usage_cache;
+
+/**
+ * @brief Add the footprint of one entry to `u`.
+ */
+static esp_err_t nvs_usage_add(nvs_usage_t *u, nvs_handle_t h, const nvs_entry_info_t *info)
+{
+    esp_err_t err = ESP_OK;
+    size_t len = nvs_type_to_size(info->type);
+    size_t entries = 1;
+
+    if(NVS_TYPE_STR == info->type) {
+        err = nvs_get_str(h, info->key, NULL, &len);
+        entries += (len + NVS_ENTRY_SIZE - 1) / NVS_ENTRY_SIZE;
+    }
+    else if(NVS_TYPE_BLOB == info->type) {
+        /* An index entry, then a header entry per chunk plus the data */
+        err = nvs_get_blob(h, info->key, NULL, &len);
+        entries += (len + NVS_BLOB_CHUNK_MAX - 1) / NVS_BLOB_CHUNK_MAX
+            + (len + NVS_ENTRY_SIZE - 1) / NVS_ENTRY_SIZE;
+    }
+    if(ESP_OK != err) return err;
+
+    u->keys++;
+    u->bytes += len;
+    u->entries += entries;
+    for(int i = 0; i < NUM_NVS_TYPES; i++) {
+        if(nvs_types[i] == info->type) {
+            u->types[i].keys++;
+            u->types[i].bytes += len;
+        }
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Walk NVS once and render the footprint of every namespace as a
+ * JSON object.
+ * @returns malloc'd string, or NULL on error.
+ */
+static char *nvs_usage_json(size_t namespace_count)
+{
+    nvs_usage_t *usage = NULL;
+    size_t n = 0, cap = namespace_count ? namespace_count : 1;
+    char open_ns[NAMESPACE_MAX] = { 0 };
+    nvs_handle_t h = 0;
+    char *json = NULL;
+    cJSON *root = NULL;
+    bool failed = false;
+
+    if(NULL == (usage = calloc(cap, sizeof(nvs_usage_t)))) goto exit;
+
+    nvs_iterator_t it = nvs_entry_find(NVS_DEFAULT_PART_NAME, NULL, NVS_TYPE_ANY);
+    while(it != NULL) {
+        nvs_entry_info_t info;
+        nvs_usage_t *u = NULL;
+
+        nvs_entry_info(it, &info);
+        it = nvs_entry_next(it);
+
+        for(size_t i = 0; i < n && NULL == u; i++) {
+            if(0 == strcmp(usage[i].namespace, info.namespace_name)) u = &usage[i];
+        }
+        if(NULL == u) {
+            if(n == cap) {
+                /* namespace_count should cover every namespace found, but
+                 * don't rely on it */
+                nvs_usage_t *grown = realloc(usage, 2 * cap * sizeof(nvs_usage_t));
+                if(NULL == grown) {
+                    failed = true;
+                    break;
+                }
+                memset(grown + cap, 0, cap * sizeof(nvs_usage_t));
+                usage = grown;
+                cap *= 2;
+            }
+            u = &usage[n++];
+            strlcpy(u->namespace, info.namespace_name, sizeof(u->namespace));
+        }
+
+        /* Entries of a namespace are mostly together, so this rarely reopens */
+        if(0 != strcmp(open_ns, info.namespace_name)) {
+            if(h) nvs_close(h);
+            h = 0;
+            open_ns[0] = '\0';
+            if(ESP_OK != nvs_open(info.namespace_name, NVS_READONLY, &h)) {
+                failed = true;
+                break;
+            }
+            strcpy(open_ns, info.namespace_name);
+        }
+        if(ESP_OK != nvs_usage_add(u, h, &info)) {
+            ESP_LOGE(TAG, "Couldn't size %s/%s", info.namespace_name, info.key);
+            failed = true;
+            break;
+        }
+    }
+    /* `it` is already NULL if this was the last entry, so it can't tell */
+    if(failed) {
+        if(it) nvs_release_iterator(it);
+        goto exit;
+    }
+
+    root = cJSON_CreateObject();
+    if(NULL == root) goto exit;
+    for(size_t i = 0; i < n; i++) {
+        cJSON *ns = cJSON_AddObjectToObject(root, usage[i].namespace);
+        cJSON *types = NULL;
+        if(NULL == ns
+                || NULL == cJSON_AddNumberToObject(ns, "keys", usage[i].keys)
+                || NULL == cJSON_AddNumberToObject(ns, "bytes", usage[i].bytes)
+                || NULL == cJSON_AddNumberToObject(ns, "entries", usage[i].entries)
+                || NULL == (types = cJSON_AddObjectToObject(ns, "dtypes"))) {
+            goto exit;
+        }
+        for(int j = 0; j < NUM_NVS_TYPES; j++) {
+            cJSON *type;
+            if(0 == usage[i].types[j].keys) continue;
+            if(NULL == (type = cJSON_AddObjectToObject(types, nvs_type_to_str(nvs_types[j])))
+                    || NULL == cJSON_AddNumberToObject(type, "keys", usage[i].types[j].keys)
+                    || NULL == cJSON_AddNumberToObject(type, "bytes", usage[i].types[j].bytes)) {
+                goto exit;
+            }
+        }
+    }
+    json = cJSON_PrintUnformatted(root);
+
+exit:
+    if(h) nvs_close(h);
+    if(root) cJSON_Delete(root);
+    free(usage);
+    return json;
+}
+
+/**
+ * @brief Respond with entry usage of the NVS partition and the footprint of
+ * every namespace.
+ *
+ * The partition totals are always current. The per-namespace footprint takes
+ * a walk over all of NVS, so it's kept until something is written.
+ */
+static esp_err_t nvs_stats_get(httpd_req_t *req)
+{
+    esp_err_t err;
+    nvs_stats_t stats;
+    nvs_wb_stats_t wb;
+    unsigned int version = nvs_version_get(NULL);
+    char msg[160];
+
+    if(ESP_OK != (err = nvs_get_stats(NULL, &stats))) {
+        ESP_LOGE(TAG, "Couldn't get NVS stats: %s", esp_err_to_name(err));
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Couldn't get NVS stats");
+        return err;
+    }
+
+    /* Flushing write-behind changes the footprint without a new version */
+    nvs_wb_get_stats(&wb);
+    if(NULL == nvs_usage_cache.json || version != nvs_usage_cache.version
+            || wb.flushed + wb.failed != nvs_usage_cache.wb_written) {
+        free(nvs_usage_cache.json);
+        if(NULL == (nvs_usage_cache.json = nvs_usage_json(stats.namespace_count))) {
+            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Couldn't walk NVS");
+            return ESP_FAIL;
+        }
+        nvs_usage_cache.version = version;
+        nvs_usage_cache.wb_written = wb.flushed + wb.failed;
+    }
+
+    snprintf(msg, sizeof(msg),
+            "{\"used_entries\":%u,\"free_entries\":%u,\"total_entries\":%u,"
+            "\"namespace_count\":%u,\"namespaces\":",
+            stats.used_entries, stats.free_entries, stats.total_entries, stats.namespace_count);
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_sendstr_chunk(req, msg);
+    httpd_resp_sendstr_chunk(req, nvs_usage_cache.json);
+    httpd_resp_sendstr_chunk(req, "}");
+    return httpd_resp_sendstr_chunk(req, NULL);
+}
+
 esp_err_t nvs_get_handler(httpd_req_t *req)
 {
     esp_err_t err = ESP_FAIL;
     char namespace[NAMESPACE_MAX] = {0};
     char key[KEY_MAX] = {0};
+    char etag[NVS_ETAG_LEN];
     uint8_t res;
 
     res = get_namespace_key_from_uri(namespace, key, req);
@@ -716,6 +1945,26 @@ esp_err_t nvs_get_handler(httpd_req_t *req)
         goto exit;
     }
 
+    if(!(res & PARSE_NAMESPACE) && http_query_has_key(req, "writebehind")) {
+        err = nvs_wb_stats_get(req);
+        goto exit;
+    }
+    if(!(res & PARSE_NAMESPACE) && http_query_has_key(req, "stats")) {
+        err = nvs_stats_get(req);
+        goto exit;
+    }
+
+    /* Every representation of a namespace changes with its version */
+    if(nvs_not_modified(req, (res & PARSE_NAMESPACE) ? namespace : NULL, etag)) {
+        err = ESP_OK;
+        goto exit;
+    }
+
+    if(!(res & PARSE_KEY) && nvs_wants_snapshot(req)) {
+        err = nvs_snapshot_get(req, (res & PARSE_NAMESPACE) ? namespace : NULL);
+        goto exit;
+    }
+
     if(res & PARSE_NAMESPACE && res & PARSE_KEY) {
         /* Directly return the value in form:
          * {
@@ -10,6 +10,9 @@
 
 #define PROJECT_ROUTE_V1_NVS "/api/v1/nvs"
 
+/* Largest snapshot accepted for restoring */
+#define NVS_SNAPSHOT_MAX (64*1024)
+
 
 /**
  * @brief Update NVS key/value pairs. 
@@ -22,8 +25,34 @@
  *     "value" - value to store at key
  *
  * Multiple values can be updated in a namespace from a single command.
- * Datatype is interpretted from the existing NVS object.
- * Binary data is currently not supported.
+ * Datatype is interpretted from the existing NVS object; binary data is
+ * given as a hex string.
+ *
+ * The update is all-or-nothing: every value is validated before anything is
+ * written, and the writes are followed by a single nvs_commit(). If a write
+ * fails, keys already written are restored to their previous values. The
+ * response reports each key's outcome:
+ *
+ *     {"namespace": "...", "committed": true, "results": {"key": "ok"}}
+ *
+ * With an `If-Match` header, the update only applies if the namespace's ETag
+ * still matches; otherwise the response is "412 Precondition Failed".
+ *
+ * In namespaces with write-behind (nvs_wb.h), the values are held in RAM
+ * instead, and the response is "202 Accepted" with every key "pending".
+ *
+ * A single binary value can also be replaced by sending its hex string as the
+ * whole body, which is decoded as it's received:
+ *
+ *      curl -X POST ${ESP32_IP}/api/v1/nvs/namespace/key --data-binary @blob.hex
+ *
+ * Binary values are read as base64 with `?encoding=base64`. A single key
+ * also takes `?encoding=raw`, or an application/octet-stream body, for the
+ * bytes as they are.
+ *
+ * A snapshot from `GET ?format=snapshot` is restored, all-or-nothing, with:
+ *
+ *      curl -X POST "${ESP32_IP}/api/v1/nvs?format=snapshot" --data-binary @nvs.snapshot
  */
 esp_err_t nvs_post_handler(httpd_req_t *req);
 
@@ -36,6 +65,31 @@ esp_err_t nvs_post_handler(httpd_req_t *req);
  *
  * where:
  *     KEY - NVS key to look up
+ *
+ * Listings of a namespace or of everything are returned a page at a time,
+ * sorted by namespace and key, and accept these query parameters:
+ *     limit - Entries per page, at most 100
+ *     cursor - The "next" value of the previous page
+ *     prefix - Only keys starting with this
+ *     dtype - Only values of this type, e.g. "uint8" or "binary"
+ *     values - "false" to list only metadata
+ * Values too long to inline are replaced by an "href" to the key's URL.
+ *
+ * Binary values are hex unless `?encoding=base64` is given. A single binary
+ * key can also be fetched as bare bytes with `?encoding=raw`.
+ *
+ * `?format=snapshot` instead streams every entry of the namespace, or of all
+ * namespaces, in the binary format of nvs_snapshot.h.
+ *
+ * Responses carry the ETag of the namespace, or of all of NVS, which
+ * changes with every update (nvs_version.h). A matching `If-None-Match` gets
+ * "304 Not Modified".
+ *
+ * `GET /api/v1/nvs?stats` reports used, free and total entries, and each
+ * namespace's keys and bytes by dtype.
+ *
+ * `GET /api/v1/nvs?writebehind` reports how many writes write-behind held
+ * back, absorbed and committed.
  */
 esp_err_t nvs_get_handler(httpd_req_t *req);
 
@@ -1,5 +1,6 @@
 #include "ota.h"
 #include "esp_ota_ops.h"
+#include "nvs_wb.h"
 #include <sys/param.h>
 
 
@@ -18,7 +19,29 @@ esp_err_t ota_post_handler(httpd_req_t *req)
 
     const esp_partition_t *update_partition = esp_ota_get_next_update_partition(NULL);
 
-    ESP_ERROR_CHECK( esp_ota_begin(update_partition, OTA_SIZE_UNKNOWN, &ota_handle) );
+    if (NULL == update_partition) {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "No OTA partition");
+        goto exit;
+    }
+    if (total_len <= 0) {
+        httpd_resp_set_status(req, "411 Length Required");
+        httpd_resp_sendstr(req, "Firmware image size required");
+        goto exit;
+    }
+    /* Reject an image that can't fit before it is sent */
+    if (total_len > update_partition->size) {
+        ESP_LOGE(TAG, "Image of %d bytes doesn't fit in %d byte partition", total_len, update_partition->size);
+        httpd_resp_set_status(req, "413 Payload Too Large");
+        httpd_resp_sendstr(req, "Firmware image larger than the OTA partition");
+        goto exit;
+    }
+
+    /* Don't leave held back NVS updates at risk for the whole upload */
+    nvs_wb_flush(NULL);
+
+    /* Only erases as much of the partition as the image needs */
+    ESP_ERROR_CHECK( esp_ota_begin(update_partition, total_len, &ota_handle) );
+    if (ESP_OK != http_continue(req)) goto exit;
 
     ESP_LOGI(TAG, "Firwmare Upload Begin: Going to transfer %d bytes.", total_len);
 
@@ -1,6 +1,10 @@
 #include "route/v1/system.h"
 #include "esp_ota_ops.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include "nvs_index.h"
 #include "sodium.h"
+#include <sys/param.h>
 
 __unused static const char TAG[] = "route/v1/system";
 
@@ -67,3 +71,281 @@ esp_err_t system_time_get_handler(httpd_req_t *req)
     httpd_resp_sendstr(req, buf);
     return ESP_OK;
 }
+
+
+#if CONFIG_PROJECT_FSBENCH
+/* Chunk sizes swept by the benchmark; all must fit in the scratch buffer */
+static const size_t fsbench_chunks[] = { 512, 1024, 2048, 4096, 8192 };
+_Static_assert(8192 <= CONFIG_SERVER_SCRATCH_BUFSIZE, "fsbench chunk exceeds scratch buffer");
+
+
+static int fsbench_kbps(size_t bytes, int64_t elapsed_us)
+{
+    /* Integer math; newlib nano formatting doesn't support floats */
+    return (int)((uint64_t)bytes * 1000000 / 1024 / MAX(elapsed_us, 1));
+}
+
+
+/**
+ * @brief Write, then read back, `size` bytes of `path` in `chunk` sized calls.
+ * @param[in] vbuf stdio buffer size; 0 for newlib's default.
+ */
+static esp_err_t fsbench_run(const char *path, char *buf, size_t size, size_t chunk, size_t vbuf,
+        int64_t *write_us, int64_t *read_us)
+{
+    esp_err_t err = ESP_FAIL;
+    FILE *fd = NULL;
+    size_t done;
+    int64_t start;
+
+    start = esp_timer_get_time();
+    if(NULL == (fd = fopen(path, "w"))) goto exit;
+    if(vbuf && 0 != setvbuf(fd, NULL, _IOFBF, vbuf)) goto exit;
+    for(done = 0; done < size; done += chunk) {
+        size_t n = MIN(chunk, size - done);
+        if(n != fwrite(buf, 1, n, fd)) goto exit;
+    }
+    /* Closing flushes and, on LittleFS, commits the file; include it */
+    if(0 != fclose(fd)) {
+        fd = NULL;
+        goto exit;
+    }
+    fd = NULL;
+    *write_us = esp_timer_get_time() - start;
+
+    start = esp_timer_get_time();
+    if(NULL == (fd = fopen(path, "r"))) goto exit;
+    if(vbuf && 0 != setvbuf(fd, NULL, _IOFBF, vbuf)) goto exit;
+    for(done = 0; done < size; ) {
+        size_t n = fread(buf, 1, chunk, fd);
+        if(0 == n) goto exit;
+        done += n;
+    }
+    fclose(fd);
+    fd = NULL;
+    *read_us = esp_timer_get_time() - start;
+
+    err = ESP_OK;
+
+exit:
+    if(fd) fclose(fd);
+    return err;
+}
+
+
+esp_err_t system_fsbench_post_handler(httpd_req_t *req)
+{
+    /* Reserved prefix keeps it out of directory listings */
+    const char path[] = CONFIG_PROJECT_FS_MOUNT_POINT "/" FS_INTERNAL_PREFIX "fsbench";
+    char *buf = ((server_ctx_t *)req->user_ctx)->scratch;
+    char line[128];
+    size_t size = FSBENCH_DEFAULT_SIZE;
+    const size_t vbufs[] = { 0, CONFIG_PROJECT_FS_STDIO_BUF_SIZE };
+
+    {
+        char val[16];
+        if(ESP_OK == http_query_get_value(req, "size", val, sizeof(val))) {
+            size = strtoul(val, NULL, 10);
+            if(size == 0) {
+                httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid size");
+                return ESP_FAIL;
+            }
+        }
+    }
+    {
+        esp_err_t err = fs_check_space(path, size, 0);
+        if(ESP_OK != err) {
+            http_resp_no_space(req, err);
+            return ESP_OK;
+        }
+    }
+
+    for(size_t i = 0; i < CONFIG_SERVER_SCRATCH_BUFSIZE; i++) buf[i] = (char)i;
+
+    httpd_resp_set_type(req, "application/json");
+    snprintf(line, sizeof(line), "{\"size\":%d,\"results\":[", size);
+    httpd_resp_sendstr_chunk(req, line);
+
+    bool first = true;
+    for(int i = 0; i < sizeof(fsbench_chunks) / sizeof(fsbench_chunks[0]); i++) {
+        for(int j = 0; j < sizeof(vbufs) / sizeof(vbufs[0]); j++) {
+            size_t chunk = fsbench_chunks[i];
+            int64_t write_us = 0, read_us = 0;
+
+            /* Skip the duplicate run when the configured buffer is the default */
+            if(j > 0 && vbufs[j] == 0) continue;
+
+            if(ESP_OK != fsbench_run(path, buf, size, chunk, vbufs[j], &write_us, &read_us)) {
+                ESP_LOGE(TAG, "Benchmark failed at chunk=%d stdio_buf=%d", chunk, vbufs[j]);
+                unlink(path);
+                /* Returning without the final chunk makes httpd close the socket */
+                return ESP_FAIL;
+            }
+            ESP_LOGI(TAG, "chunk=%d stdio_buf=%d write=%d KB/s read=%d KB/s",
+                    chunk, vbufs[j], fsbench_kbps(size, write_us), fsbench_kbps(size, read_us));
+            snprintf(line, sizeof(line),
+                    "%s{\"chunk\":%d,\"stdio_buf\":%d,\"write_kbps\":%d,\"read_kbps\":%d}",
+                    first ? "" : ",", chunk, vbufs[j],
+                    fsbench_kbps(size, write_us), fsbench_kbps(size, read_us));
+            httpd_resp_sendstr_chunk(req, line);
+            first = false;
+        }
+    }
+    unlink(path);
+
+    snprintf(line, sizeof(line), "],\"configured\":{\"chunk\":%d,\"stdio_buf\":%d}}",
+            FS_IO_CHUNK_SIZE, CONFIG_PROJECT_FS_STDIO_BUF_SIZE);
+    httpd_resp_sendstr_chunk(req, line);
+    httpd_resp_sendstr_chunk(req, NULL);
+    return ESP_OK;
+}
+#endif  /* CONFIG_PROJECT_FSBENCH */
+
+
+#define NVSBENCH_NAMESPACE "nvsbench"
+
+
+void system_nvsbench_cleanup(void)
+{
+    nvs_handle_t h;
+    /* Opening read-write would create the namespace, so look first */
+    nvs_iterator_t it = nvs_entry_find(NVS_DEFAULT_PART_NAME, NVSBENCH_NAMESPACE, NVS_TYPE_ANY);
+
+    if(NULL == it) return;
+    nvs_release_iterator(it);
+    if(ESP_OK != nvs_open(NVSBENCH_NAMESPACE, NVS_READWRITE, &h)) return;
+    ESP_LOGW(TAG, "Erasing leftover %s namespace", NVSBENCH_NAMESPACE);
+    nvs_erase_all(h);
+    nvs_commit(h);
+    nvs_close(h);
+}
+
+
+#if CONFIG_PROJECT_NVSBENCH
+
+
+/**
+ * @brief Find `key`'s type by walking the whole namespace, as lookups did
+ * before nvs_index.
+ */
+static bool nvsbench_scan(const char *key, nvs_type_t *type)
+{
+    nvs_entry_info_t info;
+    nvs_iterator_t it = nvs_entry_find(NVS_DEFAULT_PART_NAME, NVSBENCH_NAMESPACE, NVS_TYPE_ANY);
+    while(it != NULL) {
+        nvs_entry_info(it, &info);
+        if(0 == strcmp(info.key, key)) {
+            *type = info.type;
+            nvs_release_iterator(it);
+            return true;
+        }
+        it = nvs_entry_next(it);
+    }
+    return false;
+}
+
+
+esp_err_t system_nvsbench_post_handler(httpd_req_t *req)
+{
+    esp_err_t err = ESP_FAIL;
+    nvs_handle_t h = 0;
+    nvs_index_t idx = { 0 };
+    size_t entries = NVSBENCH_DEFAULT_ENTRIES, keys = NVSBENCH_DEFAULT_KEYS;
+    size_t created, found;
+    int64_t start, scan_us, index_us;
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    char line[128];
+
+    {
+        char val[16];
+        if(ESP_OK == http_query_get_value(req, "entries", val, sizeof(val))) {
+            entries = strtoul(val, NULL, 10);
+        }
+        if(ESP_OK == http_query_get_value(req, "keys", val, sizeof(val))) {
+            keys = strtoul(val, NULL, 10);
+        }
+        if(0 == entries || 0 == keys) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid entries or keys");
+            return ESP_FAIL;
+        }
+    }
+
+    /* Leave most of the partition to the application's own keys */
+    {
+        nvs_stats_t stats;
+        if(ESP_OK != (err = nvs_get_stats(NULL, &stats))) goto exit;
+        if(entries > stats.free_entries / NVSBENCH_FREE_DIVISOR) {
+            ESP_LOGW(TAG, "Capping entries at %d of %d free",
+                    stats.free_entries / NVSBENCH_FREE_DIVISOR, stats.free_entries);
+            entries = stats.free_entries / NVSBENCH_FREE_DIVISOR;
+        }
+        if(0 == entries) {
+            err = ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+            goto exit;
+        }
+    }
+
+    if(ESP_OK != (err = nvs_open(NVSBENCH_NAMESPACE, NVS_READWRITE, &h))) {
+        ESP_LOGE(TAG, "Couldn't open namespace %s", NVSBENCH_NAMESPACE);
+        goto exit;
+    }
+
+    /* Populate until done or the partition runs out of room regardless */
+    for(created = 0; created < entries; created++) {
+        snprintf(key, sizeof(key), "k%d", created);
+        if(ESP_OK != nvs_set_u32(h, key, created)) break;
+    }
+    if(ESP_OK != (err = nvs_commit(h))) goto exit;
+    if(created < entries) {
+        ESP_LOGW(TAG, "NVS full; benchmarking %d of %d entries", created, entries);
+    }
+    if(0 == created) {
+        err = ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+        goto exit;
+    }
+
+    /* Spread the looked up keys over the namespace */
+    found = 0;
+    start = esp_timer_get_time();
+    for(size_t i = 0; i < keys; i++) {
+        nvs_type_t type;
+        snprintf(key, sizeof(key), "k%d", (i * created / keys) % created);
+        if(nvsbench_scan(key, &type)) found++;
+    }
+    scan_us = esp_timer_get_time() - start;
+    if(found != keys) ESP_LOGE(TAG, "Scan found %d of %d keys", found, keys);
+
+    found = 0;
+    start = esp_timer_get_time();
+    if(ESP_OK != (err = nvs_index_build(&idx, NVS_DEFAULT_PART_NAME, NVSBENCH_NAMESPACE))) goto exit;
+    for(size_t i = 0; i < keys; i++) {
+        snprintf(key, sizeof(key), "k%d", (i * created / keys) % created);
+        if(nvs_index_find(&idx, key)) found++;
+    }
+    index_us = esp_timer_get_time() - start;
+    if(found != keys) ESP_LOGE(TAG, "Index found %d of %d keys", found, keys);
+
+    ESP_LOGI(TAG, "%d lookups in %d entries: scan=%d us index=%d us",
+            keys, created, (int)scan_us, (int)index_us);
+
+    httpd_resp_set_type(req, "application/json");
+    snprintf(line, sizeof(line), "{\"entries\":%d,\"keys\":%d,\"scan_us\":%d,\"index_us\":%d}",
+            created, keys, (int)scan_us, (int)index_us);
+    httpd_resp_sendstr(req, line);
+
+    err = ESP_OK;
+
+exit:
+    nvs_index_free(&idx);
+    if(h) {
+        nvs_erase_all(h);
+        nvs_commit(h);
+        nvs_close(h);
+    }
+    if(ESP_OK != err) {
+        ESP_LOGE(TAG, "NVS benchmark failed: %s", esp_err_to_name(err));
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "NVS benchmark failed");
+    }
+    return err;
+}
+#endif  /* CONFIG_PROJECT_NVSBENCH */
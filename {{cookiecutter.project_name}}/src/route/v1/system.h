@@ -20,4 +20,38 @@ esp_err_t system_reboot_post_handler(httpd_req_t *req);
  */
 esp_err_t system_time_get_handler(httpd_req_t *req);
 
+
+/**
+ * @brief Measure filesystem throughput across read/write chunk sizes.
+ *
+ * Writes and reads back a scratch file (`?size=` bytes, default
+ * FSBENCH_DEFAULT_SIZE) once per combination of chunk size and stdio buffer
+ * size, streaming one JSON result per run. Blocks the server while running.
+ * Only registered with CONFIG_PROJECT_FSBENCH.
+ */
+esp_err_t system_fsbench_post_handler(httpd_req_t *req);
+
+#define FSBENCH_DEFAULT_SIZE (128*1024)
+
+
+/**
+ * @brief Compare NVS key lookups by full namespace walk against nvs_index.
+ *
+ * Fills a scratch namespace with `?entries=` keys (default
+ * NVSBENCH_DEFAULT_ENTRIES, at most 1/NVSBENCH_FREE_DIVISOR of the free NVS
+ * entries), times `?keys=` type lookups (default NVSBENCH_DEFAULT_KEYS) both
+ * ways, then erases the namespace again. Blocks the server while running.
+ * Only registered with CONFIG_PROJECT_NVSBENCH.
+ */
+esp_err_t system_nvsbench_post_handler(httpd_req_t *req);
+
+#define NVSBENCH_DEFAULT_ENTRIES 500
+#define NVSBENCH_DEFAULT_KEYS 200
+#define NVSBENCH_FREE_DIVISOR 4
+
+/**
+ * @brief Erase the benchmark's namespace if a reset interrupted a run.
+ */
+void system_nvsbench_cleanup(void);
+
 #endif
@@ -1,6 +1,11 @@
 #include "helpers.h"
 #include "server.h"
 #include "route.h"
+#include "append.h"
+#include "assets.h"
+#include "jobs.h"
+#include "nvs_cache.h"
+#include "transfer.h"
 
 static const char *TAG = "server";
 
@@ -41,6 +46,14 @@ esp_err_t server_init(const char *base_path) {
     ERR_CHECK(server_ctx, "OOM while allocating server context");
     strlcpy(server_ctx->base_path, base_path, sizeof(server_ctx->base_path));
 
+    ERR_CHECK(transfer_init() == ESP_OK, "Failed to start transfer engine");
+    ERR_CHECK(jobs_init() == ESP_OK, "Failed to start jobs task");
+    ERR_CHECK(append_init() == ESP_OK, "Failed to start append task");
+#if CONFIG_PROJECT_STATIC_SITE_ASSETS
+    /* Not fatal; the site is still served from the filesystem */
+    assets_init();
+#endif
+
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.max_uri_handlers = 32;  // Adjust this depending on how many routes you have
     config.uri_match_fn = httpd_uri_match_wildcard;
@@ -72,7 +85,28 @@ esp_err_t server_register(const char *route, httpd_method_t method, esp_err_t (*
 }
 
 
-char *get_hostname()
+esp_err_t get_hostname(char *buf, size_t len)
 {
-    return nvs_get_str_default("wifi", "hostname", CONFIG_PROJECT_MDNS_HOST_NAME);
+    esp_err_t err;
+    char *hostname;
+
+    size_t size = len;
+
+    err = nvs_cache_get_str("wifi", "hostname", buf, &size);
+    if(ESP_OK == err) return ESP_OK;
+
+    if(ESP_ERR_NVS_NOT_FOUND == err) {
+        /* First boot; store the default */
+        if(NULL != (hostname = nvs_get_str_default("wifi", "hostname", CONFIG_PROJECT_MDNS_HOST_NAME))) {
+            strlcpy(buf, hostname, len);
+            free(hostname);
+            return ESP_OK;
+        }
+    }
+    else {
+        /* e.g. a stored hostname too long for `buf` */
+        ESP_LOGW(TAG, "Failed to read hostname (%s); using the default", esp_err_to_name(err));
+    }
+    strlcpy(buf, CONFIG_PROJECT_MDNS_HOST_NAME, len);
+    return ESP_OK;
 }
@@ -39,12 +39,21 @@ esp_err_t server_init(const char *base_path);
  */
 esp_err_t server_register(const char *route, httpd_method_t method, esp_err_t (*handler)(httpd_req_t *r));
 
+/* Including NULL-terminator; DNS labels are at most 63 characters */
+#define HOSTNAME_MAX 64
+
 /*****
  * @brief Gets the hostname from NVS. Sets NVS to default config value if not
  * found.
  *
- * @return Hostname. Must be freed by caller. NULL on error.
+ * Served from the NVS cache, so this is cheap enough for every request. A
+ * stored hostname that can't be read, e.g. one too long for `buf`, is
+ * replaced by CONFIG_PROJECT_MDNS_HOST_NAME with a warning.
+ *
+ * @param[out] buf Buffer to copy the hostname into.
+ * @param[in] len Size of `buf`; HOSTNAME_MAX fits any valid hostname.
+ * @return ESP_OK; `buf` always holds a hostname.
  */
-char *get_hostname();
+esp_err_t get_hostname(char *buf, size_t len);
 
 #endif
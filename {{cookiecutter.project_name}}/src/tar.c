@@ -0,0 +1,246 @@
+#include "tar.h"
+#include "esp_log.h"
+#include "stdio.h"
+#include "string.h"
+#include <sys/param.h>
+
+static const char TAG[] = "tar";
+
+enum {
+    STATE_HEADER = 0,
+    STATE_DATA,
+    STATE_PADDING,
+    STATE_DONE,
+};
+
+/* ustar header field offsets/lengths */
+#define TAR_NAME_OFF     0
+#define TAR_NAME_LEN     100
+#define TAR_MODE_OFF     100
+#define TAR_UID_OFF      108
+#define TAR_GID_OFF      116
+#define TAR_SIZE_OFF     124
+#define TAR_MTIME_OFF    136
+#define TAR_CHKSUM_OFF   148
+#define TAR_TYPE_OFF     156
+#define TAR_MAGIC_OFF    257
+#define TAR_VERSION_OFF  263
+#define TAR_PREFIX_OFF   345
+#define TAR_PREFIX_LEN   155
+
+#define TAR_TYPE_FILE     '0'
+#define TAR_TYPE_FILE_OLD '\0'
+#define TAR_TYPE_DIR      '5'
+#define TAR_TYPE_LONGNAME 'L'
+
+
+static uint32_t tar_checksum(const uint8_t *block)
+{
+    uint32_t sum = 0;
+    for(int i = 0; i < TAR_BLOCK_SIZE; i++) {
+        /* The checksum field itself counts as spaces */
+        sum += (i >= TAR_CHKSUM_OFF && i < TAR_CHKSUM_OFF + 8) ? ' ' : block[i];
+    }
+    return sum;
+}
+
+
+static uint64_t parse_octal(const uint8_t *field, size_t len)
+{
+    uint64_t val = 0;
+    size_t i = 0;
+    while(i < len && field[i] == ' ') i++;
+    for(; i < len && field[i] >= '0' && field[i] <= '7'; i++) {
+        val = (val << 3) | (field[i] - '0');
+    }
+    return val;
+}
+
+
+esp_err_t tar_header_fill(uint8_t *block, const char *name, size_t size, bool is_dir, time_t mtime)
+{
+    size_t name_len = strlen(name);
+
+    memset(block, 0, TAR_BLOCK_SIZE);
+
+    if(name_len <= TAR_NAME_LEN) {
+        memcpy(block + TAR_NAME_OFF, name, name_len);
+    }
+    else {
+        /* Split at a '/' so the prefix and name fields both fit */
+        const char *split = name + name_len - TAR_NAME_LEN - 1;
+        while(*split && *split != '/') split++;
+        if(*split == '\0' || split - name > TAR_PREFIX_LEN) {
+            ESP_LOGE(TAG, "Name too long for ustar: %s", name);
+            return ESP_ERR_INVALID_SIZE;
+        }
+        memcpy(block + TAR_PREFIX_OFF, name, split - name);
+        memcpy(block + TAR_NAME_OFF, split + 1, name_len - (split - name) - 1);
+    }
+
+    snprintf((char *)block + TAR_MODE_OFF, 8, "%07o", is_dir ? 0755 : 0644);
+    snprintf((char *)block + TAR_UID_OFF, 8, "%07o", 0);
+    snprintf((char *)block + TAR_GID_OFF, 8, "%07o", 0);
+    snprintf((char *)block + TAR_SIZE_OFF, 12, "%011o", is_dir ? 0 : (unsigned)size);
+    snprintf((char *)block + TAR_MTIME_OFF, 12, "%011lo", (unsigned long)mtime);
+    block[TAR_TYPE_OFF] = is_dir ? TAR_TYPE_DIR : TAR_TYPE_FILE;
+    memcpy(block + TAR_MAGIC_OFF, "ustar", 6);
+    memcpy(block + TAR_VERSION_OFF, "00", 2);
+    snprintf((char *)block + TAR_CHKSUM_OFF, 8, "%06o", tar_checksum(block));
+    block[TAR_CHKSUM_OFF + 7] = ' ';
+
+    return ESP_OK;
+}
+
+
+void tar_parser_init(tar_parser_t *p, const tar_ops_t *ops, void *ctx)
+{
+    memset(p, 0, sizeof(tar_parser_t));
+    p->ops = ops;
+    p->ctx = ctx;
+    p->state = STATE_HEADER;
+}
+
+
+/**
+ * @brief Handle a complete header block.
+ */
+static esp_err_t tar_parse_header(tar_parser_t *p)
+{
+    esp_err_t err;
+    const uint8_t *b = p->block;
+    char name[TAR_PREFIX_LEN + 1 + TAR_NAME_LEN + 1];
+    uint8_t type;
+
+    /* An all-zero block marks the end of the archive */
+    {
+        bool zero = true;
+        for(int i = 0; i < TAR_BLOCK_SIZE; i++) {
+            if(b[i]) {
+                zero = false;
+                break;
+            }
+        }
+        if(zero) {
+            p->state = STATE_DONE;
+            return ESP_OK;
+        }
+    }
+
+    if(parse_octal(b + TAR_CHKSUM_OFF, 8) != tar_checksum(b)) {
+        ESP_LOGE(TAG, "Header checksum mismatch");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    type = b[TAR_TYPE_OFF];
+    p->remaining = parse_octal(b + TAR_SIZE_OFF, 12);
+    p->padding = TAR_PADDING(p->remaining);
+    p->deliver = false;
+
+    if(type == TAR_TYPE_LONGNAME) {
+        if(p->remaining >= TAR_NAME_MAX) {
+            ESP_LOGE(TAG, "Long name exceeds %d bytes", TAR_NAME_MAX);
+            return ESP_ERR_INVALID_ARG;
+        }
+        p->long_name_len = 0;
+        p->long_name_pending = true;
+        p->state = p->remaining ? STATE_DATA : (p->padding ? STATE_PADDING : STATE_HEADER);
+        return ESP_OK;
+    }
+
+    if(p->long_name_pending) {
+        strlcpy(name, p->long_name, sizeof(name));
+        p->long_name_pending = false;
+    }
+    else {
+        size_t n = 0;
+        if(b[TAR_PREFIX_OFF] && 0 == memcmp(b + TAR_MAGIC_OFF, "ustar", 5)) {
+            n = strnlen((const char *)b + TAR_PREFIX_OFF, TAR_PREFIX_LEN);
+            memcpy(name, b + TAR_PREFIX_OFF, n);
+            name[n++] = '/';
+        }
+        size_t name_len = strnlen((const char *)b + TAR_NAME_OFF, TAR_NAME_LEN);
+        memcpy(name + n, b + TAR_NAME_OFF, name_len);
+        name[n + name_len] = '\0';
+    }
+
+    if(type == TAR_TYPE_FILE || type == TAR_TYPE_FILE_OLD || type == TAR_TYPE_DIR) {
+        bool is_dir = (type == TAR_TYPE_DIR);
+        if(is_dir) p->remaining = p->padding = 0;
+        if(ESP_OK != (err = p->ops->entry(p->ctx, name, is_dir, p->remaining))) return err;
+        p->deliver = true;
+        if(0 == p->remaining) {
+            if(ESP_OK != (err = p->ops->entry_end(p->ctx))) return err;
+            p->deliver = false;
+        }
+    }
+    else {
+        ESP_LOGI(TAG, "Skipping entry \"%s\" of type '%c'", name, type);
+    }
+
+    p->state = p->remaining ? STATE_DATA : (p->padding ? STATE_PADDING : STATE_HEADER);
+    return ESP_OK;
+}
+
+
+esp_err_t tar_parser_feed(tar_parser_t *p, const uint8_t *buf, size_t len)
+{
+    esp_err_t err;
+
+    while(len > 0) {
+        switch(p->state) {
+            case STATE_HEADER: {
+                size_t n = MIN(len, TAR_BLOCK_SIZE - p->block_len);
+                memcpy(p->block + p->block_len, buf, n);
+                p->block_len += n;
+                buf += n;
+                len -= n;
+                if(p->block_len < TAR_BLOCK_SIZE) break;
+                p->block_len = 0;
+                if(ESP_OK != (err = tar_parse_header(p))) return err;
+                break;
+            }
+            case STATE_DATA: {
+                size_t n = MIN(len, p->remaining);
+                if(p->long_name_pending) {
+                    memcpy(p->long_name + p->long_name_len, buf, n);
+                    p->long_name_len += n;
+                    p->long_name[p->long_name_len] = '\0';
+                }
+                else if(p->deliver) {
+                    if(ESP_OK != (err = p->ops->data(p->ctx, buf, n))) return err;
+                }
+                p->remaining -= n;
+                buf += n;
+                len -= n;
+                if(p->remaining) break;
+                if(p->deliver) {
+                    if(ESP_OK != (err = p->ops->entry_end(p->ctx))) return err;
+                    p->deliver = false;
+                }
+                p->state = p->padding ? STATE_PADDING : STATE_HEADER;
+                break;
+            }
+            case STATE_PADDING: {
+                size_t n = MIN(len, p->padding);
+                p->padding -= n;
+                buf += n;
+                len -= n;
+                if(0 == p->padding) p->state = STATE_HEADER;
+                break;
+            }
+            case STATE_DONE:
+            default:
+                /* Archivers pad the stream with zero blocks; ignore them */
+                return ESP_OK;
+        }
+    }
+
+    return ESP_OK;
+}
+
+
+bool tar_parser_done(const tar_parser_t *p)
+{
+    return p->state == STATE_DONE;
+}
@@ -0,0 +1,76 @@
+/***
+ * Minimal streaming ustar archive encoding/decoding.
+ *
+ * Only regular files and directories are supported. GNU long names ('L'
+ * entries) are understood when reading; other entry types are skipped.
+ */
+
+#ifndef PROJECT_TAR_H__
+#define PROJECT_TAR_H__
+
+#include "esp_err.h"
+#include "stdbool.h"
+#include "stdint.h"
+#include "stddef.h"
+#include "time.h"
+
+#define TAR_BLOCK_SIZE 512
+#define TAR_NAME_MAX 256  // Longest entry name accepted when reading
+
+/**
+ * @brief Number of padding bytes needed after `size` bytes of entry data.
+ */
+#define TAR_PADDING(size) ((TAR_BLOCK_SIZE - ((size) % TAR_BLOCK_SIZE)) % TAR_BLOCK_SIZE)
+
+/**
+ * @brief Fill in a ustar header block.
+ * @param[out] block TAR_BLOCK_SIZE bytes.
+ * @param[in] name Entry name relative to the archive root. Directory names
+ *            should end in '/'.
+ * @returns ESP_OK on success, ESP_ERR_INVALID_SIZE if name doesn't fit.
+ */
+esp_err_t tar_header_fill(uint8_t *block, const char *name, size_t size, bool is_dir, time_t mtime);
+
+
+/**
+ * @brief Callbacks invoked while extracting an archive.
+ *
+ * Returning anything other than ESP_OK aborts parsing.
+ */
+typedef struct tar_ops {
+    /* A new entry begins; `data` is called `size` bytes worth of times next */
+    esp_err_t (*entry)(void *ctx, const char *name, bool is_dir, size_t size);
+    esp_err_t (*data)(void *ctx, const uint8_t *buf, size_t len);
+    /* All of the current entry's data has been delivered */
+    esp_err_t (*entry_end)(void *ctx);
+} tar_ops_t;
+
+typedef struct tar_parser {
+    const tar_ops_t *ops;
+    void *ctx;
+    uint8_t state;
+    uint8_t block[TAR_BLOCK_SIZE];
+    size_t block_len;
+    size_t remaining;           // Data bytes left in the current entry
+    size_t padding;             // Padding bytes left after the current entry
+    bool deliver;               // Pass the current entry's data to callbacks
+    bool long_name_pending;     // Next header takes its name from `long_name`
+    size_t long_name_len;
+    char long_name[TAR_NAME_MAX];
+} tar_parser_t;
+
+void tar_parser_init(tar_parser_t *p, const tar_ops_t *ops, void *ctx);
+
+/**
+ * @brief Feed the next chunk of the archive into the parser.
+ * @returns ESP_OK on success, ESP_ERR_INVALID_ARG on a malformed archive, or
+ * the error returned by a callback.
+ */
+esp_err_t tar_parser_feed(tar_parser_t *p, const uint8_t *buf, size_t len);
+
+/**
+ * @brief true once the end-of-archive marker has been read.
+ */
+bool tar_parser_done(const tar_parser_t *p);
+
+#endif
@@ -0,0 +1,345 @@
+#include "transfer.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "stdatomic.h"
+#include <sys/param.h>
+
+static const char TAG[] = "transfer";
+
+
+static void log_throughput(const char *what, size_t bytes, int64_t start_us)
+{
+    int64_t elapsed_us = MAX(esp_timer_get_time() - start_us, 1);
+    /* Integer math; newlib nano formatting doesn't support floats */
+    ESP_LOGI(TAG, "%s %d bytes in %d ms (%d KB/s)",
+            what, bytes, (int)(elapsed_us / 1000), (int)((uint64_t)bytes * 1000000 / 1024 / elapsed_us));
+}
+
+
+#if CONFIG_PROJECT_TRANSFER_ENGINE
+
+#define NUM_BUFS CONFIG_PROJECT_TRANSFER_NUM_BUFS
+#define BUF_SIZE CONFIG_PROJECT_TRANSFER_BUF_SIZE
+
+#if CONFIG_FREERTOS_UNICORE
+#define STORAGE_TASK_CORE tskNO_AFFINITY
+#else
+#define STORAGE_TASK_CORE CONFIG_PROJECT_TRANSFER_TASK_CORE
+#endif
+
+typedef struct slot {
+    size_t len;             // 0 marks the end of the stream
+    uint8_t *data;
+} slot_t;
+
+/**
+ * Single-producer/single-consumer ring. `head` is only advanced by the
+ * producer and `tail` only by the consumer, so neither side needs a lock;
+ * task notifications are only used to sleep while the ring is full/empty.
+ */
+typedef struct ring {
+    slot_t slots[NUM_BUFS];
+    atomic_uint head;
+    atomic_uint tail;
+} ring_t;
+
+typedef enum {
+    JOB_WRITE,              // HTTP task produces, storage task writes
+    JOB_READ,               // Storage task reads, HTTP task sends
+} job_type_t;
+
+typedef struct job {
+    job_type_t type;
+    fs_writer_t *w;         // JOB_WRITE
+    FILE *fd;               // JOB_READ
+    TaskHandle_t requester; // HTTP server task
+    atomic_bool abort;      // Set by whichever side fails first
+    esp_err_t err;          // Storage side result
+} job_t;
+
+static ring_t ring;
+static TaskHandle_t storage_task = NULL;
+static QueueHandle_t job_queue = NULL;
+static SemaphoreHandle_t job_done = NULL;
+
+
+/**
+ * @brief Producer: get the next free slot, sleeping while the ring is full.
+ * @returns NULL if the transfer was aborted.
+ */
+static slot_t *ring_acquire(ring_t *r, atomic_bool *abort)
+{
+    while(atomic_load(&r->head) - atomic_load(&r->tail) >= NUM_BUFS) {
+        if(atomic_load(abort)) return NULL;
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100));
+    }
+    if(atomic_load(abort)) return NULL;
+    return &r->slots[atomic_load(&r->head) % NUM_BUFS];
+}
+
+/**
+ * @brief Producer: hand the acquired slot over to the consumer.
+ */
+static void ring_publish(ring_t *r, TaskHandle_t consumer)
+{
+    atomic_fetch_add(&r->head, 1);
+    xTaskNotifyGive(consumer);
+}
+
+/**
+ * @brief Consumer: get the oldest filled slot, sleeping while the ring is empty.
+ * @returns NULL if the transfer was aborted.
+ */
+static slot_t *ring_peek(ring_t *r, atomic_bool *abort)
+{
+    while(atomic_load(&r->head) == atomic_load(&r->tail)) {
+        if(atomic_load(abort)) return NULL;
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(100));
+    }
+    if(atomic_load(abort)) return NULL;
+    return &r->slots[atomic_load(&r->tail) % NUM_BUFS];
+}
+
+/**
+ * @brief Consumer: return the peeked slot to the producer.
+ */
+static void ring_release(ring_t *r, TaskHandle_t producer)
+{
+    atomic_fetch_add(&r->tail, 1);
+    xTaskNotifyGive(producer);
+}
+
+
+static void job_fail(job_t *job, TaskHandle_t peer)
+{
+    atomic_store(&job->abort, true);
+    xTaskNotifyGive(peer);
+}
+
+
+static void storage_write(job_t *job)
+{
+    slot_t *slot;
+    while(NULL != (slot = ring_peek(&ring, &job->abort))) {
+        size_t len = slot->len;
+        if(len && ESP_OK != fs_writer_write(job->w, slot->data, len)) {
+            job->err = TRANSFER_ERR_STORAGE;
+            job_fail(job, job->requester);
+            return;
+        }
+        ring_release(&ring, job->requester);
+        if(0 == len) return;
+    }
+}
+
+
+static void storage_read(job_t *job)
+{
+    slot_t *slot;
+    while(NULL != (slot = ring_acquire(&ring, &job->abort))) {
+        size_t len = fread(slot->data, 1, BUF_SIZE, job->fd);
+        if(0 == len && ferror(job->fd)) {
+            job->err = TRANSFER_ERR_STORAGE;
+            job_fail(job, job->requester);
+            return;
+        }
+        slot->len = len;
+        ring_publish(&ring, job->requester);
+        if(0 == len) return;
+    }
+}
+
+
+static void storage_task_fn(void *arg)
+{
+    job_t *job;
+    for(;;) {
+        if(pdTRUE != xQueueReceive(job_queue, &job, portMAX_DELAY)) continue;
+        if(JOB_WRITE == job->type) storage_write(job);
+        else storage_read(job);
+        xSemaphoreGive(job_done);
+    }
+}
+
+
+/**
+ * @brief Reset the ring and hand a job to the storage task.
+ */
+static void job_start(job_t *job)
+{
+    atomic_store(&ring.head, 0);
+    atomic_store(&ring.tail, 0);
+    atomic_store(&job->abort, false);
+    job->requester = xTaskGetCurrentTaskHandle();
+    job->err = ESP_OK;
+    xQueueSend(job_queue, &job, portMAX_DELAY);
+}
+
+/**
+ * @brief Wait for the storage task to finish a job.
+ */
+static void job_wait(job_t *job)
+{
+    xSemaphoreTake(job_done, portMAX_DELAY);
+    /* Drop notifications left over from the storage task */
+    ulTaskNotifyTake(pdTRUE, 0);
+}
+
+
+esp_err_t transfer_init(void)
+{
+    if(storage_task) return ESP_OK;
+
+    for(int i = 0; i < NUM_BUFS; i++) {
+        ring.slots[i].data = malloc(BUF_SIZE);
+        if(NULL == ring.slots[i].data) {
+            ESP_LOGE(TAG, "OOM while allocating transfer buffers");
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    job_queue = xQueueCreate(1, sizeof(job_t *));
+    job_done = xSemaphoreCreateBinary();
+    if(NULL == job_queue || NULL == job_done) return ESP_ERR_NO_MEM;
+
+    if(pdPASS != xTaskCreatePinnedToCore(storage_task_fn, "storage", 4096, NULL,
+                CONFIG_PROJECT_TRANSFER_TASK_PRIORITY, &storage_task, STORAGE_TASK_CORE)) {
+        ESP_LOGE(TAG, "Failed to start storage task");
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "Transfer engine started with %d x %d byte buffers", NUM_BUFS, BUF_SIZE);
+    return ESP_OK;
+}
+
+
+esp_err_t transfer_recv_to_writer(httpd_req_t *req, fs_writer_t *w, size_t len)
+{
+    esp_err_t err = ESP_OK;
+    job_t job = { .type = JOB_WRITE, .w = w };
+    size_t remaining = len;
+    int64_t start = esp_timer_get_time();
+    slot_t *slot;
+
+    job_start(&job);
+
+    while(remaining > 0) {
+        if(NULL == (slot = ring_acquire(&ring, &job.abort))) break;  // Storage failed
+
+        int received = httpd_req_recv(req, (char *)slot->data, MIN(remaining, BUF_SIZE));
+        if(received <= 0) {
+            if(received == HTTPD_SOCK_ERR_TIMEOUT) {
+                /* Retry if timeout occurred */
+                continue;
+            }
+            ESP_LOGE(TAG, "File reception failed!");
+            err = TRANSFER_ERR_NET;
+            job_fail(&job, storage_task);
+            break;
+        }
+        slot->len = received;
+        ring_publish(&ring, storage_task);
+        remaining -= received;
+    }
+
+    /* Signal end of stream */
+    if(ESP_OK == err && NULL != (slot = ring_acquire(&ring, &job.abort))) {
+        slot->len = 0;
+        ring_publish(&ring, storage_task);
+    }
+
+    job_wait(&job);
+    if(ESP_OK == err) err = job.err;
+    if(ESP_OK == err) log_throughput("Received", len, start);
+    return err;
+}
+
+
+esp_err_t transfer_send_file(httpd_req_t *req, FILE *fd)
+{
+    esp_err_t err = ESP_OK;
+    job_t job = { .type = JOB_READ, .fd = fd };
+    size_t total = 0;
+    int64_t start = esp_timer_get_time();
+    slot_t *slot;
+
+    job_start(&job);
+
+    while(NULL != (slot = ring_peek(&ring, &job.abort))) {
+        size_t len = slot->len;
+        if(len && ESP_OK != httpd_resp_send_chunk(req, (const char *)slot->data, len)) {
+            ESP_LOGE(TAG, "File sending failed!");
+            err = TRANSFER_ERR_NET;
+            job_fail(&job, storage_task);
+            break;
+        }
+        ring_release(&ring, storage_task);
+        total += len;
+        if(0 == len) break;
+    }
+
+    job_wait(&job);
+    if(ESP_OK == err) err = job.err;
+    if(ESP_OK == err) log_throughput("Sent", total, start);
+    return err;
+}
+
+#else  /* CONFIG_PROJECT_TRANSFER_ENGINE */
+
+esp_err_t transfer_init(void)
+{
+    return ESP_OK;
+}
+
+
+esp_err_t transfer_recv_to_writer(httpd_req_t *req, fs_writer_t *w, size_t len)
+{
+    char *buf = ((server_ctx_t *)req->user_ctx)->scratch;
+    size_t remaining = len;
+    int64_t start = esp_timer_get_time();
+
+    while(remaining > 0) {
+        int received = httpd_req_recv(req, buf, MIN(remaining, FS_IO_CHUNK_SIZE));
+        if(received <= 0) {
+            if(received == HTTPD_SOCK_ERR_TIMEOUT) {
+                /* Retry if timeout occurred */
+                continue;
+            }
+            ESP_LOGE(TAG, "File reception failed!");
+            return TRANSFER_ERR_NET;
+        }
+        if(ESP_OK != fs_writer_write(w, buf, received)) {
+            return TRANSFER_ERR_STORAGE;
+        }
+        remaining -= received;
+    }
+
+    log_throughput("Received", len, start);
+    return ESP_OK;
+}
+
+
+esp_err_t transfer_send_file(httpd_req_t *req, FILE *fd)
+{
+    char *chunk = ((server_ctx_t *)req->user_ctx)->scratch;
+    size_t chunksize, total = 0;
+    int64_t start = esp_timer_get_time();
+
+    while((chunksize = fread(chunk, 1, FS_IO_CHUNK_SIZE, fd)) > 0) {
+        if(ESP_OK != httpd_resp_send_chunk(req, chunk, chunksize)) {
+            ESP_LOGE(TAG, "File sending failed!");
+            return TRANSFER_ERR_NET;
+        }
+        total += chunksize;
+    }
+    if(ferror(fd)) return TRANSFER_ERR_STORAGE;
+
+    log_throughput("Sent", total, start);
+    return ESP_OK;
+}
+
+#endif  /* CONFIG_PROJECT_TRANSFER_ENGINE */
@@ -0,0 +1,45 @@
+/***
+ * Moves file data between an HTTP request and the filesystem.
+ *
+ * With CONFIG_PROJECT_TRANSFER_ENGINE, data flows through a single-producer/
+ * single-consumer ring of buffers between the HTTP server task and a
+ * dedicated storage task, so network and flash I/O overlap instead of
+ * alternating.
+ */
+
+#ifndef PROJECT_TRANSFER_H__
+#define PROJECT_TRANSFER_H__
+
+#include "filesystem.h"
+#include "server.h"
+
+/* Which side of a transfer failed */
+#define TRANSFER_ERR_NET     ESP_ERR_INVALID_RESPONSE
+#define TRANSFER_ERR_STORAGE ESP_ERR_INVALID_STATE
+
+/**
+ * @brief Allocate the transfer buffers and start the storage task.
+ */
+esp_err_t transfer_init(void);
+
+/**
+ * @brief Receive `len` bytes of request body into a file writer.
+ *
+ * The writer is neither committed nor aborted.
+ *
+ * @returns ESP_OK on success, TRANSFER_ERR_NET if the body couldn't be
+ *          received, TRANSFER_ERR_STORAGE if it couldn't be written.
+ */
+esp_err_t transfer_recv_to_writer(httpd_req_t *req, fs_writer_t *w, size_t len);
+
+/**
+ * @brief Send the remainder of an open file as chunked response data.
+ *
+ * Does not send the terminating empty chunk.
+ *
+ * @returns ESP_OK on success, TRANSFER_ERR_NET if sending failed,
+ *          TRANSFER_ERR_STORAGE if the file couldn't be read.
+ */
+esp_err_t transfer_send_file(httpd_req_t *req, FILE *fd);
+
+#endif
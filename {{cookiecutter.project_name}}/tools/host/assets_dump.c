@@ -0,0 +1,85 @@
+/***
+ * Host driver for the asset image reader (src/assets.c), used by
+ * test_assets.py.
+ *
+ *     assets_dump IMAGE [OUTDIR]
+ *
+ * Opens IMAGE, looks every entry up again by name and prints one line per
+ * asset: name, MIME type, gzip flag and stored SHA-256 in hex. With OUTDIR,
+ * each stored body is also written to OUTDIR/<index>.
+ *
+ * Exits with 2 if the image is rejected and 1 on any other failure.
+ */
+
+#include "assets.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void *read_file(const char *path, size_t *size)
+{
+    FILE *fd = fopen(path, "rb");
+    void *buf = NULL;
+    long len;
+
+    if(NULL == fd) return NULL;
+    if(0 == fseek(fd, 0, SEEK_END) && (len = ftell(fd)) >= 0 && 0 == fseek(fd, 0, SEEK_SET)) {
+        /* +1 so an empty file still gets a buffer */
+        if(NULL != (buf = malloc(len + 1)) && (size_t)len != fread(buf, 1, len, fd)) {
+            free(buf);
+            buf = NULL;
+        }
+        *size = len;
+    }
+    fclose(fd);
+    return buf;
+}
+
+int main(int argc, char **argv)
+{
+    assets_image_t img;
+    assets_file_t file, found;
+    char path[4096];
+    size_t size = 0;
+    void *image;
+
+    if(argc < 2) {
+        fprintf(stderr, "usage: %s IMAGE [OUTDIR]\n", argv[0]);
+        return 1;
+    }
+    if(NULL == (image = read_file(argv[1], &size))) {
+        perror(argv[1]);
+        return 1;
+    }
+    if(!assets_image_open(&img, image, size)) {
+        fprintf(stderr, "%s: invalid image\n", argv[1]);
+        return 2;
+    }
+
+    for(uint32_t i = 0; assets_get(&img, i, &file); i++) {
+        if(!assets_find(&img, file.name, &found) || found.data != file.data) {
+            fprintf(stderr, "%s: lookup failed\n", file.name);
+            return 1;
+        }
+        printf("%s\t%s\t%d\t", file.name, file.mime, file.gzip);
+        for(int j = 0; j < 32; j++) printf("%02x", file.sha256[j]);
+        printf("\n");
+
+        if(argc > 2) {
+            snprintf(path, sizeof(path), "%s/%u", argv[2], i);
+            FILE *fd = fopen(path, "wb");
+            if(NULL == fd || file.length != fwrite(file.data, 1, file.length, fd)) {
+                perror(path);
+                return 1;
+            }
+            fclose(fd);
+        }
+    }
+
+    if(assets_find(&img, "no/such/file", &found)) {
+        fprintf(stderr, "Found a file that doesn't exist\n");
+        return 1;
+    }
+    free(image);
+    return 0;
+}
@@ -0,0 +1,126 @@
+/***
+ * Host benchmark of fs_walk and rm_rf (src/fs_walk.c).
+ *
+ * Builds a synthetic tree of FILES files, DIR_FANOUT per directory and nested
+ * up to DEPTH levels, then times a read-only walk over it and its removal
+ * with rm_rf_progress, sampling the heap in use from the callbacks.
+ *
+ *     make -C tools/host bench [BENCH_FILES=1000]
+ *
+ * The numbers reflect the walker's own overhead on the host's filesystem;
+ * flash timings have to be taken on a device from the delete route's log.
+ */
+
+#include "file_cache.h"
+#include "filesystem.h"
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DIR_FANOUT 10
+#define DEPTH 4
+#define FILE_SIZE 64
+
+/* Only called by rm_rf_progress; there's nothing to invalidate on the host */
+void fs_dir_cache_clear(void) {}
+void file_cache_invalidate(const char *path) { (void)path; }
+
+static size_t heap_base, heap_peak;
+
+static void heap_sample(void)
+{
+    struct mallinfo2 mi = mallinfo2();
+    if(mi.uordblks > heap_peak) heap_peak = mi.uordblks;
+}
+
+static void heap_reset(void)
+{
+    heap_base = heap_peak = mallinfo2().uordblks;
+}
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/**
+ * @brief Fill `dir` with files, descending into a new subdirectory after
+ * every DIR_FANOUT of them.
+ */
+static int make_tree(char *dir, int files, int depth)
+{
+    char path[MAX_FILE_PATH];
+    static const char data[FILE_SIZE];
+    int made = 0;
+
+    for(int i = 0; made < files; i++) {
+        if(i > 0 && 0 == i % DIR_FANOUT && depth < DEPTH) {
+            snprintf(path, sizeof(path), "%s/d%d", dir, i);
+            if(0 != mkdir(path, 0700)) return -1;
+            int n = make_tree(path, (files - made) / 2, depth + 1);
+            if(n < 0) return -1;
+            made += n;
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/f%d", dir, i);
+        FILE *fd = fopen(path, "w");
+        if(NULL == fd || 1 != fwrite(data, sizeof(data), 1, fd)) return -1;
+        fclose(fd);
+        made++;
+    }
+    return made;
+}
+
+static esp_err_t count_cb(void *ctx, fs_walk_event_t event, const char *path, const struct stat *st)
+{
+    uint32_t *entries = ctx;
+    (*entries)++;
+    heap_sample();
+    return ESP_OK;
+}
+
+static esp_err_t progress_cb(void *ctx, const fs_rm_stats_t *stats)
+{
+    heap_sample();
+    return ESP_OK;
+}
+
+int main(int argc, char **argv)
+{
+    char root[] = "/tmp/fs_walk_bench.XXXXXX";
+    char path[MAX_FILE_PATH];
+    int files = argc > 1 ? atoi(argv[1]) : 1000;
+    uint32_t entries = 0;
+    fs_rm_stats_t stats;
+    double start;
+    esp_err_t err;
+
+    if(files <= 0 || NULL == mkdtemp(root) || make_tree(root, files, 0) < 0) {
+        fprintf(stderr, "Failed to create the tree\n");
+        return 1;
+    }
+
+    strcpy(path, root);
+    heap_reset();
+    start = now_ms();
+    err = fs_walk(path, sizeof(path), count_cb, &entries);
+    printf("walk:  %u entries in %.2f ms, peak heap +%zu bytes\n",
+            entries, now_ms() - start, heap_peak - heap_base);
+    if(ESP_OK != err) return 1;
+
+    heap_reset();
+    start = now_ms();
+    err = rm_rf_progress(root, &stats, progress_cb, NULL);
+    printf("rm_rf: %u files, %u dirs in %.2f ms, peak heap +%zu bytes\n",
+            stats.files, stats.dirs, now_ms() - start, heap_peak - heap_base);
+    if(ESP_OK != err || 0 == access(root, F_OK)) {
+        fprintf(stderr, "%s was not removed\n", root);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,21 @@
+/***
+ * Host stand-in for ESP-IDF's esp_err.h; just enough for the sources built by
+ * tools/host.
+ */
+
+#ifndef PROJECT_HOST_ESP_ERR_H__
+#define PROJECT_HOST_ESP_ERR_H__
+
+typedef int esp_err_t;
+
+#define ESP_OK                  0
+#define ESP_FAIL                -1
+#define ESP_ERR_NO_MEM          0x101
+#define ESP_ERR_INVALID_ARG     0x102
+#define ESP_ERR_INVALID_STATE   0x103
+#define ESP_ERR_INVALID_SIZE    0x104
+#define ESP_ERR_NOT_FOUND       0x105
+#define ESP_ERR_NOT_SUPPORTED   0x106
+#define ESP_ERR_INVALID_CRC     0x109
+
+#endif
@@ -0,0 +1,16 @@
+/***
+ * Host stand-in for ESP-IDF's esp_log.h. Errors and warnings go to stderr,
+ * everything else is dropped.
+ */
+
+#ifndef PROJECT_HOST_ESP_LOG_H__
+#define PROJECT_HOST_ESP_LOG_H__
+
+#include <stdio.h>
+
+#define ESP_LOGE(tag, fmt, ...) fprintf(stderr, "E %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) fprintf(stderr, "W %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) do {} while(0)
+#define ESP_LOGD(tag, fmt, ...) do {} while(0)
+
+#endif
@@ -0,0 +1,12 @@
+/***
+ * Functions newlib has but glibc lacks, force-included into every host build.
+ */
+
+#ifndef PROJECT_HOST_HOST_H__
+#define PROJECT_HOST_HOST_H__
+
+#include <stddef.h>
+
+size_t strlcpy(char *dst, const char *src, size_t size);
+
+#endif
@@ -0,0 +1,11 @@
+/***
+ * Host stand-in for the generated sdkconfig.h. Only options the sources built
+ * by tools/host depend on belong here.
+ */
+
+#ifndef PROJECT_HOST_SDKCONFIG_H__
+#define PROJECT_HOST_SDKCONFIG_H__
+
+#define CONFIG_PROJECT_FS_IO_CHUNK_SIZE 4096
+
+#endif
@@ -0,0 +1,18 @@
+/***
+ * Host stand-in for libsodium; only the types filesystem.h needs.
+ */
+
+#ifndef PROJECT_HOST_SODIUM_H__
+#define PROJECT_HOST_SODIUM_H__
+
+#include <stdint.h>
+
+#define crypto_hash_sha256_BYTES 32
+
+typedef struct crypto_hash_sha256_state {
+    uint32_t state[8];
+    uint64_t count;
+    uint8_t buf[64];
+} crypto_hash_sha256_state;
+
+#endif
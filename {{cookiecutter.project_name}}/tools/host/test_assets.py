@@ -0,0 +1,132 @@
+#!/usr/bin/env python3
+"""Round-trip tests of tools/pack_assets.py against the device's reader.
+
+Images are packed from a sample site and read back with ``assets_dump``, the
+host build of ``src/assets.c``. Run through ``make -C tools/host test``.
+"""
+
+import gzip
+import hashlib
+import subprocess
+import sys
+import tempfile
+import unittest
+from pathlib import Path
+
+HERE = Path(__file__).resolve().parent
+PACKER = HERE.parent / "pack_assets.py"
+DUMP = HERE / "build" / "assets_dump"
+
+SITE = {
+    "index.html": b"<!doctype html><title>test</title>" + b"<p>hello</p>" * 64,
+    "app.js": b"console.log('hello');\n" * 64,
+    "css/style.css": b"body { color: black; }\n" * 64,
+    "img/logo.png": bytes(range(256)),
+    "tiny.txt": b"x",
+    "empty.txt": b"",
+    "docs/readme.txt": b"plain sibling",
+    "docs/readme.txt.gz": gzip.compress(b"compressed sibling", mtime=0),
+    "only.json.gz": gzip.compress(b'{"only": "gzip"}', mtime=0),
+}
+
+
+class PackAssetsTest(unittest.TestCase):
+    def setUp(self):
+        self.tmp = tempfile.TemporaryDirectory()
+        self.root = Path(self.tmp.name)
+        self.site = self.root / "site"
+        for name, body in SITE.items():
+            path = self.site / name
+            path.parent.mkdir(parents=True, exist_ok=True)
+            path.write_bytes(body)
+
+    def tearDown(self):
+        self.tmp.cleanup()
+
+    def pack(self, *args):
+        image = self.root / "assets.bin"
+        subprocess.run(
+            [sys.executable, str(PACKER), str(self.site), str(image), *args],
+            check=True,
+            stdout=subprocess.DEVNULL,
+        )
+        return image
+
+    def dump(self, image):
+        """Return {name: (mime, gzip, body)} as the device reads it."""
+        out = self.root / "out"
+        out.mkdir(exist_ok=True)
+        result = subprocess.run([str(DUMP), str(image), str(out)], capture_output=True, text=True)
+        self.assertEqual(result.returncode, 0, result.stderr)
+        files = {}
+        for i, line in enumerate(result.stdout.splitlines()):
+            name, mime, is_gzip, digest = line.split("\t")
+            body = (out / str(i)).read_bytes()
+            self.assertEqual(hashlib.sha256(body).hexdigest(), digest, name)
+            files[name] = (mime, is_gzip == "1", body)
+        return files
+
+    @staticmethod
+    def decoded(entry):
+        _, is_gzip, body = entry
+        return gzip.decompress(body) if is_gzip else body
+
+    def test_identity(self):
+        files = self.dump(self.pack())
+        self.assertEqual(
+            sorted(files),
+            sorted(["index.html", "app.js", "css/style.css", "img/logo.png", "tiny.txt", "empty.txt",
+                    "docs/readme.txt", "only.json"]),
+        )
+        for name in ["index.html", "app.js", "css/style.css", "img/logo.png", "tiny.txt", "empty.txt"]:
+            self.assertEqual(files[name], (files[name][0], False, SITE[name]), name)
+        self.assertEqual(files["index.html"][0], "text/html")
+        self.assertEqual(files["css/style.css"][0], "text/css")
+        self.assertEqual(files["img/logo.png"][0], "image/png")
+        # Without --gzip the plain sibling is kept, so every client can get it
+        self.assertEqual(files["docs/readme.txt"][1:], (False, SITE["docs/readme.txt"]))
+        # A lone pre-compressed file can only be served compressed
+        self.assertEqual(files["only.json"][0], "application/json")
+        self.assertTrue(files["only.json"][1])
+        self.assertEqual(self.decoded(files["only.json"]), b'{"only": "gzip"}')
+
+    def test_gzip(self):
+        files = self.dump(self.pack("--gzip"))
+        for name in ["index.html", "app.js", "css/style.css"]:
+            self.assertTrue(files[name][1], name)
+            self.assertEqual(self.decoded(files[name]), SITE[name], name)
+        # Incompressible or not worth it
+        self.assertEqual(files["img/logo.png"][1:], (False, SITE["img/logo.png"]))
+        self.assertEqual(files["tiny.txt"][1:], (False, SITE["tiny.txt"]))
+        self.assertEqual(self.decoded(files["docs/readme.txt"]), b"compressed sibling")
+
+    def test_sorted_for_strcmp(self):
+        (self.site / "B.txt").write_bytes(b"upper")
+        (self.site / "a.txt").write_bytes(b"lower")
+        self.dump(self.pack())
+
+    def test_size_limit(self):
+        image = self.root / "assets.bin"
+        result = subprocess.run(
+            [sys.executable, str(PACKER), str(self.site), str(image), "--size", "64"],
+            capture_output=True,
+        )
+        self.assertNotEqual(result.returncode, 0)
+        self.assertFalse(image.exists())
+
+    def test_rejects_corrupt_images(self):
+        image = self.pack().read_bytes()
+        bad = self.root / "bad.bin"
+        for corrupt in [
+            image[:16],                                 # Truncated header
+            image[:-1],                                 # Shorter than image_size
+            b"XXXX" + image[4:],                        # Wrong magic
+            image[:4] + b"\xff\xff\xff\x0f" + image[8:],  # Absurd entry count
+        ]:
+            bad.write_bytes(corrupt)
+            result = subprocess.run([str(DUMP), str(bad)], capture_output=True)
+            self.assertEqual(result.returncode, 2)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,89 @@
+/***
+ * Host test of fs_walk and rm_rf (src/fs_walk.c) on trees nested deeper than
+ * FS_WALK_MAX_DEPTH, where directory handles have to be closed and reopened.
+ *
+ *     make -C tools/host test
+ */
+
+#include "filesystem.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define LEVELS (3 * FS_WALK_MAX_DEPTH)
+#define FILES_PER_DIR 3
+
+void fs_dir_cache_clear(void) {}
+void file_cache_invalidate(const char *path) { (void)path; }
+
+typedef struct count {
+    int files, dirs, dirs_post;
+} count_t;
+
+static esp_err_t count_cb(void *ctx, fs_walk_event_t event, const char *path, const struct stat *st)
+{
+    count_t *c = ctx;
+    if(FS_WALK_FILE == event) c->files++;
+    else if(FS_WALK_DIR == event) c->dirs++;
+    else c->dirs_post++;
+    return ESP_OK;
+}
+
+/**
+ * @brief Nest LEVELS directories, with files listed both before and after
+ * each subdirectory so resuming a reopened directory is exercised.
+ */
+static int make_tree(char *path)
+{
+    size_t len = strlen(path);
+
+    for(int level = 0; level < LEVELS; level++) {
+        for(int i = 0; i < FILES_PER_DIR; i++) {
+            snprintf(path + len, MAX_FILE_PATH - len, "/%c", 'a' + i);
+            FILE *fd = fopen(path, "w");
+            if(NULL == fd) return -1;
+            fclose(fd);
+        }
+        snprintf(path + len, MAX_FILE_PATH - len, "/d");
+        if(0 != mkdir(path, 0700)) return -1;
+        len += 2;
+    }
+    return 0;
+}
+
+static int check(const char *what, int got, int expected)
+{
+    if(got == expected) return 0;
+    fprintf(stderr, "%s: %d, expected %d\n", what, got, expected);
+    return 1;
+}
+
+int main(void)
+{
+    char root[] = "/tmp/fs_walk_test.XXXXXX";
+    char path[MAX_FILE_PATH];
+    count_t c = { 0 };
+    fs_rm_stats_t stats;
+    int failed = 0;
+
+    if(NULL == mkdtemp(root) || (strcpy(path, root), make_tree(path)) < 0) {
+        fprintf(stderr, "Failed to create the tree\n");
+        return 1;
+    }
+
+    strcpy(path, root);
+    failed |= check("walk", fs_walk(path, sizeof(path), count_cb, &c), ESP_OK);
+    failed |= check("walk files", c.files, LEVELS * FILES_PER_DIR);
+    failed |= check("walk dirs", c.dirs, LEVELS);
+    failed |= check("walk dirs post", c.dirs_post, LEVELS);
+    failed |= check("walk path restored", strcmp(path, root), 0);
+
+    failed |= check("rm_rf", rm_rf(root, &stats), ESP_OK);
+    failed |= check("rm_rf files", stats.files, LEVELS * FILES_PER_DIR);
+    failed |= check("rm_rf dirs", stats.dirs, LEVELS + 1);
+    failed |= check("rm_rf removed root", access(root, F_OK), -1);
+
+    if(!failed) printf("fs_walk: %d levels walked and removed\n", LEVELS);
+    return failed;
+}
@@ -0,0 +1,186 @@
+#!/usr/bin/env python3
+"""Convert NVS snapshots to and from nvs_partition_gen.py CSV files.
+
+Snapshots are exported by ``GET /api/v1/nvs?format=snapshot`` and restored by
+``POST /api/v1/nvs?format=snapshot``. The format is documented in
+``src/nvs_snapshot.h``.
+
+Example::
+
+    make nvs-pull ESP32_IP=192.168.1.42
+    python3 tools/nvs_snapshot.py unpack build/nvs.snapshot nvs.csv
+    # edit nvs.csv
+    python3 tools/nvs_snapshot.py pack nvs.csv build/nvs.snapshot
+    make nvs-push ESP32_IP=192.168.1.42
+"""
+
+import argparse
+import base64
+import csv
+import struct
+import sys
+from pathlib import Path
+
+MAGIC = b"NVS1"
+RECORD = struct.Struct("<BBB")
+LENGTH = struct.Struct("<I")
+NAME_MAX = 15
+
+# nvs_type_t -> (CSV encoding, struct format)
+INTEGERS = {
+    0x01: ("u8", "<B"),
+    0x11: ("i8", "<b"),
+    0x02: ("u16", "<H"),
+    0x12: ("i16", "<h"),
+    0x04: ("u32", "<I"),
+    0x14: ("i32", "<i"),
+    0x08: ("u64", "<Q"),
+    0x18: ("i64", "<q"),
+}
+ENCODINGS = {encoding: (type_, fmt) for type_, (encoding, fmt) in INTEGERS.items()}
+TYPE_STR = 0x21
+TYPE_BLOB = 0x42
+
+
+def check_name(name, what):
+    raw = name.encode()
+    if not 0 < len(raw) <= NAME_MAX:
+        raise ValueError(f"{what} {name!r} must be 1-{NAME_MAX} bytes")
+    return raw
+
+
+def encode(namespace, key, type_, value):
+    """Encode one record. ``value`` is an int, or bytes for strings and blobs."""
+    ns, k = check_name(namespace, "Namespace"), check_name(key, "Key")
+    out = RECORD.pack(type_, len(ns), len(k)) + ns + k
+    if type_ in INTEGERS:
+        return out + struct.pack(INTEGERS[type_][1], value)
+    return out + LENGTH.pack(len(value)) + value
+
+
+def decode(snapshot):
+    """Yield (namespace, key, type, value) from a snapshot."""
+    if snapshot[: len(MAGIC)] != MAGIC:
+        raise ValueError("Not a snapshot")
+    pos = len(MAGIC)
+    while True:
+        if pos >= len(snapshot):
+            raise ValueError("Truncated snapshot")
+        if snapshot[pos] == 0:
+            return
+        type_, ns_len, key_len = RECORD.unpack_from(snapshot, pos)
+        pos += RECORD.size
+        namespace = snapshot[pos : pos + ns_len].decode()
+        pos += ns_len
+        key = snapshot[pos : pos + key_len].decode()
+        pos += key_len
+        if type_ in INTEGERS:
+            fmt = INTEGERS[type_][1]
+            (value,) = struct.unpack_from(fmt, snapshot, pos)
+            pos += struct.calcsize(fmt)
+        elif type_ in (TYPE_STR, TYPE_BLOB):
+            (length,) = LENGTH.unpack_from(snapshot, pos)
+            pos += LENGTH.size
+            value = snapshot[pos : pos + length]
+            if len(value) != length:
+                raise ValueError("Truncated snapshot")
+            pos += length
+        else:
+            raise ValueError(f"Unknown type 0x{type_:02x} for {namespace}/{key}")
+        yield namespace, key, type_, value
+
+
+def parse_value(encoding, value):
+    """Return (type, value) for a CSV ``data`` value."""
+    if encoding in ENCODINGS:
+        return ENCODINGS[encoding][0], int(value, 0)
+    if encoding == "string":
+        return TYPE_STR, value.encode() + b"\0"
+    if encoding == "hex2bin":
+        return TYPE_BLOB, bytes.fromhex(value)
+    if encoding == "base64":
+        return TYPE_BLOB, base64.b64decode(value)
+    raise ValueError(f"Unsupported encoding {encoding!r}")
+
+
+def pack(csv_path):
+    """Build a snapshot from a nvs_partition_gen.py CSV file."""
+    out = bytearray(MAGIC)
+    count = 0
+    namespace = None
+    with open(csv_path, newline="") as f:
+        for row in csv.DictReader(f):
+            key, type_, encoding, value = (row[c] for c in ("key", "type", "encoding", "value"))
+            if type_ == "namespace":
+                namespace = key
+                continue
+            if namespace is None:
+                raise ValueError(f"{key} comes before any namespace")
+            if type_ == "file":
+                path = csv_path.parent / value
+                if encoding == "binary":
+                    nvs_type, data = TYPE_BLOB, path.read_bytes()
+                else:
+                    nvs_type, data = parse_value(encoding, path.read_text().strip())
+            elif type_ == "data":
+                nvs_type, data = parse_value(encoding, value)
+            else:
+                raise ValueError(f"Unsupported type {type_!r}")
+            out += encode(namespace, key, nvs_type, data)
+            count += 1
+    out += b"\0"
+    return bytes(out), count
+
+
+def unpack(snapshot, csv_path):
+    """Write a snapshot as a nvs_partition_gen.py CSV file."""
+    count = 0
+    namespace = None
+    with open(csv_path, "w", newline="") as f:
+        writer = csv.writer(f)
+        writer.writerow(["key", "type", "encoding", "value"])
+        for ns, key, type_, value in decode(snapshot):
+            if ns != namespace:
+                writer.writerow([ns, "namespace", "", ""])
+                namespace = ns
+            if type_ in INTEGERS:
+                writer.writerow([key, "data", INTEGERS[type_][0], value])
+            elif type_ == TYPE_STR:
+                writer.writerow([key, "data", "string", value[:-1].decode()])
+            else:
+                writer.writerow([key, "data", "base64", base64.b64encode(value).decode()])
+            count += 1
+    return count
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    subparsers = parser.add_subparsers(dest="command", required=True)
+
+    p = subparsers.add_parser("pack", help="Convert a CSV file to a snapshot.")
+    p.add_argument("input", type=Path, help="CSV file to read.")
+    p.add_argument("output", type=Path, help="Snapshot to write.")
+
+    p = subparsers.add_parser("unpack", help="Convert a snapshot to a CSV file.")
+    p.add_argument("input", type=Path, help="Snapshot to read.")
+    p.add_argument("output", type=Path, help="CSV file to write.")
+
+    args = parser.parse_args()
+
+    try:
+        if args.command == "pack":
+            snapshot, count = pack(args.input)
+            args.output.parent.mkdir(parents=True, exist_ok=True)
+            args.output.write_bytes(snapshot)
+        else:
+            count = unpack(args.input.read_bytes(), args.output)
+    except (ValueError, struct.error) as e:
+        print(f"{args.input}: {e}", file=sys.stderr)
+        return 1
+
+    print(f"Wrote {count} entries to {args.output}")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
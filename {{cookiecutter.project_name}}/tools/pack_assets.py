@@ -0,0 +1,151 @@
+#!/usr/bin/env python3
+"""Pack a directory into an asset image for the "assets" partition.
+
+The format is documented in ``src/assets.h``.
+
+Files are stored as is unless ``--gzip`` is given. The device has no
+decompressor, so gzipped assets get ``406 Not Acceptable`` for clients that
+don't accept gzip; only use it if every client does (all browsers do).
+
+Example::
+
+    python3 tools/pack_assets.py www build/assets.bin
+    parttool.py write_partition --partition-name assets --input build/assets.bin
+"""
+
+import argparse
+import gzip
+import hashlib
+import struct
+import sys
+from pathlib import Path
+
+MAGIC = b"PKA1"
+FLAG_GZIP = 0x01
+HEADER = struct.Struct("<4sIIII")
+ENTRY = struct.Struct("<IIIII32s")
+ALIGN = 4
+
+# Keep in sync with src/mime.c
+MIME_TYPES = {
+    "html": "text/html",
+    "htm": "text/html",
+    "css": "text/css",
+    "js": "application/javascript",
+    "mjs": "application/javascript",
+    "json": "application/json",
+    "map": "application/json",
+    "txt": "text/plain",
+    "csv": "text/csv",
+    "xml": "application/xml",
+    "svg": "image/svg+xml",
+    "png": "image/png",
+    "jpg": "image/jpeg",
+    "jpeg": "image/jpeg",
+    "gif": "image/gif",
+    "webp": "image/webp",
+    "ico": "image/x-icon",
+    "wasm": "application/wasm",
+    "woff": "font/woff",
+    "woff2": "font/woff2",
+    "ttf": "font/ttf",
+    "pdf": "application/pdf",
+}
+DEFAULT_MIME = "application/octet-stream"
+
+# Already compressed; gzip won't help
+INCOMPRESSIBLE = {"png", "jpg", "jpeg", "gif", "webp", "woff", "woff2", "gz"}
+
+
+def mime_type(name):
+    ext = name.rsplit(".", 1)[-1].lower() if "." in name else ""
+    return MIME_TYPES.get(ext, DEFAULT_MIME)
+
+
+def collect(root, use_gzip):
+    """Return a sorted list of (name, mime, flags, body)."""
+    files = {}
+    for path in sorted(root.rglob("*")):
+        if not path.is_file():
+            continue
+        name = path.relative_to(root).as_posix()
+        body = path.read_bytes()
+        flags = 0
+
+        if name.endswith(".gz"):
+            # Pre-compressed; serve under the uncompressed name
+            name = name[:-3]
+            flags = FLAG_GZIP
+        elif use_gzip and name.rsplit(".", 1)[-1].lower() not in INCOMPRESSIBLE:
+            compressed = gzip.compress(body, compresslevel=9, mtime=0)
+            if len(compressed) < len(body):
+                body, flags = compressed, FLAG_GZIP
+
+        precompressed = path.name.endswith(".gz")
+        if name in files and files[name][3] == use_gzip:
+            # With --gzip prefer a pre-compressed sibling, otherwise the
+            # plain file that clients without gzip can be served too
+            continue
+        files[name] = (mime_type(name), flags, body, precompressed)
+
+    # Sort by bytes to match strcmp() on the device
+    return [(name, *files[name][:3]) for name in sorted(files, key=lambda n: n.encode())]
+
+
+def pack(files):
+    strings = bytearray()
+    string_offsets = {}
+
+    def add_string(s):
+        if s not in string_offsets:
+            string_offsets[s] = len(strings)
+            strings.extend(s.encode() + b"\0")
+        return string_offsets[s]
+
+    refs = [(add_string(name), add_string(mime)) for name, mime, _, _ in files]
+
+    strings_offset = HEADER.size + ENTRY.size * len(files)
+    data_offset = strings_offset + len(strings)
+
+    entries = bytearray()
+    data = bytearray()
+    for (name_ref, mime_ref), (_, _, flags, body) in zip(refs, files):
+        pad = -(data_offset + len(data)) % ALIGN
+        data.extend(b"\0" * pad)
+        offset = data_offset + len(data)
+        data.extend(body)
+        entries.extend(
+            ENTRY.pack(name_ref, mime_ref, offset, len(body), flags, hashlib.sha256(body).digest())
+        )
+
+    image_size = data_offset + len(data)
+    header = HEADER.pack(MAGIC, len(files), strings_offset, len(strings), image_size)
+    return header + entries + strings + data
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("directory", type=Path, help="Directory to pack.")
+    parser.add_argument("output", type=Path, help="Image file to write.")
+    parser.add_argument("--gzip", action="store_true", help="Compress files where it makes them smaller.")
+    parser.add_argument("--size", type=lambda x: int(x, 0), help="Fail if the image exceeds this many bytes.")
+    args = parser.parse_args()
+
+    if not args.directory.is_dir():
+        parser.error(f"{args.directory} is not a directory")
+
+    files = collect(args.directory, args.gzip)
+    image = pack(files)
+
+    if args.size is not None and len(image) > args.size:
+        print(f"Image is {len(image)} bytes; partition only holds {args.size}", file=sys.stderr)
+        return 1
+
+    args.output.parent.mkdir(parents=True, exist_ok=True)
+    args.output.write_bytes(image)
+    print(f"Packed {len(files)} files into {args.output} ({len(image)} bytes)")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
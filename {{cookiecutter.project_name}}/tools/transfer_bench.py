@@ -0,0 +1,81 @@
+#!/usr/bin/env python3
+"""Measure upload and download throughput of the filesystem API.
+
+Uploads a file of random bytes to ``/api/v1/filesystem`` a few times, reads it
+back, deletes it and prints the median MB/s of each direction. Run it once per
+firmware configuration (e.g. with ``CONFIG_PROJECT_TRANSFER_ENGINE`` on and
+off, or LittleFS vs SD) and compare the numbers.
+
+Example::
+
+    make transfer-bench ESP32_IP=192.168.1.42
+    python3 tools/transfer_bench.py 192.168.1.42 --size 1048576 --runs 5
+"""
+
+import argparse
+import os
+import statistics
+import sys
+import time
+import urllib.error
+import urllib.request
+
+ROUTE = "/api/v1/filesystem/"
+
+
+def request(url, method, data=None):
+    """Perform a request and return (response body, seconds taken)."""
+    req = urllib.request.Request(url, data=data, method=method)
+    start = time.monotonic()
+    with urllib.request.urlopen(req, timeout=120) as resp:
+        body = resp.read()
+    return body, time.monotonic() - start
+
+
+def mb_per_s(size, seconds):
+    return size / seconds / 1e6
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("host", help="Device address, e.g. 192.168.1.42.")
+    parser.add_argument("--size", type=int, default=256 * 1024, help="Bytes per transfer.")
+    parser.add_argument("--runs", type=int, default=3, help="Transfers per direction.")
+    parser.add_argument("--path", default="transfer_bench.bin", help="File to use on the device.")
+    args = parser.parse_args()
+
+    if args.size <= 0 or args.runs <= 0:
+        parser.error("--size and --runs must be positive")
+
+    host = args.host if "://" in args.host else f"http://{args.host}"
+    url = host.rstrip("/") + ROUTE + args.path
+    payload = os.urandom(args.size)
+    up, down = [], []
+
+    try:
+        for _ in range(args.runs):
+            _, seconds = request(url, "POST", payload)
+            up.append(mb_per_s(args.size, seconds))
+        for _ in range(args.runs):
+            body, seconds = request(url, "GET")
+            if body != payload:
+                print(f"{url}: downloaded contents differ from the upload", file=sys.stderr)
+                return 1
+            down.append(mb_per_s(args.size, seconds))
+    except (urllib.error.URLError, OSError) as e:
+        print(f"{url}: {e}", file=sys.stderr)
+        return 1
+    finally:
+        try:
+            request(url, "DELETE")
+        except (urllib.error.URLError, OSError):
+            pass
+
+    print(f"{args.size} bytes x {args.runs} runs")
+    print(f"upload:   {statistics.median(up):.3f} MB/s (min {min(up):.3f}, max {max(up):.3f})")
+    print(f"download: {statistics.median(down):.3f} MB/s (min {min(down):.3f}, max {max(down):.3f})")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())